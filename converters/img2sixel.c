@@ -129,6 +129,12 @@ void show_help(void)
             "                           the image to (default=256)\n"
             "-m FILE, --mapfile=FILE    transform image colors to match this\n"
             "                           set of colorsspecify map\n"
+            "                           FILE may also be a palette artifact\n"
+            "                           written by -M option\n"
+            "-M FILE, --save-palette=FILE\n"
+            "                           save the palette of the first frame\n"
+            "                           and its lookup cache to FILE as a\n"
+            "                           palette artifact\n"
             "-e, --monochrome           output monochrome sixel image\n"
             "                           this option assumes the terminal\n"
             "                           background color is black\n"
@@ -152,6 +158,11 @@ void show_help(void)
             "                           COMPLEXIONSCORE must be 1 or more.\n"
             "-g, --ignore-delay         render GIF animation without delay\n"
             "-S, --static               render animated GIF as a static image\n"
+            "-G STRIDE, --global-palette=STRIDE\n"
+            "                           build one palette shared by all\n"
+            "                           frames of an animation from every\n"
+            "                           STRIDE-th frame, it is computed by\n"
+            "                           an extra pass over the input\n"
             );
     fprintf(stdout,
             "-d DIFFUSIONTYPE, --diffusion=DIFFUSIONTYPE\n"
@@ -170,6 +181,10 @@ void show_help(void)
             "                                         arithmetic dither\n"
             "                             x_dither -> positionally stable\n"
             "                                         arithmetic xor based dither\n"
+            "                             bayer    -> ordered dither with\n"
+            "                                         8x8 Bayer matrix\n"
+            "                             bluenoise -> ordered dither with\n"
+            "                                         64x64 blue noise texture\n"
             "-f FINDTYPE, --find-largest=FINDTYPE\n"
             "                           choose method for finding the largest\n"
             "                           dimension of median cut boxes for\n"
@@ -244,6 +259,10 @@ void show_help(void)
             "                             lanczos2 -> Lanczos-2 filter\n"
             "                             lanczos3 -> Lanczos-3 filter\n"
             "                             lanczos4 -> Lanczos-4 filter\n"
+            "                           append \":linear\" to blend\n"
+            "                           pixels in linear light, which\n"
+            "                           keeps the brightness of fine\n"
+            "                           detail (e.g. lanczos3:linear)\n"
             "-q QUALITYMODE, --quality=QUALITYMODE\n"
             "                           select quality of color\n"
             "                           quanlization.\n"
@@ -320,6 +339,17 @@ void show_help(void)
             "                             rgb:rr/gg/bb\n"
             "                             rgb:rrr/ggg/bbb\n"
             "                             rgb:rrrr/gggg/bbbb\n"
+            "SIXEL_THREADS              specify number of threads used\n"
+            "                           for resampling and for decoding\n"
+            "                           animated GIF frames ahead of\n"
+            "                           encoding (default: number of\n"
+            "                           online processors).\n"
+            "SIXEL_FRAME_CACHE_SIZE     specify the maximum number of\n"
+            "                           bytes of encoded animation frames\n"
+            "                           kept to replay the second and\n"
+            "                           later loops without encoding them\n"
+            "                           again (default: 67108864, 0\n"
+            "                           disables the cache).\n"
             );
 }
 
@@ -345,7 +375,7 @@ main(int argc, char *argv[])
     int long_opt;
     int option_index;
 #endif  /* HAVE_GETOPT_LONG */
-    char const *optstring = "o:78Rp:m:eb:Id:f:s:c:w:h:r:q:kil:t:ugvSn:PE:B:C:DVH";
+    char const *optstring = "o:78Rp:m:M:eb:Id:f:s:c:w:h:r:q:kil:t:ugvSG:n:PE:B:C:DVH";
 #if HAVE_GETOPT_LONG
     struct option long_options[] = {
         {"outfile",          required_argument,  &long_opt, 'o'},
@@ -354,6 +384,7 @@ main(int argc, char *argv[])
         {"gri-limit",        no_argument,        &long_opt, 'R'},
         {"colors",           required_argument,  &long_opt, 'p'},
         {"mapfile",          required_argument,  &long_opt, 'm'},
+        {"save-palette",     required_argument,  &long_opt, 'M'},
         {"monochrome",       no_argument,        &long_opt, 'e'},
         {"high-color",       no_argument,        &long_opt, 'I'},
         {"builtin-palette",  required_argument,  &long_opt, 'b'},
@@ -373,6 +404,7 @@ main(int argc, char *argv[])
         {"ignore-delay",     no_argument,        &long_opt, 'g'},
         {"verbose",          no_argument,        &long_opt, 'v'},
         {"static",           no_argument,        &long_opt, 'S'},
+        {"global-palette",   required_argument,  &long_opt, 'G'},
         {"macro-number",     required_argument,  &long_opt, 'n'},
         {"penetrate",        no_argument,        &long_opt, 'P'},
         {"encode-policy",    required_argument,  &long_opt, 'E'},
@@ -20,7 +20,7 @@
 # CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #
 
-from ctypes import cdll, c_void_p, c_int, c_byte, c_char_p, POINTER, byref, CFUNCTYPE, string_at
+from ctypes import cdll, c_void_p, c_int, c_byte, c_char_p, POINTER, byref, CFUNCTYPE, string_at, cast, create_string_buffer
 from ctypes.util import find_library
 
 # limitations
@@ -89,6 +89,8 @@ SIXEL_DIFFUSE_STUCKI    = 0x5  # diffuse with Stucki's method
 SIXEL_DIFFUSE_BURKES    = 0x6  # diffuse with Burkes' method
 SIXEL_DIFFUSE_A_DITHER  = 0x7  # positionally stable arithmetic dither
 SIXEL_DIFFUSE_X_DITHER  = 0x8  # positionally stable arithmetic xor based dither
+SIXEL_DIFFUSE_BAYER     = 0x9  # ordered dither with 8x8 Bayer matrix
+SIXEL_DIFFUSE_BLUENOISE = 0xa  # ordered dither with 64x64 blue noise texture
 
 # quality modes
 SIXEL_QUALITY_AUTO      = 0x0  # choose quality mode automatically
@@ -158,6 +160,7 @@ SIXEL_RES_BICUBIC          = 6   # Use bicubic filter
 SIXEL_RES_LANCZOS2         = 7   # Use lanczos-2 filter
 SIXEL_RES_LANCZOS3         = 8   # Use lanczos-3 filter
 SIXEL_RES_LANCZOS4         = 9   # Use lanczos-4 filter
+SIXEL_RES_LINEAR_LIGHT     = 0x100 # modifier: resample in linear light
 
 # image format
 SIXEL_FORMAT_GIF           = 0x0 # read only
@@ -186,6 +189,10 @@ SIXEL_OPTFLAG_7BIT_MODE        = '7'  # -7, --7bit-mode: for 7bit terminals or p
 SIXEL_OPTFLAG_8BIT_MODE        = '8'  # -8, --8bit-mode: for 8bit terminals or printers
 SIXEL_OPTFLAG_COLORS           = 'p'  # -p COLORS, --colors=COLORS: specify number of colors
 SIXEL_OPTFLAG_MAPFILE          = 'm'  # -m FILE, --mapfile=FILE: specify set of colors
+SIXEL_OPTFLAG_SAVE_PALETTE     = 'M'  # -M FILE, --save-palette=FILE:
+                                      #         save the palette of the first frame
+                                      #         as a palette artifact, which can be
+                                      #         given to -m option
 SIXEL_OPTFLAG_MONOCHROME       = 'e'  # -e, --monochrome: output monochrome sixel image
 SIXEL_OPTFLAG_INSECURE         = 'k'  # -k, --insecure: allow to connect to SSL sites without certs
 SIXEL_OPTFLAG_INVERT           = 'i'  # -i, --invert: assume the terminal background color
@@ -198,6 +205,10 @@ SIXEL_OPTFLAG_COMPLEXION_SCORE = 'C'  # -C COMPLEXIONSCORE, --complexion-score=C
                                       #        complexion correction.
 SIXEL_OPTFLAG_IGNORE_DELAY     = 'g'  # -g, --ignore-delay: render GIF animation without delay
 SIXEL_OPTFLAG_STATIC           = 'S'  # -S, --static: render animated GIF as a static image
+SIXEL_OPTFLAG_GLOBAL_PALETTE   = 'G'  # -G STRIDE, --global-palette=STRIDE:
+                                      #        build one palette shared by all frames
+                                      #        of an animation from the histogram of
+                                      #        every STRIDE-th frame
 SIXEL_OPTFLAG_DIFFUSION        = 'd'  # -d DIFFUSIONTYPE, --diffusion=DIFFUSIONTYPE:
                                       #          choose diffusion method which used with -p option.
                                       #          DIFFUSIONTYPE is one of them:
@@ -213,6 +224,10 @@ SIXEL_OPTFLAG_DIFFUSION        = 'd'  # -d DIFFUSIONTYPE, --diffusion=DIFFUSIONT
                                       #                        arithmetic dither
                                       #            x_dither -> positionally stable
                                       #                        arithmetic xor based dither
+                                      #            bayer    -> ordered dither with
+                                      #                        8x8 Bayer matrix
+                                      #            bluenoise -> ordered dither with
+                                      #                        64x64 blue noise texture
 
 SIXEL_OPTFLAG_FIND_LARGEST     = 'f'  # -f FINDTYPE, --find-largest=FINDTYPE:
                                       #         choose method for finding the largest
@@ -620,6 +635,29 @@ def sixel_encode(pixels, width, height, depth, dither, output):
     return _sixel.sixel_encode(pixels, width, height, depth, dither, output)
 
 
+# convert a rectangle of a larger pixel buffer into sixel format
+def sixel_encode_rect(pixels, stride, x, y, width, height, dither, output):
+    _sixel.sixel_encode_rect.restype = c_int
+    _sixel.sixel_encode_rect.argtypes = [c_char_p, c_int, c_int, c_int, c_int, c_int, c_void_p, c_void_p]
+    return _sixel.sixel_encode_rect(pixels, stride, x, y, width, height, dither, output)
+
+
+# convert pixels into sixel format pulling them row by row,
+# fn_scanline(y, priv) returns the bytes of row y
+def sixel_encode_scanlines(fn_scanline, width, height, dither, output, priv=None):
+    current = []
+    def _fn_scanline_local(row, y, priv_from_c):
+        buf = create_string_buffer(fn_scanline(y, priv))
+        current[:] = [buf]
+        row[0] = cast(buf, c_void_p).value
+        return SIXEL_OK
+    sixel_scanline_function = CFUNCTYPE(c_int, POINTER(c_void_p), c_int, c_void_p)
+    _fn_scanline = sixel_scanline_function(_fn_scanline_local)
+    _sixel.sixel_encode_scanlines.restype = c_int
+    _sixel.sixel_encode_scanlines.argtypes = [sixel_scanline_function, c_void_p, c_int, c_int, c_void_p, c_void_p]
+    return _sixel.sixel_encode_scanlines(_fn_scanline, c_void_p(None), width, height, dither, output)
+
+
 # create encoder object
 def sixel_encoder_new(allocator=c_void_p(None)):
     _sixel.sixel_encoder_new.restype = c_int
@@ -52,6 +52,9 @@
 #if HAVE_SYS_SELECT_H
 # include <sys/select.h>
 #endif  /* HAVE_SYS_SELECT_H */
+#if HAVE_SYS_MMAN_H
+# include <sys/mman.h>
+#endif  /* HAVE_SYS_MMAN_H */
 
 #if !defined(HAVE_MEMCPY)
 # define memcpy(d, s, n) (bcopy ((s), (d), (n)))
@@ -65,6 +68,15 @@
 # define O_BINARY _O_BINARY
 #endif  /* !defined(O_BINARY) && !defined(_O_BINARY) */
 
+#if HAVE_MMAP && HAVE_SYS_MMAN_H && HAVE_STAT && HAVE_UNISTD_H
+# if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#  define MAP_ANONYMOUS MAP_ANON
+# endif
+# if defined(MAP_ANONYMOUS) && defined(MAP_FIXED)
+#  define SIXEL_CHUNK_USE_MMAP 1
+# endif
+#endif
+
 #include "chunk.h"
 #include "allocator.h"
 
@@ -79,6 +91,7 @@ sixel_chunk_init(
 
     pchunk->max_size = initial_size;
     pchunk->size = 0;
+    pchunk->mapped_size = 0;
     pchunk->buffer
         = (unsigned char *)sixel_allocator_malloc(pchunk->allocator, pchunk->max_size);
 
@@ -104,6 +117,12 @@ sixel_chunk_destroy(
 
     if (pchunk) {
         allocator = pchunk->allocator;
+#if SIXEL_CHUNK_USE_MMAP
+        if (pchunk->mapped_size > 0) {
+            munmap(pchunk->buffer, pchunk->mapped_size);
+            pchunk->buffer = NULL;
+        }
+#endif  /* SIXEL_CHUNK_USE_MMAP */
         sixel_allocator_free(allocator, pchunk->buffer);
         sixel_allocator_free(allocator, pchunk);
         sixel_allocator_unref(allocator);
@@ -244,6 +263,96 @@ end:
 }
 
 
+#if SIXEL_CHUNK_USE_MMAP
+/*
+ * map a regular file into the chunk instead of reading it. the mapping is
+ * followed by at least one page of zeros, so parsers which peek a byte past
+ * the end see 0 as they would see stale bytes of an allocated buffer.
+ * returns SIXEL_FALSE if the file has to be read.
+ */
+static SIXELSTATUS
+sixel_chunk_map_file(
+    sixel_chunk_t   /* in */ *pchunk,
+    FILE            /* in */ *f)
+{
+    SIXELSTATUS status = SIXEL_FALSE;
+    struct stat sb;
+    size_t size;
+    size_t pagesize;
+    size_t length;
+    long ret;
+    void *region;
+    void *mapped;
+
+    if (fstat(fileno(f), &sb) != 0 || !S_ISREG(sb.st_mode) || sb.st_size <= 0) {
+        goto end;
+    }
+    ret = sysconf(_SC_PAGESIZE);
+    if (ret <= 0) {
+        goto end;
+    }
+    pagesize = (size_t)ret;
+    size = (size_t)sb.st_size;
+    if ((off_t)size != sb.st_size || size > (size_t)-1 - pagesize * 2) {
+        goto end;
+    }
+    length = (size + pagesize - 1) / pagesize * pagesize + pagesize;
+
+    /* reserve the whole range, then put the file over its head */
+    region = mmap(NULL, length, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (region == MAP_FAILED) {
+        goto end;
+    }
+    mapped = mmap(region, size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fileno(f), 0);
+    if (mapped == MAP_FAILED) {
+        munmap(region, length);
+        goto end;
+    }
+# if HAVE_MADVISE && defined(MADV_SEQUENTIAL)
+    (void) madvise(mapped, size, MADV_SEQUENTIAL);
+# endif  /* HAVE_MADVISE && defined(MADV_SEQUENTIAL) */
+
+    sixel_allocator_free(pchunk->allocator, pchunk->buffer);
+    pchunk->buffer = (unsigned char *)mapped;
+    pchunk->size = size;
+    pchunk->max_size = size;
+    pchunk->mapped_size = length;
+
+    status = SIXEL_OK;
+
+end:
+    return status;
+}
+#endif  /* SIXEL_CHUNK_USE_MMAP */
+
+
+/* read a block of at most 'size' bytes, returns 0 at the end of input
+   and -1 on error */
+long
+sixel_chunk_read_block(
+    FILE            /* in */ *f,
+    unsigned char   /* in */ *buffer,
+    size_t          /* in */ size)
+{
+    long n;
+
+#if HAVE_UNISTD_H
+    /* read(2) returns what a pipe or a tty has now, instead of waiting
+       for the whole block like fread() */
+    do {
+        n = (long)read(fileno(f), buffer, size);
+    } while (n < 0 && errno == EINTR);
+#else
+    n = (long)fread(buffer, 1, size, f);
+    if (n == 0 && ferror(f)) {
+        n = (-1);
+    }
+#endif  /* HAVE_UNISTD_H */
+
+    return n;
+}
+
+
 /* get chunk date from specified local file path */
 static SIXELSTATUS
 sixel_chunk_from_file(
@@ -255,17 +364,48 @@ sixel_chunk_from_file(
     SIXELSTATUS status = SIXEL_FALSE;
     int ret;
     FILE *f = NULL;
-    size_t n;
-    size_t const bucket_size = 4096;
+    long n;
+    size_t block;
+    size_t hint = 0;
+    /* blocks grow with the buffer up to 1MiB */
+    size_t const min_block_size = 64 * 1024;
+    size_t const max_block_size = 1024 * 1024;
+#if HAVE_STAT
+    struct stat sb;
+#endif  /* HAVE_STAT */
 
     status = open_binary_file(&f, filename);
     if (SIXEL_FAILED(status) || f == NULL) {
         goto end;
     }
 
+#if SIXEL_CHUNK_USE_MMAP
+    /* regular files are mapped, pipes and ttys are read below */
+    if (f != stdin && sixel_chunk_map_file(pchunk, f) == SIXEL_OK) {
+        fclose(f);
+        goto end;
+    }
+#endif  /* SIXEL_CHUNK_USE_MMAP */
+
+#if HAVE_STAT
+    /* allocate a regular file at once, one more byte detects the end */
+    if (fstat(fileno(f), &sb) == 0 && S_ISREG(sb.st_mode) && sb.st_size > 0 &&
+        (off_t)(size_t)sb.st_size == sb.st_size &&
+        (size_t)sb.st_size < (size_t)-1 - min_block_size) {
+        hint = (size_t)sb.st_size + 1;
+    }
+#endif  /* HAVE_STAT */
+
     for (;;) {
-        if (pchunk->max_size - pchunk->size < bucket_size) {
-            pchunk->max_size *= 2;
+        if (pchunk->max_size - pchunk->size < min_block_size ||
+            pchunk->max_size < hint) {
+            do {
+                pchunk->max_size *= 2;
+            } while (pchunk->max_size - pchunk->size < min_block_size);
+            if (pchunk->max_size < hint) {
+                pchunk->max_size = hint;
+            }
+            hint = 0;
             pchunk->buffer = (unsigned char *)sixel_allocator_realloc(pchunk->allocator,
                                                                       pchunk->buffer,
                                                                       pchunk->max_size);
@@ -295,11 +435,15 @@ sixel_chunk_from_file(
                 }
             }
         }
-        n = fread(pchunk->buffer + pchunk->size, 1, 4096, f);
-        if (n == 0) {
+        block = pchunk->max_size - pchunk->size;
+        if (block > max_block_size) {
+            block = max_block_size;
+        }
+        n = sixel_chunk_read_block(f, pchunk->buffer + pchunk->size, block);
+        if (n <= 0) {
             break;
         }
-        pchunk->size += n;
+        pchunk->size += (size_t)n;
     }
 
     if (f != stdin) {
@@ -492,7 +636,7 @@ test1(void)
     unsigned char *ptr = malloc(16);
 
 #ifdef HAVE_LIBCURL
-    sixel_chunk_t chunk = {0, 0, 0, NULL};
+    sixel_chunk_t chunk = {0, 0, 0, NULL, 0};
     int nread;
 
     nread = memory_write(NULL, 1, 1, NULL);
@@ -598,6 +742,66 @@ error:
 }
 
 
+/* a mapped file must have the same content as the one read with stdio */
+static int
+test5(void)
+{
+    int nret = EXIT_FAILURE;
+    sixel_chunk_t *chunk = NULL;
+    sixel_allocator_t *allocator = NULL;
+    SIXELSTATUS status = SIXEL_FALSE;
+    char const *filename = "../images/map8.six";
+    unsigned char *expected = NULL;
+    size_t size = 0;
+    size_t n;
+    FILE *f = NULL;
+
+    f = fopen(filename, "rb");
+    if (f == NULL) {
+        goto error;
+    }
+    expected = (unsigned char *)malloc(1024 * 1024);
+    if (expected == NULL) {
+        goto error;
+    }
+    while ((n = fread(expected + size, 1, 4096, f)) > 0) {
+        size += n;
+    }
+
+    status = sixel_allocator_new(&allocator, NULL, NULL, NULL, NULL);
+    if (SIXEL_FAILED(status)) {
+        goto error;
+    }
+    status = sixel_chunk_new(&chunk, filename, 0, NULL, allocator);
+    if (SIXEL_FAILED(status)) {
+        goto error;
+    }
+    if (chunk->size != size || memcmp(chunk->buffer, expected, size) != 0) {
+        goto error;
+    }
+#if SIXEL_CHUNK_USE_MMAP
+    if (chunk->mapped_size == 0) {
+        goto error;
+    }
+    /* the byte following the file is readable */
+    if (chunk->buffer[chunk->size] != 0) {
+        goto error;
+    }
+#endif  /* SIXEL_CHUNK_USE_MMAP */
+
+    nret = EXIT_SUCCESS;
+
+error:
+    sixel_chunk_destroy(chunk);
+    sixel_allocator_unref(allocator);
+    free(expected);
+    if (f) {
+        fclose(f);
+    }
+    return nret;
+}
+
+
 SIXELAPI int
 sixel_chunk_tests_main(void)
 {
@@ -610,6 +814,7 @@ sixel_chunk_tests_main(void)
         test2,
         test3,
         test4,
+        test5,
     };
 
     for (i = 0; i < sizeof(testcases) / sizeof(testcase); ++i) {
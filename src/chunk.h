@@ -22,6 +22,7 @@
 #ifndef LIBSIXEL_CHUNK_H
 #define LIBSIXEL_CHUNK_H
 
+#include <stdio.h>  /* for FILE */
 #include <sixel.h>
 
 /* chunk object */
@@ -31,6 +32,8 @@ typedef struct sixel_chunk
     size_t size;
     size_t max_size;
     sixel_allocator_t *allocator;
+    size_t mapped_size;     /* length of the file mapping which buffer
+                               borrows, 0 if buffer is allocated */
 } sixel_chunk_t;
 
 #ifdef __cplusplus
@@ -51,6 +54,14 @@ sixel_chunk_destroy(
     sixel_chunk_t * const /* in */ pchunk);
 
 
+/* read a block of at most 'size' bytes as soon as some are available */
+long
+sixel_chunk_read_block(
+    FILE            /* in */ *f,
+    unsigned char   /* in */ *buffer,
+    size_t          /* in */ size);
+
+
 #if HAVE_TESTS
 int
 sixel_chunk_tests_main(void);
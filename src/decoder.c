@@ -36,6 +36,10 @@
 #endif /* HAVE_ERRNO_H */
 
 #include "decoder.h"
+#include "chunk.h"
+
+/* size of input blocks passed to the parser by sixel_decoder_decode() */
+#define SIXEL_DECODER_BLOCK_SIZE (1024 * 1024)
 
 
 /* original version of strdup(3) with allocator object */
@@ -86,6 +90,7 @@ sixel_decoder_new(
     (*ppdecoder)->output       = strdup_with_allocator("-", allocator);
     (*ppdecoder)->input        = strdup_with_allocator("-", allocator);
     (*ppdecoder)->allocator    = allocator;
+    (*ppdecoder)->parser       = NULL;
 
     if ((*ppdecoder)->output == NULL || (*ppdecoder)->input == NULL) {
         sixel_decoder_unref(*ppdecoder);
@@ -129,6 +134,7 @@ sixel_decoder_destroy(sixel_decoder_t *decoder)
 
     if (decoder) {
         allocator = decoder->allocator;
+        sixel_parser_destroy(decoder->parser);
         sixel_allocator_free(allocator, decoder->input);
         sixel_allocator_free(allocator, decoder->output);
         sixel_allocator_free(allocator, decoder);
@@ -205,6 +211,77 @@ end:
 }
 
 
+/* feed a part of sixel stream to the decoder */
+SIXELAPI SIXELSTATUS
+sixel_decoder_feed(
+    sixel_decoder_t     /* in */ *decoder,  /* decoder object */
+    unsigned char const /* in */ *bytes,    /* sixel bytes */
+    int                 /* in */ len)       /* size of sixel bytes */
+{
+    SIXELSTATUS status = SIXEL_FALSE;
+
+    sixel_decoder_ref(decoder);
+
+    if (len < 0) {
+        sixel_helper_set_additional_message(
+            "sixel_decoder_feed: negative length is given.");
+        status = SIXEL_BAD_ARGUMENT;
+        goto end;
+    }
+
+    if (decoder->parser == NULL) {
+        status = sixel_parser_new(&decoder->parser, decoder->allocator);
+        if (SIXEL_FAILED(status)) {
+            goto end;
+        }
+    }
+
+    status = sixel_parser_feed(decoder->parser, bytes, len);
+    if (SIXEL_FAILED(status)) {
+        goto end;
+    }
+
+end:
+    sixel_decoder_unref(decoder);
+
+    return status;
+}
+
+
+/* finish the stream given with sixel_decoder_feed() and take the image */
+SIXELAPI SIXELSTATUS
+sixel_decoder_finish(
+    sixel_decoder_t     /* in */  *decoder,   /* decoder object */
+    unsigned char       /* out */ **pixels,   /* decoded pixels */
+    int                 /* out */ *pwidth,    /* image width */
+    int                 /* out */ *pheight,   /* image height */
+    unsigned char       /* out */ **palette,  /* RGB palette */
+    int                 /* out */ *ncolors)   /* palette size (<= 256) */
+{
+    SIXELSTATUS status = SIXEL_FALSE;
+
+    sixel_decoder_ref(decoder);
+
+    if (decoder->parser == NULL) {
+        status = sixel_parser_new(&decoder->parser, decoder->allocator);
+        if (SIXEL_FAILED(status)) {
+            goto end;
+        }
+    }
+
+    status = sixel_parser_finish(decoder->parser, pixels, pwidth, pheight,
+                                 palette, ncolors);
+    if (SIXEL_FAILED(status)) {
+        goto end;
+    }
+
+end:
+    sixel_decoder_unref(decoder);
+
+    return status;
+}
+
+
 /* load source data from stdin or the file specified with
    SIXEL_OPTFLAG_INPUT flag, and decode it */
 SIXELAPI SIXELSTATUS
@@ -212,12 +289,11 @@ sixel_decoder_decode(
     sixel_decoder_t /* in */ *decoder)
 {
     SIXELSTATUS status = SIXEL_FALSE;
-    unsigned char *raw_data = NULL;
+    sixel_parser_t *parser = NULL;
+    unsigned char *buffer = NULL;
+    long n;
     int sx;
     int sy;
-    int raw_len;
-    int max;
-    int n;
     FILE *input_fp = NULL;
     unsigned char *indexed_pixels = NULL;
     unsigned char *palette = NULL;
@@ -245,47 +321,40 @@ sixel_decoder_decode(
         }
     }
 
-    raw_len = 0;
-    max = 64 * 1024;
+    /* a private parser, so that a stream being fed is not disturbed */
+    status = sixel_parser_new(&parser, decoder->allocator);
+    if (SIXEL_FAILED(status)) {
+        goto end;
+    }
 
-    raw_data = (unsigned char *)sixel_allocator_malloc(decoder->allocator, (size_t)max);
-    if (raw_data == NULL) {
+    /* only one block of the input is held at a time */
+    buffer = (unsigned char *)sixel_allocator_malloc(
+        decoder->allocator,
+        SIXEL_DECODER_BLOCK_SIZE);
+    if (buffer == NULL) {
         sixel_helper_set_additional_message(
             "sixel_decoder_decode: sixel_allocator_malloc() failed.");
         status = SIXEL_BAD_ALLOCATION;
         goto end;
     }
 
-    for (;;) {
-        if ((max - raw_len) < 4096) {
-            max *= 2;
-            raw_data = (unsigned char *)sixel_allocator_realloc(decoder->allocator, raw_data, (size_t)max);
-            if (raw_data == NULL) {
-                sixel_helper_set_additional_message(
-                    "sixel_decoder_decode: sixel_allocator_realloc() failed.");
-                status = SIXEL_BAD_ALLOCATION;
-                goto end;
-            }
-        }
-        if ((n = (int)fread(raw_data + raw_len, 1, 4096, input_fp)) <= 0) {
-            break;
+    /* blocks are read like sixel_chunk_new() reads pipes */
+    while ((n = sixel_chunk_read_block(input_fp, buffer,
+                                       SIXEL_DECODER_BLOCK_SIZE)) > 0) {
+        status = sixel_parser_feed(parser, buffer, (int)n);
+        if (SIXEL_FAILED(status)) {
+            goto end;
         }
-        raw_len += n;
     }
-
-    if (input_fp != stdout) {
-        fclose(input_fp);
+    if (n < 0) {
+        sixel_helper_set_additional_message(
+            "sixel_decoder_decode: read() failed.");
+        status = (SIXEL_LIBC_ERROR | (errno & 0xff));
+        goto end;
     }
 
-    status = sixel_decode_raw(
-        raw_data,
-        raw_len,
-        &indexed_pixels,
-        &sx,
-        &sy,
-        &palette,
-        &ncolors,
-        decoder->allocator);
+    status = sixel_parser_finish(parser, &indexed_pixels, &sx, &sy,
+                                 &palette, &ncolors);
     if (SIXEL_FAILED(status)) {
         goto end;
     }
@@ -306,7 +375,11 @@ sixel_decoder_decode(
     }
 
 end:
-    sixel_allocator_free(decoder->allocator, raw_data);
+    if (input_fp && input_fp != stdin) {
+        fclose(input_fp);
+    }
+    sixel_parser_destroy(parser);
+    sixel_allocator_free(decoder->allocator, buffer);
     sixel_allocator_free(decoder->allocator, indexed_pixels);
     sixel_allocator_free(decoder->allocator, palette);
     sixel_decoder_unref(decoder);
@@ -554,6 +627,186 @@ error:
 }
 
 
+/* a stream fed in pieces decodes to the same image as the whole stream */
+static int
+test9(void)
+{
+    int nret = EXIT_FAILURE;
+    sixel_decoder_t *decoder = NULL;
+    SIXELSTATUS status;
+    FILE *fp = NULL;
+    static char const *files[] = {
+        "../images/map8.six",
+        "../images/map64.six"
+    };
+    static int const steps[] = { 1, 2, 3, 7, 64, 4096 };
+    unsigned char buffer[4096];
+    int len;
+    size_t i;
+    size_t j;
+    int pos;
+    int n;
+    unsigned char *pixels1 = NULL;
+    unsigned char *pixels2 = NULL;
+    unsigned char *palette1 = NULL;
+    unsigned char *palette2 = NULL;
+    int width1;
+    int width2;
+    int height1;
+    int height2;
+    int ncolors1;
+    int ncolors2;
+
+    status = sixel_decoder_new(&decoder, NULL);
+    if (SIXEL_FAILED(status)) {
+        goto error;
+    }
+
+    for (i = 0; i < sizeof(files) / sizeof(files[0]); ++i) {
+        fp = fopen(files[i], "rb");
+        if (fp == NULL) {
+            goto error;
+        }
+        len = (int)fread(buffer, 1, sizeof(buffer), fp);
+        fclose(fp);
+        if (len <= 0) {
+            goto error;
+        }
+
+        status = sixel_decode_raw(buffer, len, &pixels1, &width1, &height1,
+                                  &palette1, &ncolors1, decoder->allocator);
+        if (SIXEL_FAILED(status)) {
+            goto error;
+        }
+
+        for (j = 0; j < sizeof(steps) / sizeof(steps[0]); ++j) {
+            for (pos = 0; pos < len; pos += n) {
+                n = len - pos < steps[j] ? len - pos: steps[j];
+                status = sixel_decoder_feed(decoder, buffer + pos, n);
+                if (SIXEL_FAILED(status)) {
+                    goto error;
+                }
+            }
+            status = sixel_decoder_finish(decoder, &pixels2, &width2, &height2,
+                                          &palette2, &ncolors2);
+            if (SIXEL_FAILED(status)) {
+                goto error;
+            }
+            if (width1 != width2 || height1 != height2 || ncolors1 != ncolors2) {
+                goto error;
+            }
+            if (memcmp(pixels1, pixels2, (size_t)(width1 * height1)) != 0) {
+                goto error;
+            }
+            if (memcmp(palette1, palette2, (size_t)(ncolors1 * 3)) != 0) {
+                goto error;
+            }
+            sixel_allocator_free(decoder->allocator, pixels2);
+            sixel_allocator_free(decoder->allocator, palette2);
+            pixels2 = NULL;
+            palette2 = NULL;
+        }
+        sixel_allocator_free(decoder->allocator, pixels1);
+        sixel_allocator_free(decoder->allocator, palette1);
+        pixels1 = NULL;
+        palette1 = NULL;
+    }
+
+    nret = EXIT_SUCCESS;
+
+error:
+    if (decoder) {
+        sixel_allocator_free(decoder->allocator, pixels1);
+        sixel_allocator_free(decoder->allocator, pixels2);
+        sixel_allocator_free(decoder->allocator, palette1);
+        sixel_allocator_free(decoder->allocator, palette2);
+    }
+    sixel_decoder_unref(decoder);
+    return nret;
+}
+
+
+/* the decoder stops at ST and is reset by sixel_decoder_finish() */
+static int
+test10(void)
+{
+    int nret = EXIT_FAILURE;
+    sixel_decoder_t *decoder = NULL;
+    SIXELSTATUS status;
+    static unsigned char const first[] = "\033Pq#1;2;100;0;0~~\033\\~~~~";
+    static unsigned char const second[] = "\033Pq!5~";
+    unsigned char *pixels = NULL;
+    unsigned char *palette = NULL;
+    int width;
+    int height;
+    int ncolors;
+
+    status = sixel_decoder_new(&decoder, NULL);
+    if (SIXEL_FAILED(status)) {
+        goto error;
+    }
+
+    status = sixel_decoder_feed(decoder, first, (int)sizeof(first) - 1);
+    if (SIXEL_FAILED(status)) {
+        goto error;
+    }
+    status = sixel_decoder_finish(decoder, &pixels, &width, &height,
+                                  &palette, &ncolors);
+    if (SIXEL_FAILED(status)) {
+        goto error;
+    }
+    if (width != 2 || height != 6 || pixels[0] != 1 || palette[3] != 255) {
+        goto error;
+    }
+    sixel_allocator_free(decoder->allocator, pixels);
+    sixel_allocator_free(decoder->allocator, palette);
+    pixels = NULL;
+    palette = NULL;
+
+    /* an unterminated stream is completed by sixel_decoder_finish() */
+    status = sixel_decoder_feed(decoder, second, (int)sizeof(second) - 1);
+    if (SIXEL_FAILED(status)) {
+        goto error;
+    }
+    status = sixel_decoder_finish(decoder, &pixels, &width, &height,
+                                  &palette, &ncolors);
+    if (SIXEL_FAILED(status)) {
+        goto error;
+    }
+    if (width != 5 || height != 6 || pixels[4] != 15) {
+        goto error;
+    }
+    sixel_allocator_free(decoder->allocator, pixels);
+    sixel_allocator_free(decoder->allocator, palette);
+    pixels = NULL;
+    palette = NULL;
+
+    status = sixel_decoder_finish(decoder, &pixels, &width, &height,
+                                  &palette, &ncolors);
+    if (SIXEL_FAILED(status)) {
+        goto error;
+    }
+    if (width != 1 || height != 1) {
+        goto error;
+    }
+
+    status = sixel_decoder_feed(decoder, first, -1);
+    if (status != SIXEL_BAD_ARGUMENT) {
+        goto error;
+    }
+
+    nret = EXIT_SUCCESS;
+
+error:
+    if (decoder) {
+        sixel_allocator_free(decoder->allocator, pixels);
+        sixel_allocator_free(decoder->allocator, palette);
+    }
+    sixel_decoder_unref(decoder);
+    return nret;
+}
+
+
 SIXELAPI int
 sixel_decoder_tests_main(void)
 {
@@ -569,7 +822,9 @@ sixel_decoder_tests_main(void)
         test5,
         test6,
         test7,
-        test8
+        test8,
+        test9,
+        test10
     };
 
     for (i = 0; i < sizeof(testcases) / sizeof(testcase); ++i) {
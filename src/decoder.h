@@ -23,6 +23,7 @@
 #define LIBSIXEL_DECODER_H
 
 #include <sixel.h>
+#include "fromsixel.h"
 
 /* encode settings object */
 struct sixel_decoder {
@@ -30,6 +31,7 @@ struct sixel_decoder {
     char *input;
     char *output;
     sixel_allocator_t *allocator;
+    sixel_parser_t *parser;  /* stream given with sixel_decoder_feed() */
 };
 
 #if HAVE_TESTS
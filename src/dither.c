@@ -36,9 +36,13 @@
 #if HAVE_INTTYPES_H
 # include <inttypes.h>
 #endif  /* HAVE_INTTYPES_H */
+#if HAVE_ERRNO_H
+# include <errno.h>
+#endif  /* HAVE_ERRNO_H */
 
 #include "dither.h"
 #include "quant.h"
+#include "pixelformat.h"
 #include <sixel.h>
 
 
@@ -327,6 +331,7 @@ sixel_dither_new(
     (*ppdither)->method_for_diffuse = SIXEL_DIFFUSE_FS;
     (*ppdither)->quality_mode = quality_mode;
     (*ppdither)->pixelformat = SIXEL_PIXELFORMAT_RGB888;
+    (*ppdither)->histogram = NULL;
     (*ppdither)->allocator = allocator;
 
     status = SIXEL_OK;
@@ -364,6 +369,7 @@ sixel_dither_destroy(
         allocator = dither->allocator;
         sixel_allocator_free(allocator, dither->cachetable);
         dither->cachetable = NULL;
+        sixel_allocator_free(allocator, dither->histogram);
         sixel_allocator_free(allocator, dither);
         sixel_allocator_unref(allocator);
     }
@@ -525,6 +531,8 @@ sixel_dither_initialize(
     unsigned char *buf = NULL;
     unsigned char *normalized_pixels = NULL;
     unsigned char *input_pixels;
+    int stride;
+    int offsets[3];
     SIXELSTATUS status = SIXEL_FALSE;
 
     /* ensure dither object is not null */
@@ -540,11 +548,10 @@ sixel_dither_initialize(
 
     sixel_dither_set_pixelformat(dither, pixelformat);
 
-    switch (pixelformat) {
-    case SIXEL_PIXELFORMAT_RGB888:
+    if (sixel_pixelformat_get_channels(pixelformat, &stride, offsets)) {
+        /* 24bpp and 32bpp pixels are sampled in place */
         input_pixels = data;
-        break;
-    default:
+    } else {
         /* normalize pixelformat */
         normalized_pixels
             = (unsigned char *)sixel_allocator_malloc(dither->allocator, (size_t)(width * height * 3));
@@ -566,7 +573,7 @@ sixel_dither_initialize(
             goto end;
         }
         input_pixels = normalized_pixels;
-        break;
+        stride = 3;
     }
 
     sixel_dither_set_method_for_largest(dither, method_for_largest);
@@ -575,8 +582,8 @@ sixel_dither_initialize(
 
     status = sixel_quant_make_palette(&buf,
                                       input_pixels,
-                                      (unsigned int)(width * height * 3),
-                                      SIXEL_PIXELFORMAT_RGB888,
+                                      (unsigned int)(width * height * stride),
+                                      pixelformat,
                                       (unsigned int)dither->reqcolors,
                                       (unsigned int *)&dither->ncolors,
                                       (unsigned int *)&dither->origcolors,
@@ -598,7 +605,9 @@ sixel_dither_initialize(
     status = SIXEL_OK;
 
 end:
-    free(normalized_pixels);
+    if (dither) {
+        sixel_allocator_free(dither->allocator, normalized_pixels);
+    }
 
     /* decrement ref count */
     sixel_dither_unref(dither);
@@ -607,6 +616,134 @@ end:
 }
 
 
+/* add the colors of an image into the histogram of the dither, its size
+   does not depend on the number of images */
+SIXELSTATUS
+sixel_dither_add_histogram(
+    sixel_dither_t  /* in */ *dither,
+    unsigned char   /* in */ *data,
+    int             /* in */ width,
+    int             /* in */ height,
+    int             /* in */ pixelformat,
+    int             /* in */ quality_mode)
+{
+    SIXELSTATUS status = SIXEL_FALSE;
+    unsigned char *normalized_pixels = NULL;
+    unsigned char *input_pixels;
+    int stride;
+    int offsets[3];
+
+    sixel_dither_ref(dither);
+
+    if (dither->histogram == NULL) {
+        dither->histogram = (unsigned int *)sixel_allocator_calloc(
+            dither->allocator,
+            SIXEL_QUANT_HISTOGRAM_SIZE,
+            sizeof(unsigned int));
+        if (dither->histogram == NULL) {
+            sixel_helper_set_additional_message(
+                "sixel_dither_add_histogram: sixel_allocator_calloc() failed.");
+            status = SIXEL_BAD_ALLOCATION;
+            goto end;
+        }
+    }
+
+    if (sixel_pixelformat_get_channels(pixelformat, &stride, offsets)) {
+        input_pixels = data;
+    } else {
+        normalized_pixels
+            = (unsigned char *)sixel_allocator_malloc(dither->allocator, (size_t)(width * height * 3));
+        if (normalized_pixels == NULL) {
+            sixel_helper_set_additional_message(
+                "sixel_dither_add_histogram: sixel_allocator_malloc() failed.");
+            status = SIXEL_BAD_ALLOCATION;
+            goto end;
+        }
+        status = sixel_helper_normalize_pixelformat(normalized_pixels,
+                                                    &pixelformat,
+                                                    data,
+                                                    pixelformat,
+                                                    width,
+                                                    height);
+        if (SIXEL_FAILED(status)) {
+            goto end;
+        }
+        input_pixels = normalized_pixels;
+        stride = 3;
+    }
+
+    sixel_dither_set_quality_mode(dither, quality_mode);
+
+    status = sixel_quant_add_histogram(dither->histogram,
+                                       input_pixels,
+                                       (unsigned int)(width * height * stride),
+                                       pixelformat,
+                                       dither->quality_mode);
+
+end:
+    sixel_allocator_free(dither->allocator, normalized_pixels);
+    sixel_dither_unref(dither);
+
+    return status;
+}
+
+
+/* create the palette from the colors collected by
+   sixel_dither_add_histogram(), and release them */
+SIXELSTATUS
+sixel_dither_initialize_with_histogram(
+    sixel_dither_t  /* in */ *dither,
+    int             /* in */ method_for_largest,
+    int             /* in */ method_for_rep)
+{
+    SIXELSTATUS status = SIXEL_FALSE;
+    unsigned char *buf = NULL;
+
+    sixel_dither_ref(dither);
+
+    if (dither->histogram == NULL) {
+        sixel_helper_set_additional_message(
+            "sixel_dither_initialize_with_histogram: no color is collected.");
+        status = SIXEL_BAD_ARGUMENT;
+        goto end;
+    }
+
+    sixel_dither_set_pixelformat(dither, SIXEL_PIXELFORMAT_RGB888);
+    sixel_dither_set_method_for_largest(dither, method_for_largest);
+    sixel_dither_set_method_for_rep(dither, method_for_rep);
+
+    status = sixel_quant_make_palette_from_histogram(
+        &buf,
+        dither->histogram,
+        (unsigned int)dither->reqcolors,
+        (unsigned int *)&dither->ncolors,
+        (unsigned int *)&dither->origcolors,
+        dither->method_for_largest,
+        dither->method_for_rep,
+        dither->allocator);
+    if (SIXEL_FAILED(status)) {
+        goto end;
+    }
+    memcpy(dither->palette, buf, (size_t)(dither->ncolors * 3));
+
+    dither->optimized = 1;
+    if (dither->origcolors <= dither->ncolors) {
+        dither->method_for_diffuse = SIXEL_DIFFUSE_NONE;
+    }
+
+    sixel_quant_free_palette(buf, dither->allocator);
+    sixel_allocator_free(dither->allocator, dither->histogram);
+    dither->histogram = NULL;
+
+    status = SIXEL_OK;
+
+end:
+    sixel_dither_unref(dither);
+
+    return status;
+}
+
+
 /* set diffusion type, choose from enum methodForDiffuse */
 SIXELAPI void
 sixel_dither_set_diffusion_type(
@@ -667,6 +804,11 @@ sixel_dither_set_palette(
     unsigned char  /* in */ *palette)
 {
     memcpy(dither->palette, palette, (size_t)(dither->ncolors * 3));
+
+    /* cached lookup results are no longer valid */
+    if (dither->cachetable) {
+        memset(dither->cachetable, 0, sizeof(unsigned short) * SIXEL_DITHER_CACHE_SIZE);
+    }
 }
 
 
@@ -676,6 +818,10 @@ sixel_dither_set_complexion_score(
     sixel_dither_t /* in */ *dither,  /* dither context object */
     int            /* in */ score)    /* complexion score (>= 1) */
 {
+    /* cached lookup results depend on the complexion score */
+    if (dither->cachetable && dither->complexion != score) {
+        memset(dither->cachetable, 0, sizeof(unsigned short) * SIXEL_DITHER_CACHE_SIZE);
+    }
     dither->complexion = score;
 }
 
@@ -722,161 +868,1096 @@ sixel_dither_set_transparent(
 }
 
 
-/* set transparent */
-SIXELAPI sixel_index_t *
-sixel_dither_apply_palette(
-    sixel_dither_t  /* in */ *dither,
-    unsigned char   /* in */ *pixels,
-    int             /* in */ width,
-    int             /* in */ height)
+/*
+ * palette artifact
+ *
+ * offset  size            contents
+ *      0  8               magic (SIXEL_PALETTE_ARTIFACT_MAGIC)
+ *      8  1               format version (1)
+ *      9  1               flags (bit 0: lookup cache follows the palette)
+ *     10  2               number of colors (little endian, 1 - 256)
+ *     12  4               complexion score (little endian)
+ *     16  ncolors * 3     RGB palette
+ *      -  2 * 32768       lookup cache (little endian, optional)
+ */
+#define SIXEL_PALETTE_ARTIFACT_VERSION      1
+#define SIXEL_PALETTE_ARTIFACT_HAS_CACHE    0x01
+#define SIXEL_PALETTE_ARTIFACT_HEADER_SIZE  16
+#define SIXEL_PALETTE_ARTIFACT_MAX_SIZE     (SIXEL_PALETTE_ARTIFACT_HEADER_SIZE \
+                                             + SIXEL_PALETTE_MAX * 3 \
+                                             + SIXEL_DITHER_CACHE_SIZE * 2)
+
+
+/* save palette and lookup cache as a palette artifact */
+SIXELAPI SIXELSTATUS
+sixel_dither_save(
+    sixel_dither_t  /* in */ *dither,    /* dither context object */
+    char const      /* in */ *filename)  /* path of the palette artifact */
 {
     SIXELSTATUS status = SIXEL_FALSE;
-    size_t bufsize;
-    sixel_index_t *dest = NULL;
-    int ncolors;
-    unsigned char *normalized_pixels = NULL;
-    unsigned char *input_pixels;
+    FILE *fp = NULL;
+    unsigned char *buffer = NULL;
+    unsigned char *p;
+    size_t size;
+    int i;
 
-    /* ensure dither object is not null */
-    if (dither == NULL) {
+    if (dither == NULL || filename == NULL) {
         sixel_helper_set_additional_message(
-            "sixel_dither_apply_palette: dither is null.");
+            "sixel_dither_save: a bad argument is detected.");
         status = SIXEL_BAD_ARGUMENT;
         goto end;
     }
 
-    sixel_dither_ref(dither);
-
-    bufsize = (size_t)(width * height) * sizeof(sixel_index_t);
-    dest = (sixel_index_t *)sixel_allocator_malloc(dither->allocator, bufsize);
-    if (dest == NULL) {
+    if (dither->ncolors < 1 || dither->ncolors > SIXEL_PALETTE_MAX) {
         sixel_helper_set_additional_message(
-            "sixel_dither_new: sixel_allocator_malloc() failed.");
-        status = SIXEL_BAD_ALLOCATION;
+            "sixel_dither_save: the dither has no valid palette.");
+        status = SIXEL_BAD_ARGUMENT;
         goto end;
     }
 
-    /* if quality_mode is full, do not use palette caching */
-    if (dither->quality_mode == SIXEL_QUALITY_FULL) {
-        dither->optimized = 0;
+    size = SIXEL_PALETTE_ARTIFACT_HEADER_SIZE + (size_t)dither->ncolors * 3;
+    if (dither->cachetable) {
+        size += SIXEL_DITHER_CACHE_SIZE * 2;
     }
-
-    if (dither->cachetable == NULL && dither->optimized) {
-        if (dither->palette != pal_mono_dark && dither->palette != pal_mono_light) {
-            dither->cachetable = (unsigned short *)sixel_allocator_calloc(dither->allocator,
-                                                                          (size_t)(1 << 3 * 5),
-                                                                          sizeof(unsigned short));
-            if (dither->cachetable == NULL) {
-                sixel_helper_set_additional_message(
-                    "sixel_dither_new: sixel_allocator_calloc() failed.");
-                status = SIXEL_BAD_ALLOCATION;
-                goto end;
-            }
-        }
+    buffer = (unsigned char *)sixel_allocator_malloc(dither->allocator, size);
+    if (buffer == NULL) {
+        sixel_helper_set_additional_message(
+            "sixel_dither_save: sixel_allocator_malloc() failed.");
+        status = SIXEL_BAD_ALLOCATION;
+        goto end;
     }
 
-    if (dither->pixelformat != SIXEL_PIXELFORMAT_RGB888) {
-        /* normalize pixelformat */
-        normalized_pixels
-            = (unsigned char *)sixel_allocator_malloc(dither->allocator, (size_t)(width * height * 3));
-        if (normalized_pixels == NULL) {
-            sixel_helper_set_additional_message(
-                "sixel_dither_new: sixel_allocator_malloc() failed.");
-            status = SIXEL_BAD_ALLOCATION;
-            goto end;
-        }
-        status = sixel_helper_normalize_pixelformat(normalized_pixels,
-                                                    &dither->pixelformat,
-                                                    pixels, dither->pixelformat,
-                                                    width, height);
-        if (SIXEL_FAILED(status)) {
-            goto end;
+    p = buffer;
+    memcpy(p, SIXEL_PALETTE_ARTIFACT_MAGIC, 8);
+    p[8] = SIXEL_PALETTE_ARTIFACT_VERSION;
+    p[9] = dither->cachetable ? SIXEL_PALETTE_ARTIFACT_HAS_CACHE: 0;
+    p[10] = (unsigned char)(dither->ncolors & 0xff);
+    p[11] = (unsigned char)(dither->ncolors >> 8 & 0xff);
+    p[12] = (unsigned char)(dither->complexion & 0xff);
+    p[13] = (unsigned char)(dither->complexion >> 8 & 0xff);
+    p[14] = (unsigned char)(dither->complexion >> 16 & 0xff);
+    p[15] = (unsigned char)(dither->complexion >> 24 & 0xff);
+    p += SIXEL_PALETTE_ARTIFACT_HEADER_SIZE;
+    memcpy(p, dither->palette, (size_t)dither->ncolors * 3);
+    p += dither->ncolors * 3;
+    if (dither->cachetable) {
+        for (i = 0; i < SIXEL_DITHER_CACHE_SIZE; ++i) {
+            p[i * 2 + 0] = (unsigned char)(dither->cachetable[i] & 0xff);
+            p[i * 2 + 1] = (unsigned char)(dither->cachetable[i] >> 8 & 0xff);
         }
-        input_pixels = normalized_pixels;
-    } else {
-        input_pixels = pixels;
     }
 
-    status = sixel_quant_apply_palette(dest,
-                                       input_pixels,
-                                       width, height, 3,
-                                       dither->palette,
-                                       dither->ncolors,
-                                       dither->method_for_diffuse,
-                                       dither->optimized,
-                                       dither->optimize_palette,
-                                       dither->complexion,
-                                       dither->cachetable,
-                                       &ncolors,
-                                       dither->allocator);
-    if (SIXEL_FAILED(status)) {
-        free(dest);
-        dest = NULL;
+    fp = fopen(filename, "wb");
+    if (fp == NULL) {
+        sixel_helper_set_additional_message(
+            "sixel_dither_save: fopen() failed.");
+        status = (SIXEL_LIBC_ERROR | (errno & 0xff));
+        goto end;
+    }
+    if (fwrite(buffer, 1, size, fp) != size) {
+        sixel_helper_set_additional_message(
+            "sixel_dither_save: fwrite() failed.");
+        status = (SIXEL_LIBC_ERROR | (errno & 0xff));
+        goto end;
+    }
+    if (fclose(fp) != 0) {
+        fp = NULL;
+        sixel_helper_set_additional_message(
+            "sixel_dither_save: fclose() failed.");
+        status = (SIXEL_LIBC_ERROR | (errno & 0xff));
         goto end;
     }
+    fp = NULL;
 
-    dither->ncolors = ncolors;
+    status = SIXEL_OK;
 
 end:
-    free(normalized_pixels);
-    sixel_dither_unref(dither);
-    return dest;
+    if (fp) {
+        fclose(fp);
+    }
+    if (dither) {
+        sixel_allocator_free(dither->allocator, buffer);
+    }
+    return status;
 }
 
 
-#if HAVE_TESTS
-static int
-test1(void)
+/* create dither context object from a palette artifact */
+SIXELAPI SIXELSTATUS
+sixel_dither_load(
+    sixel_dither_t      /* out */ **ppdither,  /* dither object to be created */
+    char const          /* in */  *filename,   /* path of the palette artifact */
+    sixel_allocator_t   /* in */  *allocator)  /* allocator, null if you use
+                                                  default allocator */
 {
-    sixel_dither_t *dither = NULL;
-    int nret = EXIT_FAILURE;
+    SIXELSTATUS status = SIXEL_FALSE;
+    FILE *fp = NULL;
+    unsigned char *buffer = NULL;
+    unsigned char *p;
+    size_t size;
+    size_t expected_size;
+    int ncolors;
+    int complexion;
+    int has_cache;
+    int i;
 
-#if HAVE_DIAGNOSTIC_DEPRECATED_DECLARATIONS
-#  pragma GCC diagnostic push
-#  pragma GCC diagnostic ignored "-Wdeprecated-declarations"
-#endif
-    dither = sixel_dither_create(2);
-#if HAVE_DIAGNOSTIC_DEPRECATED_DECLARATIONS
-#  pragma GCC diagnostic pop
-#endif
-    if (dither == NULL) {
-        goto error;
+    if (ppdither == NULL || filename == NULL) {
+        sixel_helper_set_additional_message(
+            "sixel_dither_load: a bad argument is detected.");
+        return SIXEL_BAD_ARGUMENT;
     }
-    sixel_dither_ref(dither);
-    sixel_dither_unref(dither);
-    nret = EXIT_SUCCESS;
+    *ppdither = NULL;
 
-error:
-    sixel_dither_unref(dither);
-    return nret;
-}
+    if (allocator == NULL) {
+        status = sixel_allocator_new(&allocator, NULL, NULL, NULL, NULL);
+        if (SIXEL_FAILED(status)) {
+            goto end;
+        }
+    } else {
+        sixel_allocator_ref(allocator);
+    }
 
-static int
-test2(void)
-{
-    sixel_dither_t *dither = NULL;
-    int colors;
-    int nret = EXIT_FAILURE;
+    /* the artifact is small enough to be read at once */
+    buffer = (unsigned char *)sixel_allocator_malloc(
+        allocator, SIXEL_PALETTE_ARTIFACT_MAX_SIZE + 1);
+    if (buffer == NULL) {
+        sixel_helper_set_additional_message(
+            "sixel_dither_load: sixel_allocator_malloc() failed.");
+        status = SIXEL_BAD_ALLOCATION;
+        goto end;
+    }
 
-#if HAVE_DIAGNOSTIC_DEPRECATED_DECLARATIONS
-#  pragma GCC diagnostic push
-#  pragma GCC diagnostic ignored "-Wdeprecated-declarations"
-#endif
-    dither = sixel_dither_create(INT_MAX);
-#if HAVE_DIAGNOSTIC_DEPRECATED_DECLARATIONS
-#  pragma GCC diagnostic pop
-#endif
-    if (dither == NULL) {
-        goto error;
+    fp = fopen(filename, "rb");
+    if (fp == NULL) {
+        sixel_helper_set_additional_message(
+            "sixel_dither_load: fopen() failed.");
+        status = (SIXEL_LIBC_ERROR | (errno & 0xff));
+        goto end;
     }
-    sixel_dither_set_body_only(dither, 1);
-    colors = sixel_dither_get_num_of_histogram_colors(dither);
-    if (colors != -1) {
-        goto error;
+    size = fread(buffer, 1, SIXEL_PALETTE_ARTIFACT_MAX_SIZE + 1, fp);
+    if (ferror(fp)) {
+        sixel_helper_set_additional_message(
+            "sixel_dither_load: fread() failed.");
+        status = (SIXEL_LIBC_ERROR | (errno & 0xff));
+        goto end;
     }
-    nret = EXIT_SUCCESS;
 
-error:
+    if (size < SIXEL_PALETTE_ARTIFACT_HEADER_SIZE
+        || memcmp(buffer, SIXEL_PALETTE_ARTIFACT_MAGIC, 8) != 0) {
+        sixel_helper_set_additional_message(
+            "sixel_dither_load: not a palette artifact.");
+        status = SIXEL_BAD_INPUT;
+        goto end;
+    }
+    if (buffer[8] != SIXEL_PALETTE_ARTIFACT_VERSION) {
+        sixel_helper_set_additional_message(
+            "sixel_dither_load: unsupported palette artifact version.");
+        status = SIXEL_BAD_INPUT;
+        goto end;
+    }
+
+    has_cache = buffer[9] & SIXEL_PALETTE_ARTIFACT_HAS_CACHE;
+    ncolors = buffer[10] | buffer[11] << 8;
+    complexion = (int)((unsigned int)buffer[12]
+                       | (unsigned int)buffer[13] << 8
+                       | (unsigned int)buffer[14] << 16
+                       | (unsigned int)buffer[15] << 24);
+    if (ncolors < 1 || ncolors > SIXEL_PALETTE_MAX || complexion < 1) {
+        sixel_helper_set_additional_message(
+            "sixel_dither_load: broken palette artifact header.");
+        status = SIXEL_BAD_INPUT;
+        goto end;
+    }
+    expected_size = SIXEL_PALETTE_ARTIFACT_HEADER_SIZE + (size_t)ncolors * 3;
+    if (has_cache) {
+        expected_size += SIXEL_DITHER_CACHE_SIZE * 2;
+    }
+    if (size != expected_size) {
+        sixel_helper_set_additional_message(
+            "sixel_dither_load: unexpected palette artifact size.");
+        status = SIXEL_BAD_INPUT;
+        goto end;
+    }
+
+    status = sixel_dither_new(ppdither, ncolors, allocator);
+    if (SIXEL_FAILED(status)) {
+        *ppdither = NULL;
+        goto end;
+    }
+
+    p = buffer + SIXEL_PALETTE_ARTIFACT_HEADER_SIZE;
+    memcpy((*ppdither)->palette, p, (size_t)ncolors * 3);
+    p += ncolors * 3;
+    (*ppdither)->complexion = complexion;
+    (*ppdither)->optimized = 1;
+
+    if (has_cache) {
+        (*ppdither)->cachetable = (unsigned short *)sixel_allocator_malloc(
+            allocator, SIXEL_DITHER_CACHE_SIZE * sizeof(unsigned short));
+        if ((*ppdither)->cachetable == NULL) {
+            sixel_helper_set_additional_message(
+                "sixel_dither_load: sixel_allocator_malloc() failed.");
+            status = SIXEL_BAD_ALLOCATION;
+            sixel_dither_unref(*ppdither);
+            *ppdither = NULL;
+            goto end;
+        }
+        for (i = 0; i < SIXEL_DITHER_CACHE_SIZE; ++i) {
+            (*ppdither)->cachetable[i] = (unsigned short)(p[i * 2] | p[i * 2 + 1] << 8);
+            /* reject entries which point outside of the palette */
+            if ((*ppdither)->cachetable[i] > ncolors) {
+                sixel_helper_set_additional_message(
+                    "sixel_dither_load: broken lookup cache.");
+                status = SIXEL_BAD_INPUT;
+                sixel_dither_unref(*ppdither);
+                *ppdither = NULL;
+                goto end;
+            }
+        }
+    }
+
+    status = SIXEL_OK;
+
+end:
+    if (fp) {
+        fclose(fp);
+    }
+    if (allocator) {
+        sixel_allocator_free(allocator, buffer);
+        sixel_allocator_unref(allocator);
+    }
+    return status;
+}
+
+/* allocate lookup cache if it does not exist */
+static SIXELSTATUS
+sixel_dither_prepare_cache(
+    sixel_dither_t  /* in */ *dither)
+{
+    if (dither->cachetable == NULL) {
+        dither->cachetable = (unsigned short *)sixel_allocator_calloc(
+            dither->allocator,
+            SIXEL_DITHER_CACHE_SIZE,
+            sizeof(unsigned short));
+        if (dither->cachetable == NULL) {
+            sixel_helper_set_additional_message(
+                "sixel_dither_prepare_cache: sixel_allocator_calloc() failed.");
+            return SIXEL_BAD_ALLOCATION;
+        }
+    }
+
+    return SIXEL_OK;
+}
+
+
+/* fill whole lookup cache for current palette */
+SIXELAPI SIXELSTATUS
+sixel_dither_precompute_cache(
+    sixel_dither_t  /* in */ *dither)  /* dither context object */
+{
+    SIXELSTATUS status = SIXEL_FALSE;
+
+    if (dither == NULL) {
+        sixel_helper_set_additional_message(
+            "sixel_dither_precompute_cache: dither is null.");
+        status = SIXEL_BAD_ARGUMENT;
+        goto end;
+    }
+
+    status = sixel_dither_prepare_cache(dither);
+    if (SIXEL_FAILED(status)) {
+        goto end;
+    }
+
+    status = sixel_quant_precompute_cache(dither->cachetable,
+                                          dither->palette,
+                                          dither->ncolors,
+                                          dither->complexion,
+                                          dither->allocator);
+    if (SIXEL_FAILED(status)) {
+        goto end;
+    }
+
+    /* the cache is used only by fast lookup */
+    dither->optimized = 1;
+
+end:
+    return status;
+}
+
+
+/* copy lookup cache into specified buffer */
+SIXELAPI SIXELSTATUS
+sixel_dither_export_cache(
+    sixel_dither_t  /* in */  *dither,  /* dither context object */
+    unsigned short  /* out */ *cache)   /* SIXEL_DITHER_CACHE_SIZE entries */
+{
+    if (dither == NULL || cache == NULL) {
+        sixel_helper_set_additional_message(
+            "sixel_dither_export_cache: a bad argument is detected.");
+        return SIXEL_BAD_ARGUMENT;
+    }
+
+    if (dither->cachetable) {
+        memcpy(cache, dither->cachetable,
+               sizeof(unsigned short) * SIXEL_DITHER_CACHE_SIZE);
+    } else {
+        memset(cache, 0, sizeof(unsigned short) * SIXEL_DITHER_CACHE_SIZE);
+    }
+
+    return SIXEL_OK;
+}
+
+
+/* replace lookup cache with specified buffer */
+SIXELAPI SIXELSTATUS
+sixel_dither_import_cache(
+    sixel_dither_t          /* in */ *dither,  /* dither context object */
+    unsigned short const    /* in */ *cache)   /* SIXEL_DITHER_CACHE_SIZE entries */
+{
+    SIXELSTATUS status = SIXEL_FALSE;
+    int i;
+
+    if (dither == NULL || cache == NULL) {
+        sixel_helper_set_additional_message(
+            "sixel_dither_import_cache: a bad argument is detected.");
+        status = SIXEL_BAD_ARGUMENT;
+        goto end;
+    }
+
+    /* reject entries which point outside of the palette */
+    for (i = 0; i < SIXEL_DITHER_CACHE_SIZE; ++i) {
+        if (cache[i] > dither->ncolors) {
+            sixel_helper_set_additional_message(
+                "sixel_dither_import_cache: broken lookup cache.");
+            status = SIXEL_BAD_INPUT;
+            goto end;
+        }
+    }
+
+    status = sixel_dither_prepare_cache(dither);
+    if (SIXEL_FAILED(status)) {
+        goto end;
+    }
+    memcpy(dither->cachetable, cache,
+           sizeof(unsigned short) * SIXEL_DITHER_CACHE_SIZE);
+
+    /* the cache is used only by fast lookup */
+    dither->optimized = 1;
+
+end:
+    return status;
+}
+
+
+/* set up the lookup cache before palette application */
+static SIXELSTATUS
+sixel_dither_prepare_lookup(sixel_dither_t /* in */ *dither)
+{
+    SIXELSTATUS status = SIXEL_OK;
+
+    /* if quality_mode is full, do not use palette caching */
+    if (dither->quality_mode == SIXEL_QUALITY_FULL) {
+        dither->optimized = 0;
+    }
+
+    if (dither->cachetable == NULL && dither->optimized) {
+        if (dither->palette != pal_mono_dark && dither->palette != pal_mono_light) {
+            status = sixel_dither_prepare_cache(dither);
+        }
+    }
+
+    return status;
+}
+
+
+/* whether the diffusion method writes errors into neighbour pixels */
+static int
+sixel_dither_diffuses_error(int method_for_diffuse)
+{
+    switch (method_for_diffuse) {
+    case SIXEL_DIFFUSE_ATKINSON:
+    case SIXEL_DIFFUSE_FS:
+    case SIXEL_DIFFUSE_JAJUNI:
+    case SIXEL_DIFFUSE_STUCKI:
+    case SIXEL_DIFFUSE_BURKES:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+
+/* drop unused colors from the palette, indexes are renumbered in order of
+   appearance as sixel_quant_apply_palette() does */
+static void
+sixel_dither_compact_palette(
+    sixel_dither_t  /* in */     *dither,
+    sixel_index_t   /* in/out */ *dest,
+    size_t          /* in */     size)
+{
+    unsigned char new_palette[SIXEL_PALETTE_MAX * 3];
+    unsigned short migration_map[SIXEL_PALETTE_MAX];
+    int ncolors = 0;
+    size_t i;
+
+    memset(migration_map, 0x00, sizeof(migration_map));
+    for (i = 0; i < size; ++i) {
+        if (migration_map[dest[i]] == 0) {
+            memcpy(new_palette + ncolors * 3, dither->palette + dest[i] * 3, 3);
+            migration_map[dest[i]] = (unsigned short)++ncolors;
+        }
+        dest[i] = (sixel_index_t)(migration_map[dest[i]] - 1);
+    }
+    memcpy(dither->palette, new_palette, (size_t)(ncolors * 3));
+    dither->ncolors = ncolors;
+}
+
+
+/* diffuse errors of 24bpp and 32bpp pixels through a window of copied
+   rows, so that the caller's pixels are left as they are */
+static SIXELSTATUS
+sixel_dither_apply_palette_window(
+    sixel_dither_t  /* in */  *dither,
+    sixel_index_t   /* out */ *dest,
+    unsigned char   /* in */  *pixels,
+    int             /* in */  width,
+    int             /* in */  height,
+    int             /* in */  pitch,
+    int             /* in */  stride)
+{
+    SIXELSTATUS status = SIXEL_FALSE;
+    unsigned char *window;
+    size_t row_bytes = (size_t)width * (size_t)stride;
+    int fetched;
+    int limit;
+    int nrows;
+    int y;
+
+    window = (unsigned char *)sixel_allocator_malloc(
+        dither->allocator,
+        row_bytes * (SIXEL_DITHER_BAND_ROWS + SIXEL_DITHER_LOOKAHEAD_ROWS));
+    if (window == NULL) {
+        sixel_helper_set_additional_message(
+            "sixel_dither_apply_palette: sixel_allocator_malloc() failed.");
+        status = SIXEL_BAD_ALLOCATION;
+        goto end;
+    }
+
+    for (y = fetched = 0; y < height; y += SIXEL_DITHER_BAND_ROWS) {
+        nrows = height - y < SIXEL_DITHER_BAND_ROWS
+              ? height - y: SIXEL_DITHER_BAND_ROWS;
+        limit = height - y < SIXEL_DITHER_BAND_ROWS + SIXEL_DITHER_LOOKAHEAD_ROWS
+              ? height: y + SIXEL_DITHER_BAND_ROWS + SIXEL_DITHER_LOOKAHEAD_ROWS;
+        for (; fetched < limit; ++fetched) {
+            memcpy(window + (size_t)(fetched - y) * row_bytes,
+                   pixels + (size_t)fetched * (size_t)pitch, row_bytes);
+        }
+        status = sixel_dither_apply_palette_rows(dither,
+                                                 dest + (size_t)y * (size_t)width,
+                                                 window, dither->pixelformat,
+                                                 width, limit - y,
+                                                 (int)row_bytes, nrows, y);
+        if (SIXEL_FAILED(status)) {
+            goto end;
+        }
+        memmove(window, window + (size_t)nrows * row_bytes,
+                (size_t)(limit - y - nrows) * row_bytes);
+    }
+
+    if (dither->optimize_palette) {
+        sixel_dither_compact_palette(dither, dest,
+                                     (size_t)width * (size_t)height);
+    }
+
+    status = SIXEL_OK;
+
+end:
+    sixel_allocator_free(dither->allocator, window);
+    return status;
+}
+
+
+/* apply palette to rows which are 'pitch' bytes apart */
+sixel_index_t *
+sixel_dither_apply_palette_with_pitch(
+    sixel_dither_t  /* in */ *dither,
+    unsigned char   /* in */ *pixels,
+    int             /* in */ width,
+    int             /* in */ height,
+    int             /* in */ pitch)
+{
+    SIXELSTATUS status = SIXEL_FALSE;
+    size_t bufsize;
+    sixel_index_t *dest = NULL;
+    int ncolors;
+    unsigned char *normalized_pixels = NULL;
+    unsigned char *input_pixels;
+    int input_pixelformat;
+    int stride;
+    int offsets[3];
+
+    /* ensure dither object is not null */
+    if (dither == NULL) {
+        sixel_helper_set_additional_message(
+            "sixel_dither_apply_palette: dither is null.");
+        status = SIXEL_BAD_ARGUMENT;
+        goto end;
+    }
+
+    sixel_dither_ref(dither);
+
+    bufsize = (size_t)(width * height) * sizeof(sixel_index_t);
+    dest = (sixel_index_t *)sixel_allocator_malloc(dither->allocator, bufsize);
+    if (dest == NULL) {
+        sixel_helper_set_additional_message(
+            "sixel_dither_new: sixel_allocator_malloc() failed.");
+        status = SIXEL_BAD_ALLOCATION;
+        goto end;
+    }
+
+    status = sixel_dither_prepare_lookup(dither);
+    if (SIXEL_FAILED(status)) {
+        goto end;
+    }
+
+    if (sixel_pixelformat_get_channels(dither->pixelformat, &stride, offsets)) {
+        if (sixel_dither_diffuses_error(dither->method_for_diffuse)) {
+            status = sixel_dither_apply_palette_window(dither, dest, pixels,
+                                                       width, height, pitch,
+                                                       stride);
+            if (SIXEL_FAILED(status)) {
+                sixel_allocator_free(dither->allocator, dest);
+                dest = NULL;
+            }
+            goto end;
+        }
+        /* without diffusion, 24bpp and 32bpp pixels are only read */
+        input_pixels = pixels;
+        input_pixelformat = dither->pixelformat;
+    } else {
+        /* normalize pixelformat */
+        normalized_pixels
+            = (unsigned char *)sixel_allocator_malloc(dither->allocator, (size_t)(width * height * 3));
+        if (normalized_pixels == NULL) {
+            sixel_helper_set_additional_message(
+                "sixel_dither_new: sixel_allocator_malloc() failed.");
+            status = SIXEL_BAD_ALLOCATION;
+            goto end;
+        }
+        status = sixel_pixelformat_normalize_rows(normalized_pixels,
+                                                  &dither->pixelformat,
+                                                  pixels, dither->pixelformat,
+                                                  width, height, pitch);
+        if (SIXEL_FAILED(status)) {
+            goto end;
+        }
+        input_pixels = normalized_pixels;
+        input_pixelformat = SIXEL_PIXELFORMAT_RGB888;
+        pitch = width * 3;
+    }
+
+    status = sixel_quant_apply_palette(dest,
+                                       input_pixels,
+                                       width, height, pitch,
+                                       input_pixelformat,
+                                       dither->palette,
+                                       dither->ncolors,
+                                       dither->method_for_diffuse,
+                                       dither->optimized,
+                                       dither->optimize_palette,
+                                       dither->complexion,
+                                       dither->cachetable,
+                                       &ncolors,
+                                       dither->allocator);
+    if (SIXEL_FAILED(status)) {
+        sixel_allocator_free(dither->allocator, dest);
+        dest = NULL;
+        goto end;
+    }
+
+    dither->ncolors = ncolors;
+
+end:
+    if (dither) {
+        sixel_allocator_free(dither->allocator, normalized_pixels);
+    }
+    sixel_dither_unref(dither);
+    return dest;
+}
+
+
+/* set transparent */
+SIXELAPI sixel_index_t *
+sixel_dither_apply_palette(
+    sixel_dither_t  /* in */ *dither,
+    unsigned char   /* in */ *pixels,
+    int             /* in */ width,
+    int             /* in */ height)
+{
+    int pitch = 0;
+
+    if (dither != NULL) {
+        pitch = sixel_pixelformat_get_row_bytes(dither->pixelformat, width);
+    }
+
+    return sixel_dither_apply_palette_with_pitch(dither, pixels,
+                                                 width, height, pitch);
+}
+
+
+/* apply palette to the first 'rows' rows of a buffer of 24bpp or 32bpp
+   pixels, the palette is kept as is */
+SIXELSTATUS
+sixel_dither_apply_palette_rows(
+    sixel_dither_t  /* in */  *dither,
+    sixel_index_t   /* out */ *dest,
+    unsigned char   /* in */  *pixels,
+    int             /* in */  pixelformat,
+    int             /* in */  width,
+    int             /* in */  height,
+    int             /* in */  pitch,
+    int             /* in */  rows,
+    int             /* in */  origin)
+{
+    SIXELSTATUS status = SIXEL_FALSE;
+    int ncolors;
+
+    status = sixel_dither_prepare_lookup(dither);
+    if (SIXEL_FAILED(status)) {
+        goto end;
+    }
+
+    status = sixel_quant_apply_palette_rows(dest,
+                                            pixels,
+                                            width, height, pitch,
+                                            rows, origin,
+                                            pixelformat,
+                                            dither->palette,
+                                            dither->ncolors,
+                                            dither->method_for_diffuse,
+                                            dither->optimized,
+                                            0,
+                                            dither->complexion,
+                                            dither->cachetable,
+                                            &ncolors,
+                                            dither->allocator);
+
+end:
+    return status;
+}
+
+
+#if HAVE_TESTS
+static int
+test1(void)
+{
+    sixel_dither_t *dither = NULL;
+    int nret = EXIT_FAILURE;
+
+#if HAVE_DIAGNOSTIC_DEPRECATED_DECLARATIONS
+#  pragma GCC diagnostic push
+#  pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+#endif
+    dither = sixel_dither_create(2);
+#if HAVE_DIAGNOSTIC_DEPRECATED_DECLARATIONS
+#  pragma GCC diagnostic pop
+#endif
+    if (dither == NULL) {
+        goto error;
+    }
+    sixel_dither_ref(dither);
+    sixel_dither_unref(dither);
+    nret = EXIT_SUCCESS;
+
+error:
+    sixel_dither_unref(dither);
+    return nret;
+}
+
+static int
+test2(void)
+{
+    sixel_dither_t *dither = NULL;
+    int colors;
+    int nret = EXIT_FAILURE;
+
+#if HAVE_DIAGNOSTIC_DEPRECATED_DECLARATIONS
+#  pragma GCC diagnostic push
+#  pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+#endif
+    dither = sixel_dither_create(SIXEL_PALETTE_MAX);
+#if HAVE_DIAGNOSTIC_DEPRECATED_DECLARATIONS
+#  pragma GCC diagnostic pop
+#endif
+    if (dither == NULL) {
+        goto error;
+    }
+    sixel_dither_set_body_only(dither, 1);
+    colors = sixel_dither_get_num_of_histogram_colors(dither);
+    if (colors != -1) {
+        goto error;
+    }
+    nret = EXIT_SUCCESS;
+
+error:
+    sixel_dither_unref(dither);
+    return nret;
+}
+
+
+/* palette artifact round trip */
+static int
+test3(void)
+{
+    int nret = EXIT_FAILURE;
+    SIXELSTATUS status;
+    sixel_dither_t *dither = NULL;
+    sixel_dither_t *loaded = NULL;
+    sixel_index_t *indexes1 = NULL;
+    sixel_index_t *indexes2 = NULL;
+    unsigned char pixels[16 * 16 * 3];
+    unsigned char work[16 * 16 * 3];
+    FILE *fp = NULL;
+    int i;
+
+    for (i = 0; i < 16 * 16; ++i) {
+        pixels[i * 3 + 0] = (unsigned char)(i * 7);
+        pixels[i * 3 + 1] = (unsigned char)(i * 13);
+        pixels[i * 3 + 2] = (unsigned char)(i * 29);
+    }
+
+    status = sixel_dither_new(&dither, 16, NULL);
+    if (SIXEL_FAILED(status)) {
+        goto error;
+    }
+    status = sixel_dither_initialize(dither, pixels, 16, 16,
+                                     SIXEL_PIXELFORMAT_RGB888,
+                                     SIXEL_LARGE_AUTO,
+                                     SIXEL_REP_AUTO,
+                                     SIXEL_QUALITY_AUTO);
+    if (SIXEL_FAILED(status)) {
+        goto error;
+    }
+    sixel_dither_set_diffusion_type(dither, SIXEL_DIFFUSE_NONE);
+    memcpy(work, pixels, sizeof(pixels));
+    indexes1 = sixel_dither_apply_palette(dither, work, 16, 16);
+    if (indexes1 == NULL || dither->cachetable == NULL) {
+        goto error;
+    }
+
+    status = sixel_dither_save(dither, "test-output.pal");
+    if (SIXEL_FAILED(status)) {
+        goto error;
+    }
+    status = sixel_dither_load(&loaded, "test-output.pal", NULL);
+    if (SIXEL_FAILED(status)) {
+        goto error;
+    }
+    if (loaded->ncolors != dither->ncolors) {
+        goto error;
+    }
+    if (memcmp(loaded->palette, dither->palette, (size_t)(dither->ncolors * 3)) != 0) {
+        goto error;
+    }
+    if (loaded->cachetable == NULL) {
+        goto error;
+    }
+    if (memcmp(loaded->cachetable, dither->cachetable,
+               sizeof(unsigned short) * SIXEL_DITHER_CACHE_SIZE) != 0) {
+        goto error;
+    }
+
+    /* loaded palette must give the same result */
+    sixel_dither_set_diffusion_type(loaded, SIXEL_DIFFUSE_NONE);
+    memcpy(work, pixels, sizeof(pixels));
+    indexes2 = sixel_dither_apply_palette(loaded, work, 16, 16);
+    if (indexes2 == NULL) {
+        goto error;
+    }
+    if (memcmp(indexes1, indexes2, 16 * 16 * sizeof(sixel_index_t)) != 0) {
+        goto error;
+    }
+    sixel_dither_unref(loaded);
+    loaded = NULL;
+
+    /* truncated artifact must be rejected */
+    fp = fopen("test-output.pal", "wb");
+    if (fp == NULL) {
+        goto error;
+    }
+    fwrite(SIXEL_PALETTE_ARTIFACT_MAGIC "\001\001\020\000\001\000\000\000", 1, 16, fp);
+    fclose(fp);
+    fp = NULL;
+    status = sixel_dither_load(&loaded, "test-output.pal", NULL);
+    if (status != SIXEL_BAD_INPUT || loaded != NULL) {
+        goto error;
+    }
+
+    nret = EXIT_SUCCESS;
+
+error:
+    if (fp) {
+        fclose(fp);
+    }
+    remove("test-output.pal");
+    if (dither) {
+        sixel_allocator_free(dither->allocator, indexes1);
+        sixel_allocator_free(dither->allocator, indexes2);
+    }
+    sixel_dither_unref(loaded);
+    sixel_dither_unref(dither);
+    return nret;
+}
+
+
+/* precompute, export and import lookup cache */
+static int
+test4(void)
+{
+    int nret = EXIT_FAILURE;
+    SIXELSTATUS status;
+    sixel_dither_t *dither = NULL;
+    sixel_dither_t *cold = NULL;
+    unsigned short *cache = NULL;
+    int i;
+
+    status = sixel_dither_new(&dither, 16, NULL);
+    if (SIXEL_FAILED(status)) {
+        goto error;
+    }
+    sixel_dither_set_palette(dither, (unsigned char *)pal_vt340_color);
+    status = sixel_dither_precompute_cache(dither);
+    if (SIXEL_FAILED(status)) {
+        goto error;
+    }
+
+    cache = (unsigned short *)sixel_allocator_malloc(
+        dither->allocator, sizeof(unsigned short) * SIXEL_DITHER_CACHE_SIZE);
+    if (cache == NULL) {
+        goto error;
+    }
+    status = sixel_dither_export_cache(dither, cache);
+    if (SIXEL_FAILED(status)) {
+        goto error;
+    }
+    for (i = 0; i < SIXEL_DITHER_CACHE_SIZE; ++i) {
+        if (cache[i] < 1 || cache[i] > 16) {
+            goto error;
+        }
+    }
+
+    status = sixel_dither_new(&cold, 16, NULL);
+    if (SIXEL_FAILED(status)) {
+        goto error;
+    }
+    sixel_dither_set_palette(cold, (unsigned char *)pal_vt340_color);
+    status = sixel_dither_import_cache(cold, cache);
+    if (SIXEL_FAILED(status)) {
+        goto error;
+    }
+    if (memcmp(cold->cachetable, dither->cachetable,
+               sizeof(unsigned short) * SIXEL_DITHER_CACHE_SIZE) != 0) {
+        goto error;
+    }
+
+    /* index out of the palette must be rejected */
+    cache[100] = 17;
+    status = sixel_dither_import_cache(cold, cache);
+    if (status != SIXEL_BAD_INPUT) {
+        goto error;
+    }
+
+    /* changing palette invalidates the cache */
+    sixel_dither_set_palette(cold, (unsigned char *)pal_vt340_mono);
+    for (i = 0; i < SIXEL_DITHER_CACHE_SIZE; ++i) {
+        if (cold->cachetable[i] != 0) {
+            goto error;
+        }
+    }
+
+    nret = EXIT_SUCCESS;
+
+error:
+    if (dither) {
+        sixel_allocator_free(dither->allocator, cache);
+    }
+    sixel_dither_unref(cold);
+    sixel_dither_unref(dither);
+    return nret;
+}
+
+
+/* BGRA input must give the same palette and indexes as RGB888 input */
+static int
+test5(void)
+{
+    int nret = EXIT_FAILURE;
+    SIXELSTATUS status;
+    sixel_dither_t *dither1 = NULL;
+    sixel_dither_t *dither2 = NULL;
+    sixel_index_t *indexes1 = NULL;
+    sixel_index_t *indexes2 = NULL;
+    unsigned char rgb[24 * 16 * 3];
+    unsigned char bgra[24 * 16 * 4];
+    int i;
+
+    for (i = 0; i < 24 * 16; ++i) {
+        rgb[i * 3 + 0] = bgra[i * 4 + 2] = (unsigned char)(i * 7);
+        rgb[i * 3 + 1] = bgra[i * 4 + 1] = (unsigned char)(i * 13);
+        rgb[i * 3 + 2] = bgra[i * 4 + 0] = (unsigned char)(i * 29);
+        bgra[i * 4 + 3] = 0xff;
+    }
+
+    status = sixel_dither_new(&dither1, 16, NULL);
+    if (SIXEL_FAILED(status)) {
+        goto error;
+    }
+    status = sixel_dither_initialize(dither1, rgb, 24, 16,
+                                     SIXEL_PIXELFORMAT_RGB888,
+                                     SIXEL_LARGE_AUTO,
+                                     SIXEL_REP_AUTO,
+                                     SIXEL_QUALITY_AUTO);
+    if (SIXEL_FAILED(status)) {
+        goto error;
+    }
+    status = sixel_dither_new(&dither2, 16, NULL);
+    if (SIXEL_FAILED(status)) {
+        goto error;
+    }
+    status = sixel_dither_initialize(dither2, bgra, 24, 16,
+                                     SIXEL_PIXELFORMAT_BGRA8888,
+                                     SIXEL_LARGE_AUTO,
+                                     SIXEL_REP_AUTO,
+                                     SIXEL_QUALITY_AUTO);
+    if (SIXEL_FAILED(status)) {
+        goto error;
+    }
+    if (dither1->ncolors != dither2->ncolors) {
+        goto error;
+    }
+    if (memcmp(dither1->palette, dither2->palette,
+               (size_t)(dither1->ncolors * 3)) != 0) {
+        goto error;
+    }
+
+    sixel_dither_set_diffusion_type(dither1, SIXEL_DIFFUSE_FS);
+    sixel_dither_set_diffusion_type(dither2, SIXEL_DIFFUSE_FS);
+    indexes1 = sixel_dither_apply_palette(dither1, rgb, 24, 16);
+    indexes2 = sixel_dither_apply_palette(dither2, bgra, 24, 16);
+    if (indexes1 == NULL || indexes2 == NULL) {
+        goto error;
+    }
+    if (memcmp(indexes1, indexes2, 24 * 16 * sizeof(sixel_index_t)) != 0) {
+        goto error;
+    }
+    /* the input is used in place, so the format must be kept */
+    if (dither2->pixelformat != SIXEL_PIXELFORMAT_BGRA8888) {
+        goto error;
+    }
+
+    nret = EXIT_SUCCESS;
+
+error:
+    if (dither1) {
+        sixel_allocator_free(dither1->allocator, indexes1);
+    }
+    if (dither2) {
+        sixel_allocator_free(dither2->allocator, indexes2);
+    }
+    sixel_dither_unref(dither1);
+    sixel_dither_unref(dither2);
+    return nret;
+}
+
+
+/* diffusion must give the same indexes as on a whole image, without
+   writing errors into the caller's pixels */
+static int
+test6(void)
+{
+    int nret = EXIT_FAILURE;
+    SIXELSTATUS status;
+    sixel_dither_t *dither = NULL;
+    sixel_index_t *indexes = NULL;
+    sixel_index_t expected[64 * 32];
+    unsigned char bgra[64 * 32 * 4];
+    unsigned char copy[64 * 32 * 4];
+    unsigned char palette[SIXEL_PALETTE_MAX * 3];
+    static int const methods[] = {
+        SIXEL_DIFFUSE_FS, SIXEL_DIFFUSE_ATKINSON, SIXEL_DIFFUSE_JAJUNI,
+        SIXEL_DIFFUSE_STUCKI, SIXEL_DIFFUSE_BURKES,
+    };
+    size_t i;
+    int optimize_palette;
+    int ncolors;
+    int n;
+
+    for (n = 0; n < 64 * 32; ++n) {
+        bgra[n * 4 + 0] = (unsigned char)(n * 29);
+        bgra[n * 4 + 1] = (unsigned char)(n / 64 * 8);
+        bgra[n * 4 + 2] = (unsigned char)(n % 64 * 4);
+        bgra[n * 4 + 3] = 0xff;
+    }
+
+    for (i = 0; i < sizeof(methods) / sizeof(methods[0]); ++i) {
+        for (optimize_palette = 0; optimize_palette < 2; ++optimize_palette) {
+            status = sixel_dither_new(&dither, 16, NULL);
+            if (SIXEL_FAILED(status)) {
+                goto error;
+            }
+            status = sixel_dither_initialize(dither, bgra, 64, 32,
+                                             SIXEL_PIXELFORMAT_BGRA8888,
+                                             SIXEL_LARGE_AUTO,
+                                             SIXEL_REP_AUTO,
+                                             SIXEL_QUALITY_AUTO);
+            if (SIXEL_FAILED(status)) {
+                goto error;
+            }
+            sixel_dither_set_diffusion_type(dither, methods[i]);
+            sixel_dither_set_optimize_palette(dither, optimize_palette);
+            memcpy(palette, dither->palette, (size_t)(dither->ncolors * 3));
+            ncolors = dither->ncolors;
+            memcpy(copy, bgra, sizeof(bgra));
+
+            indexes = sixel_dither_apply_palette(dither, bgra, 64, 32);
+            if (indexes == NULL) {
+                goto error;
+            }
+            if (memcmp(copy, bgra, sizeof(bgra)) != 0) {
+                goto error;
+            }
+
+            status = sixel_quant_apply_palette(expected, copy, 64, 32, 64 * 4,
+                                               SIXEL_PIXELFORMAT_BGRA8888,
+                                               palette, ncolors, methods[i],
+                                               dither->optimized,
+                                               optimize_palette,
+                                               dither->complexion,
+                                               dither->cachetable,
+                                               &ncolors, dither->allocator);
+            if (SIXEL_FAILED(status)) {
+                goto error;
+            }
+            if (ncolors != dither->ncolors ||
+                memcmp(palette, dither->palette, (size_t)(ncolors * 3)) != 0 ||
+                memcmp(expected, indexes, sizeof(expected)) != 0) {
+                goto error;
+            }
+
+            sixel_allocator_free(dither->allocator, indexes);
+            indexes = NULL;
+            sixel_dither_unref(dither);
+            dither = NULL;
+        }
+    }
+
+    nret = EXIT_SUCCESS;
+
+error:
+    if (dither) {
+        sixel_allocator_free(dither->allocator, indexes);
+    }
     sixel_dither_unref(dither);
     return nret;
 }
@@ -892,6 +1973,10 @@ sixel_dither_tests_main(void)
     static testcase const testcases[] = {
         test1,
         test2,
+        test3,
+        test4,
+        test5,
+        test6,
     };
 
     for (i = 0; i < sizeof(testcases) / sizeof(testcase); ++i) {
@@ -43,9 +43,22 @@ struct sixel_dither {
     int quality_mode;               /* quality of histogram */
     int keycolor;                   /* background color */
     int pixelformat;                /* pixelformat for internal processing */
+    unsigned int *histogram;        /* colors collected from many images,
+                                       NULL if none is being collected */
     sixel_allocator_t *allocator;   /* allocator */
 };
 
+/*
+ * error diffusion reaches two rows below the current pixel, and wraps
+ * around to the third one at the end of a row. rows are quantized band
+ * by band in a window which also holds the rows receiving errors.
+ */
+#define SIXEL_DITHER_BAND_ROWS      6
+#define SIXEL_DITHER_LOOKAHEAD_ROWS 3
+
+/* leading bytes of palette artifacts written by sixel_dither_save() */
+#define SIXEL_PALETTE_ARTIFACT_MAGIC "SIXELPAL"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -57,6 +70,43 @@ sixel_dither_apply_palette(struct sixel_dither /* in */ *dither,
                            int                 /* in */ width,
                            int                 /* in */ height);
 
+/* apply palette to rows which are 'pitch' bytes apart */
+sixel_index_t *
+sixel_dither_apply_palette_with_pitch(struct sixel_dither /* in */ *dither,
+                                      unsigned char       /* in */ *pixels,
+                                      int                 /* in */ width,
+                                      int                 /* in */ height,
+                                      int                 /* in */ pitch);
+
+/* apply palette to the first 'rows' rows of 24bpp or 32bpp pixels */
+SIXELSTATUS
+sixel_dither_apply_palette_rows(struct sixel_dither /* in */  *dither,
+                                sixel_index_t       /* out */ *dest,
+                                unsigned char       /* in */  *pixels,
+                                int                 /* in */  pixelformat,
+                                int                 /* in */  width,
+                                int                 /* in */  height,
+                                int                 /* in */  pitch,
+                                int                 /* in */  rows,
+                                int                 /* in */  origin);
+
+/* add the colors of an image into the histogram of the dither */
+SIXELSTATUS
+sixel_dither_add_histogram(struct sixel_dither /* in */ *dither,
+                           unsigned char       /* in */ *data,
+                           int                 /* in */ width,
+                           int                 /* in */ height,
+                           int                 /* in */ pixelformat,
+                           int                 /* in */ quality_mode);
+
+/* create the palette from the colors collected by
+   sixel_dither_add_histogram() */
+SIXELSTATUS
+sixel_dither_initialize_with_histogram(
+    struct sixel_dither /* in */ *dither,
+    int                 /* in */ method_for_largest,
+    int                 /* in */ method_for_rep);
+
 #if HAVE_TESTS
 int
 sixel_frame_tests_main(void);
@@ -64,6 +64,9 @@
 #include <sixel.h>
 #include "tty.h"
 #include "encoder.h"
+#include "frame.h"
+#include "dither.h"
+#include "loader.h"
 #include "rgblookup.h"
 
 
@@ -379,6 +382,230 @@ sixel_hex_write_callback(
 }
 
 
+/* drop all entries of the frame cache */
+static void
+sixel_frame_cache_clear(
+    sixel_frame_cache_t /* in */ *cache,
+    sixel_allocator_t   /* in */ *allocator)
+{
+    sixel_frame_cache_entry_t *entry;
+
+    while ((entry = cache->head) != NULL) {
+        cache->head = entry->next;
+        sixel_allocator_free(allocator, entry->data);
+        sixel_allocator_free(allocator, entry);
+    }
+    cache->tail = NULL;
+    cache->size = 0;
+    cache->recording = 0;
+    cache->record_size = 0;
+    cache->nframes = 0;
+}
+
+
+static void
+sixel_frame_cache_unlink(
+    sixel_frame_cache_t       /* in */ *cache,
+    sixel_frame_cache_entry_t /* in */ *entry)
+{
+    if (entry->prev) {
+        entry->prev->next = entry->next;
+    } else {
+        cache->head = entry->next;
+    }
+    if (entry->next) {
+        entry->next->prev = entry->prev;
+    } else {
+        cache->tail = entry->prev;
+    }
+    entry->prev = entry->next = NULL;
+}
+
+
+static void
+sixel_frame_cache_push_front(
+    sixel_frame_cache_t       /* in */ *cache,
+    sixel_frame_cache_entry_t /* in */ *entry)
+{
+    entry->prev = NULL;
+    entry->next = cache->head;
+    if (cache->head) {
+        cache->head->prev = entry;
+    } else {
+        cache->tail = entry;
+    }
+    cache->head = entry;
+}
+
+
+/* find the encoded bytes of a frame and mark them as most recently used */
+static sixel_frame_cache_entry_t *
+sixel_frame_cache_lookup(
+    sixel_frame_cache_t /* in */ *cache,
+    int                 /* in */ frame_no,
+    int                 /* in */ width,
+    int                 /* in */ height)
+{
+    sixel_frame_cache_entry_t *entry;
+
+    for (entry = cache->head; entry != NULL; entry = entry->next) {
+        if (entry->frame_no == frame_no &&
+            entry->width == width && entry->height == height) {
+            if (entry != cache->head) {
+                sixel_frame_cache_unlink(cache, entry);
+                sixel_frame_cache_push_front(cache, entry);
+            }
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+
+/* find the encoded bytes of a frame without changing the order */
+static sixel_frame_cache_entry_t *
+sixel_frame_cache_find(
+    sixel_frame_cache_t /* in */ *cache,
+    int                 /* in */ frame_no)
+{
+    sixel_frame_cache_entry_t *entry;
+
+    for (entry = cache->head; entry != NULL; entry = entry->next) {
+        if (entry->frame_no == frame_no) {
+            break;
+        }
+    }
+
+    return entry;
+}
+
+
+/* whether every frame of the first loop is held by the cache */
+static int
+sixel_frame_cache_has_loop(sixel_frame_cache_t /* in */ *cache)
+{
+    int frame_no;
+
+    if (cache->nframes == 0) {
+        return 0;
+    }
+    for (frame_no = 0; frame_no < cache->nframes; ++frame_no) {
+        if (sixel_frame_cache_find(cache, frame_no) == NULL) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+
+/* append written bytes to the frame being recorded */
+static void
+sixel_frame_cache_append(
+    sixel_frame_cache_t /* in */ *cache,
+    char const          /* in */ *data,
+    size_t              /* in */ size,
+    sixel_allocator_t   /* in */ *allocator)
+{
+    char *record;
+    size_t capacity;
+
+    if (cache->record_size + size > cache->limit) {
+        /* this frame will never fit, give up recording it */
+        cache->recording = 0;
+        return;
+    }
+    if (cache->record_size + size > cache->record_capacity) {
+        capacity = cache->record_capacity > 0 ? cache->record_capacity: 4096;
+        while (capacity < cache->record_size + size) {
+            capacity *= 2;
+        }
+        record = (char *)sixel_allocator_realloc(allocator,
+                                                 cache->record,
+                                                 capacity);
+        if (record == NULL) {
+            cache->recording = 0;
+            return;
+        }
+        cache->record = record;
+        cache->record_capacity = capacity;
+    }
+    memcpy(cache->record + cache->record_size, data, size);
+    cache->record_size += size;
+}
+
+
+/* store the recorded frame, evicting least recently used frames */
+static void
+sixel_frame_cache_commit(
+    sixel_frame_cache_t /* in */ *cache,
+    int                 /* in */ frame_no,
+    int                 /* in */ width,
+    int                 /* in */ height,
+    int                 /* in */ encoded_height,
+    int                 /* in */ delay,
+    sixel_allocator_t   /* in */ *allocator)
+{
+    sixel_frame_cache_entry_t *entry;
+
+    if (!cache->recording || cache->record_size == 0) {
+        cache->recording = 0;
+        return;
+    }
+    cache->recording = 0;
+
+    while (cache->tail != NULL &&
+           cache->size + cache->record_size > cache->limit) {
+        entry = cache->tail;
+        sixel_frame_cache_unlink(cache, entry);
+        cache->size -= entry->size;
+        sixel_allocator_free(allocator, entry->data);
+        sixel_allocator_free(allocator, entry);
+    }
+
+    entry = (sixel_frame_cache_entry_t *)
+        sixel_allocator_malloc(allocator, sizeof(sixel_frame_cache_entry_t));
+    if (entry == NULL) {
+        return;
+    }
+    entry->data = (char *)sixel_allocator_malloc(allocator, cache->record_size);
+    if (entry->data == NULL) {
+        sixel_allocator_free(allocator, entry);
+        return;
+    }
+    memcpy(entry->data, cache->record, cache->record_size);
+    entry->size = cache->record_size;
+    entry->frame_no = frame_no;
+    entry->width = width;
+    entry->height = height;
+    entry->encoded_height = encoded_height;
+    entry->delay = delay;
+    sixel_frame_cache_push_front(cache, entry);
+    cache->size += entry->size;
+}
+
+
+/* the writer function which also records the frame for the frame cache */
+static int
+sixel_cache_write_callback(
+    char    /* in */ *data,
+    int     /* in */ size,
+    void    /* in */ *priv)
+{
+    sixel_encoder_t *encoder = (sixel_encoder_t *)priv;
+    int result;
+
+    result = sixel_write_callback(data, size, &encoder->outfd);
+    if (result > 0 && encoder->frame_cache.recording) {
+        sixel_frame_cache_append(&encoder->frame_cache, data,
+                                 (size_t)result, encoder->allocator);
+    }
+
+    return result;
+}
+
+
 /* returns monochrome dithering context object */
 static SIXELSTATUS
 sixel_prepare_monochrome_palette(
@@ -532,6 +759,30 @@ end:
 }
 
 
+/* check whether the file starts with the magic of palette artifacts */
+static int
+sixel_encoder_is_palette_artifact(char const *filename)
+{
+    FILE *fp;
+    char magic[8];
+    int result = 0;
+
+    if (strcmp(filename, "-") == 0) {
+        return 0;
+    }
+    fp = fopen(filename, "rb");
+    if (fp == NULL) {
+        return 0;
+    }
+    if (fread(magic, 1, sizeof(magic), fp) == sizeof(magic)) {
+        result = memcmp(magic, SIXEL_PALETTE_ARTIFACT_MAGIC, sizeof(magic)) == 0;
+    }
+    fclose(fp);
+
+    return result;
+}
+
+
 /* create palette from specified map file */
 static SIXELSTATUS
 sixel_prepare_specified_palette(
@@ -541,6 +792,11 @@ sixel_prepare_specified_palette(
     SIXELSTATUS status = SIXEL_FALSE;
     sixel_callback_context_for_mapfile_t callback_context;
 
+    /* palette artifact written by -M option */
+    if (sixel_encoder_is_palette_artifact(encoder->mapfile)) {
+        return sixel_dither_load(dither, encoder->mapfile, encoder->allocator);
+    }
+
     callback_context.reqcolors = encoder->reqcolors;
     callback_context.dither = NULL;
     callback_context.allocator = encoder->allocator;
@@ -669,6 +925,15 @@ sixel_encoder_prepare_palette(
         goto end;
     }
 
+    /* -G option: all frames share the palette built by the first pass */
+    if (encoder->global_dither) {
+        *dither = encoder->global_dither;
+        sixel_dither_ref(*dither);
+        sixel_dither_set_pixelformat(*dither, sixel_frame_get_pixelformat(frame));
+        status = SIXEL_OK;
+        goto end;
+    }
+
     if (encoder->dither_cache) {
         sixel_dither_unref(encoder->dither_cache);
     }
@@ -884,6 +1149,188 @@ end:
 }
 
 
+/* crop/scale a frame in the order given by -w, -h, and -c option */
+static SIXELSTATUS
+sixel_encoder_do_crop_and_scale(
+    sixel_encoder_t /* in */    *encoder,   /* encoder object */
+    sixel_frame_t   /* in */    *frame)     /* frame object to be processed */
+{
+    SIXELSTATUS status = SIXEL_FALSE;
+
+    if (encoder->clipfirst) {
+        /* clipping */
+        status = sixel_encoder_do_clip(encoder, frame);
+        if (SIXEL_FAILED(status)) {
+            goto end;
+        }
+
+        /* scaling */
+        status = sixel_encoder_do_resize(encoder, frame);
+        if (SIXEL_FAILED(status)) {
+            goto end;
+        }
+    } else {
+        /* scaling */
+        status = sixel_encoder_do_resize(encoder, frame);
+        if (SIXEL_FAILED(status)) {
+            goto end;
+        }
+
+        /* clipping */
+        status = sixel_encoder_do_clip(encoder, frame);
+        if (SIXEL_FAILED(status)) {
+            goto end;
+        }
+    }
+
+    status = SIXEL_OK;
+
+end:
+    return status;
+}
+
+
+typedef struct sixel_callback_context_for_global_palette {
+    sixel_encoder_t *encoder;   /* encoder object */
+    sixel_dither_t *dither;     /* dither which collects the histogram */
+    int nframes;                /* number of sampled direct color frames */
+} sixel_callback_context_for_global_palette_t;
+
+
+/* callback function for the first pass of -G option,
+ * adds colors of every STRIDE-th frame into one histogram */
+static SIXELSTATUS
+load_image_callback_for_global_palette(
+    sixel_frame_t   /* in */    *frame, /* frame object from image loader */
+    void            /* in */    *data)  /* private data */
+{
+    SIXELSTATUS status = SIXEL_FALSE;
+    sixel_callback_context_for_global_palette_t *callback_context;
+    sixel_encoder_t *encoder;
+    int pixelformat;
+
+    callback_context = (sixel_callback_context_for_global_palette_t *)data;
+    encoder = callback_context->encoder;
+
+    if (sixel_frame_get_frame_no(frame) % encoder->global_palette_stride != 0) {
+        /* this frame is not sampled */
+        status = SIXEL_OK;
+        goto end;
+    }
+
+    /* sample the frame in the same geometry as the second pass */
+    status = sixel_encoder_do_crop_and_scale(encoder, frame);
+    if (SIXEL_FAILED(status)) {
+        goto end;
+    }
+
+    /* paletted and grayscale frames do not use the shared palette */
+    pixelformat = sixel_frame_get_pixelformat(frame);
+    if (pixelformat & (SIXEL_FORMATTYPE_PALETTE | SIXEL_FORMATTYPE_GRAYSCALE)) {
+        status = SIXEL_OK;
+        goto end;
+    }
+
+    /* the histogram has a fixed size, however long the animation is */
+    status = sixel_dither_add_histogram(callback_context->dither,
+                                        sixel_frame_get_pixels(frame),
+                                        sixel_frame_get_width(frame),
+                                        sixel_frame_get_height(frame),
+                                        pixelformat,
+                                        encoder->quality_mode);
+    if (SIXEL_FAILED(status)) {
+        goto end;
+    }
+    ++callback_context->nframes;
+
+    status = SIXEL_OK;
+
+end:
+    return status;
+}
+
+
+/* the first pass of -G option: build one palette from the histogram of
+ * the sampled frames, it is shared by all frames of the second pass */
+static SIXELSTATUS
+sixel_encoder_prepare_global_palette(
+    sixel_encoder_t /* in */    *encoder,   /* encoder object */
+    char const      /* in */    *filename)  /* input filename */
+{
+    SIXELSTATUS status = SIXEL_FALSE;
+    sixel_callback_context_for_global_palette_t callback_context;
+    sixel_dither_t *dither = NULL;
+    int histogram_colors;
+
+    sixel_dither_unref(encoder->global_dither);
+    encoder->global_dither = NULL;
+
+    status = sixel_dither_new(&dither, encoder->reqcolors, encoder->allocator);
+    if (SIXEL_FAILED(status)) {
+        dither = NULL;
+        goto end;
+    }
+
+    callback_context.encoder = encoder;
+    callback_context.dither = dither;
+    callback_context.nframes = 0;
+
+    status = sixel_helper_load_image_file(filename,
+                                          encoder->fstatic,
+                                          0,   /* fuse_palette */
+                                          encoder->reqcolors,
+                                          encoder->bgcolor,
+                                          SIXEL_LOOP_DISABLE,
+                                          load_image_callback_for_global_palette,
+                                          encoder->finsecure,
+                                          encoder->cancel_flag,
+                                          &callback_context,
+                                          encoder->allocator);
+    if (status != SIXEL_OK) {
+        goto end;
+    }
+
+    if (callback_context.nframes == 0) {
+        /* no direct color frame, each frame uses its own palette */
+        status = SIXEL_OK;
+        goto end;
+    }
+
+    status = sixel_dither_initialize_with_histogram(dither,
+                                                    encoder->method_for_largest,
+                                                    encoder->method_for_rep);
+    if (SIXEL_FAILED(status)) {
+        goto end;
+    }
+
+    histogram_colors = sixel_dither_get_num_of_histogram_colors(dither);
+    if (histogram_colors <= encoder->reqcolors) {
+        encoder->method_for_diffuse = SIXEL_DIFFUSE_NONE;
+    }
+
+    /* all frames share the lookup cache, so build it at once */
+    if (encoder->quality_mode != SIXEL_QUALITY_FULL) {
+        if (encoder->complexion > 1) {
+            sixel_dither_set_complexion_score(dither, encoder->complexion);
+        }
+        status = sixel_dither_precompute_cache(dither);
+        if (SIXEL_FAILED(status)) {
+            goto end;
+        }
+    }
+
+    encoder->global_dither = dither;
+    dither = NULL;
+
+    status = SIXEL_OK;
+
+end:
+    sixel_dither_unref(dither);
+
+    return status;
+}
+
+
 static void
 sixel_debug_print_palette(
     sixel_dither_t /* in */ *dither /* dithering object */
@@ -903,6 +1350,28 @@ sixel_debug_print_palette(
 }
 
 
+/* rows of a frame passed to sixel_encode_scanlines() */
+typedef struct sixel_encoder_scanline_source {
+    unsigned char *pixels;
+    size_t pitch;
+} sixel_encoder_scanline_source_t;
+
+
+static SIXELSTATUS
+sixel_encoder_read_scanline(
+    unsigned char   /* out */    **row,
+    int             /* in */     y,
+    void            /* in/out */ *priv)
+{
+    sixel_encoder_scanline_source_t *source;
+
+    source = (sixel_encoder_scanline_source_t *)priv;
+    *row = source->pixels + (size_t)y * source->pitch;
+
+    return SIXEL_OK;
+}
+
+
 static SIXELSTATUS
 sixel_encoder_output_without_macro(
     sixel_frame_t       /* in */ *frame,
@@ -911,7 +1380,6 @@ sixel_encoder_output_without_macro(
     sixel_encoder_t     /* in */ *encoder)
 {
     SIXELSTATUS status = SIXEL_OK;
-    static unsigned char *p;
     int depth;
     enum { message_buffer_size = 256 };
     char message[message_buffer_size];
@@ -932,6 +1400,7 @@ sixel_encoder_output_without_macro(
     int height;
     int pixelformat;
     size_t size;
+    sixel_encoder_scanline_source_t source;
 
     if (encoder == NULL) {
         sixel_helper_set_additional_message(
@@ -940,7 +1409,12 @@ sixel_encoder_output_without_macro(
         goto end;
     }
 
-    if (encoder->color_option == SIXEL_COLOR_OPTION_DEFAULT) {
+    /* the shared palette of -G option must keep its color order because
+       its lookup cache is reused by the following frames, and so does
+       the palette saved by -M option */
+    if (encoder->color_option == SIXEL_COLOR_OPTION_DEFAULT
+        && encoder->global_dither == NULL
+        && encoder->palette_output == NULL) {
         sixel_dither_set_optimize_palette(dither, 1);
     }
 
@@ -975,13 +1449,6 @@ sixel_encoder_output_without_macro(
         }
         goto end;
     }
-    p = (unsigned char *)sixel_allocator_malloc(encoder->allocator, size);
-    if (p == NULL) {
-        sixel_helper_set_additional_message(
-            "sixel_encoder_output_without_macro: sixel_allocator_malloc() failed.");
-        status = SIXEL_BAD_ALLOCATION;
-        goto end;
-    }
 #if HAVE_NANOSLEEP && HAVE_CLOCK
     start = clock();
 #endif
@@ -1013,20 +1480,22 @@ sixel_encoder_output_without_macro(
 #endif
 
     pixbuf = sixel_frame_get_pixels(frame);
-    memcpy(p, pixbuf, size);
 
     if (encoder->cancel_flag && *encoder->cancel_flag) {
         goto end;
     }
 
-    status = sixel_encode(p, width, height, depth, dither, output);
+    /* stream the frame band by band, rows are copied as they are needed
+       and the frame itself is left unmodified */
+    source.pixels = pixbuf;
+    source.pitch = size / (size_t)height;
+    status = sixel_encode_scanlines(sixel_encoder_read_scanline, &source,
+                                    width, height, dither, output);
     if (status != SIXEL_OK) {
         goto end;
     }
 
 end:
-    sixel_allocator_free(encoder->allocator, p);
-
     return status;
 }
 
@@ -1145,45 +1614,156 @@ end:
 }
 
 
+/* write the bytes of a frame encoded by the first loop of an animation */
 static SIXELSTATUS
-sixel_encoder_encode_frame(
-    sixel_encoder_t *encoder,
-    sixel_frame_t   *frame,
-    sixel_output_t  *output)
+sixel_encoder_replay_frame(
+    sixel_encoder_t             /* in */ *encoder,
+    sixel_frame_cache_entry_t   /* in */ *entry)
 {
-    SIXELSTATUS status = SIXEL_FALSE;
-    sixel_dither_t *dither = NULL;
-    int height;
-    int is_animation = 0;
+    SIXELSTATUS status = SIXEL_OK;
+    size_t offset;
+    int chunk;
     int nwrite;
+#if HAVE_NANOSLEEP
+    int delay;
+    long long target_usec;
+    struct timespec tv;
+#endif
 
-    /* evaluate -w, -h, and -c option: crop/scale input source */
-    if (encoder->clipfirst) {
-        /* clipping */
-        status = sixel_encoder_do_clip(encoder, frame);
-        if (SIXEL_FAILED(status)) {
-            goto end;
-        }
-
-        /* scaling */
-        status = sixel_encoder_do_resize(encoder, frame);
-        if (SIXEL_FAILED(status)) {
+    (void) sixel_tty_scroll(sixel_write_callback, encoder->outfd,
+                            entry->encoded_height, 1);
+
+#if HAVE_NANOSLEEP
+    delay = entry->delay;
+    if (delay > 0 && !encoder->fignore_delay) {
+        target_usec = 10000LL * (long long)delay;
+        tv.tv_sec = (time_t)(target_usec / 1000000LL);
+        tv.tv_nsec = (long)((target_usec % 1000000LL) * 1000LL);
+        nanosleep(&tv, NULL);
+    }
+#endif
+
+    if (encoder->cancel_flag && *encoder->cancel_flag) {
+        status = SIXEL_INTERRUPTED;
+        goto end;
+    }
+
+    for (offset = 0; offset < entry->size; offset += (size_t)nwrite) {
+        chunk = entry->size - offset > INT_MAX ?
+            INT_MAX: (int)(entry->size - offset);
+        nwrite = sixel_write_callback(entry->data + offset, chunk,
+                                      &encoder->outfd);
+        if (nwrite < 0) {
+            status = (SIXEL_LIBC_ERROR | (errno & 0xff));
+            sixel_helper_set_additional_message(
+                "sixel_encoder_replay_frame: sixel_write_callback() failed.");
             goto end;
         }
-    } else {
-        /* scaling */
-        status = sixel_encoder_do_resize(encoder, frame);
-        if (SIXEL_FAILED(status)) {
-            goto end;
+    }
+
+end:
+    return status;
+}
+
+
+/*
+ * play the loops from "loop_no" of an animation whose first loop is
+ * cached, "loops" is 0 for endless ones. the loader does not have to
+ * decode these loops, so it is told to stop.
+ */
+static SIXELSTATUS
+sixel_encoder_replay_loops(
+    sixel_encoder_t     /* in */ *encoder,
+    int                 /* in */ loop_no,
+    int                 /* in */ loops)
+{
+    SIXELSTATUS status = SIXEL_FALSE;
+    sixel_frame_cache_entry_t *entry;
+    int frame_no;
+
+    for (; loops == 0 || loop_no < loops; ++loop_no) {
+        for (frame_no = 0; frame_no < encoder->frame_cache.nframes; ++frame_no) {
+            entry = sixel_frame_cache_find(&encoder->frame_cache, frame_no);
+            if (entry == NULL) {
+                sixel_helper_set_additional_message(
+                    "sixel_encoder_replay_loops: a cached frame is lost.");
+                status = SIXEL_LOGIC_ERROR;
+                goto end;
+            }
+            status = sixel_encoder_replay_frame(encoder, entry);
+            if (status != SIXEL_OK) {
+                goto end;
+            }
+            encoder->frame_cache.hits++;
         }
+    }
 
-        /* clipping */
-        status = sixel_encoder_do_clip(encoder, frame);
-        if (SIXEL_FAILED(status)) {
+    status = SIXEL_LOOPS_REPLAYED;
+
+end:
+    return status;
+}
+
+
+static SIXELSTATUS
+sixel_encoder_encode_frame(
+    sixel_encoder_t *encoder,
+    sixel_frame_t   *frame,
+    sixel_output_t  *output)
+{
+    SIXELSTATUS status = SIXEL_FALSE;
+    sixel_dither_t *dither = NULL;
+    sixel_frame_cache_entry_t *entry;
+    int height;
+    int is_animation = 0;
+    int nwrite;
+    int use_frame_cache;
+    int frame_no = 0;
+    int source_width = 0;
+    int source_height = 0;
+
+    /* the following loops of an animation replay the bytes encoded by
+       the first one, -u and -n options replay the frames with macros */
+    use_frame_cache = output == NULL
+        && encoder->frame_cache.limit > 0
+        && !encoder->fuse_macro
+        && encoder->macro_number < 0
+        && sixel_frame_get_multiframe(frame)
+        && !encoder->fstatic;
+    if (use_frame_cache) {
+        frame_no = sixel_frame_get_frame_no(frame);
+        source_width = sixel_frame_get_width(frame);
+        source_height = sixel_frame_get_height(frame);
+        if (sixel_frame_get_loop_no(frame) == 0) {
+            if (frame_no >= encoder->frame_cache.nframes) {
+                encoder->frame_cache.nframes = frame_no + 1;
+            }
+        } else if (frame_no == 0 && frame->loops >= 0 &&
+                   sixel_frame_cache_has_loop(&encoder->frame_cache)) {
+            /* the loader knows how many loops follow, play them all */
+            status = sixel_encoder_replay_loops(encoder,
+                                                sixel_frame_get_loop_no(frame),
+                                                frame->loops);
             goto end;
+        } else {
+            entry = sixel_frame_cache_lookup(&encoder->frame_cache, frame_no,
+                                             source_width, source_height);
+            if (entry != NULL) {
+                status = sixel_encoder_replay_frame(encoder, entry);
+                if (status == SIXEL_OK) {
+                    encoder->frame_cache.hits++;
+                }
+                goto end;
+            }
         }
     }
 
+    /* evaluate -w, -h, and -c option: crop/scale input source */
+    status = sixel_encoder_do_crop_and_scale(encoder, frame);
+    if (SIXEL_FAILED(status)) {
+        goto end;
+    }
+
     /* prepare dither context */
     status = sixel_encoder_prepare_palette(encoder, frame, &dither);
     if (status != SIXEL_OK) {
@@ -1221,6 +1801,11 @@ sixel_encoder_encode_frame(
                                       sixel_hex_write_callback,
                                       &encoder->outfd,
                                       encoder->allocator);
+        } else if (use_frame_cache) {
+            status = sixel_output_new(&output,
+                                      sixel_cache_write_callback,
+                                      encoder,
+                                      encoder->allocator);
         } else {
             status = sixel_output_new(&output,
                                       sixel_write_callback,
@@ -1252,6 +1837,20 @@ sixel_encoder_encode_frame(
         goto end;
     }
 
+    /* evaluate -M option: the saved lookup cache should be complete */
+    if (encoder->palette_output && !encoder->fpalette_saved
+        && encoder->quality_mode != SIXEL_QUALITY_FULL) {
+        status = sixel_dither_precompute_cache(dither);
+        if (SIXEL_FAILED(status)) {
+            goto end;
+        }
+    }
+
+    if (use_frame_cache) {
+        encoder->frame_cache.record_size = 0;
+        encoder->frame_cache.recording = 1;
+    }
+
     /* output sixel: junction of multi-frame processing strategy */
     if (encoder->fuse_macro) {  /* -u option */
         /* use macro */
@@ -1279,7 +1878,25 @@ sixel_encoder_encode_frame(
         goto end;
     }
 
+    if (use_frame_cache && status == SIXEL_OK) {
+        sixel_frame_cache_commit(&encoder->frame_cache, frame_no,
+                                 source_width, source_height,
+                                 sixel_frame_get_height(frame),
+                                 sixel_frame_get_delay(frame),
+                                 encoder->allocator);
+    }
+
+    /* evaluate -M option: save the palette of the first frame */
+    if (encoder->palette_output && !encoder->fpalette_saved) {
+        status = sixel_dither_save(dither, encoder->palette_output);
+        if (SIXEL_FAILED(status)) {
+            goto end;
+        }
+        encoder->fpalette_saved = 1;
+    }
+
 end:
+    encoder->frame_cache.recording = 0;
     if (output) {
         sixel_output_unref(output);
     }
@@ -1301,7 +1918,9 @@ sixel_encoder_new(
     SIXELSTATUS status = SIXEL_FALSE;
     char const *env_default_bgcolor;
     char const *env_default_ncolors;
+    char const *env_frame_cache_size;
     int ncolors;
+    int frame_cache_size;
 
     if (allocator == NULL) {
         status = sixel_allocator_new(&allocator, NULL, NULL, NULL, NULL);
@@ -1361,6 +1980,12 @@ sixel_encoder_new(
     (*ppencoder)->finsecure             = 0;
     (*ppencoder)->cancel_flag           = NULL;
     (*ppencoder)->dither_cache          = NULL;
+    (*ppencoder)->global_palette_stride = 0;
+    (*ppencoder)->global_dither         = NULL;
+    (*ppencoder)->palette_output        = NULL;
+    (*ppencoder)->fpalette_saved        = 0;
+    memset(&(*ppencoder)->frame_cache, 0, sizeof(sixel_frame_cache_t));
+    (*ppencoder)->frame_cache.limit     = SIXEL_FRAME_CACHE_LIMIT;
     (*ppencoder)->allocator             = allocator;
 
     /* evaluate environment variable ${SIXEL_BGCOLOR} */
@@ -1383,6 +2008,15 @@ sixel_encoder_new(
         }
     }
 
+    /* evaluate environment variable ${SIXEL_FRAME_CACHE_SIZE} */
+    env_frame_cache_size = getenv("SIXEL_FRAME_CACHE_SIZE");
+    if (env_frame_cache_size) {
+        frame_cache_size = atoi(env_frame_cache_size); /* may overflow */
+        if (frame_cache_size >= 0) {
+            (*ppencoder)->frame_cache.limit = (size_t)frame_cache_size;
+        }
+    }
+
     /* success */
     status = SIXEL_OK;
 
@@ -1423,8 +2057,12 @@ sixel_encoder_destroy(sixel_encoder_t *encoder)
     if (encoder) {
         allocator = encoder->allocator;
         sixel_allocator_free(allocator, encoder->mapfile);
+        sixel_allocator_free(allocator, encoder->palette_output);
         sixel_allocator_free(allocator, encoder->bgcolor);
         sixel_dither_unref(encoder->dither_cache);
+        sixel_dither_unref(encoder->global_dither);
+        sixel_frame_cache_clear(&encoder->frame_cache, allocator);
+        sixel_allocator_free(allocator, encoder->frame_cache.record);
         if (encoder->outfd
             && encoder->outfd != STDOUT_FILENO
             && encoder->outfd != STDERR_FILENO) {
@@ -1482,6 +2120,8 @@ sixel_encoder_setopt(
     int number;
     int parsed;
     char unit[32];
+    char name[32];
+    char const *modifier;
 
     sixel_encoder_ref(encoder);
 
@@ -1527,6 +2167,19 @@ sixel_encoder_setopt(
         }
         encoder->color_option = SIXEL_COLOR_OPTION_MAPFILE;
         break;
+    case SIXEL_OPTFLAG_SAVE_PALETTE:  /* M */
+        if (encoder->palette_output) {
+            sixel_allocator_free(encoder->allocator, encoder->palette_output);
+        }
+        encoder->palette_output = arg_strdup(value, encoder->allocator);
+        if (encoder->palette_output == NULL) {
+            sixel_helper_set_additional_message(
+                "sixel_encoder_setopt: sixel_allocator_malloc() failed.");
+            status = SIXEL_BAD_ALLOCATION;
+            goto end;
+        }
+        encoder->fpalette_saved = 0;
+        break;
     case SIXEL_OPTFLAG_MONOCHROME:  /* e */
         encoder->color_option = SIXEL_COLOR_OPTION_MONOCHROME;
         break;
@@ -1578,6 +2231,10 @@ sixel_encoder_setopt(
             encoder->method_for_diffuse = SIXEL_DIFFUSE_A_DITHER;
         } else if (strcmp(value, "x_dither") == 0) {
             encoder->method_for_diffuse = SIXEL_DIFFUSE_X_DITHER;
+        } else if (strcmp(value, "bayer") == 0) {
+            encoder->method_for_diffuse = SIXEL_DIFFUSE_BAYER;
+        } else if (strcmp(value, "bluenoise") == 0) {
+            encoder->method_for_diffuse = SIXEL_DIFFUSE_BLUENOISE;
         } else {
             sixel_helper_set_additional_message(
                 "specified diffusion method is not supported.");
@@ -1681,7 +2338,20 @@ sixel_encoder_setopt(
         }
         break;
     case SIXEL_OPTFLAG_RESAMPLING:  /* r */
-        /* parse --resampling option */
+        /* parse --resampling option, "FILTER[:linear]" */
+        modifier = strchr(value, ':');
+        if (modifier == NULL) {
+            modifier = value + strlen(value);
+        }
+        if ((size_t)(modifier - value) >= sizeof(name)) {
+            sixel_helper_set_additional_message(
+                "specified desampling method is not supported.");
+            status = SIXEL_BAD_ARGUMENT;
+            goto end;
+        }
+        memcpy(name, value, (size_t)(modifier - value));
+        name[modifier - value] = '\0';
+        value = name;
         if (strcmp(value, "nearest") == 0) {
             encoder->method_for_resampling = SIXEL_RES_NEAREST;
         } else if (strcmp(value, "gaussian") == 0) {
@@ -1708,6 +2378,15 @@ sixel_encoder_setopt(
             status = SIXEL_BAD_ARGUMENT;
             goto end;
         }
+        if (strcmp(modifier, ":linear") == 0) {
+            /* blend samples in linear light instead of sRGB */
+            encoder->method_for_resampling |= SIXEL_RES_LINEAR_LIGHT;
+        } else if (*modifier != '\0') {
+            sixel_helper_set_additional_message(
+                "cannot parse resampling modifier.");
+            status = SIXEL_BAD_ARGUMENT;
+            goto end;
+        }
         break;
     case SIXEL_OPTFLAG_QUALITY:  /* q */
         /* parse --quality option */
@@ -1797,6 +2476,15 @@ sixel_encoder_setopt(
     case SIXEL_OPTFLAG_STATIC:  /* S */
         encoder->fstatic = 1;
         break;
+    case SIXEL_OPTFLAG_GLOBAL_PALETTE:  /* G */
+        encoder->global_palette_stride = atoi(value);
+        if (encoder->global_palette_stride < 1) {
+            sixel_helper_set_additional_message(
+                "global-palette stride must be 1 or more.");
+            status = SIXEL_BAD_ARGUMENT;
+            goto end;
+        }
+        break;
     case SIXEL_OPTFLAG_PENETRATE:  /* P */
         encoder->penetrate_multiplexer = 1;
         break;
@@ -1863,6 +2551,15 @@ sixel_encoder_setopt(
         }
     }
 
+    /* high color mode(-I) has no palette to be saved(-M) */
+    if (encoder->palette_output
+        && encoder->color_option == SIXEL_COLOR_OPTION_HIGHCOLOR) {
+        sixel_helper_set_additional_message(
+            "option -M, --save-palette conflicts with -I, --high-color.");
+        status = SIXEL_BAD_ARGUMENT;
+        goto end;
+    }
+
     /* 8bit output option(-8) conflicts width GNU Screen integration(-P) */
     if (encoder->f8bit && encoder->penetrate_multiplexer) {
         sixel_helper_set_additional_message(
@@ -1898,6 +2595,8 @@ sixel_encoder_encode(
 {
     SIXELSTATUS status = SIXEL_FALSE;
     int fuse_palette = 1;
+    int reqwidth;
+    int reqheight;
 
     if (encoder == NULL) {
 #if HAVE_DIAGNOSTIC_DEPRECATED_DECLARATIONS
@@ -1949,17 +2648,43 @@ sixel_encoder_encode(
     }
 
 reload:
-    status = sixel_helper_load_image_file(filename,
-                                          encoder->fstatic,
-                                          fuse_palette,
-                                          encoder->reqcolors,
-                                          encoder->bgcolor,
-                                          encoder->loop_mode,
-                                          load_image_callback,
-                                          encoder->finsecure,
-                                          encoder->cancel_flag,
-                                          (void *)encoder,
-                                          encoder->allocator);
+    /* frames of the previous image must not be replayed */
+    sixel_frame_cache_clear(&encoder->frame_cache, encoder->allocator);
+
+    /* evaluate -G option: the first pass builds the shared palette,
+       stdin can not be read twice */
+    if (encoder->global_palette_stride > 0 &&
+        encoder->color_option == SIXEL_COLOR_OPTION_DEFAULT &&
+        filename != NULL && strcmp(filename, "-") != 0) {
+        status = sixel_encoder_prepare_global_palette(encoder, filename);
+        if (status != SIXEL_OK) {
+            goto end;
+        }
+        fuse_palette = 0;
+    }
+
+    /* let the loader decode at a reduced size if the target size does
+       not depend on the source size */
+    reqwidth = reqheight = 0;
+    if (encoder->percentwidth <= 0 && encoder->percentheight <= 0 &&
+        !encoder->clipfirst) {
+        reqwidth = encoder->pixelwidth > 0 ? encoder->pixelwidth: 0;
+        reqheight = encoder->pixelheight > 0 ? encoder->pixelheight: 0;
+    }
+
+    status = sixel_loader_load_file(filename,
+                                    encoder->fstatic,
+                                    fuse_palette,
+                                    encoder->reqcolors,
+                                    encoder->bgcolor,
+                                    encoder->loop_mode,
+                                    load_image_callback,
+                                    encoder->finsecure,
+                                    encoder->cancel_flag,
+                                    (void *)encoder,
+                                    reqwidth,
+                                    reqheight,
+                                    encoder->allocator);
     if (status != SIXEL_OK) {
         goto end;
     }
@@ -2336,6 +3061,1042 @@ error:
 }
 
 
+static int
+test7(void)
+{
+    int nret = EXIT_FAILURE;
+    sixel_encoder_t *encoder = NULL;
+    sixel_dither_t *dither;
+    SIXELSTATUS status;
+
+    status = sixel_encoder_new(&encoder, NULL);
+    if (SIXEL_FAILED(status)) {
+        goto error;
+    }
+
+    status = sixel_encoder_setopt(encoder,
+                                  SIXEL_OPTFLAG_GLOBAL_PALETTE,
+                                  "0");
+    if (status != SIXEL_BAD_ARGUMENT) {
+        goto error;
+    }
+
+    status = sixel_encoder_setopt(encoder,
+                                  SIXEL_OPTFLAG_GLOBAL_PALETTE,
+                                  "2");
+    if (SIXEL_FAILED(status)) {
+        goto error;
+    }
+    encoder->reqcolors = 16;
+
+    status = sixel_encoder_prepare_global_palette(encoder,
+                                                  "../images/seq2gif.gif");
+    if (SIXEL_FAILED(status)) {
+        goto error;
+    }
+    dither = encoder->global_dither;
+    if (dither == NULL) {
+        goto error;
+    }
+    if (sixel_dither_get_num_of_palette_colors(dither) > 16) {
+        goto error;
+    }
+
+    nret = EXIT_SUCCESS;
+
+error:
+    sixel_encoder_unref(encoder);
+    return nret;
+}
+
+
+/* collects sixel output of test8 */
+typedef struct test8_capture {
+    char *data;
+    size_t size;
+    size_t capacity;
+} test8_capture_t;
+
+
+static int
+test8_write(char *data, int size, void *priv)
+{
+    test8_capture_t *capture = (test8_capture_t *)priv;
+    char *grown;
+
+    if (capture->size + (size_t)size > capture->capacity) {
+        capture->capacity = (capture->size + (size_t)size) * 2;
+        grown = (char *)realloc(capture->data, capture->capacity);
+        if (grown == NULL) {
+            return (-1);
+        }
+        capture->data = grown;
+    }
+    memcpy(capture->data + capture->size, data, (size_t)size);
+    capture->size += (size_t)size;
+
+    return size;
+}
+
+
+/* encode a packed copy, or the rectangle in place, and keep the output */
+static SIXELSTATUS
+test8_encode(test8_capture_t *capture, sixel_dither_t *dither,
+             int pixelformat, unsigned char *pixels, int stride,
+             int x, int y, int width, int height)
+{
+    SIXELSTATUS status;
+    sixel_output_t *output = NULL;
+
+    capture->size = 0;
+    status = sixel_output_new(&output, test8_write, capture, NULL);
+    if (SIXEL_FAILED(status)) {
+        return status;
+    }
+    /* normalization may replace the pixelformat of the dither */
+    sixel_dither_set_pixelformat(dither, pixelformat);
+    if (stride == 0) {
+        status = sixel_encode(pixels, width, height, 0, dither, output);
+    } else {
+        status = sixel_encode_rect(pixels, stride, x, y, width, height,
+                                   dither, output);
+    }
+    sixel_output_unref(output);
+
+    return status;
+}
+
+
+/* a rectangle of a padded buffer must encode like a packed copy of it */
+static int
+test8(void)
+{
+    int nret = EXIT_FAILURE;
+    SIXELSTATUS status;
+    enum { buffer_width = 61, buffer_height = 23, padding = 13 };
+    enum { rect_x = 6, rect_y = 5, rect_width = 37, rect_height = 14 };
+    static struct {
+        int pixelformat;
+        int quality;
+        int diffuse;
+    } const cases[] = {
+        { SIXEL_PIXELFORMAT_RGB888,   SIXEL_QUALITY_AUTO,      SIXEL_DIFFUSE_FS },
+        { SIXEL_PIXELFORMAT_BGRA8888, SIXEL_QUALITY_AUTO,      SIXEL_DIFFUSE_JAJUNI },
+        { SIXEL_PIXELFORMAT_BGRA8888, SIXEL_QUALITY_AUTO,      SIXEL_DIFFUSE_ATKINSON },
+        { SIXEL_PIXELFORMAT_RGB565,   SIXEL_QUALITY_AUTO,      SIXEL_DIFFUSE_BURKES },
+        { SIXEL_PIXELFORMAT_RGB888,   SIXEL_QUALITY_HIGHCOLOR, SIXEL_DIFFUSE_FS },
+        { SIXEL_PIXELFORMAT_PAL8,     SIXEL_QUALITY_AUTO,      SIXEL_DIFFUSE_NONE },
+        { SIXEL_PIXELFORMAT_G4,       SIXEL_QUALITY_AUTO,      SIXEL_DIFFUSE_NONE },
+    };
+    unsigned char *buffer = NULL;
+    unsigned char *original = NULL;
+    unsigned char *packed = NULL;
+    sixel_dither_t *dither = NULL;
+    test8_capture_t expected = { NULL, 0, 0 };
+    test8_capture_t actual = { NULL, 0, 0 };
+    size_t buffer_size;
+    size_t i;
+    int stride;
+    int row_bytes;
+    int offset;
+    int bits;
+    int row;
+
+    buffer_size = (size_t)(buffer_width * 4 + padding) * buffer_height;
+    buffer = (unsigned char *)malloc(buffer_size);
+    original = (unsigned char *)malloc(buffer_size);
+    packed = (unsigned char *)malloc(buffer_size);
+    if (buffer == NULL || original == NULL || packed == NULL) {
+        goto error;
+    }
+    for (i = 0; i < buffer_size; ++i) {
+        original[i] = (unsigned char)((i * 2654435761u) >> 13);
+    }
+
+    for (i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+        bits = cases[i].pixelformat == SIXEL_PIXELFORMAT_G4 ? 4:
+               sixel_helper_compute_depth(cases[i].pixelformat) * 8;
+        stride = (buffer_width * bits + 7) / 8 + padding;
+        offset = rect_x * bits / 8;
+        row_bytes = (rect_width * bits + 7) / 8;
+        for (row = 0; row < rect_height; ++row) {
+            memcpy(packed + row * row_bytes,
+                   original + (rect_y + row) * stride + offset,
+                   (size_t)row_bytes);
+        }
+
+        if (cases[i].pixelformat == SIXEL_PIXELFORMAT_PAL8) {
+            status = sixel_dither_new(&dither, 256, NULL);
+            if (SIXEL_FAILED(status)) {
+                goto error;
+            }
+            sixel_dither_set_palette(dither, original);
+        } else if (cases[i].pixelformat == SIXEL_PIXELFORMAT_G4) {
+            dither = sixel_dither_get(SIXEL_BUILTIN_G4);
+            if (dither == NULL) {
+                goto error;
+            }
+        } else if (cases[i].quality == SIXEL_QUALITY_HIGHCOLOR) {
+            /* high color mode fills a palette of its own size */
+            status = sixel_dither_new(&dither, (-1), NULL);
+            if (SIXEL_FAILED(status)) {
+                goto error;
+            }
+        } else {
+            status = sixel_dither_new(&dither, 64, NULL);
+            if (SIXEL_FAILED(status)) {
+                goto error;
+            }
+            status = sixel_dither_initialize(dither, packed,
+                                             rect_width, rect_height,
+                                             cases[i].pixelformat,
+                                             SIXEL_LARGE_AUTO,
+                                             SIXEL_REP_AUTO,
+                                             cases[i].quality);
+            if (SIXEL_FAILED(status)) {
+                goto error;
+            }
+            sixel_dither_set_diffusion_type(dither, cases[i].diffuse);
+        }
+
+        status = test8_encode(&expected, dither, cases[i].pixelformat,
+                              packed, 0, 0, 0, rect_width, rect_height);
+        if (SIXEL_FAILED(status)) {
+            goto error;
+        }
+        memcpy(buffer, original, buffer_size);
+        status = test8_encode(&actual, dither, cases[i].pixelformat,
+                              buffer, stride, rect_x, rect_y,
+                              rect_width, rect_height);
+        if (SIXEL_FAILED(status)) {
+            goto error;
+        }
+        if (expected.size != actual.size ||
+            memcmp(expected.data, actual.data, expected.size) != 0) {
+            goto error;
+        }
+
+        /* the buffers are only read, error diffusion works on copies */
+        if (memcmp(buffer, original, buffer_size) != 0) {
+            goto error;
+        }
+        for (row = 0; row < rect_height; ++row) {
+            if (memcmp(packed + row * row_bytes,
+                       original + (rect_y + row) * stride + offset,
+                       (size_t)row_bytes) != 0) {
+                goto error;
+            }
+        }
+
+        sixel_dither_unref(dither);
+        dither = NULL;
+    }
+
+    /* 4bpp rectangles have to start on a byte boundary */
+    dither = sixel_dither_get(SIXEL_BUILTIN_G4);
+    if (dither == NULL) {
+        goto error;
+    }
+    status = test8_encode(&actual, dither, SIXEL_PIXELFORMAT_G4,
+                          buffer, 40, 3, 0, 8, 8);
+    if (status != SIXEL_BAD_INPUT) {
+        goto error;
+    }
+    /* the rectangle must fit in the stride */
+    status = test8_encode(&actual, dither, SIXEL_PIXELFORMAT_G4,
+                          buffer, 4, 2, 0, 8, 8);
+    if (status != SIXEL_BAD_INPUT) {
+        goto error;
+    }
+
+    nret = EXIT_SUCCESS;
+
+error:
+    sixel_dither_unref(dither);
+    free(expected.data);
+    free(actual.data);
+    free(buffer);
+    free(original);
+    free(packed);
+    return nret;
+}
+
+
+/* rows of test9, which have to be requested in order */
+typedef struct test9_source {
+    unsigned char *pixels;
+    int pitch;
+    int next;
+} test9_source_t;
+
+
+static SIXELSTATUS
+test9_scanline(unsigned char **row, int y, void *priv)
+{
+    test9_source_t *source = (test9_source_t *)priv;
+
+    if (y != source->next) {
+        return SIXEL_BAD_INPUT;
+    }
+    ++source->next;
+    *row = source->pixels + y * source->pitch;
+
+    return SIXEL_OK;
+}
+
+
+/* streamed rows must encode like the whole image */
+static int
+test9(void)
+{
+    int nret = EXIT_FAILURE;
+    SIXELSTATUS status;
+    enum { width = 29, max_height = 20 };
+    static int const heights[] = { 1, 5, 6, 11, 13, 20 };
+    static struct {
+        int pixelformat;
+        int quality;
+        int diffuse;
+    } const cases[] = {
+        { SIXEL_PIXELFORMAT_RGB888,   SIXEL_QUALITY_AUTO,      SIXEL_DIFFUSE_FS },
+        { SIXEL_PIXELFORMAT_RGB888,   SIXEL_QUALITY_AUTO,      SIXEL_DIFFUSE_ATKINSON },
+        { SIXEL_PIXELFORMAT_RGB888,   SIXEL_QUALITY_AUTO,      SIXEL_DIFFUSE_JAJUNI },
+        { SIXEL_PIXELFORMAT_BGRA8888, SIXEL_QUALITY_AUTO,      SIXEL_DIFFUSE_STUCKI },
+        { SIXEL_PIXELFORMAT_RGB565,   SIXEL_QUALITY_AUTO,      SIXEL_DIFFUSE_BURKES },
+        { SIXEL_PIXELFORMAT_RGB888,   SIXEL_QUALITY_FULL,      SIXEL_DIFFUSE_BAYER },
+        { SIXEL_PIXELFORMAT_RGB888,   SIXEL_QUALITY_AUTO,      SIXEL_DIFFUSE_A_DITHER },
+        { SIXEL_PIXELFORMAT_RGB888,   SIXEL_QUALITY_HIGHCOLOR, SIXEL_DIFFUSE_FS },
+        { SIXEL_PIXELFORMAT_PAL8,     SIXEL_QUALITY_AUTO,      SIXEL_DIFFUSE_NONE },
+        { SIXEL_PIXELFORMAT_G4,       SIXEL_QUALITY_AUTO,      SIXEL_DIFFUSE_NONE },
+    };
+    unsigned char *original = NULL;
+    unsigned char *source_pixels = NULL;
+    unsigned char *copy = NULL;
+    sixel_dither_t *dither = NULL;
+    sixel_output_t *output = NULL;
+    test8_capture_t expected = { NULL, 0, 0 };
+    test8_capture_t actual = { NULL, 0, 0 };
+    test9_source_t source;
+    size_t buffer_size;
+    size_t i;
+    size_t h;
+    int pitch;
+    int height;
+
+    buffer_size = (size_t)(width * 4 * max_height);
+    original = (unsigned char *)malloc(buffer_size);
+    source_pixels = (unsigned char *)malloc(buffer_size);
+    copy = (unsigned char *)malloc(buffer_size);
+    if (original == NULL || source_pixels == NULL || copy == NULL) {
+        goto error;
+    }
+    for (i = 0; i < buffer_size; ++i) {
+        original[i] = (unsigned char)((i * 2654435761u) >> 11);
+    }
+
+    for (i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+        pitch = cases[i].pixelformat == SIXEL_PIXELFORMAT_G4 ? (width * 4 + 7) / 8:
+                width * sixel_helper_compute_depth(cases[i].pixelformat);
+        for (h = 0; h < sizeof(heights) / sizeof(heights[0]); ++h) {
+            height = heights[h];
+            if (cases[i].pixelformat == SIXEL_PIXELFORMAT_PAL8) {
+                status = sixel_dither_new(&dither, 256, NULL);
+                if (SIXEL_FAILED(status)) {
+                    goto error;
+                }
+                sixel_dither_set_palette(dither, original);
+            } else if (cases[i].pixelformat == SIXEL_PIXELFORMAT_G4) {
+                dither = sixel_dither_get(SIXEL_BUILTIN_G4);
+                if (dither == NULL) {
+                    goto error;
+                }
+            } else if (cases[i].quality == SIXEL_QUALITY_HIGHCOLOR) {
+                status = sixel_dither_new(&dither, (-1), NULL);
+                if (SIXEL_FAILED(status)) {
+                    goto error;
+                }
+            } else {
+                status = sixel_dither_new(&dither, 32, NULL);
+                if (SIXEL_FAILED(status)) {
+                    goto error;
+                }
+                status = sixel_dither_initialize(dither, original,
+                                                 width, height,
+                                                 cases[i].pixelformat,
+                                                 SIXEL_LARGE_AUTO,
+                                                 SIXEL_REP_AUTO,
+                                                 cases[i].quality);
+                if (SIXEL_FAILED(status)) {
+                    goto error;
+                }
+                sixel_dither_set_diffusion_type(dither, cases[i].diffuse);
+            }
+
+            memcpy(copy, original, buffer_size);
+            status = test8_encode(&expected, dither, cases[i].pixelformat,
+                                  copy, 0, 0, 0, width, height);
+            if (SIXEL_FAILED(status)) {
+                goto error;
+            }
+
+            memcpy(source_pixels, original, buffer_size);
+            source.pixels = source_pixels;
+            source.pitch = pitch;
+            source.next = 0;
+            actual.size = 0;
+            status = sixel_output_new(&output, test8_write, &actual, NULL);
+            if (SIXEL_FAILED(status)) {
+                goto error;
+            }
+            sixel_dither_set_pixelformat(dither, cases[i].pixelformat);
+            status = sixel_encode_scanlines(test9_scanline, &source,
+                                            width, height, dither, output);
+            sixel_output_unref(output);
+            output = NULL;
+            if (SIXEL_FAILED(status)) {
+                goto error;
+            }
+            if (source.next != height) {
+                goto error;
+            }
+            if (expected.size != actual.size ||
+                memcmp(expected.data, actual.data, expected.size) != 0) {
+                goto error;
+            }
+            /* source rows are never modified */
+            if (memcmp(source_pixels, original, buffer_size) != 0) {
+                goto error;
+            }
+
+            sixel_dither_unref(dither);
+            dither = NULL;
+        }
+    }
+
+    nret = EXIT_SUCCESS;
+
+error:
+    sixel_output_unref(output);
+    sixel_dither_unref(dither);
+    free(expected.data);
+    free(actual.data);
+    free(original);
+    free(source_pixels);
+    free(copy);
+    return nret;
+}
+
+
+/* encode "nloops" loops of a small animation into the file "fp", "loops"
+   is the number of loops announced by the loader */
+static SIXELSTATUS
+test10_encode(sixel_encoder_t *encoder, FILE *fp, int nloops, int loops)
+{
+    SIXELSTATUS status = SIXEL_FALSE;
+    enum { nframes = 3, width = 16, height = 12 };
+    sixel_frame_t *frame = NULL;
+    unsigned char *pixels;
+    int loop_no;
+    int frame_no;
+    int i;
+
+    encoder->outfd = fileno(fp);
+    for (loop_no = 0; loop_no < nloops; ++loop_no) {
+        for (frame_no = 0; frame_no < nframes; ++frame_no) {
+            status = sixel_frame_new(&frame, encoder->allocator);
+            if (SIXEL_FAILED(status)) {
+                goto end;
+            }
+            pixels = (unsigned char *)sixel_allocator_malloc(
+                encoder->allocator, width * height * 3);
+            if (pixels == NULL) {
+                status = SIXEL_BAD_ALLOCATION;
+                goto end;
+            }
+            for (i = 0; i < width * height * 3; ++i) {
+                pixels[i] = (unsigned char)((i * (frame_no + 7) * 2654435761u) >> 17);
+            }
+            status = sixel_frame_init(frame, pixels, width, height,
+                                      SIXEL_PIXELFORMAT_RGB888, NULL, 0);
+            if (SIXEL_FAILED(status)) {
+                goto end;
+            }
+            frame->loop_count = loop_no;
+            frame->loops = loops;
+            frame->frame_no = frame_no;
+            frame->multiframe = 1;
+            status = sixel_encoder_encode_frame(encoder, frame, NULL);
+            if (status == SIXEL_LOOPS_REPLAYED) {
+                /* the loader stops here */
+                goto end;
+            }
+            if (SIXEL_FAILED(status)) {
+                goto end;
+            }
+            sixel_frame_unref(frame);
+            frame = NULL;
+        }
+    }
+
+end:
+    encoder->outfd = STDOUT_FILENO;
+    sixel_frame_unref(frame);
+    return status;
+}
+
+
+static char *
+test10_read(FILE *fp, long *size)
+{
+    char *data;
+
+    if (fseek(fp, 0, SEEK_END) != 0 || (*size = ftell(fp)) <= 0 ||
+        fseek(fp, 0, SEEK_SET) != 0) {
+        return NULL;
+    }
+    data = (char *)malloc((size_t)*size);
+    if (data != NULL && fread(data, 1, (size_t)*size, fp) != (size_t)*size) {
+        free(data);
+        data = NULL;
+    }
+
+    return data;
+}
+
+
+/* replayed loops must be identical to encoded ones */
+static int
+test10(void)
+{
+    int nret = EXIT_FAILURE;
+    SIXELSTATUS status;
+    sixel_encoder_t *encoder = NULL;
+    sixel_frame_cache_t *cache;
+    FILE *fp[4] = { NULL, NULL, NULL, NULL };
+    char *data[4] = { NULL, NULL, NULL, NULL };
+    long size[4];
+    size_t frame_size;
+    int i;
+
+    status = sixel_encoder_new(&encoder, NULL);
+    if (SIXEL_FAILED(status)) {
+        goto error;
+    }
+    encoder->fignore_delay = 1;
+    cache = &encoder->frame_cache;
+    for (i = 0; i < 4; ++i) {
+        fp[i] = tmpfile();
+        if (fp[i] == NULL) {
+            goto error;
+        }
+    }
+
+    /* without the cache */
+    cache->limit = 0;
+    status = test10_encode(encoder, fp[0], 3, (-1));
+    if (SIXEL_FAILED(status) || cache->head != NULL || cache->hits != 0) {
+        goto error;
+    }
+
+    /* the first loop is encoded, the others are replayed */
+    cache->limit = SIXEL_FRAME_CACHE_LIMIT;
+    status = test10_encode(encoder, fp[1], 3, (-1));
+    if (SIXEL_FAILED(status) || cache->hits != 6) {
+        goto error;
+    }
+    frame_size = cache->head->size;
+
+    /* room for one frame only: the least recently used one is evicted */
+    sixel_frame_cache_clear(cache, encoder->allocator);
+    cache->hits = 0;
+    cache->limit = frame_size + frame_size / 2;
+    status = test10_encode(encoder, fp[2], 3, (-1));
+    if (SIXEL_FAILED(status) || cache->size > cache->limit) {
+        goto error;
+    }
+    if (cache->head == NULL || cache->head != cache->tail) {
+        goto error;
+    }
+
+    /* if the loader announces the loops, they are replayed at once and
+       the loader does not decode them */
+    sixel_frame_cache_clear(cache, encoder->allocator);
+    cache->hits = 0;
+    cache->limit = SIXEL_FRAME_CACHE_LIMIT;
+    status = test10_encode(encoder, fp[3], 3, 3);
+    if (status != SIXEL_LOOPS_REPLAYED || cache->hits != 6 ||
+        cache->nframes != 3) {
+        goto error;
+    }
+
+    for (i = 0; i < 4; ++i) {
+        data[i] = test10_read(fp[i], &size[i]);
+        if (data[i] == NULL) {
+            goto error;
+        }
+    }
+    if (size[0] != size[1] || memcmp(data[0], data[1], (size_t)size[0]) != 0) {
+        goto error;
+    }
+    if (size[0] != size[2] || memcmp(data[0], data[2], (size_t)size[0]) != 0) {
+        goto error;
+    }
+    if (size[0] != size[3] || memcmp(data[0], data[3], (size_t)size[0]) != 0) {
+        goto error;
+    }
+
+    /* lookups refresh the order of eviction */
+    sixel_frame_cache_clear(cache, encoder->allocator);
+    cache->limit = 30;
+    for (i = 0; i < 3; ++i) {
+        cache->recording = 1;
+        cache->record_size = 0;
+        sixel_frame_cache_append(cache, "0123456789", 10, encoder->allocator);
+        sixel_frame_cache_commit(cache, i, 1, 1, 1, 0, encoder->allocator);
+    }
+    if (sixel_frame_cache_lookup(cache, 0, 1, 1) == NULL) {
+        goto error;
+    }
+    if (sixel_frame_cache_lookup(cache, 0, 2, 1) != NULL) {
+        goto error;
+    }
+    cache->recording = 1;
+    cache->record_size = 0;
+    sixel_frame_cache_append(cache, "0123456789", 10, encoder->allocator);
+    sixel_frame_cache_commit(cache, 3, 1, 1, 1, 0, encoder->allocator);
+    if (sixel_frame_cache_lookup(cache, 1, 1, 1) != NULL ||
+        sixel_frame_cache_lookup(cache, 0, 1, 1) == NULL ||
+        sixel_frame_cache_lookup(cache, 2, 1, 1) == NULL ||
+        sixel_frame_cache_lookup(cache, 3, 1, 1) == NULL ||
+        cache->size != 30) {
+        goto error;
+    }
+    /* a frame larger than the cache is not recorded */
+    cache->recording = 1;
+    cache->record_size = 0;
+    sixel_frame_cache_append(cache, "0123456789", 10, encoder->allocator);
+    sixel_frame_cache_append(cache, "0123456789", 10, encoder->allocator);
+    sixel_frame_cache_append(cache, "0123456789", 10, encoder->allocator);
+    sixel_frame_cache_append(cache, "0123456789", 10, encoder->allocator);
+    sixel_frame_cache_commit(cache, 4, 1, 1, 1, 0, encoder->allocator);
+    if (sixel_frame_cache_lookup(cache, 4, 1, 1) != NULL || cache->size != 30) {
+        goto error;
+    }
+
+    nret = EXIT_SUCCESS;
+
+error:
+    for (i = 0; i < 4; ++i) {
+        if (fp[i] != NULL) {
+            fclose(fp[i]);
+        }
+        free(data[i]);
+    }
+    sixel_encoder_unref(encoder);
+    return nret;
+}
+
+
+/* live bytes of the allocator of test11, each block is prefixed by its size */
+static size_t test11_live = 0;
+
+static void *
+test11_malloc(size_t size)
+{
+    size_t *p;
+
+    p = (size_t *)malloc(sizeof(size_t) * 2 + size);
+    if (p == NULL) {
+        return NULL;
+    }
+    p[0] = size;
+    test11_live += size;
+
+    return p + 2;
+}
+
+
+static void *
+test11_calloc(size_t nelm, size_t elsize)
+{
+    void *p;
+
+    p = test11_malloc(nelm * elsize);
+    if (p != NULL) {
+        memset(p, 0, nelm * elsize);
+    }
+
+    return p;
+}
+
+
+static void *
+test11_realloc(void *ptr, size_t size)
+{
+    size_t *p;
+
+    if (ptr == NULL) {
+        return test11_malloc(size);
+    }
+    p = (size_t *)ptr - 2;
+    test11_live -= p[0];
+    p = (size_t *)realloc(p, sizeof(size_t) * 2 + size);
+    if (p == NULL) {
+        return NULL;
+    }
+    p[0] = size;
+    test11_live += size;
+
+    return p + 2;
+}
+
+
+static void
+test11_free(void *ptr)
+{
+    size_t *p;
+
+    if (ptr != NULL) {
+        p = (size_t *)ptr - 2;
+        test11_live -= p[0];
+        free(p);
+    }
+}
+
+
+/* the first pass of -G keeps the same memory however many frames it samples */
+static int
+test11(void)
+{
+    int nret = EXIT_FAILURE;
+    SIXELSTATUS status;
+    enum { width = 16, height = 16, ncolors = 200, nframes = 1000 };
+    sixel_allocator_t *allocator = NULL;
+    sixel_encoder_t *encoder = NULL;
+    sixel_frame_t *frame = NULL;
+    unsigned char *pixels = NULL;
+    unsigned char *palette;
+    sixel_callback_context_for_global_palette_t callback_context;
+    size_t live = 0;
+    int found;
+    int i;
+    int j;
+
+    callback_context.dither = NULL;
+
+    status = sixel_allocator_new(&allocator, test11_malloc, test11_calloc,
+                                 test11_realloc, test11_free);
+    if (SIXEL_FAILED(status)) {
+        goto error;
+    }
+    status = sixel_encoder_new(&encoder, allocator);
+    if (SIXEL_FAILED(status)) {
+        goto error;
+    }
+    status = sixel_encoder_setopt(encoder, SIXEL_OPTFLAG_GLOBAL_PALETTE, "1");
+    if (SIXEL_FAILED(status)) {
+        goto error;
+    }
+    status = sixel_dither_new(&callback_context.dither, 256, allocator);
+    if (SIXEL_FAILED(status)) {
+        goto error;
+    }
+    callback_context.encoder = encoder;
+    callback_context.nframes = 0;
+
+    status = sixel_frame_new(&frame, allocator);
+    if (SIXEL_FAILED(status)) {
+        goto error;
+    }
+    pixels = (unsigned char *)sixel_allocator_malloc(allocator,
+                                                     width * height * 3);
+    if (pixels == NULL) {
+        goto error;
+    }
+    status = sixel_frame_init(frame, pixels, width, height,
+                              SIXEL_PIXELFORMAT_RGB888, NULL, (-1));
+    if (SIXEL_FAILED(status)) {
+        goto error;
+    }
+
+    /* each frame has one color, which is distinct in 15bpp */
+    for (i = 0; i < nframes; ++i) {
+        for (j = 0; j < width * height; ++j) {
+            pixels[j * 3 + 0] = (unsigned char)((i % ncolors) % 32 << 3);
+            pixels[j * 3 + 1] = (unsigned char)((i % ncolors) / 32 << 3);
+            pixels[j * 3 + 2] = 0x80;
+        }
+        frame->frame_no = i;
+        status = load_image_callback_for_global_palette(frame,
+                                                        &callback_context);
+        if (SIXEL_FAILED(status)) {
+            goto error;
+        }
+        if (i == 0) {
+            live = test11_live;
+        } else if (test11_live != live) {
+            goto error;
+        }
+    }
+    if (callback_context.nframes != nframes) {
+        goto error;
+    }
+
+    status = sixel_dither_initialize_with_histogram(callback_context.dither,
+                                                    SIXEL_LARGE_AUTO,
+                                                    SIXEL_REP_AUTO);
+    if (SIXEL_FAILED(status)) {
+        goto error;
+    }
+    if (sixel_dither_get_num_of_palette_colors(callback_context.dither)
+        != ncolors) {
+        goto error;
+    }
+    /* colors of the last frames are not lost */
+    palette = sixel_dither_get_palette(callback_context.dither);
+    for (i = 0; i < ncolors; ++i) {
+        found = 0;
+        for (j = 0; j < ncolors; ++j) {
+            if (palette[j * 3 + 0] == (i % 32 << 3) &&
+                palette[j * 3 + 1] == (i / 32 << 3) &&
+                palette[j * 3 + 2] == 0x80) {
+                found = 1;
+            }
+        }
+        if (!found) {
+            goto error;
+        }
+    }
+
+    nret = EXIT_SUCCESS;
+
+error:
+    sixel_dither_unref(callback_context.dither);
+    sixel_frame_unref(frame);
+    sixel_encoder_unref(encoder);
+    sixel_allocator_unref(allocator);
+    return nret;
+}
+
+
+/* rows of test12, the output written before the last row is recorded */
+typedef struct test12_source {
+    unsigned char *pixels;
+    int pitch;
+    int height;
+    test8_capture_t *capture;
+    size_t written;
+} test12_source_t;
+
+
+static SIXELSTATUS
+test12_scanline(unsigned char **row, int y, void *priv)
+{
+    test12_source_t *source = (test12_source_t *)priv;
+
+    if (y == source->height - 1) {
+        source->written = source->capture->size;
+    }
+    *row = source->pixels + y * source->pitch;
+
+    return SIXEL_OK;
+}
+
+
+/* decode sixel data into RGB pixels, the caller frees *pixels */
+static int
+test12_decode(test8_capture_t *capture, unsigned char **pixels,
+              int width, int height)
+{
+    SIXELSTATUS status;
+    unsigned char *indexes = NULL;
+    unsigned char *palette = NULL;
+    int decoded_width;
+    int decoded_height;
+    int ncolors;
+    int i;
+
+    *pixels = NULL;
+    status = sixel_decode_raw((unsigned char *)capture->data,
+                              (int)capture->size, &indexes,
+                              &decoded_width, &decoded_height,
+                              &palette, &ncolors, NULL);
+    if (SIXEL_FAILED(status)) {
+        goto error;
+    }
+    if (decoded_width != width || decoded_height != height) {
+        goto error;
+    }
+    *pixels = (unsigned char *)malloc((size_t)(width * height * 3));
+    if (*pixels == NULL) {
+        goto error;
+    }
+    for (i = 0; i < width * height; ++i) {
+        memcpy(*pixels + i * 3, palette + indexes[i] * 3, 3);
+    }
+    free(indexes);
+    free(palette);
+    return 0;
+
+error:
+    free(indexes);
+    free(palette);
+    return (-1);
+}
+
+
+/* an optimized palette streams the image sixel_encode() makes, and the
+   output begins before the last row is pulled */
+static int
+test12(void)
+{
+    int nret = EXIT_FAILURE;
+    SIXELSTATUS status;
+    enum { width = 64, height = 600 };
+    static struct {
+        int optimize;
+        int diffuse;
+        int keycolor;
+    } const cases[] = {
+        { 0, SIXEL_DIFFUSE_FS,   (-1) },
+        { 1, SIXEL_DIFFUSE_FS,   (-1) },
+        { 1, SIXEL_DIFFUSE_NONE, (-1) },
+        { 1, SIXEL_DIFFUSE_FS,   0 },
+    };
+    unsigned char *original = NULL;
+    unsigned char *copy = NULL;
+    unsigned char *expected_pixels = NULL;
+    unsigned char *actual_pixels = NULL;
+    unsigned char palette[SIXEL_PALETTE_MAX * 3];
+    unsigned char expected_palette[SIXEL_PALETTE_MAX * 3];
+    sixel_dither_t *dither = NULL;
+    sixel_output_t *output = NULL;
+    test8_capture_t expected = { NULL, 0, 0 };
+    test8_capture_t actual = { NULL, 0, 0 };
+    test12_source_t source;
+    size_t buffer_size;
+    size_t i;
+    int ncolors;
+    int expected_ncolors;
+
+    buffer_size = (size_t)(width * height * 3);
+    original = (unsigned char *)malloc(buffer_size);
+    copy = (unsigned char *)malloc(buffer_size);
+    if (original == NULL || copy == NULL) {
+        goto error;
+    }
+    for (i = 0; i < buffer_size; ++i) {
+        original[i] = (unsigned char)((i * 2654435761u) >> 11);
+    }
+
+    for (i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+        if (cases[i].optimize) {
+            status = sixel_dither_new(&dither, 256, NULL);
+            if (SIXEL_FAILED(status)) {
+                goto error;
+            }
+            status = sixel_dither_initialize(dither, original, width, height,
+                                             SIXEL_PIXELFORMAT_RGB888,
+                                             SIXEL_LARGE_AUTO,
+                                             SIXEL_REP_AUTO,
+                                             SIXEL_QUALITY_AUTO);
+            if (SIXEL_FAILED(status)) {
+                goto error;
+            }
+            sixel_dither_set_optimize_palette(dither, 1);
+            sixel_dither_set_transparent(dither, cases[i].keycolor);
+        } else {
+            /* a fixed palette */
+            dither = sixel_dither_get(SIXEL_BUILTIN_XTERM256);
+            if (dither == NULL) {
+                goto error;
+            }
+        }
+        sixel_dither_set_diffusion_type(dither, cases[i].diffuse);
+
+        /* sixel_encode() leaves the optimized palette in the dither, the
+           palette of a builtin dither is never written */
+        ncolors = dither->ncolors;
+        memcpy(palette, dither->palette, (size_t)(ncolors * 3));
+        memcpy(copy, original, buffer_size);
+        status = test8_encode(&expected, dither, SIXEL_PIXELFORMAT_RGB888,
+                              copy, 0, 0, 0, width, height);
+        if (SIXEL_FAILED(status)) {
+            goto error;
+        }
+        expected_ncolors = dither->ncolors;
+        memcpy(expected_palette, dither->palette,
+               (size_t)(expected_ncolors * 3));
+        if (cases[i].optimize) {
+            dither->ncolors = ncolors;
+            memcpy(dither->palette, palette, (size_t)(ncolors * 3));
+        }
+
+        source.pixels = original;
+        source.pitch = width * 3;
+        source.height = height;
+        source.capture = &actual;
+        source.written = 0;
+        actual.size = 0;
+        status = sixel_output_new(&output, test8_write, &actual, NULL);
+        if (SIXEL_FAILED(status)) {
+            goto error;
+        }
+        status = sixel_encode_scanlines(test12_scanline, &source,
+                                        width, height, dither, output);
+        sixel_output_unref(output);
+        output = NULL;
+        if (SIXEL_FAILED(status)) {
+            goto error;
+        }
+        if (dither->ncolors != expected_ncolors ||
+            memcmp(dither->palette, expected_palette,
+                   (size_t)(expected_ncolors * 3)) != 0) {
+            goto error;
+        }
+
+        if (cases[i].keycolor != (-1)) {
+            /* the key color needs the whole image */
+            if (expected.size != actual.size ||
+                memcmp(expected.data, actual.data, expected.size) != 0) {
+                goto error;
+            }
+        } else {
+            if (source.written == 0) {
+                goto error;
+            }
+            /* colors may be defined later, the image is the same */
+            if (test12_decode(&expected, &expected_pixels, width, height) != 0 ||
+                test12_decode(&actual, &actual_pixels, width, height) != 0) {
+                goto error;
+            }
+            if (memcmp(expected_pixels, actual_pixels, buffer_size) != 0) {
+                goto error;
+            }
+            free(expected_pixels);
+            free(actual_pixels);
+            expected_pixels = actual_pixels = NULL;
+        }
+
+        sixel_dither_unref(dither);
+        dither = NULL;
+    }
+
+    nret = EXIT_SUCCESS;
+
+error:
+    sixel_output_unref(output);
+    sixel_dither_unref(dither);
+    free(expected.data);
+    free(actual.data);
+    free(expected_pixels);
+    free(actual_pixels);
+    free(original);
+    free(copy);
+    return nret;
+}
+
+
 SIXELAPI int
 sixel_encoder_tests_main(void)
 {
@@ -2349,7 +4110,13 @@ sixel_encoder_tests_main(void)
         test3,
         test4,
         test5,
-        test6
+        test6,
+        test7,
+        test8,
+        test9,
+        test10,
+        test11,
+        test12
     };
 
     for (i = 0; i < sizeof(testcases) / sizeof(testcase); ++i) {
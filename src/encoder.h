@@ -30,6 +30,36 @@
 #define SIXEL_COLOR_OPTION_HIGHCOLOR        4   /* use highcolor option */
 
 /* encoder object */
+/* default of ${SIXEL_FRAME_CACHE_SIZE} */
+#define SIXEL_FRAME_CACHE_LIMIT             (64 * 1024 * 1024)
+
+/* encoded bytes of an animation frame, replayed by the following loops */
+typedef struct sixel_frame_cache_entry {
+    struct sixel_frame_cache_entry *prev;   /* more recently used */
+    struct sixel_frame_cache_entry *next;   /* less recently used */
+    int frame_no;
+    int width;                              /* size of the source frame */
+    int height;
+    int encoded_height;                     /* height of the encoded image */
+    int delay;
+    char *data;
+    size_t size;
+} sixel_frame_cache_entry_t;
+
+/* LRU cache of encoded frames, bounded by "limit" bytes */
+typedef struct sixel_frame_cache {
+    sixel_frame_cache_entry_t *head;        /* most recently used */
+    sixel_frame_cache_entry_t *tail;        /* least recently used */
+    size_t size;                            /* bytes held by the entries */
+    size_t limit;                           /* 0 disables the cache */
+    char *record;                           /* bytes of the frame being encoded */
+    size_t record_size;
+    size_t record_capacity;
+    int recording;
+    int nframes;                            /* frames of the first loop */
+    int hits;                               /* number of replayed frames */
+} sixel_frame_cache_t;
+
 struct sixel_encoder {
     unsigned int ref;               /* reference counter */
     sixel_allocator_t *allocator;   /* allocator object */
@@ -70,6 +100,12 @@ struct sixel_encoder {
     int finsecure;
     int *cancel_flag;
     void *dither_cache;
+    int global_palette_stride;      /* sampling stride of -G option,
+                                       0 if the global palette is disabled */
+    sixel_dither_t *global_dither;  /* palette shared by all frames */
+    char *palette_output;           /* path of the palette artifact (-M) */
+    int fpalette_saved;             /* palette artifact is already written */
+    sixel_frame_cache_t frame_cache; /* encoded frames of the first loop */
 };
 
 #if HAVE_TESTS
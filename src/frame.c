@@ -37,6 +37,7 @@
 #endif  /* HAVE_INTTYPES_H */
 
 #include "frame.h"
+#include "scale.h"
 
 #if !defined(HAVE_MEMMOVE)
 # define memmove(d, s, n) (bcopy ((s), (d), (n)))
@@ -76,6 +77,7 @@ sixel_frame_new(
     (*ppframe)->delay = 0;
     (*ppframe)->frame_no = 0;
     (*ppframe)->loop_count = 0;
+    (*ppframe)->loops = (-1);
     (*ppframe)->multiframe = 0;
     (*ppframe)->transparent = (-1);
     (*ppframe)->allocator = allocator;
@@ -399,6 +401,8 @@ sixel_frame_strip_alpha(
 }
 
 
+#if HAVE_TESTS
+/* converts a whole frame, the tests compare row by row paths against it */
 static SIXELSTATUS
 sixel_frame_convert_to_rgb888(sixel_frame_t /*in */ *frame)
 {
@@ -538,6 +542,7 @@ end:
 
     return status;
 }
+#endif  /* HAVE_TESTS */
 
 /* resize a frame to given size with specified resampling filter */
 SIXELAPI SIXELSTATUS
@@ -585,8 +590,37 @@ sixel_frame_resize(
         goto out;
     }
 
-    status = sixel_frame_convert_to_rgb888(frame);
-    if (SIXEL_FAILED(status)) {
+    /*
+     * pixels are normalized row by row while scaling, instead of
+     * converting the whole frame into RGB888 first.
+     */
+    switch (frame->pixelformat) {
+    case SIXEL_PIXELFORMAT_PAL1:
+    case SIXEL_PIXELFORMAT_PAL2:
+    case SIXEL_PIXELFORMAT_PAL4:
+    case SIXEL_PIXELFORMAT_PAL8:
+        if (frame->palette == NULL) {
+            sixel_helper_set_additional_message(
+                "sixel_frame_resize: palette is not specified.");
+            status = SIXEL_BAD_INPUT;
+            goto end;
+        }
+        break;
+    case SIXEL_PIXELFORMAT_RGB888:
+    case SIXEL_PIXELFORMAT_G8:
+    case SIXEL_PIXELFORMAT_GA88:
+    case SIXEL_PIXELFORMAT_AG88:
+    case SIXEL_PIXELFORMAT_RGB555:
+    case SIXEL_PIXELFORMAT_RGB565:
+    case SIXEL_PIXELFORMAT_BGR555:
+    case SIXEL_PIXELFORMAT_BGR565:
+    case SIXEL_PIXELFORMAT_RGBA8888:
+    case SIXEL_PIXELFORMAT_ARGB8888:
+        break;
+    default:
+        status = SIXEL_LOGIC_ERROR;
+        sixel_helper_set_additional_message(
+            "sixel_frame_resize: invalid pixelformat.");
         goto end;
     }
 
@@ -599,21 +633,24 @@ sixel_frame_resize(
         goto end;
     }
 
-    status = sixel_helper_scale_image(
+    status = sixel_scale_image(
         scaled_frame,
         frame->pixels,
         frame->width,
         frame->height,
-        3,
+        frame->pixelformat,
+        frame->palette,
         width,
         height,
         method_for_resampling,
         frame->allocator);
     if (SIXEL_FAILED(status)) {
+        sixel_allocator_free(frame->allocator, scaled_frame);
         goto end;
     }
     sixel_allocator_free(frame->allocator, frame->pixels);
     frame->pixels = scaled_frame;
+    frame->pixelformat = SIXEL_PIXELFORMAT_RGB888;
     frame->width = width;
     frame->height = height;
 
@@ -1145,6 +1182,211 @@ error:
 }
 
 
+/* resampling must keep flat colors and the direction of gradients */
+static int
+test7(void)
+{
+    int nret = EXIT_FAILURE;
+    SIXELSTATUS status;
+    sixel_allocator_t *allocator = NULL;
+    unsigned char flat[37 * 23 * 3];
+    unsigned char ramp[64 * 4 * 3];
+    unsigned char *dst = NULL;
+    static int const methods[] = {
+        SIXEL_RES_NEAREST,
+        SIXEL_RES_GAUSSIAN,
+        SIXEL_RES_HANNING,
+        SIXEL_RES_HAMMING,
+        SIXEL_RES_BILINEAR,
+        SIXEL_RES_WELSH,
+        SIXEL_RES_BICUBIC,
+        SIXEL_RES_LANCZOS2,
+        SIXEL_RES_LANCZOS3,
+        SIXEL_RES_LANCZOS4,
+    };
+    static int const sizes[][2] = {
+        { 11, 7 }, { 37, 23 }, { 80, 50 }, { 1, 1 },
+    };
+    size_t i;
+    size_t j;
+    int n;
+
+    status = sixel_allocator_new(&allocator, NULL, NULL, NULL, NULL);
+    if (SIXEL_FAILED(status)) {
+        goto error;
+    }
+    dst = (unsigned char *)sixel_allocator_malloc(allocator, 80 * 50 * 3);
+    if (dst == NULL) {
+        goto error;
+    }
+
+    for (n = 0; n < 37 * 23; ++n) {
+        flat[n * 3 + 0] = 0x40;
+        flat[n * 3 + 1] = 0x80;
+        flat[n * 3 + 2] = 0xc0;
+    }
+    for (n = 0; n < 64 * 4; ++n) {
+        ramp[n * 3 + 0] = ramp[n * 3 + 1] = ramp[n * 3 + 2]
+            = (unsigned char)(n % 64 * 4);
+    }
+
+    for (i = 0; i < sizeof(methods) / sizeof(methods[0]); ++i) {
+        for (j = 0; j < sizeof(sizes) / sizeof(sizes[0]); ++j) {
+            if (sixel_helper_scale_image(dst, flat, 37, 23,
+                                         SIXEL_PIXELFORMAT_RGB888,
+                                         sizes[j][0], sizes[j][1],
+                                         methods[i], allocator) != 0) {
+                goto error;
+            }
+            for (n = 0; n < sizes[j][0] * sizes[j][1]; ++n) {
+                if (dst[n * 3 + 0] != 0x40 || dst[n * 3 + 1] != 0x80
+                    || dst[n * 3 + 2] != 0xc0) {
+                    goto error;
+                }
+            }
+        }
+
+        /* the ramp must stay increasing */
+        if (sixel_helper_scale_image(dst, ramp, 64, 4,
+                                     SIXEL_PIXELFORMAT_RGB888,
+                                     16, 2, methods[i], allocator) != 0) {
+            goto error;
+        }
+        if (dst[0] >= dst[15 * 3]) {
+            goto error;
+        }
+    }
+
+    nret = EXIT_SUCCESS;
+
+error:
+    sixel_allocator_free(allocator, dst);
+    sixel_allocator_unref(allocator);
+    return nret;
+}
+
+
+/* resize a frame, optionally converting it to RGB888 first */
+static int
+test8_resize(
+    unsigned char const *pixels,
+    size_t size,
+    unsigned char const *palette,
+    int pixelformat,
+    int convert_first,
+    int method,
+    unsigned char *result)
+{
+    int nret = EXIT_FAILURE;
+    sixel_frame_t *frame = NULL;
+    unsigned char *copy = NULL;
+    unsigned char *palette_copy = NULL;
+    SIXELSTATUS status;
+
+    copy = malloc(size);
+    if (copy == NULL) {
+        goto error;
+    }
+    memcpy(copy, pixels, size);
+    if (palette != NULL) {
+        palette_copy = malloc(256 * 3);
+        if (palette_copy == NULL) {
+            goto error;
+        }
+        memcpy(palette_copy, palette, 256 * 3);
+    }
+
+    status = sixel_frame_new(&frame, NULL);
+    if (SIXEL_FAILED(status)) {
+        goto error;
+    }
+    status = sixel_frame_init(frame, copy, 37, 23, pixelformat,
+                              palette_copy, palette == NULL ? (-1): 256);
+    copy = palette_copy = NULL;
+    if (SIXEL_FAILED(status)) {
+        goto error;
+    }
+    if (convert_first) {
+        status = sixel_frame_convert_to_rgb888(frame);
+        if (SIXEL_FAILED(status)) {
+            goto error;
+        }
+    }
+    status = sixel_frame_resize(frame, 19, 31, method);
+    if (SIXEL_FAILED(status)) {
+        goto error;
+    }
+    if (frame->pixelformat != SIXEL_PIXELFORMAT_RGB888) {
+        goto error;
+    }
+    memcpy(result, frame->pixels, 19 * 31 * 3);
+
+    nret = EXIT_SUCCESS;
+
+error:
+    free(copy);
+    free(palette_copy);
+    sixel_frame_unref(frame);
+    return nret;
+}
+
+
+/* resizing must give the same result as converting to RGB888 first */
+static int
+test8(void)
+{
+    int nret = EXIT_FAILURE;
+    static int const formats[][2] = {
+        { SIXEL_PIXELFORMAT_PAL8, 37 * 23 },
+        { SIXEL_PIXELFORMAT_PAL1, 5 * 23 },
+        { SIXEL_PIXELFORMAT_PAL4, 19 * 23 },
+        { SIXEL_PIXELFORMAT_G8, 37 * 23 },
+        { SIXEL_PIXELFORMAT_RGB565, 37 * 23 * 2 },
+        { SIXEL_PIXELFORMAT_RGBA8888, 37 * 23 * 4 },
+    };
+    static int const methods[] = {
+        SIXEL_RES_NEAREST, SIXEL_RES_BILINEAR, SIXEL_RES_LANCZOS3,
+    };
+    unsigned char pixels[37 * 23 * 4];
+    unsigned char palette[256 * 3];
+    unsigned char expected[19 * 31 * 3];
+    unsigned char actual[19 * 31 * 3];
+    unsigned char const *p;
+    size_t i;
+    size_t j;
+    int n;
+
+    for (n = 0; n < (int)sizeof(pixels); ++n) {
+        pixels[n] = (unsigned char)(n * 37 + n / 7);
+    }
+    for (n = 0; n < (int)sizeof(palette); ++n) {
+        palette[n] = (unsigned char)(n * 101);
+    }
+
+    for (i = 0; i < sizeof(formats) / sizeof(formats[0]); ++i) {
+        p = SIXEL_FORMATTYPE_PALETTE & formats[i][0] ? palette: NULL;
+        for (j = 0; j < sizeof(methods) / sizeof(methods[0]); ++j) {
+            if (test8_resize(pixels, (size_t)formats[i][1], p, formats[i][0],
+                             1, methods[j], expected) != EXIT_SUCCESS) {
+                goto error;
+            }
+            if (test8_resize(pixels, (size_t)formats[i][1], p, formats[i][0],
+                             0, methods[j], actual) != EXIT_SUCCESS) {
+                goto error;
+            }
+            if (memcmp(expected, actual, sizeof(actual)) != 0) {
+                goto error;
+            }
+        }
+    }
+
+    nret = EXIT_SUCCESS;
+
+error:
+    return nret;
+}
+
+
 SIXELAPI int
 sixel_frame_tests_main(void)
 {
@@ -1159,6 +1401,8 @@ sixel_frame_tests_main(void)
         test4,
         test5,
         test6,
+        test7,
+        test8,
     };
 
     for (i = 0; i < sizeof(testcases) / sizeof(testcase); ++i) {
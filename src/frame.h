@@ -36,11 +36,19 @@ struct sixel_frame {
     int delay;                      /* delay in msec */
     int frame_no;                   /* frame number */
     int loop_count;                 /* loop count */
+    int loops;                      /* loops played by the loader, 0 for
+                                       endless, -1 if unknown */
     int multiframe;                 /* whether the image has multiple frames */
     int transparent;                /* -1(no transparent) or >= 0(index of transparent color) */
     sixel_allocator_t *allocator;   /* allocator object */
 };
 
+/*
+ * a load callback returns this when it replays the remaining loops of an
+ * animation by itself, the loader stops decoding and succeeds.
+ */
+#define SIXEL_LOOPS_REPLAYED    (SIXEL_OK | 0x0002)
+
 #ifdef __cplusplus
 extern "C" {
 #endif
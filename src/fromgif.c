@@ -47,6 +47,13 @@
 #if HAVE_STDINT_H
 # include <stdint.h>
 #endif  /* HAVE_STDINT_H */
+#if HAVE_UNISTD_H
+# include <unistd.h>
+#endif  /* HAVE_UNISTD_H */
+#if HAVE_PTHREAD_H && HAVE_PTHREAD
+# include <pthread.h>
+# define GIF_USE_THREADS 1
+#endif  /* HAVE_PTHREAD_H && HAVE_PTHREAD */
 
 #include "frame.h"
 #include "fromgif.h"
@@ -74,6 +81,7 @@ typedef struct
    signed short prefix;
    unsigned char first;
    unsigned char suffix;
+   unsigned short length;  /* length of the string of the code */
 } gif_lzw;
 
 #define GIF_LZW_MAX_CODE_SIZE 12
@@ -90,6 +98,12 @@ typedef struct
    unsigned char *out;       /* composited frame buffer (RGB888) */
    unsigned char *prev_out;  /* RGB888 backup for disposal method 3 */
    unsigned char *history;   /* pixels modified in the previous frame */
+   unsigned char *indices;   /* palette indices of the frame in raster order */
+   size_t npixels;           /* number of decoded indices */
+   int paletted;             /* the frame is passed as palette indices */
+   int fuse_palette;
+   int reqcolors;
+   int fstatic;
    int flags, bgindex, ratio, transparent, eflags;
    unsigned char pal[256][3];
    unsigned char lpal[256][3];
@@ -99,15 +113,40 @@ typedef struct
    int lflags;
    int start_x, start_y;
    int max_x, max_y;
-   int cur_x, cur_y;
    int actual_width, actual_height;
    int line_size;
    int loop_count;
    int delay;
    int is_multiframe;
    int is_terminated;
+   char *message;            /* error message of the decoder thread or NULL */
 } gif_t;
 
+/* size of gif_t.message */
+#define GIF_MESSAGE_SIZE 256
+
+
+/*
+ * set an error message of the decoder. the decoder thread keeps it in
+ * g->message, the global buffer belongs to the calling thread.
+ */
+static void
+gif_set_message(gif_t /* in */ *g, char const /* in */ *message)
+{
+    size_t len;
+
+    if (g->message == NULL) {
+        sixel_helper_set_additional_message(message);
+    } else {
+        len = strlen(message);
+        if (len > GIF_MESSAGE_SIZE - 1) {
+            len = GIF_MESSAGE_SIZE - 1;
+        }
+        memcpy(g->message, message, len);
+        g->message[len] = '\0';
+    }
+}
+
 
 /* initialize a memory-decode context */
 static unsigned char
@@ -192,120 +231,30 @@ end:
 }
 
 
-static SIXELSTATUS
-gif_init_frame(
-    sixel_frame_t /* in */ *frame,
-    gif_t         /* in */ *pg,
-    unsigned char /* in */ *bgcolor,
-    int           /* in */ reqcolors,
-    int           /* in */ fuse_palette)
-{
-    SIXELSTATUS status = SIXEL_OK;
-    size_t frame_size;
-
-    (void)bgcolor;
-    (void)reqcolors;
-    (void)fuse_palette;
-
-    frame->delay = pg->delay;
-    frame->pixelformat = SIXEL_PIXELFORMAT_RGB888;
-    sixel_allocator_free(frame->allocator, frame->pixels);
-    frame_size = (size_t)frame->width * (size_t)frame->height * 3;
-    frame->pixels = (unsigned char *)sixel_allocator_malloc(frame->allocator, frame_size);
-    if (frame->pixels == NULL) {
-        sixel_helper_set_additional_message(
-            "sixel_allocator_malloc() failed in gif_init_frame().");
-        status = SIXEL_BAD_ALLOCATION;
-        goto end;
-    }
-
-    /*
-     * The canvas is already composited in RGB888, so each frame can be
-     * exported directly without reinterpretation through a per-frame palette.
-     */
-    memcpy(frame->pixels, pg->out, frame_size);
-    frame->multiframe = (pg->loop_count != (-1));
-
-    status = SIXEL_OK;
-
-end:
-    return status;
-}
-
-
-static SIXELSTATUS
-gif_out_code(
-    gif_t           /* in */ *g,
-    unsigned short  /* in */ code
-)
+/* advance to the next row of the raster, following the interlace passes */
+static int
+gif_next_row(
+    gif_t   /* in */     *g,
+    int     /* in */     y,
+    int     /* in/out */ *step,
+    int     /* in/out */ *parse)
 {
-    size_t idx;
-    size_t pixel_offset;
-    size_t palette_offset;
-    unsigned char suffix;
-    SIXELSTATUS status;
-
-    if (code > GIF_LZW_MAX) {
-        sixel_helper_set_additional_message("gif_out_code() failed; GIF file corrupt");
-        return SIXEL_RUNTIME_ERROR;
-    }
-
-    /* recurse to decode the prefixes, since the linked-list is backwards,
-       and working backwards through an interleaved image would be nasty */
-    if (g->codes[code].prefix >= 0) {
-        status = gif_out_code(g, (unsigned short)g->codes[code].prefix);
-        if (SIXEL_FAILED(status)) {
-            return status;
-        }
-    }
-
-    if (g->cur_y >= g->max_y) {
-        return SIXEL_OK;
-    }
-
-    idx = (size_t)g->cur_x + (size_t)g->cur_y * g->w;
-    suffix = g->codes[code].suffix;
-    /*
-     * Track every decoded pixel position, even when the source index is the
-     * transparent index. GIF disposal methods 2/3 are defined on the whole
-     * image rectangle of the previous frame, not only on non-transparent
-     * writes. If we only mark opaque writes here, the next disposal step keeps
-     * stale pixels and visible noise appears in animated transparent GIFs.
-     */
-    if (g->history) {
-        g->history[idx] = 1;
-    }
-    if (!(g->transparent >= 0 && suffix == g->transparent)) {
-        pixel_offset = idx * 3;
-        palette_offset = (size_t)suffix * 3;
-        g->out[pixel_offset + 0] = g->color_table[palette_offset + 2];
-        g->out[pixel_offset + 1] = g->color_table[palette_offset + 1];
-        g->out[pixel_offset + 2] = g->color_table[palette_offset + 0];
+    y += *step;
+    while (y >= g->max_y && *parse > 0) {
+        *step = 1 << *parse;
+        y = g->start_y + (*step >> 1);
+        --*parse;
     }
-    if (g->cur_x >= g->actual_width) {
-        g->actual_width = g->cur_x + 1;
-    }
-    if (g->cur_y >= g->actual_height) {
-        g->actual_height = g->cur_y + 1;
-    }
-
-    g->cur_x++;
-
-    if (g->cur_x >= g->max_x) {
-        g->cur_x = g->start_x;
-        g->cur_y += g->step;
 
-        while (g->cur_y >= g->max_y && g->parse > 0) {
-            g->step = 1 << g->parse;
-            g->cur_y = g->start_y + (g->step >> 1);
-            --g->parse;
-        }
-    }
-
-    return SIXEL_OK;
+    return y;
 }
 
 
+/*
+ * decode the LZW codes of a raster into palette indices in raster order.
+ * codes are taken from a 64-bit bit buffer and each code writes its whole
+ * string backwards in one pass, using the string length kept in the table.
+ */
 static SIXELSTATUS
 gif_process_raster(
     gif_context_t /* in */ *s,
@@ -314,14 +263,20 @@ gif_process_raster(
 {
     SIXELSTATUS status = SIXEL_FALSE;
     unsigned char lzw_cs;
-    signed int len, code;
-    signed int codesize, codemask, avail, oldcode, bits, valid_bits, clear;
+    unsigned long long bits;
+    signed int len, code, c;
+    signed int codesize, codemask, avail, oldcode, valid_bits, clear;
+    int eod;
+    size_t capacity;
+    size_t count;
+    size_t length;
+    unsigned char *q;
     gif_lzw *p;
 
     /* LZW Minimum Code Size */
     lzw_cs = gif_get8(s);
     if (lzw_cs > GIF_LZW_MAX_CODE_SIZE) {
-        sixel_helper_set_additional_message(
+        gif_set_message(g,
             "Unsupported GIF (LZW code size)");
         status = SIXEL_RUNTIME_ERROR;
         goto end;
@@ -336,75 +291,349 @@ gif_process_raster(
         g->codes[code].prefix = (-1);
         g->codes[code].first = (unsigned char) code;
         g->codes[code].suffix = (unsigned char) code;
+        g->codes[code].length = 1;
     }
 
     /* support no starting clear code */
     avail = clear + 2;
     oldcode = (-1);
 
+    capacity = (size_t)(g->max_x - g->start_x)
+             * (size_t)(g->max_y - g->start_y);
+    count = 0;
     len = 0;
+    eod = 0;
     for(;;) {
         if (valid_bits < codesize) {
-            if (len == 0) {
-                len = gif_get8(s); /* start new block */
+            /* fill the bit buffer across data sub-blocks */
+            while (valid_bits <= 56 && !eod) {
                 if (len == 0) {
-                    return SIXEL_OK;
+                    len = gif_get8(s); /* start new block */
+                    if (len == 0) {
+                        eod = 1;
+                        break;
+                    }
                 }
+                --len;
+                bits |= (unsigned long long)gif_get8(s) << valid_bits;
+                valid_bits += 8;
             }
-            --len;
-            bits |= (signed int) gif_get8(s) << valid_bits;
-            valid_bits += 8;
-        } else {
-            code = bits & codemask;
-            bits >>= codesize;
-            valid_bits -= codesize;
-            /* @OPTIMIZE: is there some way we can accelerate the non-clear path? */
-            if (code == clear) {  /* clear code */
-                codesize = lzw_cs + 1;
-                codemask = (1 << codesize) - 1;
-                avail = clear + 2;
-                oldcode = (-1);
-            } else if (code == clear + 1) { /* end of stream code */
-                s->img_buffer += len;
+            if (valid_bits < codesize) {
+                break;
+            }
+        }
+        code = (signed int)(bits & (unsigned long long)codemask);
+        bits >>= codesize;
+        valid_bits -= codesize;
+        if (code == clear) {  /* clear code */
+            codesize = lzw_cs + 1;
+            codemask = (1 << codesize) - 1;
+            avail = clear + 2;
+            oldcode = (-1);
+        } else if (code == clear + 1) { /* end of stream code */
+            s->img_buffer += len;
+            if (!eod) {
                 while ((len = gif_get8(s)) > 0) {
                     s->img_buffer += len;
                 }
-                return SIXEL_OK;
-            } else if (code <= avail) {
-                if (oldcode >= 0) {
-                    if (avail < (1 << GIF_LZW_MAX_CODE_SIZE)) {
-                        p = &g->codes[avail++];
-                        p->prefix = (signed short) oldcode;
-                        p->first = g->codes[oldcode].first;
-                        p->suffix = (code == avail) ? p->first : g->codes[code].first;
-                    }
-                } else if (code == avail) {
-                    sixel_helper_set_additional_message(
-                        "corrupt GIF (reason: illegal code in raster).");
-                    status = SIXEL_RUNTIME_ERROR;
-                    goto end;
+            }
+            break;
+        } else if (code <= avail) {
+            if (oldcode >= 0) {
+                if (avail < (1 << GIF_LZW_MAX_CODE_SIZE)) {
+                    p = &g->codes[avail];
+                    p->prefix = (signed short) oldcode;
+                    p->first = g->codes[oldcode].first;
+                    p->suffix = (code == avail) ? p->first : g->codes[code].first;
+                    p->length = (unsigned short)(g->codes[oldcode].length + 1);
+                    ++avail;
                 }
+            } else if (code == avail) {
+                gif_set_message(g,
+                    "corrupt GIF (reason: illegal code in raster).");
+                status = SIXEL_RUNTIME_ERROR;
+                goto end;
+            }
 
-                status = gif_out_code(g, (unsigned short) code);
-                if (status != SIXEL_OK) {
-                    goto end;
+            if (count < capacity) {
+                c = code;
+                length = g->codes[c].length;
+                /* drop the part of the string beyond the image */
+                for (; length > capacity - count; --length) {
+                    c = g->codes[c].prefix;
                 }
+                q = g->indices + count + length;
+                count += length;
+                do {
+                    *--q = g->codes[c].suffix;
+                    c = g->codes[c].prefix;
+                } while (c >= 0);
+            }
+
+            if ((avail & codemask) == 0 && avail <= 0x0FFF) {
+                codesize++;
+                codemask = (1 << codesize) - 1;
+            }
+
+            oldcode = code;
+        } else {
+            gif_set_message(g,
+                "corrupt GIF (reason: illegal code in raster).");
+            status = SIXEL_RUNTIME_ERROR;
+            goto end;
+        }
+    }
+
+    g->npixels = count;
+    status = SIXEL_OK;
 
-                if ((avail & codemask) == 0 && avail <= 0x0FFF) {
-                    codesize++;
-                    codemask = (1 << codesize) - 1;
+end:
+    return status;
+}
+
+
+/* write the decoded indices of the current frame onto the RGB canvas */
+static void
+gif_expand_indices(gif_t /* in */ *g)
+{
+    unsigned char rgb[256][3];
+    unsigned char const *src;
+    unsigned char *dst;
+    unsigned char transparent;
+    size_t offset;
+    size_t pos;
+    size_t width;
+    size_t n;
+    size_t x;
+    int i;
+    int y;
+    int step;
+    int parse;
+
+    /* the color table is stored in BGR order */
+    for (i = 0; i < 256; ++i) {
+        rgb[i][0] = g->color_table[i * 3 + 2];
+        rgb[i][1] = g->color_table[i * 3 + 1];
+        rgb[i][2] = g->color_table[i * 3 + 0];
+    }
+
+    width = (size_t)(g->max_x - g->start_x);
+    y = g->start_y;
+    step = g->step;
+    parse = g->parse;
+    for (offset = 0; offset < g->npixels; offset += n) {
+        n = g->npixels - offset < width ? g->npixels - offset: width;
+        src = g->indices + offset;
+        pos = (size_t)y * (size_t)g->w + (size_t)g->start_x;
+        dst = g->out + pos * 3;
+        /*
+         * Track every decoded pixel position, even when the source index is
+         * the transparent index. GIF disposal methods 2/3 are defined on the
+         * whole image rectangle of the previous frame, not only on
+         * non-transparent writes. If we only mark opaque writes here, the
+         * next disposal step keeps stale pixels and visible noise appears in
+         * animated transparent GIFs.
+         */
+        memset(g->history + pos, 1, n);
+        if (g->transparent >= 0) {
+            transparent = (unsigned char)g->transparent;
+            for (x = 0; x < n; ++x, dst += 3) {
+                if (src[x] != transparent) {
+                    dst[0] = rgb[src[x]][0];
+                    dst[1] = rgb[src[x]][1];
+                    dst[2] = rgb[src[x]][2];
                 }
+            }
+        } else {
+            for (x = 0; x < n; ++x, dst += 3) {
+                dst[0] = rgb[src[x]][0];
+                dst[1] = rgb[src[x]][1];
+                dst[2] = rgb[src[x]][2];
+            }
+        }
+        if (g->start_x + (int)n > g->actual_width) {
+            g->actual_width = g->start_x + (int)n;
+        }
+        if (y >= g->actual_height) {
+            g->actual_height = y + 1;
+        }
+        y = gif_next_row(g, y, &step, &parse);
+    }
+}
 
-                oldcode = code;
-            } else {
-                sixel_helper_set_additional_message(
-                    "corrupt GIF (reason: illegal code in raster).");
-                status = SIXEL_RUNTIME_ERROR;
-                goto end;
+
+/* copy the indices of a frame covering the canvas in image order */
+static void
+gif_export_indices(
+    gif_t           /* in */  *g,
+    unsigned char   /* out */ *dst)
+{
+    size_t offset;
+    size_t width;
+    int y;
+    int step;
+    int parse;
+
+    width = (size_t)g->w;
+    y = g->start_y;
+    step = g->step;
+    parse = g->parse;
+    for (offset = 0; offset < g->npixels; offset += width) {
+        memcpy(dst + (size_t)y * width, g->indices + offset, width);
+        y = gif_next_row(g, y, &step, &parse);
+    }
+}
+
+
+/* copy the color table of the current frame as RGB, returns its size */
+static int
+gif_export_palette(
+    gif_t           /* in */  *g,
+    unsigned char   /* out */ *dst)
+{
+    int ncolors;
+    int i;
+
+    ncolors = g->color_table == (unsigned char *)g->lpal ?
+        2 << (g->lflags & 7): 2 << (g->flags & 7);
+    for (i = 0; i < ncolors; ++i) {
+        dst[i * 3 + 0] = g->color_table[i * 3 + 2];
+        dst[i * 3 + 1] = g->color_table[i * 3 + 1];
+        dst[i * 3 + 2] = g->color_table[i * 3 + 0];
+    }
+
+    return ncolors;
+}
+
+
+/* whether another image follows in the stream, nothing is consumed */
+static int
+gif_has_next_image(gif_context_t /* in */ *s)
+{
+    unsigned char const *p = s->img_buffer;
+    unsigned char const *end = s->img_buffer_end;
+
+    while (p < end) {
+        switch (*p++) {
+        case 0x2C:  /* Image Separator */
+            return 1;
+        case 0x21:  /* Extension Introducer */
+            ++p;    /* label */
+            while (p < end && *p != 0) {
+                p += *p + 1;
             }
+            ++p;    /* block terminator */
+            break;
+        default:
+            return 0;
+        }
+    }
+
+    return 0;
+}
+
+
+/*
+ * a still image which covers the whole canvas with an opaque color table
+ * is passed to the callback as palette indices, as the other loaders do
+ * for paletted images. the canvas is left untouched in this case.
+ */
+static int
+gif_frame_is_paletted(
+    gif_context_t /* in */ *s,
+    gif_t         /* in */ *g,
+    int           /* in */ first_frame)
+{
+    size_t i;
+    int ncolors;
+    int used;
+
+    if (!g->fuse_palette || !first_frame) {
+        return 0;
+    }
+    if (g->start_x != 0 || g->start_y != 0 ||
+        g->max_x != g->w || g->max_y != g->h) {
+        return 0;
+    }
+    if (g->npixels != (size_t)g->w * (size_t)g->h || g->transparent >= 0) {
+        return 0;
+    }
+    ncolors = g->color_table == (unsigned char *)g->lpal ?
+        2 << (g->lflags & 7): 2 << (g->flags & 7);
+    if (ncolors > g->reqcolors) {
+        return 0;
+    }
+    if (!g->fstatic && gif_has_next_image(s)) {
+        return 0;
+    }
+    /* broken images may refer to colors beyond the table, whose size
+       is a power of two */
+    used = 0;
+    for (i = 0; i < g->npixels; ++i) {
+        used |= g->indices[i];
+    }
+    if (used >= ncolors) {
+        return 0;
+    }
+
+    return 1;
+}
+
+
+static SIXELSTATUS
+gif_init_frame(
+    sixel_frame_t /* in */ *frame,
+    gif_t         /* in */ *pg,
+    unsigned char /* in */ *bgcolor,
+    int           /* in */ reqcolors,
+    int           /* in */ fuse_palette)
+{
+    SIXELSTATUS status = SIXEL_OK;
+    size_t frame_size;
+
+    (void)bgcolor;
+    (void)reqcolors;
+    (void)fuse_palette;
+
+    frame->delay = pg->delay;
+    frame->multiframe = (pg->loop_count != (-1));
+    sixel_allocator_free(frame->allocator, frame->pixels);
+    frame->pixels = NULL;
+
+    if (pg->paletted) {
+        frame->pixelformat = SIXEL_PIXELFORMAT_PAL8;
+        frame->pixels = (unsigned char *)sixel_allocator_malloc(
+            frame->allocator, pg->npixels);
+        frame->palette = (unsigned char *)sixel_allocator_malloc(
+            frame->allocator, 256 * 3);
+        if (frame->pixels == NULL || frame->palette == NULL) {
+            sixel_helper_set_additional_message(
+                "sixel_allocator_malloc() failed in gif_init_frame().");
+            status = SIXEL_BAD_ALLOCATION;
+            goto end;
         }
+        gif_export_indices(pg, frame->pixels);
+        frame->ncolors = gif_export_palette(pg, frame->palette);
+        status = SIXEL_OK;
+        goto end;
+    }
+
+    frame->pixelformat = SIXEL_PIXELFORMAT_RGB888;
+    frame_size = (size_t)frame->width * (size_t)frame->height * 3;
+    frame->pixels = (unsigned char *)sixel_allocator_malloc(frame->allocator, frame_size);
+    if (frame->pixels == NULL) {
+        sixel_helper_set_additional_message(
+            "sixel_allocator_malloc() failed in gif_init_frame().");
+        status = SIXEL_BAD_ALLOCATION;
+        goto end;
     }
 
+    /*
+     * The canvas is already composited in RGB888, so each frame can be
+     * exported directly without reinterpretation through a per-frame palette.
+     */
+    memcpy(frame->pixels, pg->out, frame_size);
+
     status = SIXEL_OK;
 
 end:
@@ -436,31 +665,34 @@ gif_load_next(
     unsigned char bg_r;
     unsigned char bg_g;
     unsigned char bg_b;
+    int first_frame;
+
+    first_frame = !g->is_multiframe;
 
     /* apply disposal of previous frame and prepare buffers */
     if (g->out) {
         if (g->w <= 0 || g->h <= 0 ||
             (size_t)g->w > SIZE_MAX / (size_t)g->h) {
-            sixel_helper_set_additional_message(
+            gif_set_message(g,
                 "corrupt GIF (reason: invalid image size).");
             status = SIXEL_BAD_INPUT;
             goto end;
         }
         if (g->w > SIXEL_WIDTH_LIMIT || g->h > SIXEL_HEIGHT_LIMIT) {
-            sixel_helper_set_additional_message(
+            gif_set_message(g,
                 "corrupt GIF (reason: image dimensions exceed limit).");
             status = SIXEL_BAD_INPUT;
             goto end;
         }
         pcount = (size_t)g->w * (size_t)g->h;
         if (pcount > SIXEL_ALLOCATE_BYTES_MAX) {
-            sixel_helper_set_additional_message(
+            gif_set_message(g,
                 "corrupt GIF (reason: image data exceeds limit).");
             status = SIXEL_BAD_INPUT;
             goto end;
         }
         if (pcount > SIZE_MAX / 3) {
-            sixel_helper_set_additional_message(
+            gif_set_message(g,
                 "corrupt GIF (reason: image data exceeds limit).");
             status = SIXEL_BAD_INPUT;
             goto end;
@@ -529,7 +761,7 @@ gif_load_next(
             w = gif_get16le(s);  /* Image Width (2 bytes) */
             h = gif_get16le(s);  /* Image Height (2 bytes) */
             if (x >= g->w || y >= g->h || x + w > g->w || y + h > g->h) {
-                sixel_helper_set_additional_message(
+                gif_set_message(g,
                     "corrupt GIF (reason: bad Image Separator).");
                 status = SIXEL_RUNTIME_ERROR;
                 goto end;
@@ -540,8 +772,6 @@ gif_load_next(
             g->start_y = y;
             g->max_x   = g->start_x + w;
             g->max_y   = g->start_y + h;
-            g->cur_x   = g->start_x;
-            g->cur_y   = g->start_y;
             g->actual_width   = g->start_x;
             g->actual_height   = g->start_y;
 
@@ -583,7 +813,7 @@ gif_load_next(
                 }
                 g->color_table = (unsigned char *)g->pal;
             } else {
-                sixel_helper_set_additional_message(
+                gif_set_message(g,
                     "corrupt GIF (reason: missing color table).");
                 status = SIXEL_RUNTIME_ERROR;
                 goto end;
@@ -593,6 +823,13 @@ gif_load_next(
             if (SIXEL_FAILED(status)) {
                 goto end;
             }
+            g->paletted = gif_frame_is_paletted(s, g, first_frame);
+            if (g->paletted) {
+                g->actual_width = g->w;
+                g->actual_height = g->h;
+            } else {
+                gif_expand_indices(g);
+            }
             goto end;
 
         case 0x21:  /* Comment Extension. */
@@ -657,7 +894,7 @@ gif_load_next(
             }
             if ((c = gif_get8(s)) != 0x00) {
                 sprintf((char *)buffer, "missing valid block terminator (unknown code %02x).", c);
-                sixel_helper_set_additional_message((char *)buffer);
+                gif_set_message(g, (char *)buffer);
                 status = SIXEL_RUNTIME_ERROR;
                 goto end;
             }
@@ -670,7 +907,7 @@ gif_load_next(
 
         default:
             sprintf((char *)buffer, "corrupt GIF (reason: unknown code %02x).", c);
-            sixel_helper_set_additional_message((char *)buffer);
+            gif_set_message(g, (char *)buffer);
             status = SIXEL_RUNTIME_ERROR;
             goto end;
         }
@@ -687,27 +924,34 @@ typedef union _fn_pointer {
     void *                    p;
 } fn_pointer;
 
-SIXELSTATUS
-load_gif(
-    unsigned char       /* in */ *buffer,
-    int                 /* in */ size,
+/* receives each composited frame of gif_decode_frames() */
+typedef SIXELSTATUS (* gif_emit_function)(
+    gif_t   /* in */ *g,
+    int     /* in */ loop_no,
+    int     /* in */ frame_no,
+    void    /* in */ *data);
+
+#if HAVE_TESTS
+static int gif_force_threads = 0;
+#endif
+
+/*
+ * walk over the frames of all loops, apply disposal and hand each
+ * composited canvas to "emit". this does not call the allocator, so it
+ * may run on a worker thread.
+ */
+static SIXELSTATUS
+gif_decode_frames(
+    gif_context_t       /* in */ *s,
+    gif_t               /* in */ *g,
     unsigned char       /* in */ *bgcolor,
-    int                 /* in */ reqcolors,
-    int                 /* in */ fuse_palette,
     int                 /* in */ fstatic,
     int                 /* in */ loop_control,
-    void                /* in */ *fn_load,     /* callback */
-    void                /* in */ *context,     /* private data for callback */
-    sixel_allocator_t   /* in */ *allocator)   /* allocator object */
+    gif_emit_function   /* in */ emit,
+    void                /* in */ *data)
 {
-    gif_context_t s;
-    gif_t g;
     SIXELSTATUS status = SIXEL_FALSE;
-    sixel_frame_t *frame;
-    fn_pointer fnp;
-    char message[256];
     size_t pcount;
-    size_t bcount;
     size_t i;
     unsigned char bg_r;
     unsigned char bg_g;
@@ -715,143 +959,65 @@ load_gif(
     int frame_no;
     int loop_no;
 
-    frame = NULL;
-    fnp.p = fn_load;
-
-    s.img_buffer = s.img_buffer_original = (unsigned char *)buffer;
-    s.img_buffer_end = (unsigned char *)buffer + size;
-    memset(&g, 0, sizeof(g));
-    g.delay = SIXEL_DEFALUT_GIF_DELAY;
-    status = gif_load_header(&s, &g);
-    if (status != SIXEL_OK) {
-        goto end;
-    }
-    if (g.w <= 0 || g.h <= 0 ||
-        (size_t)g.w > SIZE_MAX / (size_t)g.h) {
-        sixel_helper_set_additional_message(
-            "corrupt GIF (reason: invalid image size).");
-        status = SIXEL_BAD_INPUT;
-        goto end;
-    }
-    if (g.w > SIXEL_WIDTH_LIMIT || g.h > SIXEL_HEIGHT_LIMIT) {
-        sixel_helper_set_additional_message(
-            "corrupt GIF (reason: image dimensions exceed limit).");
-        status = SIXEL_BAD_INPUT;
-        goto end;
-    }
-    pcount = (size_t)g.w * (size_t)g.h;
-    if (pcount > SIXEL_ALLOCATE_BYTES_MAX) {
-        sixel_helper_set_additional_message(
-            "corrupt GIF (reason: image data exceeds limit).");
-        status = SIXEL_BAD_INPUT;
-        goto end;
-    }
-    if (pcount > SIZE_MAX / 3) {
-        sixel_helper_set_additional_message(
-            "corrupt GIF (reason: image data exceeds limit).");
-        status = SIXEL_BAD_INPUT;
-        goto end;
-    }
-    bcount = pcount * 3;
-
-    g.out = (unsigned char *)sixel_allocator_malloc(allocator, bcount);
-    g.prev_out = (unsigned char *)sixel_allocator_malloc(allocator, bcount);
-    g.history = (unsigned char *)sixel_allocator_malloc(allocator, pcount);
-    if (g.out == NULL || g.prev_out == NULL || g.history == NULL) {
-        sprintf(message,
-                "load_gif: sixel_allocator_malloc() failed. size=%zu.",
-                pcount);
-        sixel_helper_set_additional_message(message);
-        status = SIXEL_BAD_ALLOCATION;
-        goto end;
-    }
-    bg_r = g.pal[g.bgindex][2];
-    bg_g = g.pal[g.bgindex][1];
-    bg_b = g.pal[g.bgindex][0];
-    for (i = 0; i < pcount; ++i) {
-        g.out[i * 3 + 0] = bg_r;
-        g.out[i * 3 + 1] = bg_g;
-        g.out[i * 3 + 2] = bg_b;
-        g.prev_out[i * 3 + 0] = bg_r;
-        g.prev_out[i * 3 + 1] = bg_g;
-        g.prev_out[i * 3 + 2] = bg_b;
-    }
-    memset(g.history, 0, pcount);
-
-    loop_no = 0;
+    loop_no = 0;
 
     for (;;) { /* per loop */
 
         frame_no = 0;
 
-        s.img_buffer = s.img_buffer_original;
-        status = gif_load_header(&s, &g);
+        s->img_buffer = s->img_buffer_original;
+        status = gif_load_header(s, g);
         if (status != SIXEL_OK) {
             goto end;
         }
-        if (g.w <= 0 || g.h <= 0 ||
-            (size_t)g.w > SIZE_MAX / (size_t)g.h) {
-            sixel_helper_set_additional_message(
+        if (g->w <= 0 || g->h <= 0 ||
+            (size_t)g->w > SIZE_MAX / (size_t)g->h) {
+            gif_set_message(g,
                 "corrupt GIF (reason: invalid image size).");
             status = SIXEL_BAD_INPUT;
             goto end;
         }
-        if (g.w > SIXEL_WIDTH_LIMIT || g.h > SIXEL_HEIGHT_LIMIT) {
-            sixel_helper_set_additional_message(
+        if (g->w > SIXEL_WIDTH_LIMIT || g->h > SIXEL_HEIGHT_LIMIT) {
+            gif_set_message(g,
                 "corrupt GIF (reason: image dimensions exceed limit).");
             status = SIXEL_BAD_INPUT;
             goto end;
         }
-        pcount = (size_t)g.w * (size_t)g.h;
+        pcount = (size_t)g->w * (size_t)g->h;
         if (pcount > SIXEL_ALLOCATE_BYTES_MAX) {
-            sixel_helper_set_additional_message(
+            gif_set_message(g,
                 "corrupt GIF (reason: image data exceeds limit).");
             status = SIXEL_BAD_INPUT;
             goto end;
         }
 
         /* reset canvas for new loop */
-        bg_r = g.pal[g.bgindex][2];
-        bg_g = g.pal[g.bgindex][1];
-        bg_b = g.pal[g.bgindex][0];
+        bg_r = g->pal[g->bgindex][2];
+        bg_g = g->pal[g->bgindex][1];
+        bg_b = g->pal[g->bgindex][0];
         for (i = 0; i < pcount; ++i) {
-            g.out[i * 3 + 0] = bg_r;
-            g.out[i * 3 + 1] = bg_g;
-            g.out[i * 3 + 2] = bg_b;
-            g.prev_out[i * 3 + 0] = bg_r;
-            g.prev_out[i * 3 + 1] = bg_g;
-            g.prev_out[i * 3 + 2] = bg_b;
+            g->out[i * 3 + 0] = bg_r;
+            g->out[i * 3 + 1] = bg_g;
+            g->out[i * 3 + 2] = bg_b;
+            g->prev_out[i * 3 + 0] = bg_r;
+            g->prev_out[i * 3 + 1] = bg_g;
+            g->prev_out[i * 3 + 2] = bg_b;
         }
-        memset(g.history, 0, pcount);
-        g.is_multiframe = 0;
+        memset(g->history, 0, pcount);
+        g->is_multiframe = 0;
 
-        g.is_terminated = 0;
+        g->is_terminated = 0;
 
         for (;;) { /* per frame */
-            status = gif_load_next(&s, &g, bgcolor);
+            status = gif_load_next(s, g, bgcolor);
             if (status != SIXEL_OK) {
                 goto end;
             }
-            if (g.is_terminated) {
+            if (g->is_terminated) {
                 break;
             }
 
-            status = sixel_frame_new(&frame, allocator);
-            if (SIXEL_FAILED(status)) {
-                goto end;
-            }
-            frame->loop_count = loop_no;
-            frame->frame_no = frame_no;
-            frame->width = g.actual_width;
-            frame->height = g.actual_height;
-            status = gif_init_frame(frame, &g, bgcolor, reqcolors, fuse_palette);
-            if (status != SIXEL_OK) {
-                goto end;
-            }
-
-            status = fnp.fn(frame, context);
-            sixel_frame_unref(frame);
-            frame = NULL;
+            status = emit(g, loop_no, frame_no, data);
             if (status != SIXEL_OK) {
                 goto end;
             }
@@ -864,23 +1030,85 @@ load_gif(
 
         ++loop_no;
 
-        if (g.loop_count < 0) {
+        if (g->loop_count < 0) {
             break;
         }
         if (loop_control == SIXEL_LOOP_DISABLE || frame_no == 1) {
             break;
         }
         if (loop_control == SIXEL_LOOP_AUTO) {
-            if (loop_no == g.loop_count) {
+            if (loop_no == g->loop_count) {
                 break;
             }
         }
     }
 
+    status = SIXEL_OK;
+
+end:
+    return status;
+}
+
+
+/* the caller side of load_gif() */
+typedef struct gif_load_context {
+    fn_pointer fnp;
+    void *context;
+    unsigned char *bgcolor;
+    int reqcolors;
+    int fuse_palette;
+    int loop_control;
+    sixel_allocator_t *allocator;
+} gif_load_context_t;
+
+
+/* number of loops gif_decode_frames() plays, 0 for endless */
+static int
+gif_count_loops(
+    gif_t   /* in */ *g,
+    int     /* in */ loop_control)
+{
+    if (g->loop_count < 0 || loop_control == SIXEL_LOOP_DISABLE) {
+        return 1;
+    }
+    if (loop_control == SIXEL_LOOP_FORCE) {
+        return 0;
+    }
+
+    return g->loop_count;
+}
+
+
+/* wrap the canvas into a new frame and pass it to the callback */
+static SIXELSTATUS
+gif_emit_frame(
+    gif_t   /* in */ *g,
+    int     /* in */ loop_no,
+    int     /* in */ frame_no,
+    void    /* in */ *data)
+{
+    SIXELSTATUS status = SIXEL_FALSE;
+    gif_load_context_t *load = (gif_load_context_t *)data;
+    sixel_frame_t *frame = NULL;
+
+    status = sixel_frame_new(&frame, load->allocator);
+    if (SIXEL_FAILED(status)) {
+        goto end;
+    }
+    frame->loop_count = loop_no;
+    frame->loops = gif_count_loops(g, load->loop_control);
+    frame->frame_no = frame_no;
+    frame->width = g->actual_width;
+    frame->height = g->actual_height;
+    status = gif_init_frame(frame, g, load->bgcolor,
+                            load->reqcolors, load->fuse_palette);
+    if (status != SIXEL_OK) {
+        goto end;
+    }
+
+    status = load->fnp.fn(frame, load->context);
+
 end:
-    sixel_allocator_free(allocator, g.out);
-    sixel_allocator_free(allocator, g.prev_out);
-    sixel_allocator_free(allocator, g.history);
     if (frame != NULL) {
         sixel_frame_unref(frame);
     }
@@ -889,6 +1117,412 @@ end:
 }
 
 
+#if GIF_USE_THREADS
+/*
+ * number of threads for the frame pipeline, taken from ${SIXEL_THREADS}
+ * or the number of online processors.
+ */
+static int
+gif_get_thread_count(void)
+{
+    int nthreads = 1;
+    char const *env;
+
+#if HAVE_TESTS
+    if (gif_force_threads > 0) {
+        return gif_force_threads;
+    }
+#endif
+
+    env = getenv("SIXEL_THREADS");
+    if (env != NULL && atoi(env) > 0) {
+        nthreads = atoi(env);
+    }
+#if HAVE_UNISTD_H && defined(_SC_NPROCESSORS_ONLN)
+    else {
+        nthreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    }
+#endif
+
+    return nthreads > 1 ? nthreads: 1;
+}
+
+
+/* number of decoded frames the decoder thread may run ahead */
+#define GIF_PIPELINE_DEPTH 2
+
+typedef struct gif_slot {
+    unsigned char *pixels;  /* canvas sized RGB888 buffer */
+    int pixelformat;        /* RGB888 or PAL8 */
+    unsigned char palette[256 * 3];
+    int ncolors;
+    int width;
+    int height;
+    int delay;
+    int multiframe;
+    int loop_no;
+    int loops;
+    int frame_no;
+} gif_slot_t;
+
+/*
+ * a bounded FIFO of decoded frames between the decoder thread and the
+ * calling thread. slots[head] .. slots[head + count - 1] belong to the
+ * caller, the others to the decoder. only the caller touches the allocator.
+ */
+typedef struct gif_pipeline {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    gif_slot_t slots[GIF_PIPELINE_DEPTH];
+    int head;
+    int count;
+    int done;
+    int cancelled;
+    SIXELSTATUS status;     /* result of the decoder thread */
+    char message[GIF_MESSAGE_SIZE];  /* error message of the decoder thread */
+    gif_context_t *s;
+    gif_t *g;
+    unsigned char *bgcolor;
+    int fstatic;
+    int loop_control;
+} gif_pipeline_t;
+
+
+/* decoder side: copy the canvas into the next free slot */
+static SIXELSTATUS
+gif_pipeline_push(
+    gif_t   /* in */ *g,
+    int     /* in */ loop_no,
+    int     /* in */ frame_no,
+    void    /* in */ *data)
+{
+    gif_pipeline_t *pipeline = (gif_pipeline_t *)data;
+    gif_slot_t *slot;
+
+    pthread_mutex_lock(&pipeline->mutex);
+    while (pipeline->count == GIF_PIPELINE_DEPTH && !pipeline->cancelled) {
+        pthread_cond_wait(&pipeline->cond, &pipeline->mutex);
+    }
+    if (pipeline->cancelled) {
+        pthread_mutex_unlock(&pipeline->mutex);
+        return SIXEL_INTERRUPTED;
+    }
+    slot = &pipeline->slots[(pipeline->head + pipeline->count)
+                            % GIF_PIPELINE_DEPTH];
+    pthread_mutex_unlock(&pipeline->mutex);
+
+    /* fail like gif_init_frame() does on the serial path */
+    if (g->actual_width <= 0 || g->actual_height <= 0) {
+        gif_set_message(g,
+            "sixel_allocator_malloc() failed in gif_init_frame().");
+        return SIXEL_BAD_ALLOCATION;
+    }
+
+    slot->width = g->actual_width;
+    slot->height = g->actual_height;
+    slot->delay = g->delay;
+    slot->multiframe = (g->loop_count != (-1));
+    slot->loop_no = loop_no;
+    slot->loops = gif_count_loops(g, pipeline->loop_control);
+    slot->frame_no = frame_no;
+    if (g->paletted) {
+        slot->pixelformat = SIXEL_PIXELFORMAT_PAL8;
+        gif_export_indices(g, slot->pixels);
+        slot->ncolors = gif_export_palette(g, slot->palette);
+    } else {
+        slot->pixelformat = SIXEL_PIXELFORMAT_RGB888;
+        memcpy(slot->pixels, g->out,
+               (size_t)slot->width * (size_t)slot->height * 3);
+    }
+
+    pthread_mutex_lock(&pipeline->mutex);
+    pipeline->count++;
+    pthread_cond_broadcast(&pipeline->cond);
+    pthread_mutex_unlock(&pipeline->mutex);
+
+    return SIXEL_OK;
+}
+
+
+static void *
+gif_pipeline_main(void *arg)
+{
+    gif_pipeline_t *pipeline = (gif_pipeline_t *)arg;
+    SIXELSTATUS status;
+
+    status = gif_decode_frames(pipeline->s, pipeline->g, pipeline->bgcolor,
+                               pipeline->fstatic, pipeline->loop_control,
+                               gif_pipeline_push, pipeline);
+
+    pthread_mutex_lock(&pipeline->mutex);
+    pipeline->status = status;
+    pipeline->done = 1;
+    pthread_cond_broadcast(&pipeline->cond);
+    pthread_mutex_unlock(&pipeline->mutex);
+
+    return NULL;
+}
+
+
+/*
+ * decode frame N + 1 on a worker thread while the callback (usually the
+ * whole quantize and encode step) processes frame N on the calling thread.
+ * callbacks still run in frame order on the calling thread.
+ */
+static SIXELSTATUS
+gif_decode_frames_pipelined(
+    gif_context_t       /* in */ *s,
+    gif_t               /* in */ *g,
+    size_t              /* in */ bcount,
+    int                 /* in */ fstatic,
+    int                 /* in */ loop_control,
+    gif_load_context_t  /* in */ *load)
+{
+    SIXELSTATUS status = SIXEL_OK;
+    gif_pipeline_t pipeline;
+    gif_slot_t slot;
+    sixel_frame_t *frame;
+    unsigned char *pixels;
+    pthread_t thread;
+    int i;
+
+    memset(&pipeline, 0, sizeof(pipeline));
+    pipeline.s = s;
+    pipeline.g = g;
+    pipeline.bgcolor = load->bgcolor;
+    pipeline.fstatic = fstatic;
+    pipeline.loop_control = loop_control;
+
+    for (i = 0; i < GIF_PIPELINE_DEPTH; ++i) {
+        pipeline.slots[i].pixels
+            = (unsigned char *)sixel_allocator_malloc(load->allocator, bcount);
+        if (pipeline.slots[i].pixels == NULL) {
+            sixel_helper_set_additional_message(
+                "load_gif: sixel_allocator_malloc() failed.");
+            status = SIXEL_BAD_ALLOCATION;
+            goto free_slots;
+        }
+    }
+
+    if (pthread_mutex_init(&pipeline.mutex, NULL) != 0) {
+        goto serial;
+    }
+    if (pthread_cond_init(&pipeline.cond, NULL) != 0) {
+        pthread_mutex_destroy(&pipeline.mutex);
+        goto serial;
+    }
+    g->message = pipeline.message;
+    if (pthread_create(&thread, NULL, gif_pipeline_main, &pipeline) != 0) {
+        g->message = NULL;
+        pthread_cond_destroy(&pipeline.cond);
+        pthread_mutex_destroy(&pipeline.mutex);
+        goto serial;
+    }
+
+    for (;;) {
+        pthread_mutex_lock(&pipeline.mutex);
+        while (pipeline.count == 0 && !pipeline.done) {
+            pthread_cond_wait(&pipeline.cond, &pipeline.mutex);
+        }
+        if (pipeline.count == 0) {
+            pthread_mutex_unlock(&pipeline.mutex);
+            break;
+        }
+        pthread_mutex_unlock(&pipeline.mutex);
+
+        /* the head slot stays ours until count is decremented */
+        pixels = (unsigned char *)sixel_allocator_malloc(load->allocator,
+                                                         bcount);
+        if (pixels == NULL) {
+            sixel_helper_set_additional_message(
+                "load_gif: sixel_allocator_malloc() failed.");
+            status = SIXEL_BAD_ALLOCATION;
+            break;
+        }
+
+        pthread_mutex_lock(&pipeline.mutex);
+        slot = pipeline.slots[pipeline.head];
+        pipeline.slots[pipeline.head].pixels = pixels;
+        pipeline.head = (pipeline.head + 1) % GIF_PIPELINE_DEPTH;
+        pipeline.count--;
+        pthread_cond_broadcast(&pipeline.cond);
+        pthread_mutex_unlock(&pipeline.mutex);
+
+        status = sixel_frame_new(&frame, load->allocator);
+        if (SIXEL_FAILED(status)) {
+            sixel_allocator_free(load->allocator, slot.pixels);
+            break;
+        }
+        frame->pixels = slot.pixels;
+        frame->width = slot.width;
+        frame->height = slot.height;
+        frame->delay = slot.delay;
+        frame->multiframe = slot.multiframe;
+        frame->loop_count = slot.loop_no;
+        frame->loops = slot.loops;
+        frame->frame_no = slot.frame_no;
+        frame->pixelformat = slot.pixelformat;
+        if (slot.pixelformat == SIXEL_PIXELFORMAT_PAL8) {
+            frame->palette = (unsigned char *)sixel_allocator_malloc(
+                load->allocator, sizeof(slot.palette));
+            if (frame->palette == NULL) {
+                sixel_helper_set_additional_message(
+                    "load_gif: sixel_allocator_malloc() failed.");
+                status = SIXEL_BAD_ALLOCATION;
+                sixel_frame_unref(frame);
+                break;
+            }
+            memcpy(frame->palette, slot.palette, sizeof(slot.palette));
+            frame->ncolors = slot.ncolors;
+        }
+
+        status = load->fnp.fn(frame, load->context);
+        sixel_frame_unref(frame);
+        if (status != SIXEL_OK) {
+            break;
+        }
+    }
+
+    pthread_mutex_lock(&pipeline.mutex);
+    pipeline.cancelled = 1;
+    pthread_cond_broadcast(&pipeline.cond);
+    pthread_mutex_unlock(&pipeline.mutex);
+    pthread_join(thread, NULL);
+    pthread_cond_destroy(&pipeline.cond);
+    pthread_mutex_destroy(&pipeline.mutex);
+    g->message = NULL;
+
+    /* a failure of the calling thread keeps its own message */
+    if (status == SIXEL_OK) {
+        status = pipeline.status;
+        if (pipeline.message[0] != '\0') {
+            sixel_helper_set_additional_message(pipeline.message);
+        }
+    }
+    goto free_slots;
+
+serial:
+    status = gif_decode_frames(s, g, load->bgcolor, fstatic, loop_control,
+                               gif_emit_frame, load);
+
+free_slots:
+    for (i = 0; i < GIF_PIPELINE_DEPTH; ++i) {
+        sixel_allocator_free(load->allocator, pipeline.slots[i].pixels);
+    }
+
+    return status;
+}
+#endif  /* GIF_USE_THREADS */
+
+
+SIXELSTATUS
+load_gif(
+    unsigned char       /* in */ *buffer,
+    int                 /* in */ size,
+    unsigned char       /* in */ *bgcolor,
+    int                 /* in */ reqcolors,
+    int                 /* in */ fuse_palette,
+    int                 /* in */ fstatic,
+    int                 /* in */ loop_control,
+    void                /* in */ *fn_load,     /* callback */
+    void                /* in */ *context,     /* private data for callback */
+    sixel_allocator_t   /* in */ *allocator)   /* allocator object */
+{
+    gif_context_t s;
+    gif_t g;
+    SIXELSTATUS status = SIXEL_FALSE;
+    gif_load_context_t load;
+    char message[256];
+    size_t pcount;
+    size_t bcount;
+
+    load.fnp.p = fn_load;
+    load.context = context;
+    load.bgcolor = bgcolor;
+    load.reqcolors = reqcolors;
+    load.fuse_palette = fuse_palette;
+    load.loop_control = loop_control;
+    load.allocator = allocator;
+
+    s.img_buffer = s.img_buffer_original = (unsigned char *)buffer;
+    s.img_buffer_end = (unsigned char *)buffer + size;
+    memset(&g, 0, sizeof(g));
+    g.delay = SIXEL_DEFALUT_GIF_DELAY;
+    status = gif_load_header(&s, &g);
+    if (status != SIXEL_OK) {
+        goto end;
+    }
+    if (g.w <= 0 || g.h <= 0 ||
+        (size_t)g.w > SIZE_MAX / (size_t)g.h) {
+        sixel_helper_set_additional_message(
+            "corrupt GIF (reason: invalid image size).");
+        status = SIXEL_BAD_INPUT;
+        goto end;
+    }
+    if (g.w > SIXEL_WIDTH_LIMIT || g.h > SIXEL_HEIGHT_LIMIT) {
+        sixel_helper_set_additional_message(
+            "corrupt GIF (reason: image dimensions exceed limit).");
+        status = SIXEL_BAD_INPUT;
+        goto end;
+    }
+    pcount = (size_t)g.w * (size_t)g.h;
+    if (pcount > SIXEL_ALLOCATE_BYTES_MAX) {
+        sixel_helper_set_additional_message(
+            "corrupt GIF (reason: image data exceeds limit).");
+        status = SIXEL_BAD_INPUT;
+        goto end;
+    }
+    if (pcount > SIZE_MAX / 3) {
+        sixel_helper_set_additional_message(
+            "corrupt GIF (reason: image data exceeds limit).");
+        status = SIXEL_BAD_INPUT;
+        goto end;
+    }
+    bcount = pcount * 3;
+
+    g.out = (unsigned char *)sixel_allocator_malloc(allocator, bcount);
+    g.prev_out = (unsigned char *)sixel_allocator_malloc(allocator, bcount);
+    g.history = (unsigned char *)sixel_allocator_malloc(allocator, pcount);
+    g.indices = (unsigned char *)sixel_allocator_malloc(allocator, pcount);
+    if (g.out == NULL || g.prev_out == NULL || g.history == NULL ||
+        g.indices == NULL) {
+        sprintf(message,
+                "load_gif: sixel_allocator_malloc() failed. size=%zu.",
+                pcount);
+        sixel_helper_set_additional_message(message);
+        status = SIXEL_BAD_ALLOCATION;
+        goto end;
+    }
+    g.fuse_palette = fuse_palette;
+    g.reqcolors = reqcolors;
+    g.fstatic = fstatic;
+
+#if GIF_USE_THREADS
+    /* a still image has nothing to overlap */
+    if (!fstatic && gif_get_thread_count() > 1) {
+        status = gif_decode_frames_pipelined(&s, &g, bcount,
+                                             fstatic, loop_control, &load);
+        goto end;
+    }
+#endif  /* GIF_USE_THREADS */
+
+    status = gif_decode_frames(&s, &g, bgcolor, fstatic, loop_control,
+                               gif_emit_frame, &load);
+
+end:
+    /* the callback plays the remaining loops by itself */
+    if (status == SIXEL_LOOPS_REPLAYED) {
+        status = SIXEL_OK;
+    }
+    sixel_allocator_free(allocator, g.out);
+    sixel_allocator_free(allocator, g.prev_out);
+    sixel_allocator_free(allocator, g.history);
+    sixel_allocator_free(allocator, g.indices);
+
+    return status;
+}
+
+
 #if HAVE_TESTS
 static unsigned char const test1_gif[] = {
   0x47, 0x49, 0x46, 0x38, 0x39, 0x61, 0x02, 0x00, 0x02, 0x00, 0x81, 0x00,
@@ -990,6 +1624,387 @@ end:
 }
 
 
+#define TEST2_MAX_FRAMES 256
+
+typedef struct {
+    int count;
+    int fail_at;
+    unsigned long hash[TEST2_MAX_FRAMES];
+    int info[TEST2_MAX_FRAMES][6];
+} test2_context_t;
+
+static SIXELSTATUS
+test2_on_frame(
+    sixel_frame_t *frame,
+    void *context)
+{
+    test2_context_t *ctx = (test2_context_t *)context;
+    unsigned char *pixels = sixel_frame_get_pixels(frame);
+    unsigned long hash = 2166136261UL;
+    size_t size;
+    size_t i;
+
+    if (ctx->count == ctx->fail_at) {
+        return SIXEL_RUNTIME_ERROR;
+    }
+    if (ctx->count < TEST2_MAX_FRAMES) {
+        size = (size_t)sixel_frame_get_width(frame)
+             * (size_t)sixel_frame_get_height(frame);
+        if (sixel_frame_get_pixelformat(frame) == SIXEL_PIXELFORMAT_RGB888) {
+            size *= 3;
+        }
+        for (i = 0; i < size; ++i) {
+            hash = ((hash ^ pixels[i]) * 16777619UL) & 0xffffffffUL;
+        }
+        ctx->hash[ctx->count] = hash;
+        ctx->info[ctx->count][0] = sixel_frame_get_width(frame);
+        ctx->info[ctx->count][1] = sixel_frame_get_height(frame);
+        ctx->info[ctx->count][2] = sixel_frame_get_delay(frame);
+        ctx->info[ctx->count][3] = sixel_frame_get_frame_no(frame);
+        ctx->info[ctx->count][4] = sixel_frame_get_loop_no(frame)
+                                 * 2 + sixel_frame_get_multiframe(frame);
+        ctx->info[ctx->count][5] = sixel_frame_get_pixelformat(frame);
+    }
+    ++ctx->count;
+
+    return SIXEL_OK;
+}
+
+static unsigned char *
+test2_read_file(char const *filename, int *len)
+{
+    FILE *fp;
+    unsigned char *buffer;
+    long size;
+
+    fp = fopen(filename, "rb");
+    if (fp == NULL) {
+        return NULL;
+    }
+    if (fseek(fp, 0, SEEK_END) != 0 || (size = ftell(fp)) <= 0 ||
+        fseek(fp, 0, SEEK_SET) != 0) {
+        fclose(fp);
+        return NULL;
+    }
+    buffer = (unsigned char *)malloc((size_t)size);
+    if (buffer != NULL && fread(buffer, 1, (size_t)size, fp) != (size_t)size) {
+        free(buffer);
+        buffer = NULL;
+    }
+    fclose(fp);
+    *len = (int)size;
+
+    return buffer;
+}
+
+/* pipelined decoding emits the same frames in the same order */
+static int
+test2(void)
+{
+    SIXELSTATUS status;
+    SIXELSTATUS expected;
+    int nret = EXIT_FAILURE;
+    sixel_allocator_t *allocator = NULL;
+    test2_context_t serial;
+    test2_context_t pipelined;
+    unsigned char *buffer = NULL;
+    int len = 0;
+    int i;
+    int loop;
+    static char const *files[] = {
+        NULL,
+        "../images/seq2gif.gif",
+        "../images/snake.gif",
+    };
+    static int const loops[] = {
+        SIXEL_LOOP_DISABLE,
+        SIXEL_LOOP_FORCE,
+    };
+
+    status = sixel_allocator_new(&allocator, NULL, NULL, NULL, NULL);
+    if (SIXEL_FAILED(status)) {
+        goto end;
+    }
+
+    for (i = 0; i < (int)(sizeof(files) / sizeof(files[0])); ++i) {
+        free(buffer);
+        buffer = NULL;
+        if (files[i] == NULL) {
+            buffer = (unsigned char *)malloc(sizeof(test1_gif));
+            if (buffer == NULL) {
+                goto end;
+            }
+            memcpy(buffer, test1_gif, sizeof(test1_gif));
+            len = (int)sizeof(test1_gif);
+        } else {
+            buffer = test2_read_file(files[i], &len);
+            if (buffer == NULL) {
+                continue;
+            }
+        }
+        for (loop = 0; loop < (int)(sizeof(loops) / sizeof(loops[0])); ++loop) {
+            memset(&serial, 0, sizeof(serial));
+            memset(&pipelined, 0, sizeof(pipelined));
+            serial.fail_at = pipelined.fail_at = (-1);
+            if (loops[loop] == SIXEL_LOOP_FORCE) {
+                /* stop the endless loop from the callback */
+                serial.fail_at = pipelined.fail_at = 40;
+            }
+
+            gif_force_threads = 1;
+            expected = load_gif(buffer, len, NULL, SIXEL_PALETTE_MAX, 1, 0,
+                                loops[loop], (void *)test2_on_frame,
+                                &serial, allocator);
+            if (SIXEL_FAILED(expected) && serial.count != serial.fail_at) {
+                goto end;
+            }
+            gif_force_threads = 2;
+            status = load_gif(buffer, len, NULL, SIXEL_PALETTE_MAX, 1, 0,
+                              loops[loop], (void *)test2_on_frame,
+                              &pipelined, allocator);
+            if (status != expected) {
+                goto end;
+            }
+            if (serial.count == 0 || serial.count != pipelined.count) {
+                goto end;
+            }
+            if (memcmp(serial.hash, pipelined.hash, sizeof(serial.hash)) != 0) {
+                goto end;
+            }
+            if (memcmp(serial.info, pipelined.info, sizeof(serial.info)) != 0) {
+                goto end;
+            }
+        }
+    }
+
+    /* a failure of the callback stops the decoder thread */
+    memset(&pipelined, 0, sizeof(pipelined));
+    pipelined.fail_at = 1;
+    status = load_gif((unsigned char *)test1_gif, sizeof(test1_gif),
+                      NULL, SIXEL_PALETTE_MAX, 1, 0, SIXEL_LOOP_FORCE,
+                      (void *)test2_on_frame, &pipelined, allocator);
+    if (status != SIXEL_RUNTIME_ERROR || pipelined.count != 1) {
+        goto end;
+    }
+
+    /* an error of the decoder thread is reported by the calling thread */
+    free(buffer);
+    buffer = (unsigned char *)malloc(sizeof(test1_gif));
+    if (buffer == NULL) {
+        goto end;
+    }
+    memcpy(buffer, test1_gif, sizeof(test1_gif));
+    buffer[80] = 0x05;  /* move the second image out of the screen */
+    memset(&pipelined, 0, sizeof(pipelined));
+    pipelined.fail_at = (-1);
+    sixel_helper_set_additional_message("");
+    status = load_gif(buffer, (int)sizeof(test1_gif),
+                      NULL, SIXEL_PALETTE_MAX, 1, 0, SIXEL_LOOP_DISABLE,
+                      (void *)test2_on_frame, &pipelined, allocator);
+    if (status != SIXEL_RUNTIME_ERROR || pipelined.count != 1) {
+        goto end;
+    }
+    if (strcmp(sixel_helper_get_additional_message(),
+               "corrupt GIF (reason: bad Image Separator).") != 0) {
+        goto end;
+    }
+
+    nret = EXIT_SUCCESS;
+
+end:
+    gif_force_threads = 0;
+    free(buffer);
+    if (allocator != NULL) {
+        sixel_allocator_unref(allocator);
+    }
+
+    return nret;
+}
+
+
+/* 7x11 interlaced image with a 4 color table, pixel (x, y) has the
+   color ((x * 3 + y * 5) / 4) % 4 */
+static unsigned char const test3_gif[] = {
+  0x47, 0x49, 0x46, 0x38, 0x39, 0x61, 0x07, 0x00, 0x0b, 0x00, 0x81, 0x00,
+  0x00, 0xa5, 0x4d, 0xca, 0x18, 0x25, 0x30, 0xbb, 0x1d, 0x6d, 0x13, 0x2c,
+  0xde, 0x21, 0xf9, 0x04, 0x00, 0x03, 0x00, 0x00, 0x00, 0x2c, 0x00, 0x00,
+  0x00, 0x00, 0x07, 0x00, 0x0b, 0x00, 0x40, 0x02, 0x07, 0x04, 0x22, 0x33,
+  0x20, 0x79, 0x18, 0xd0, 0x07, 0x3a, 0x8e, 0xaa, 0x57, 0x91, 0x8b, 0x6d,
+  0x07, 0x45, 0xdf, 0x31, 0x97, 0x66, 0x79, 0x93, 0x02, 0x34, 0x14, 0x00,
+  0x3b
+};
+
+static SIXELSTATUS
+test3_on_frame(
+    sixel_frame_t *frame,
+    void *context)
+{
+    sixel_frame_t **pframe = (sixel_frame_t **)context;
+
+    if (*pframe != NULL) {
+        sixel_frame_unref(*pframe);
+    }
+    sixel_frame_ref(frame);
+    *pframe = frame;
+
+    return SIXEL_OK;
+}
+
+/* a still image is passed as palette indices if requested */
+static int
+test3(void)
+{
+    SIXELSTATUS status;
+    int nret = EXIT_FAILURE;
+    sixel_allocator_t *allocator = NULL;
+    sixel_frame_t *rgb = NULL;
+    sixel_frame_t *paletted = NULL;
+    unsigned char *pixels;
+    unsigned char *indices;
+    unsigned char *palette;
+    int x;
+    int y;
+    int i;
+
+    status = sixel_allocator_new(&allocator, NULL, NULL, NULL, NULL);
+    if (SIXEL_FAILED(status)) {
+        goto end;
+    }
+
+    status = load_gif((unsigned char *)test3_gif, sizeof(test3_gif),
+                      NULL, SIXEL_PALETTE_MAX, 0, 0, SIXEL_LOOP_DISABLE,
+                      (void *)test3_on_frame, &rgb, allocator);
+    if (SIXEL_FAILED(status) || rgb == NULL) {
+        goto end;
+    }
+    status = load_gif((unsigned char *)test3_gif, sizeof(test3_gif),
+                      NULL, SIXEL_PALETTE_MAX, 1, 0, SIXEL_LOOP_DISABLE,
+                      (void *)test3_on_frame, &paletted, allocator);
+    if (SIXEL_FAILED(status) || paletted == NULL) {
+        goto end;
+    }
+
+    if (sixel_frame_get_pixelformat(rgb) != SIXEL_PIXELFORMAT_RGB888 ||
+        sixel_frame_get_pixelformat(paletted) != SIXEL_PIXELFORMAT_PAL8 ||
+        sixel_frame_get_ncolors(paletted) != 4 ||
+        sixel_frame_get_width(rgb) != 7 || sixel_frame_get_height(rgb) != 11 ||
+        sixel_frame_get_width(paletted) != 7 ||
+        sixel_frame_get_height(paletted) != 11) {
+        goto end;
+    }
+
+    pixels = sixel_frame_get_pixels(rgb);
+    indices = sixel_frame_get_pixels(paletted);
+    palette = sixel_frame_get_palette(paletted);
+    for (y = 0; y < 11; ++y) {
+        for (x = 0; x < 7; ++x) {
+            i = y * 7 + x;
+            if (indices[i] != ((x * 3 + y * 5) / 4) % 4) {
+                goto end;
+            }
+            if (memcmp(pixels + i * 3, palette + indices[i] * 3, 3) != 0) {
+                goto end;
+            }
+        }
+    }
+
+    /* frames of an animation are composed on the RGB canvas */
+    sixel_frame_unref(paletted);
+    paletted = NULL;
+    status = load_gif((unsigned char *)test1_gif, sizeof(test1_gif),
+                      NULL, SIXEL_PALETTE_MAX, 1, 0, SIXEL_LOOP_DISABLE,
+                      (void *)test3_on_frame, &paletted, allocator);
+    if (SIXEL_FAILED(status) || paletted == NULL ||
+        sixel_frame_get_pixelformat(paletted) != SIXEL_PIXELFORMAT_RGB888) {
+        goto end;
+    }
+
+    nret = EXIT_SUCCESS;
+
+end:
+    if (rgb != NULL) {
+        sixel_frame_unref(rgb);
+    }
+    if (paletted != NULL) {
+        sixel_frame_unref(paletted);
+    }
+    if (allocator != NULL) {
+        sixel_allocator_unref(allocator);
+    }
+
+    return nret;
+}
+
+
+typedef struct {
+    int count;
+    int loops;
+} test4_context_t;
+
+static SIXELSTATUS
+test4_on_frame(
+    sixel_frame_t *frame,
+    void *context)
+{
+    test4_context_t *ctx = (test4_context_t *)context;
+
+    ++ctx->count;
+    ctx->loops = frame->loops;
+    if (sixel_frame_get_loop_no(frame) > 0) {
+        return SIXEL_LOOPS_REPLAYED;
+    }
+
+    return SIXEL_OK;
+}
+
+/* the callback may play the following loops by itself */
+static int
+test4(void)
+{
+    SIXELSTATUS status;
+    int nret = EXIT_FAILURE;
+    sixel_allocator_t *allocator = NULL;
+    test4_context_t ctx;
+    int threads;
+
+    status = sixel_allocator_new(&allocator, NULL, NULL, NULL, NULL);
+    if (SIXEL_FAILED(status)) {
+        goto end;
+    }
+
+    for (threads = 1; threads <= 2; ++threads) {
+        gif_force_threads = threads;
+
+        /* decoding stops at the first frame of the second loop */
+        memset(&ctx, 0, sizeof(ctx));
+        status = load_gif((unsigned char *)test1_gif, sizeof(test1_gif),
+                          NULL, SIXEL_PALETTE_MAX, 1, 0, SIXEL_LOOP_FORCE,
+                          (void *)test4_on_frame, &ctx, allocator);
+        if (status != SIXEL_OK || ctx.count != 3 || ctx.loops != 0) {
+            goto end;
+        }
+
+        memset(&ctx, 0, sizeof(ctx));
+        status = load_gif((unsigned char *)test1_gif, sizeof(test1_gif),
+                          NULL, SIXEL_PALETTE_MAX, 1, 0, SIXEL_LOOP_DISABLE,
+                          (void *)test4_on_frame, &ctx, allocator);
+        if (status != SIXEL_OK || ctx.count != 2 || ctx.loops != 1) {
+            goto end;
+        }
+    }
+
+    nret = EXIT_SUCCESS;
+
+end:
+    gif_force_threads = 0;
+    if (allocator != NULL) {
+        sixel_allocator_unref(allocator);
+    }
+
+    return nret;
+}
+
+
 SIXELAPI int
 sixel_fromgif_tests_main(void)
 {
@@ -999,6 +2014,9 @@ sixel_fromgif_tests_main(void)
 
     static testcase const testcases[] = {
         test1,
+        test2,
+        test3,
+        test4,
     };
 
     for (i = 0; i < sizeof(testcases) / sizeof(testcase); ++i) {
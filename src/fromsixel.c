@@ -31,9 +31,14 @@
 #if HAVE_INTTYPES_H
 # include <inttypes.h>
 #endif  /* HAVE_INTTYPES_H */
+#if HAVE_TIME_H
+# include <time.h>
+#endif  /* HAVE_TIME_H */
 
 #include <sixel.h>
 #include "output.h"
+#include "fromsixel.h"
+#include "pixelformat.h"
 
 #define SIXEL_RGB(r, g, b) (((r) << 16) + ((g) << 8) +  (b))
 
@@ -63,12 +68,26 @@ static int const sixel_default_color_table[] = {
 };
 
 
+/* framebuffer of sixel_decode_direct(), colors are resolved on drawing */
+typedef struct direct_target {
+    unsigned char *pixels;
+    int width;
+    int height;
+    int stride;
+    int depth;
+    int red;        /* byte offsets of the components in a pixel */
+    int green;
+    int blue;
+    int alpha;      /* -1 if the pixelformat has no alpha */
+} direct_target_t;
+
 typedef struct image_buffer {
     unsigned char *data;
     int width;
     int height;
     int palette[SIXEL_PALETTE_MAX];
     int ncolors;
+    direct_target_t *target;  /* null for indexed output */
 } image_buffer_t;
 
 typedef enum parse_state {
@@ -97,8 +116,15 @@ typedef struct parser_context {
     int param;
     int nparams;
     int params[DECSIXEL_PARAMS_MAX];
+    int terminated;
 } parser_context_t;
 
+struct sixel_parser {
+    parser_context_t context;
+    image_buffer_t image;
+    sixel_allocator_t *allocator;
+};
+
 
 /*
  * Primary color hues:
@@ -215,6 +241,7 @@ image_buffer_init(
     image->height = height;
     image->data = (unsigned char *)sixel_allocator_malloc(allocator, size);
     image->ncolors = 2;
+    image->target = NULL;
 
     if (image->data == NULL) {
         sixel_helper_set_additional_message(
@@ -264,7 +291,9 @@ image_buffer_resize(
 {
     SIXELSTATUS status = SIXEL_FALSE;
     size_t size;
+    size_t old_size;
     unsigned char *alt_buffer;
+    unsigned char *shrunk_buffer;
     int n;
     int min_height;
 
@@ -300,36 +329,48 @@ image_buffer_resize(
         goto end;
     }
 
+    /*
+     * Resize in place. realloc() can usually extend a large block without
+     * copying it, so growing the height never touches the decoded rows.
+     * Changing the width moves the rows inside the block, starting from the
+     * bottom when rows get wider and from the top when they get narrower.
+     */
     size = (size_t)width * (size_t)height;
-    alt_buffer = (unsigned char *)sixel_allocator_malloc(allocator, size);
-    if (alt_buffer == NULL || size == 0) {
-        /* free source image */
-        sixel_allocator_free(allocator, image->data);
-        image->data = NULL;
-        sixel_helper_set_additional_message(
-            "image_buffer_resize: sixel_allocator_malloc() failed.");
-        status = SIXEL_BAD_ALLOCATION;
-        goto end;
+    old_size = (size_t)image->width * (size_t)image->height;
+    alt_buffer = image->data;
+    if (size > old_size) {
+        alt_buffer = (unsigned char *)sixel_allocator_realloc(allocator,
+                                                              image->data,
+                                                              size);
+        if (alt_buffer == NULL) {
+            /* free source image */
+            sixel_allocator_free(allocator, image->data);
+            image->data = NULL;
+            sixel_helper_set_additional_message(
+                "image_buffer_resize: sixel_allocator_realloc() failed.");
+            status = SIXEL_BAD_ALLOCATION;
+            goto end;
+        }
     }
 
     min_height = height > image->height ? image->height: height;
     if (width > image->width) {  /* if width is extended */
-        for (n = 0; n < min_height; ++n) {
-            /* copy from source image */
-            memcpy(alt_buffer + (size_t)width * (size_t)n,
-                   image->data + (size_t)image->width * (size_t)n,
-                   (size_t)image->width);
+        for (n = min_height - 1; n >= 0; --n) {
+            /* move rows of source image */
+            memmove(alt_buffer + (size_t)width * (size_t)n,
+                    alt_buffer + (size_t)image->width * (size_t)n,
+                    (size_t)image->width);
             /* fill extended area with background color */
             memset(alt_buffer + (size_t)width * (size_t)n + (size_t)image->width,
                    bgindex,
                    (size_t)(width - image->width));
         }
-    } else {
-        for (n = 0; n < min_height; ++n) {
-            /* copy from source image */
-            memcpy(alt_buffer + (size_t)width * (size_t)n,
-                   image->data + (size_t)image->width * (size_t)n,
-                   (size_t)width);
+    } else if (width < image->width) {
+        for (n = 1; n < min_height; ++n) {
+            /* move rows of source image */
+            memmove(alt_buffer + (size_t)width * (size_t)n,
+                    alt_buffer + (size_t)image->width * (size_t)n,
+                    (size_t)width);
         }
     }
 
@@ -340,8 +381,15 @@ image_buffer_resize(
                (size_t)width * (size_t)(height - image->height));
     }
 
-    /* free source image */
-    sixel_allocator_free(allocator, image->data);
+    if (size < old_size) {
+        /* shrinking never fails in practice; keep the block if it does */
+        shrunk_buffer = (unsigned char *)sixel_allocator_realloc(allocator,
+                                                                 alt_buffer,
+                                                                 size);
+        if (shrunk_buffer != NULL) {
+            alt_buffer = shrunk_buffer;
+        }
+    }
 
     image->data = alt_buffer;
     image->width = width;
@@ -373,6 +421,7 @@ parser_context_init(parser_context_t *context)
     context->bgindex = (-1);
     context->nparams = 0;
     context->param = 0;
+    context->terminated = 0;
 
     status = SIXEL_OK;
 
@@ -381,7 +430,7 @@ parser_context_init(parser_context_t *context)
 
 
 static SIXELSTATUS
-safe_addition_for_params(parser_context_t *context, unsigned char *p)
+safe_addition_for_params(parser_context_t *context, unsigned char const *p)
 {
     SIXELSTATUS status = SIXEL_FALSE;
     int x;
@@ -476,14 +525,351 @@ end:
 }
 
 
-/* convert sixel data into indexed pixel bytes and palette data */
-SIXELAPI SIXELSTATUS
-sixel_decode_raw_impl(
-    unsigned char     *p,         /* sixel bytes */
-    int                len,       /* size of sixel bytes */
-    image_buffer_t    *image,
-    parser_context_t  *context,
-    sixel_allocator_t *allocator) /* allocator object */
+/* bottom row (0-5) drawn by each sixel bit pattern, -1 for none */
+static signed char const sixel_bottom_row[64] = {
+    -1,  0,  1,  1,  2,  2,  2,  2,  3,  3,  3,  3,  3,  3,  3,  3,
+     4,  4,  4,  4,  4,  4,  4,  4,  4,  4,  4,  4,  4,  4,  4,  4,
+     5,  5,  5,  5,  5,  5,  5,  5,  5,  5,  5,  5,  5,  5,  5,  5,
+     5,  5,  5,  5,  5,  5,  5,  5,  5,  5,  5,  5,  5,  5,  5,  5,
+};
+
+
+#if HAVE_TESTS
+static int fromsixel_force_generic = 0;
+#endif
+
+
+static int
+sixel_parser_use_runs(void)
+{
+#if HAVE_TESTS
+    if (fromsixel_force_generic) {
+        return 0;
+    }
+#endif
+    return 1;
+}
+
+
+/*
+ * Draw a sixel byte into the framebuffer of sixel_decode_direct(). The color
+ * register is read now, so a later redefinition does not change the pixels
+ * already drawn. Pixels outside the framebuffer are clipped.
+ */
+static void
+sixel_parser_draw_direct(
+    image_buffer_t      *image,
+    parser_context_t    *context,
+    int                 bits)
+{
+    direct_target_t *target = image->target;
+    unsigned char color[4];
+    unsigned char *dst;
+    int rgb;
+    int i;
+    int x;
+    int y;
+    int x0;
+    int x1;
+    int k;
+
+    rgb = image->palette[context->color_index];
+    color[target->red] = (unsigned char)(rgb >> 16 & 0xff);
+    color[target->green] = (unsigned char)(rgb >> 8 & 0xff);
+    color[target->blue] = (unsigned char)(rgb & 0xff);
+    if (target->alpha >= 0) {
+        color[target->alpha] = 0xff;
+    }
+
+    x0 = context->pos_x;
+    x1 = context->pos_x + context->repeat_count;
+    if (x1 > target->width) {
+        x1 = target->width;
+    }
+
+    for (i = 0; i < 6; ++i) {
+        if ((bits >> i & 1) == 0) {
+            continue;
+        }
+        y = context->pos_y + i;
+        if (context->max_y < y) {
+            context->max_y = y;
+        }
+        if (y >= target->height || x0 >= x1) {
+            continue;
+        }
+        dst = target->pixels + (size_t)target->stride * (size_t)y
+            + (size_t)x0 * (size_t)target->depth;
+        for (x = x0; x < x1; ++x) {
+            for (k = 0; k < target->depth; ++k) {
+                *dst++ = color[k];
+            }
+        }
+    }
+
+    if (bits != 0 && context->max_x < context->pos_x + context->repeat_count - 1) {
+        context->max_x = context->pos_x + context->repeat_count - 1;
+    }
+}
+
+
+/* store a 32bit pixel if bit is 1, without a branch on the bit */
+static void
+blend_pixel32(unsigned char *dst, unsigned int pixel, int bit)
+{
+    unsigned int value;
+    unsigned int mask;
+
+    mask = 0u - (unsigned int)bit;
+    memcpy(&value, dst, 4);
+    value = (value & ~mask) | (pixel & mask);
+    memcpy(dst, &value, 4);
+}
+
+
+/* draw a run of plain sixel bytes into the framebuffer of sixel_decode_direct() */
+static SIXELSTATUS
+sixel_parser_draw_direct_run(
+    unsigned char const **pp,       /* in: first sixel byte, out: next byte */
+    unsigned char const *end,       /* end of sixel bytes */
+    image_buffer_t      *image,
+    parser_context_t    *context)
+{
+    SIXELSTATUS status = SIXEL_FALSE;
+    direct_target_t *target = image->target;
+    unsigned char const *p = *pp;
+    unsigned char *rows[6];
+    unsigned char color[4];
+    unsigned int pixel;
+    int nrows;
+    int visible;
+    int limit;
+    int n;
+    int x;
+    int i;
+    int bits;
+    int drawn = 0;
+    int last = (-1);
+    int rgb;
+
+    status = reject_invalid_position(context);
+    if (SIXEL_FAILED(status)) {
+        goto end;
+    }
+
+    limit = SIXEL_WIDTH_LIMIT - context->pos_x;
+    for (n = 0; n < limit && p + n < end; ++n) {
+        if (p[n] < '?' || p[n] > '~') {
+            break;
+        }
+    }
+
+    rgb = image->palette[context->color_index];
+    color[target->red] = (unsigned char)(rgb >> 16 & 0xff);
+    color[target->green] = (unsigned char)(rgb >> 8 & 0xff);
+    color[target->blue] = (unsigned char)(rgb & 0xff);
+    if (target->alpha >= 0) {
+        color[target->alpha] = 0xff;
+    }
+
+    /* rows and columns beyond the framebuffer are clipped */
+    nrows = target->height - context->pos_y;
+    if (nrows > 6) {
+        nrows = 6;
+    }
+    visible = target->width - context->pos_x;
+    if (visible > n) {
+        visible = n;
+    }
+    if (nrows <= 0 || visible < 0) {
+        visible = 0;
+    }
+    for (i = 0; i < nrows && visible > 0; ++i) {
+        rows[i] = target->pixels
+                + (size_t)target->stride * (size_t)(context->pos_y + i)
+                + (size_t)context->pos_x * (size_t)target->depth;
+    }
+
+    if (target->depth == 4 && sizeof(pixel) == 4) {
+        memcpy(&pixel, color, 4);
+        for (x = 0; x < visible; ++x) {
+            bits = p[x] - '?';
+            if (nrows == 6) {
+                blend_pixel32(rows[0] + x * 4, pixel, bits & 1);
+                blend_pixel32(rows[1] + x * 4, pixel, bits >> 1 & 1);
+                blend_pixel32(rows[2] + x * 4, pixel, bits >> 2 & 1);
+                blend_pixel32(rows[3] + x * 4, pixel, bits >> 3 & 1);
+                blend_pixel32(rows[4] + x * 4, pixel, bits >> 4 & 1);
+                blend_pixel32(rows[5] + x * 4, pixel, bits >> 5 & 1);
+            } else {
+                for (i = 0; i < nrows; ++i) {
+                    blend_pixel32(rows[i] + x * 4, pixel, bits >> i & 1);
+                }
+            }
+            drawn |= bits;
+            if (bits != 0) {
+                last = x;
+            }
+        }
+    } else {
+        for (x = 0; x < visible; ++x) {
+            bits = p[x] - '?';
+            for (i = 0; i < nrows; ++i) {
+                if (bits >> i & 1) {
+                    memcpy(rows[i] + x * target->depth, color,
+                           (size_t)target->depth);
+                }
+            }
+            drawn |= bits;
+            if (bits != 0) {
+                last = x;
+            }
+        }
+    }
+    for (x = visible; x < n; ++x) {
+        bits = p[x] - '?';
+        drawn |= bits;
+        if (bits != 0) {
+            last = x;
+        }
+    }
+
+    if (last >= 0) {
+        if (context->max_x < context->pos_x + last) {
+            context->max_x = context->pos_x + last;
+        }
+        if (context->max_y < context->pos_y + sixel_bottom_row[drawn]) {
+            context->max_y = context->pos_y + sixel_bottom_row[drawn];
+        }
+    }
+
+    context->pos_x += n;
+    *pp = p + n;
+
+    status = SIXEL_OK;
+
+end:
+    return status;
+}
+
+
+/*
+ * Draw a run of plain sixel bytes without repeat introducer. The image is
+ * sized once for the whole run and the six destination rows are addressed
+ * through row pointers, the extents are updated once at the end of the run.
+ */
+static SIXELSTATUS
+sixel_parser_draw_run(
+    unsigned char const **pp,       /* in: first sixel byte, out: next byte */
+    unsigned char const *end,       /* end of sixel bytes */
+    image_buffer_t      *image,
+    parser_context_t    *context,
+    sixel_allocator_t   *allocator) /* allocator object */
+{
+    SIXELSTATUS status = SIXEL_FALSE;
+    unsigned char const *p = *pp;
+    unsigned char *rows[6];
+    unsigned char color;
+    int limit;
+    int n;
+    int x;
+    int i;
+    int bits;
+    int drawn = 0;
+    int last = (-1);
+    int sx;
+    int sy;
+
+    status = reject_invalid_position(context);
+    if (SIXEL_FAILED(status)) {
+        goto end;
+    }
+
+    /* the generic path rejects the first byte beyond the width limit */
+    limit = SIXEL_WIDTH_LIMIT - context->pos_x;
+    for (n = 0; n < limit && p + n < end; ++n) {
+        if (p[n] < '?' || p[n] > '~') {
+            break;
+        }
+    }
+
+    sx = image->width;
+    while (sx < context->pos_x + n) {
+        sx *= 2;
+    }
+
+    sy = image->height;
+    while (sy < context->pos_y + 6) {
+        sy *= 2;
+    }
+
+    if (sx > image->width || sy > image->height) {
+        status = image_buffer_resize(image, sx, sy, context->bgindex, allocator);
+        if (SIXEL_FAILED(status)) {
+            goto end;
+        }
+    }
+
+    if (context->color_index > image->ncolors) {
+        image->ncolors = context->color_index;
+    }
+
+    for (i = 0; i < 6; ++i) {
+        rows[i] = image->data
+                + (size_t)image->width * (size_t)(context->pos_y + i)
+                + (size_t)context->pos_x;
+    }
+    color = (unsigned char)context->color_index;
+
+    /*
+     * Each row takes the color through a mask made from its bit, so the
+     * stores are unconditional and no branch depends on the pixel data.
+     */
+    for (x = 0; x < n; ++x) {
+        bits = p[x] - '?';
+        rows[0][x] ^= (unsigned char)((rows[0][x] ^ color) & (0 - (bits & 1)));
+        rows[1][x] ^= (unsigned char)((rows[1][x] ^ color) & (0 - (bits >> 1 & 1)));
+        rows[2][x] ^= (unsigned char)((rows[2][x] ^ color) & (0 - (bits >> 2 & 1)));
+        rows[3][x] ^= (unsigned char)((rows[3][x] ^ color) & (0 - (bits >> 3 & 1)));
+        rows[4][x] ^= (unsigned char)((rows[4][x] ^ color) & (0 - (bits >> 4 & 1)));
+        rows[5][x] ^= (unsigned char)((rows[5][x] ^ color) & (0 - (bits >> 5 & 1)));
+        drawn |= bits;
+        if (bits != 0) {
+            last = x;
+        }
+    }
+
+    if (last >= 0) {
+        if (context->max_x < context->pos_x + last) {
+            context->max_x = context->pos_x + last;
+        }
+        if (context->max_y < context->pos_y + sixel_bottom_row[drawn]) {
+            context->max_y = context->pos_y + sixel_bottom_row[drawn];
+        }
+    }
+
+    context->pos_x += n;
+    *pp = p + n;
+
+    status = SIXEL_OK;
+
+end:
+    return status;
+}
+
+
+/*
+ * Run the parser over a part of sixel stream. All the parser state lives in
+ * the context, so the stream may be split at any byte and fed again later.
+ * Once ST has been seen the context is terminated and the rest is ignored.
+ */
+static SIXELSTATUS
+sixel_parser_parse(
+    unsigned char const *p,         /* sixel bytes */
+    int                  len,       /* size of sixel bytes */
+    image_buffer_t      *image,
+    parser_context_t    *context,
+    sixel_allocator_t   *allocator) /* allocator object */
 {
     SIXELSTATUS status = SIXEL_FALSE;
     int n;
@@ -495,7 +881,12 @@ sixel_decode_raw_impl(
     int sy;
     int c;
     size_t pos;
-    unsigned char *p0 = p;
+    unsigned char const *p0 = p;
+
+    if (context->terminated) {
+        status = SIXEL_OK;
+        goto end;
+    }
 
     while (p < p0 + len) {
         switch (context->state) {
@@ -511,7 +902,7 @@ sixel_decode_raw_impl(
                 break;
             case 0x9c:
                 p++;
-                goto finalize;
+                goto terminate;
             default:
                 p++;
                 break;
@@ -523,7 +914,7 @@ sixel_decode_raw_impl(
             case '\\':
             case 0x9c:
                 p++;
-                goto finalize;
+                goto terminate;
             case 'P':
                 context->param = -1;
                 context->state = PS_DCS;
@@ -689,6 +1080,36 @@ sixel_decode_raw_impl(
             default:
                 if (*p >= '?' && *p <= '~') {  /* sixel characters */
 
+                    if (image->target != NULL && context->repeat_count <= 1) {
+                        status = sixel_parser_draw_direct_run(&p, p0 + len,
+                                                              image, context);
+                        if (SIXEL_FAILED(status)) {
+                            goto end;
+                        }
+                        break;
+                    }
+
+                    if (image->target != NULL) {
+                        status = reject_invalid_position(context);
+                        if (SIXEL_FAILED(status)) {
+                            goto end;
+                        }
+                        sixel_parser_draw_direct(image, context, *p - '?');
+                        context->pos_x += context->repeat_count;
+                        context->repeat_count = 1;
+                        p++;
+                        break;
+                    }
+
+                    if (context->repeat_count <= 1 && sixel_parser_use_runs()) {
+                        status = sixel_parser_draw_run(&p, p0 + len, image,
+                                                       context, allocator);
+                        if (SIXEL_FAILED(status)) {
+                            goto end;
+                        }
+                        break;
+                    }
+
                     status = reject_invalid_position(context);
                     if (SIXEL_FAILED(status)) {
                         goto end;
@@ -827,15 +1248,25 @@ sixel_decode_raw_impl(
                     context->attributed_pad = 1;
                 }
 
-                if (image->width < context->attributed_ph ||
-                        image->height < context->attributed_pv) {
+                /*
+                 * The raster attributes tell the final size up front, so the
+                 * image is allocated once here. The height is rounded up to
+                 * whole sixel bands, or drawing the last band of an image
+                 * whose height is not a multiple of 6 would grow it again.
+                 */
+                if (image->target == NULL &&
+                        (image->width < context->attributed_ph ||
+                         image->height < context->attributed_pv)) {
                     sx = context->attributed_ph;
                     if (image->width > context->attributed_ph) {
                         sx = image->width;
                     }
 
                     sy = context->attributed_pv;
-                    if (image->height > context->attributed_pv) {
+                    if (sy <= SIXEL_HEIGHT_LIMIT - 5) {
+                        sy = (sy + 5) / 6 * 6;
+                    }
+                    if (image->height > sy) {
                         sy = image->height;
                     }
 
@@ -974,7 +1405,27 @@ sixel_decode_raw_impl(
         }
     }
 
-finalize:
+    status = SIXEL_OK;
+    goto end;
+
+terminate:
+    context->terminated = 1;
+    status = SIXEL_OK;
+
+end:
+    return status;
+}
+
+
+/* fix the image size to the drawn area and the raster attributes */
+static SIXELSTATUS
+sixel_parser_finalize(
+    image_buffer_t      *image,
+    parser_context_t    *context,
+    sixel_allocator_t   *allocator) /* allocator object */
+{
+    SIXELSTATUS status = SIXEL_FALSE;
+
     if (++context->max_x < context->attributed_ph) {
         context->max_x = context->attributed_ph;
     }
@@ -983,7 +1434,9 @@ finalize:
         context->max_y = context->attributed_pv;
     }
 
-    if (image->width > context->max_x || image->height > context->max_y) {
+    /* a direct framebuffer keeps its size, only the extents are reported */
+    if (image->target == NULL &&
+            (image->width > context->max_x || image->height > context->max_y)) {
         status = image_buffer_resize(image, context->max_x, context->max_y, context->bgindex, allocator);
         if (SIXEL_FAILED(status)) {
             goto end;
@@ -999,73 +1452,264 @@ end:
 
 /* convert sixel data into indexed pixel bytes and palette data */
 SIXELAPI SIXELSTATUS
-sixel_decode_raw(
-    unsigned char       /* in */  *p,           /* sixel bytes */
-    int                 /* in */  len,          /* size of sixel bytes */
-    unsigned char       /* out */ **pixels,     /* decoded pixels */
-    int                 /* out */ *pwidth,      /* image width */
-    int                 /* out */ *pheight,     /* image height */
-    unsigned char       /* out */ **palette,    /* ARGB palette */
-    int                 /* out */ *ncolors,     /* palette size (<= 256) */
-    sixel_allocator_t   /* in */  *allocator)   /* allocator object or null */
+sixel_decode_raw_impl(
+    unsigned char     *p,         /* sixel bytes */
+    int                len,       /* size of sixel bytes */
+    image_buffer_t    *image,
+    parser_context_t  *context,
+    sixel_allocator_t *allocator) /* allocator object */
 {
     SIXELSTATUS status = SIXEL_FALSE;
-    parser_context_t context;
-    image_buffer_t image;
-    int n;
-    int alloc_size;
-
-    image.data = NULL;
-
-    if (allocator) {
-        sixel_allocator_ref(allocator);
-    } else {
-        status = sixel_allocator_new(&allocator, NULL, NULL, NULL, NULL);
-        if (SIXEL_FAILED(status)) {
-            allocator = NULL;
-            goto error;
-        }
-    }
 
-    /* parser context initialization */
-    status = parser_context_init(&context);
+    status = sixel_parser_parse(p, len, image, context, allocator);
     if (SIXEL_FAILED(status)) {
-        goto error;
+        goto end;
     }
 
-    /* buffer initialization */
-    status = image_buffer_init(&image, 1, 1, context.bgindex, allocator);
-    if (SIXEL_FAILED(status)) {
-        goto error;
-    }
+    status = sixel_parser_finalize(image, context, allocator);
 
-    status = sixel_decode_raw_impl(p, len, &image, &context, allocator);
-    if (SIXEL_FAILED(status)) {
-        goto error;
-    }
+end:
+    return status;
+}
 
-    *ncolors = image.ncolors + 1;
-    alloc_size = *ncolors;
-    if (alloc_size < SIXEL_PALETTE_MAX) {
-        /* memory access range should be 0 <= 255 */
-        alloc_size = SIXEL_PALETTE_MAX;
-    }
-    *palette = (unsigned char *)sixel_allocator_malloc(
+
+/* export the palette of decoded image as RGB bytes */
+static SIXELSTATUS
+image_buffer_export_palette(
+    image_buffer_t      *image,
+    unsigned char       **palette,  /* RGB palette */
+    int                 *ncolors,   /* palette size (<= 256) */
+    sixel_allocator_t   *allocator) /* allocator object */
+{
+    SIXELSTATUS status = SIXEL_FALSE;
+    int n;
+    int alloc_size;
+
+    *ncolors = image->ncolors + 1;
+    alloc_size = *ncolors;
+    if (alloc_size < SIXEL_PALETTE_MAX) {
+        /* memory access range should be 0 <= 255 */
+        alloc_size = SIXEL_PALETTE_MAX;
+    }
+    *palette = (unsigned char *)sixel_allocator_malloc(
         allocator,
         (size_t)(alloc_size * 3));
     /* palette is an output parameter; check the allocated value. */
     if (*palette == NULL) {
-        sixel_allocator_free(allocator, image.data);
-        image.data = NULL;
         sixel_helper_set_additional_message(
             "sixel_decode_raw: sixel_allocator_malloc() failed.");
         status = SIXEL_BAD_ALLOCATION;
-        goto error;
+        goto end;
     }
     for (n = 0; n < *ncolors; ++n) {
-        (*palette)[n * 3 + 0] = image.palette[n] >> 16 & 0xff;
-        (*palette)[n * 3 + 1] = image.palette[n] >> 8 & 0xff;
-        (*palette)[n * 3 + 2] = image.palette[n] & 0xff;
+        (*palette)[n * 3 + 0] = image->palette[n] >> 16 & 0xff;
+        (*palette)[n * 3 + 1] = image->palette[n] >> 8 & 0xff;
+        (*palette)[n * 3 + 2] = image->palette[n] & 0xff;
+    }
+
+    status = SIXEL_OK;
+
+end:
+    return status;
+}
+
+
+/* create parser object */
+SIXELSTATUS
+sixel_parser_new(
+    sixel_parser_t      /* out */ **ppparser,   /* parser object to be created */
+    sixel_allocator_t   /* in */  *allocator)   /* allocator object */
+{
+    SIXELSTATUS status = SIXEL_FALSE;
+
+    *ppparser = (sixel_parser_t *)sixel_allocator_malloc(
+        allocator,
+        sizeof(sixel_parser_t));
+    if (*ppparser == NULL) {
+        sixel_helper_set_additional_message(
+            "sixel_parser_new: sixel_allocator_malloc() failed.");
+        status = SIXEL_BAD_ALLOCATION;
+        goto end;
+    }
+
+    /* the image buffer is allocated on the first feed of each stream */
+    (*ppparser)->image.data = NULL;
+    (*ppparser)->allocator = allocator;
+    sixel_allocator_ref(allocator);
+
+    status = SIXEL_OK;
+
+end:
+    return status;
+}
+
+
+/* destroy parser object and the image being decoded */
+void
+sixel_parser_destroy(sixel_parser_t /* in */ *parser)
+{
+    sixel_allocator_t *allocator;
+
+    if (parser) {
+        allocator = parser->allocator;
+        sixel_allocator_free(allocator, parser->image.data);
+        sixel_allocator_free(allocator, parser);
+        sixel_allocator_unref(allocator);
+    }
+}
+
+
+/* prepare the parser context and the image buffer for a new stream */
+static SIXELSTATUS
+sixel_parser_start(sixel_parser_t *parser)
+{
+    SIXELSTATUS status = SIXEL_FALSE;
+
+    status = parser_context_init(&parser->context);
+    if (SIXEL_FAILED(status)) {
+        goto end;
+    }
+
+    status = image_buffer_init(&parser->image, 1, 1,
+                               parser->context.bgindex,
+                               parser->allocator);
+    if (SIXEL_FAILED(status)) {
+        goto end;
+    }
+
+end:
+    return status;
+}
+
+
+/* parse a part of sixel stream, the stream may be split at any byte */
+SIXELSTATUS
+sixel_parser_feed(
+    sixel_parser_t      /* in */  *parser,      /* parser object */
+    unsigned char const /* in */  *p,           /* sixel bytes */
+    int                 /* in */  len)          /* size of sixel bytes */
+{
+    SIXELSTATUS status = SIXEL_FALSE;
+
+    if (parser->image.data == NULL) {
+        status = sixel_parser_start(parser);
+        if (SIXEL_FAILED(status)) {
+            goto end;
+        }
+    }
+
+    status = sixel_parser_parse(p, len, &parser->image, &parser->context,
+                                parser->allocator);
+    if (SIXEL_FAILED(status)) {
+        /* drop the broken stream, the next feed starts a new one */
+        sixel_allocator_free(parser->allocator, parser->image.data);
+        parser->image.data = NULL;
+        goto end;
+    }
+
+end:
+    return status;
+}
+
+
+/* take the decoded image and reset the parser for the next stream */
+SIXELSTATUS
+sixel_parser_finish(
+    sixel_parser_t      /* in */  *parser,      /* parser object */
+    unsigned char       /* out */ **pixels,     /* decoded pixels */
+    int                 /* out */ *pwidth,      /* image width */
+    int                 /* out */ *pheight,     /* image height */
+    unsigned char       /* out */ **palette,    /* RGB palette */
+    int                 /* out */ *ncolors)     /* palette size (<= 256) */
+{
+    SIXELSTATUS status = SIXEL_FALSE;
+
+    /* an empty stream still yields the 1x1 image sixel_decode_raw() makes */
+    if (parser->image.data == NULL) {
+        status = sixel_parser_start(parser);
+        if (SIXEL_FAILED(status)) {
+            goto end;
+        }
+    }
+
+    status = sixel_parser_finalize(&parser->image, &parser->context,
+                                   parser->allocator);
+    if (SIXEL_FAILED(status)) {
+        goto reset;
+    }
+
+    status = image_buffer_export_palette(&parser->image, palette, ncolors,
+                                         parser->allocator);
+    if (SIXEL_FAILED(status)) {
+        goto reset;
+    }
+
+    *pwidth = parser->image.width;
+    *pheight = parser->image.height;
+    *pixels = parser->image.data;
+    parser->image.data = NULL;
+
+    status = SIXEL_OK;
+
+reset:
+    sixel_allocator_free(parser->allocator, parser->image.data);
+    parser->image.data = NULL;
+
+end:
+    return status;
+}
+
+
+/* convert sixel data into indexed pixel bytes and palette data */
+SIXELAPI SIXELSTATUS
+sixel_decode_raw(
+    unsigned char       /* in */  *p,           /* sixel bytes */
+    int                 /* in */  len,          /* size of sixel bytes */
+    unsigned char       /* out */ **pixels,     /* decoded pixels */
+    int                 /* out */ *pwidth,      /* image width */
+    int                 /* out */ *pheight,     /* image height */
+    unsigned char       /* out */ **palette,    /* ARGB palette */
+    int                 /* out */ *ncolors,     /* palette size (<= 256) */
+    sixel_allocator_t   /* in */  *allocator)   /* allocator object or null */
+{
+    SIXELSTATUS status = SIXEL_FALSE;
+    parser_context_t context;
+    image_buffer_t image;
+
+    image.data = NULL;
+
+    if (allocator) {
+        sixel_allocator_ref(allocator);
+    } else {
+        status = sixel_allocator_new(&allocator, NULL, NULL, NULL, NULL);
+        if (SIXEL_FAILED(status)) {
+            allocator = NULL;
+            goto error;
+        }
+    }
+
+    /* parser context initialization */
+    status = parser_context_init(&context);
+    if (SIXEL_FAILED(status)) {
+        goto error;
+    }
+
+    /* buffer initialization */
+    status = image_buffer_init(&image, 1, 1, context.bgindex, allocator);
+    if (SIXEL_FAILED(status)) {
+        goto error;
+    }
+
+    status = sixel_decode_raw_impl(p, len, &image, &context, allocator);
+    if (SIXEL_FAILED(status)) {
+        goto error;
+    }
+
+    status = image_buffer_export_palette(&image, palette, ncolors, allocator);
+    if (SIXEL_FAILED(status)) {
+        sixel_allocator_free(allocator, image.data);
+        image.data = NULL;
+        goto error;
     }
 
     *pwidth = image.width;
@@ -1085,6 +1729,99 @@ end:
 }
 
 
+/* convert sixel data into direct color pixels of a framebuffer */
+SIXELAPI SIXELSTATUS
+sixel_decode_direct(
+    unsigned char       /* in */  *p,           /* sixel bytes */
+    int                 /* in */  len,          /* size of sixel bytes */
+    unsigned char       /* in */  *pixels,      /* framebuffer to draw into */
+    int                 /* in */  width,        /* framebuffer width */
+    int                 /* in */  height,       /* framebuffer height */
+    int                 /* in */  stride,       /* bytes per framebuffer row */
+    int                 /* in */  pixelformat,  /* one of 24bpp or 32bpp
+                                                   SIXEL_PIXELFORMAT_* */
+    int                 /* out */ *pwidth,      /* image width */
+    int                 /* out */ *pheight,     /* image height */
+    sixel_allocator_t   /* in */  *allocator)   /* allocator object or null */
+{
+    SIXELSTATUS status = SIXEL_FALSE;
+    parser_context_t context;
+    image_buffer_t image;
+    direct_target_t target;
+    int offsets[3];
+
+    image.data = NULL;
+
+    if (!sixel_pixelformat_get_channels(pixelformat, &target.depth, offsets)) {
+        sixel_helper_set_additional_message(
+            "sixel_decode_direct: unsupported pixelformat.");
+        status = SIXEL_BAD_ARGUMENT;
+        goto end;
+    }
+    target.red = offsets[0];
+    target.green = offsets[1];
+    target.blue = offsets[2];
+    target.alpha = (-1);
+    if (target.depth == 4) {
+        /* alpha takes the byte which is left over by the channels */
+        target.alpha = 0 + 1 + 2 + 3 - offsets[0] - offsets[1] - offsets[2];
+    }
+
+    if (pixels == NULL || width <= 0 || height <= 0
+            || width > INT_MAX / target.depth || stride < width * target.depth) {
+        sixel_helper_set_additional_message(
+            "sixel_decode_direct: invalid framebuffer is given.");
+        status = SIXEL_BAD_ARGUMENT;
+        goto end;
+    }
+
+    target.pixels = pixels;
+    target.width = width;
+    target.height = height;
+    target.stride = stride;
+
+    if (allocator) {
+        sixel_allocator_ref(allocator);
+    } else {
+        status = sixel_allocator_new(&allocator, NULL, NULL, NULL, NULL);
+        if (SIXEL_FAILED(status)) {
+            allocator = NULL;
+            goto end;
+        }
+    }
+
+    /* parser context initialization */
+    status = parser_context_init(&context);
+    if (SIXEL_FAILED(status)) {
+        goto cleanup;
+    }
+
+    /* the 1x1 index buffer is only a holder of the color registers */
+    status = image_buffer_init(&image, 1, 1, context.bgindex, allocator);
+    if (SIXEL_FAILED(status)) {
+        goto cleanup;
+    }
+    image.target = &target;
+
+    status = sixel_decode_raw_impl(p, len, &image, &context, allocator);
+    if (SIXEL_FAILED(status)) {
+        goto cleanup;
+    }
+
+    *pwidth = context.max_x;
+    *pheight = context.max_y;
+
+    status = SIXEL_OK;
+
+cleanup:
+    sixel_allocator_free(allocator, image.data);
+    sixel_allocator_unref(allocator);
+
+end:
+    return status;
+}
+
+
 /* deprecated */
 SIXELAPI SIXELSTATUS
 sixel_decode(unsigned char              /* in */  *p,         /* sixel bytes */
@@ -1154,6 +1891,428 @@ end:
     return status;
 }
 
+
+#if HAVE_TESTS
+/* decode a stream with the generic per byte path or with the run path */
+static SIXELSTATUS
+decode_with_path(
+    unsigned char   *p,
+    int             len,
+    int             force_generic,
+    unsigned char   **pixels,
+    int             *width,
+    int             *height,
+    unsigned char   **palette,
+    int             *ncolors)
+{
+    SIXELSTATUS status;
+
+    fromsixel_force_generic = force_generic;
+    status = sixel_decode_raw(p, len, pixels, width, height,
+                              palette, ncolors, NULL);
+    fromsixel_force_generic = 0;
+
+    return status;
+}
+
+
+/* read a file of images/ into a buffer */
+static unsigned char *
+read_image_file(char const *filename, int *len)
+{
+    FILE *fp;
+    unsigned char *buffer = NULL;
+    long size;
+
+    fp = fopen(filename, "rb");
+    if (fp == NULL) {
+        return NULL;
+    }
+    if (fseek(fp, 0, SEEK_END) != 0 || (size = ftell(fp)) <= 0) {
+        goto end;
+    }
+    rewind(fp);
+    buffer = (unsigned char *)malloc((size_t)size);
+    if (buffer == NULL) {
+        goto end;
+    }
+    if (fread(buffer, 1, (size_t)size, fp) != (size_t)size) {
+        free(buffer);
+        buffer = NULL;
+        goto end;
+    }
+    *len = (int)size;
+
+end:
+    fclose(fp);
+    return buffer;
+}
+
+
+/* the run path decodes the same image as the generic path */
+static int
+test1(void)
+{
+    int nret = EXIT_FAILURE;
+    static char const *files[] = {
+        "../images/map8.six",
+        "../images/map64.six",
+        "../images/snake.six"
+    };
+    static char const *streams[] = {
+        /* runs split by color changes, carriage returns and repeats */
+        "\033Pq#1;2;100;0;0~~@@AA#2;2;0;100;0$??oo!3w~~-#1!4~?_@$#3NN\033\\",
+        /* runs of empty sixels only and a raster attribute */
+        "\033Pq\"1;1;9;13???????#4-??????@\033\\",
+        /* a run ended by the end of the stream */
+        "\033Pq#5ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+    };
+    unsigned char *buffer = NULL;
+    unsigned char *pixels[2] = { NULL, NULL };
+    unsigned char *palette[2] = { NULL, NULL };
+    int width[2];
+    int height[2];
+    int ncolors[2];
+    int len = 0;
+    size_t i;
+    int n;
+    SIXELSTATUS status;
+
+    for (i = 0; i < sizeof(files) / sizeof(files[0])
+                  + sizeof(streams) / sizeof(streams[0]); ++i) {
+        if (i < sizeof(files) / sizeof(files[0])) {
+            buffer = read_image_file(files[i], &len);
+            if (buffer == NULL) {
+                goto error;
+            }
+        } else {
+            len = (int)strlen(streams[i - sizeof(files) / sizeof(files[0])]);
+            buffer = (unsigned char *)malloc((size_t)len);
+            if (buffer == NULL) {
+                goto error;
+            }
+            memcpy(buffer, streams[i - sizeof(files) / sizeof(files[0])],
+                   (size_t)len);
+        }
+        for (n = 0; n < 2; ++n) {
+            status = decode_with_path(buffer, len, n == 0,
+                                      &pixels[n], &width[n], &height[n],
+                                      &palette[n], &ncolors[n]);
+            if (SIXEL_FAILED(status)) {
+                goto error;
+            }
+        }
+        if (width[0] != width[1] || height[0] != height[1]
+                || ncolors[0] != ncolors[1]) {
+            goto error;
+        }
+        if (memcmp(pixels[0], pixels[1],
+                   (size_t)width[0] * (size_t)height[0]) != 0) {
+            goto error;
+        }
+        if (memcmp(palette[0], palette[1], (size_t)ncolors[0] * 3) != 0) {
+            goto error;
+        }
+        for (n = 0; n < 2; ++n) {
+            free(pixels[n]);
+            free(palette[n]);
+            pixels[n] = NULL;
+            palette[n] = NULL;
+        }
+        free(buffer);
+        buffer = NULL;
+    }
+
+    nret = EXIT_SUCCESS;
+
+error:
+    for (n = 0; n < 2; ++n) {
+        free(pixels[n]);
+        free(palette[n]);
+    }
+    free(buffer);
+    return nret;
+}
+
+
+/*
+ * benchmark of decoding the sixel images of images/ with the generic per
+ * byte path against the run path.
+ * runs only if SIXEL_BENCHMARK environment variable is set.
+ */
+static int
+test2(void)
+{
+    int nret = EXIT_FAILURE;
+    static char const *files[] = {
+        "../images/map8.six",
+        "../images/map64.six",
+        "../images/snake.six"
+    };
+    unsigned char *buffer = NULL;
+    unsigned char *pixels;
+    unsigned char *palette;
+    int width;
+    int height;
+    int ncolors;
+    int len = 0;
+    int iterations;
+    int count;
+    int n;
+    size_t i;
+    clock_t start;
+    double elapsed[2];
+    SIXELSTATUS status;
+
+    if (getenv("SIXEL_BENCHMARK") == NULL) {
+        return EXIT_SUCCESS;
+    }
+
+    fprintf(stderr, "fromsixel: %-20s %10s %10s\n",
+            "file", "generic", "runs");
+    for (i = 0; i < sizeof(files) / sizeof(files[0]); ++i) {
+        buffer = read_image_file(files[i], &len);
+        if (buffer == NULL) {
+            goto error;
+        }
+        /* decode about 16MB of sixel data for each file */
+        iterations = 16 * 1024 * 1024 / len + 1;
+        for (n = 0; n < 2; ++n) {
+            start = clock();
+            for (count = 0; count < iterations; ++count) {
+                status = decode_with_path(buffer, len, n == 0,
+                                          &pixels, &width, &height,
+                                          &palette, &ncolors);
+                if (SIXEL_FAILED(status)) {
+                    goto error;
+                }
+                free(pixels);
+                free(palette);
+            }
+            elapsed[n] = (double)(clock() - start) / CLOCKS_PER_SEC;
+        }
+        fprintf(stderr, "fromsixel: %-20s %9.2fms %9.2fms\n",
+                files[i] + sizeof("../images/") - 1,
+                elapsed[0] * 1000, elapsed[1] * 1000);
+        free(buffer);
+        buffer = NULL;
+    }
+
+    nret = EXIT_SUCCESS;
+
+error:
+    free(buffer);
+    return nret;
+}
+
+
+/* direct decoding draws the colors of indexed decoding */
+static int
+test3(void)
+{
+    int nret = EXIT_FAILURE;
+    static char const *files[] = {
+        "../images/map8.six",
+        "../images/map64.six",
+        "../images/snake.six"
+    };
+    unsigned char *buffer = NULL;
+    unsigned char *pixels = NULL;
+    unsigned char *palette = NULL;
+    unsigned char *framebuffer = NULL;
+    unsigned char clipped[7 * 5 * 4];
+    unsigned char *src;
+    unsigned char *dst;
+    int width;
+    int height;
+    int ncolors;
+    int direct_width;
+    int direct_height;
+    int len = 0;
+    size_t i;
+    size_t n;
+    SIXELSTATUS status;
+
+    for (i = 0; i < sizeof(files) / sizeof(files[0]); ++i) {
+        buffer = read_image_file(files[i], &len);
+        if (buffer == NULL) {
+            goto error;
+        }
+        status = sixel_decode_raw(buffer, len, &pixels, &width, &height,
+                                  &palette, &ncolors, NULL);
+        if (SIXEL_FAILED(status)) {
+            goto error;
+        }
+        framebuffer = (unsigned char *)calloc((size_t)width * (size_t)height, 4);
+        if (framebuffer == NULL) {
+            goto error;
+        }
+        status = sixel_decode_direct(buffer, len, framebuffer, width, height,
+                                     width * 4, SIXEL_PIXELFORMAT_RGBA8888,
+                                     &direct_width, &direct_height, NULL);
+        if (SIXEL_FAILED(status)) {
+            goto error;
+        }
+        if (direct_width != width || direct_height != height) {
+            goto error;
+        }
+        /* a smaller framebuffer gets the clipped top left corner */
+        memset(clipped, 0, sizeof(clipped));
+        status = sixel_decode_direct(buffer, len, clipped, 7, 5, 7 * 4,
+                                     SIXEL_PIXELFORMAT_RGBA8888,
+                                     &direct_width, &direct_height, NULL);
+        if (SIXEL_FAILED(status)) {
+            goto error;
+        }
+        if (direct_width != width || direct_height != height) {
+            goto error;
+        }
+        for (n = 0; n < 5; ++n) {
+            if (memcmp(clipped + n * 7 * 4,
+                       framebuffer + n * (size_t)width * 4, 7 * 4) != 0) {
+                goto error;
+            }
+        }
+        for (n = 0; n < (size_t)width * (size_t)height; ++n) {
+            dst = framebuffer + n * 4;
+            if (dst[3] == 0) {
+                /* not drawn, the indexed image has the background there */
+                if (pixels[n] != 255) {
+                    goto error;
+                }
+                continue;
+            }
+            src = palette + pixels[n] * 3;
+            if (dst[0] != src[0] || dst[1] != src[1] || dst[2] != src[2]
+                    || dst[3] != 255) {
+                goto error;
+            }
+        }
+        free(framebuffer);
+        free(pixels);
+        free(palette);
+        free(buffer);
+        framebuffer = NULL;
+        pixels = NULL;
+        palette = NULL;
+        buffer = NULL;
+    }
+
+    nret = EXIT_SUCCESS;
+
+error:
+    free(framebuffer);
+    free(pixels);
+    free(palette);
+    free(buffer);
+    return nret;
+}
+
+
+/* color redefinition, clipping and framebuffer parameters */
+static int
+test4(void)
+{
+    int nret = EXIT_FAILURE;
+    /* red, then the register is made blue, then a repeat of 3 in row 1 */
+    static char const sixels[] = "\033Pq#1;2;100;0;0~#1;2;0;0;100~!3A\033\\";
+    unsigned char framebuffer[2 * 8];  /* 2x2 BGR888 with 2 bytes of padding */
+    unsigned char expected[2 * 8] = {
+        0x00, 0x00, 0xff,  0xff, 0x00, 0x00,  0xaa, 0xaa,
+        0x00, 0x00, 0xff,  0xff, 0x00, 0x00,  0xaa, 0xaa
+    };
+    unsigned char const argb[4] = { 0xff, 0xff, 0x00, 0x00 };
+    unsigned char const abgr[4] = { 0xff, 0x00, 0x00, 0xff };
+    int width;
+    int height;
+    int len = (int)sizeof(sixels) - 1;
+    SIXELSTATUS status;
+
+    memset(framebuffer, 0xaa, sizeof(framebuffer));
+    status = sixel_decode_direct((unsigned char *)sixels, len, framebuffer,
+                                 2, 2, 8, SIXEL_PIXELFORMAT_BGR888,
+                                 &width, &height, NULL);
+    if (SIXEL_FAILED(status)) {
+        goto error;
+    }
+    /* the image is 5x6, the framebuffer keeps the top left 2x2 */
+    if (width != 5 || height != 6) {
+        goto error;
+    }
+    if (memcmp(framebuffer, expected, sizeof(framebuffer)) != 0) {
+        goto error;
+    }
+
+    /* alpha leads in 32bpp layouts which end with a color channel */
+    status = sixel_decode_direct((unsigned char *)sixels, len, framebuffer,
+                                 1, 1, 4, SIXEL_PIXELFORMAT_ARGB8888,
+                                 &width, &height, NULL);
+    if (SIXEL_FAILED(status) || memcmp(framebuffer, argb, 4) != 0) {
+        goto error;
+    }
+    status = sixel_decode_direct((unsigned char *)sixels, len, framebuffer,
+                                 1, 1, 4, SIXEL_PIXELFORMAT_ABGR8888,
+                                 &width, &height, NULL);
+    if (SIXEL_FAILED(status) || memcmp(framebuffer, abgr, 4) != 0) {
+        goto error;
+    }
+
+    status = sixel_decode_direct((unsigned char *)sixels, len, framebuffer,
+                                 2, 2, 8, SIXEL_PIXELFORMAT_PAL8,
+                                 &width, &height, NULL);
+    if (status != SIXEL_BAD_ARGUMENT) {
+        goto error;
+    }
+
+    status = sixel_decode_direct((unsigned char *)sixels, len, framebuffer,
+                                 2, 2, 8, SIXEL_PIXELFORMAT_G8,
+                                 &width, &height, NULL);
+    if (status != SIXEL_BAD_ARGUMENT) {
+        goto error;
+    }
+
+    status = sixel_decode_direct((unsigned char *)sixels, len, framebuffer,
+                                 2, 2, 7, SIXEL_PIXELFORMAT_RGBA8888,
+                                 &width, &height, NULL);
+    if (status != SIXEL_BAD_ARGUMENT) {
+        goto error;
+    }
+
+    nret = EXIT_SUCCESS;
+
+error:
+    return nret;
+}
+
+
+SIXELAPI int
+sixel_fromsixel_tests_main(void)
+{
+    int nret = EXIT_FAILURE;
+    size_t i;
+    typedef int (* testcase)(void);
+
+    static testcase const testcases[] = {
+        test1,
+        test2,
+        test3,
+        test4,
+    };
+
+    for (i = 0; i < sizeof(testcases) / sizeof(testcase); ++i) {
+        nret = testcases[i]();
+        if (nret != EXIT_SUCCESS) {
+            goto error;
+        }
+    }
+
+    nret = EXIT_SUCCESS;
+
+error:
+    return nret;
+}
+#endif  /* HAVE_TESTS */
+
 /* emacs Local Variables:      */
 /* emacs mode: c               */
 /* emacs tab-width: 4          */
@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) 2014-2016 Hayaki Saito
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef LIBSIXEL_FROMSIXEL_H
+#define LIBSIXEL_FROMSIXEL_H
+
+#include <sixel.h>
+
+/* incremental sixel parser, keeps the parser context and the image buffer
+   between calls of sixel_parser_feed() */
+typedef struct sixel_parser sixel_parser_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* create parser object */
+SIXELSTATUS
+sixel_parser_new(
+    sixel_parser_t      /* out */ **ppparser,   /* parser object to be created */
+    sixel_allocator_t   /* in */  *allocator);  /* allocator object */
+
+/* destroy parser object and the image being decoded */
+void
+sixel_parser_destroy(sixel_parser_t /* in */ *parser);
+
+/* parse a part of sixel stream, the stream may be split at any byte */
+SIXELSTATUS
+sixel_parser_feed(
+    sixel_parser_t      /* in */  *parser,      /* parser object */
+    unsigned char const /* in */  *p,           /* sixel bytes */
+    int                 /* in */  len);         /* size of sixel bytes */
+
+/* take the decoded image and reset the parser for the next stream */
+SIXELSTATUS
+sixel_parser_finish(
+    sixel_parser_t      /* in */  *parser,      /* parser object */
+    unsigned char       /* out */ **pixels,     /* decoded pixels */
+    int                 /* out */ *pwidth,      /* image width */
+    int                 /* out */ *pheight,     /* image height */
+    unsigned char       /* out */ **palette,    /* RGB palette */
+    int                 /* out */ *ncolors);    /* palette size (<= 256) */
+
+#if HAVE_TESTS
+int
+sixel_fromsixel_tests_main(void);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LIBSIXEL_FROMSIXEL_H */
+
+/* emacs Local Variables:      */
+/* emacs mode: c               */
+/* emacs tab-width: 4          */
+/* emacs indent-tabs-mode: nil */
+/* emacs c-basic-offset: 4     */
+/* emacs End:                  */
+/* vim: set expandtab ts=4 sts=4 sw=4 : */
+/* EOF */
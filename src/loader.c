@@ -64,6 +64,7 @@
 #include "frompnm.h"
 #include "fromgif.h"
 #include "allocator.h"
+#include "loader.h"
 
 sixel_allocator_t *stbi_allocator;
 
@@ -148,11 +149,48 @@ stbi_free(void *p)
 
 
 # if HAVE_JPEG
+/*
+ * choose a denominator of DCT scaling which keeps the image at least
+ * as large as the requested size. only exact divisions are used, so
+ * that the aspect ratio of the decoded image does not change.
+ */
+static unsigned int
+jpeg_scale_denom(
+    JDIMENSION width,
+    JDIMENSION height,
+    int reqwidth,
+    int reqheight)
+{
+    unsigned int denom;
+
+    if (reqwidth <= 0 && reqheight <= 0) {
+        return 1;
+    }
+
+    for (denom = 8; denom > 1; denom /= 2) {
+        if (width % denom != 0 || height % denom != 0) {
+            continue;
+        }
+        if (reqwidth > 0 && width / denom < (JDIMENSION)reqwidth) {
+            continue;
+        }
+        if (reqheight > 0 && height / denom < (JDIMENSION)reqheight) {
+            continue;
+        }
+        break;
+    }
+
+    return denom;
+}
+
+
 /* import from @uobikiemukot's sdump loader.h */
 static SIXELSTATUS
 load_jpeg(unsigned char **result,
           unsigned char *data,
           size_t datasize,
+          int reqwidth,
+          int reqheight,
           int *pwidth,
           int *pheight,
           int *ppixelformat,
@@ -174,6 +212,13 @@ load_jpeg(unsigned char **result,
     /* disable colormap (indexed color), grayscale -> rgb */
     cinfo.quantize_colors = FALSE;
     cinfo.out_color_space = JCS_RGB;
+
+    /* decode straight to 1/2, 1/4 or 1/8 size if it is large enough */
+    cinfo.scale_num = 1;
+    cinfo.scale_denom = jpeg_scale_denom(cinfo.image_width,
+                                         cinfo.image_height,
+                                         reqwidth,
+                                         reqheight);
     jpeg_start_decompress(&cinfo);
 
     if (cinfo.output_components != 3) {
@@ -846,6 +891,8 @@ load_with_builtin(
     int                       /* in */     reqcolors,    /* reqcolors */
     unsigned char             /* in */     *bgcolor,     /* background color */
     int                       /* in */     loop_control, /* one of enum loop_control */
+    int                       /* in */     reqwidth,     /* size hint, 0 if unknown */
+    int                       /* in */     reqheight,    /* size hint, 0 if unknown */
     sixel_load_image_function /* in */     fn_load,      /* callback */
     void                      /* in/out */ *context      /* private data for callback */
 )
@@ -856,6 +903,11 @@ load_with_builtin(
     int nwrite;
     fn_pointer fnp;
 
+#if !HAVE_JPEG
+    (void) reqwidth;
+    (void) reqheight;
+#endif  /* !HAVE_JPEG */
+
     if (chunk_is_sixel(pchunk)) {
         status = sixel_frame_new(&frame, pchunk->allocator);
         if (SIXEL_FAILED(status)) {
@@ -910,6 +962,8 @@ load_with_builtin(
         status = load_jpeg(&frame->pixels,
                            pchunk->buffer,
                            pchunk->size,
+                           reqwidth,
+                           reqheight,
                            &frame->width,
                            &frame->height,
                            &frame->pixelformat,
@@ -1392,10 +1446,13 @@ end:
 #endif  /* HAVE_GD */
 
 
-/* load image from file */
-
-SIXELAPI SIXELSTATUS
-sixel_helper_load_image_file(
+/*
+ * load image from file, with a hint of the size which will be required.
+ * loaders which can decode at a reduced size (JPEG) keep the image at
+ * least as large as the hint.
+ */
+SIXELSTATUS
+sixel_loader_load_file(
     char const                /* in */     *filename,     /* source file name */
     int                       /* in */     fstatic,       /* whether to extract static image from animated gif */
     int                       /* in */     fuse_palette,  /* whether to use paletted image, set non-zero value to try to get paletted image */
@@ -1406,6 +1463,8 @@ sixel_helper_load_image_file(
     int                       /* in */     finsecure,     /* true if do not verify SSL */
     int const                 /* in */     *cancel_flag,  /* cancel flag, may be NULL */
     void                      /* in/out */ *context,      /* private data which is passed to callback function as an argument, may be NULL */
+    int                       /* in */     reqwidth,      /* required width, 0 if unknown */
+    int                       /* in */     reqheight,     /* required height, 0 if unknown */
     sixel_allocator_t         /* in */     *allocator     /* allocator object, may be NULL */
 )
 {
@@ -1467,6 +1526,8 @@ sixel_helper_load_image_file(
                                    reqcolors,
                                    bgcolor,
                                    loop_control,
+                                   reqwidth,
+                                   reqheight,
                                    fn_load,
                                    context);
     }
@@ -1481,6 +1542,39 @@ end:
 }
 
 
+/* load image from file */
+
+SIXELAPI SIXELSTATUS
+sixel_helper_load_image_file(
+    char const                /* in */     *filename,     /* source file name */
+    int                       /* in */     fstatic,       /* whether to extract static image from animated gif */
+    int                       /* in */     fuse_palette,  /* whether to use paletted image, set non-zero value to try to get paletted image */
+    int                       /* in */     reqcolors,     /* requested number of colors, should be equal or less than SIXEL_PALETTE_MAX */
+    unsigned char             /* in */     *bgcolor,      /* background color, may be NULL */
+    int                       /* in */     loop_control,  /* one of enum loopControl */
+    sixel_load_image_function /* in */     fn_load,       /* callback */
+    int                       /* in */     finsecure,     /* true if do not verify SSL */
+    int const                 /* in */     *cancel_flag,  /* cancel flag, may be NULL */
+    void                      /* in/out */ *context,      /* private data which is passed to callback function as an argument, may be NULL */
+    sixel_allocator_t         /* in */     *allocator     /* allocator object, may be NULL */
+)
+{
+    return sixel_loader_load_file(filename,
+                                  fstatic,
+                                  fuse_palette,
+                                  reqcolors,
+                                  bgcolor,
+                                  loop_control,
+                                  fn_load,
+                                  finsecure,
+                                  cancel_flag,
+                                  context,
+                                  0,
+                                  0,
+                                  allocator);
+}
+
+
 #if HAVE_TESTS
 static sixel_frame_t *test2_saved_frame = NULL;
 static int test2_frame_freed = 0;
@@ -1523,12 +1617,12 @@ static int
 test2(void)
 {
     int nret = EXIT_FAILURE;
+    sixel_allocator_t *allocator = NULL;
 #if HAVE_GDK_PIXBUF2
     size_t i;
     FILE *fp;
     char const *filename = NULL;
     unsigned char *pixels = NULL;
-    sixel_allocator_t *allocator = NULL;
     SIXELSTATUS status;
     static char const * const candidates[] = {
         "../images/snake.png",
@@ -1603,6 +1697,90 @@ end:
     return nret;
 }
 
+#if HAVE_JPEG
+static SIXELSTATUS
+test3_on_frame(sixel_frame_t *frame, void *context)
+{
+    int *size = (int *)context;
+
+    size[0] = sixel_frame_get_width(frame);
+    size[1] = sixel_frame_get_height(frame);
+
+    return SIXEL_OK;
+}
+#endif  /* HAVE_JPEG */
+
+
+/* JPEG images are decoded at a reduced size which satisfies the hint */
+static int
+test3(void)
+{
+    int nret = EXIT_FAILURE;
+#if HAVE_JPEG && !defined(HAVE_GDK_PIXBUF2) && !HAVE_GD
+    size_t i;
+    size_t j;
+    FILE *fp;
+    char const *filename = NULL;
+    SIXELSTATUS status;
+    sixel_allocator_t *allocator = NULL;
+    int size[2];
+    static char const * const candidates[] = {
+        "../images/snake.jpg",
+        "images/snake.jpg",
+        "../../images/snake.jpg",
+    };
+    /* snake.jpg is 600x450, the height is divisible only by 2 */
+    static int const cases[][4] = {
+        /* reqwidth, reqheight, width, height */
+        { 0, 0, 600, 450 },
+        { 100, 0, 300, 225 },
+        { 0, 225, 300, 225 },
+        { 301, 0, 600, 450 },
+        { 100, 226, 600, 450 },
+    };
+
+    for (i = 0; i < sizeof(candidates) / sizeof(candidates[0]); ++i) {
+        fp = fopen(candidates[i], "rb");
+        if (fp != NULL) {
+            fclose(fp);
+            filename = candidates[i];
+            break;
+        }
+    }
+    if (filename == NULL) {
+        nret = EXIT_SUCCESS;
+        goto end;
+    }
+
+    status = sixel_allocator_new(&allocator, NULL, NULL, NULL, NULL);
+    if (SIXEL_FAILED(status)) {
+        goto end;
+    }
+
+    for (j = 0; j < sizeof(cases) / sizeof(cases[0]); ++j) {
+        size[0] = size[1] = 0;
+        status = sixel_loader_load_file(filename, 1, 0, SIXEL_PALETTE_MAX,
+                                        NULL, SIXEL_LOOP_AUTO,
+                                        test3_on_frame, 0, NULL, size,
+                                        cases[j][0], cases[j][1], allocator);
+        if (SIXEL_FAILED(status)) {
+            goto end;
+        }
+        if (size[0] != cases[j][2] || size[1] != cases[j][3]) {
+            goto end;
+        }
+    }
+#endif  /* HAVE_JPEG && !HAVE_GDK_PIXBUF2 && !HAVE_GD */
+
+    nret = EXIT_SUCCESS;
+
+#if HAVE_JPEG && !defined(HAVE_GDK_PIXBUF2) && !HAVE_GD
+end:
+    sixel_allocator_unref(allocator);
+#endif
+    return nret;
+}
+
 
 SIXELAPI int
 sixel_loader_tests_main(void)
@@ -1614,6 +1792,7 @@ sixel_loader_tests_main(void)
     static testcase const testcases[] = {
         test1,
         test2,
+        test3,
     };
 
     for (i = 0; i < sizeof(testcases) / sizeof(testcase); ++i) {
@@ -22,10 +22,29 @@
 #ifndef LIBSIXEL_LOADER_H
 #define LIBSIXEL_LOADER_H
 
+#include <sixel.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/* load image from file, with a hint of the required size */
+SIXELSTATUS
+sixel_loader_load_file(
+    char const                /* in */     *filename,     /* source file name */
+    int                       /* in */     fstatic,       /* whether to extract static image */
+    int                       /* in */     fuse_palette,  /* whether to use paletted image */
+    int                       /* in */     reqcolors,     /* requested number of colors */
+    unsigned char             /* in */     *bgcolor,      /* background color */
+    int                       /* in */     loop_control,  /* one of enum loopControl */
+    sixel_load_image_function /* in */     fn_load,       /* callback */
+    int                       /* in */     finsecure,     /* true if do not verify SSL */
+    int const                 /* in */     *cancel_flag,  /* cancel flag */
+    void                      /* in/out */ *context,      /* private data for callback */
+    int                       /* in */     reqwidth,      /* required width, 0 if unknown */
+    int                       /* in */     reqheight,     /* required height, 0 if unknown */
+    sixel_allocator_t         /* in */     *allocator);   /* allocator object */
+
 #if HAVE_TESTS
 int
 sixel_loader_tests_main(void);
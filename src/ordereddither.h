@@ -0,0 +1,313 @@
+/*
+ * Copyright (c) 2026 libsixel developers. See `AUTHORS`.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef LIBSIXEL_ORDEREDDITHER_H
+#define LIBSIXEL_ORDEREDDITHER_H
+
+/*
+ * threshold matrices for ordered dithering.
+ * both are indexed with (y % size) * size + (x % size), so the dither
+ * pattern does not depend on neighbor pixels.
+ */
+
+/* 8x8 Bayer matrix, values are 0..63 */
+static unsigned char const bayer_matrix_8x8[64] = {
+     0, 32,  8, 40,  2, 34, 10, 42,
+    48, 16, 56, 24, 50, 18, 58, 26,
+    12, 44,  4, 36, 14, 46,  6, 38,
+    60, 28, 52, 20, 62, 30, 54, 22,
+     3, 35, 11, 43,  1, 33,  9, 41,
+    51, 19, 59, 27, 49, 17, 57, 25,
+    15, 47,  7, 39, 13, 45,  5, 37,
+    63, 31, 55, 23, 61, 29, 53, 21
+};
+
+/* 64x64 tileable blue-noise texture generated with Ulichney's
+ * void-and-cluster method (sigma = 1.9), values are 0..255 */
+static unsigned char const bluenoise_matrix_64x64[64 * 64] = {
+    242, 107,  44,  18,  99,   5,  85, 238,  48, 144, 250,  88, 232,  30, 213,  89,
+     22,  71,   8, 130,  77, 143, 246, 191,  59, 136, 247, 121, 186,  66, 134, 115,
+    183,  39, 222,  98, 160,  26, 124, 103,  21, 139, 211, 229,  53,  69, 169,   0,
+     38,  96,  58, 137,  87, 155, 237,  20, 180, 228, 154,  73, 122, 236, 180, 147,
+      2, 205,  75, 246, 180,  58, 151, 220, 101, 166,   8, 133,  69, 188,  46, 255,
+    147, 101, 193, 166, 221, 208,   1, 127, 101,  17, 174,  46, 228,  34, 158, 233,
+     27,  83, 136, 243,  47, 189, 217,  61, 176,  44, 160,  89, 186, 130, 222, 193,
+    143, 232,  23, 243, 209,   3,  99,  49, 165,  85,  40, 245, 196,  31,  63,  95,
+     51, 167, 119, 215, 131, 197,  72,  22, 124,  34, 217, 206,  19, 106, 160, 120,
+    202, 236,  56,  38, 114,  24,  90, 181, 237, 217,  81,   4, 145,  96,  74, 205,
+    104, 172, 195,  12,  75, 143,  90, 198, 244,  71, 112,  12, 251,  22,  82,  49,
+    213, 178, 108, 126,  34, 184, 218, 117, 255, 129,  59,   4, 109, 162, 211, 128,
+    186, 150,  30,  88, 160,  38, 254, 138, 193,  63,  92, 176, 150, 238,  77,   2,
+     34, 134, 178,  95, 250,  66, 162,  51,  33, 151, 196, 109, 253, 190,  11,  50,
+    246,  63,  25, 111, 232, 169,  32,   3, 133, 224,  34, 207, 166, 101, 154, 114,
+     12,  77,  65, 198, 150,  80, 139,  66,  29, 208, 146, 219,  89, 141,  14, 253,
+    101, 222,  65,  11, 230, 110,  14, 183, 225, 115, 244,  42, 127,  55, 224, 168,
+    211,  83,  21, 150, 188, 202, 138, 230, 118,  69, 167,  56, 128, 213, 178, 119,
+    141, 155, 215, 129, 203,  54, 249, 117, 156,  97, 188, 140,  64,  40, 202, 247,
+    133, 162, 220,  19,  53, 168, 230,   9, 187,  97, 171,  24, 190, 227,  39,  80,
+     19, 198, 243, 143,  55,  93, 167,  78,  51,   3, 160,  81, 199,  14,  96, 190,
+     62, 111, 228,  11, 123,  42,  82,  16, 212,  92, 240,  22,  39,  86, 161,  19,
+    227,  43,  92,   6, 159, 101,  82, 211,  19,  52,  77, 242, 118, 179, 229,  57,
+     31,  94, 237, 119, 250, 104,  38, 202, 157,  75, 237, 122,  53,  70, 116, 173,
+    134,  45, 113, 179, 192, 210, 238, 148, 100, 204, 233,  28, 143, 252, 118,  40,
+    138, 244, 160,  72, 215, 239, 107, 175, 144,   7, 203, 135, 224,  65, 241, 100,
+     78, 192, 251,  67, 185,  38, 142, 178, 237, 165,   9, 218,  24,  90,   3, 145,
+    170, 190,  44,  10, 179, 130,  87, 244, 114,  45,  13, 181, 248, 151, 204, 232,
+    161,  95,  72,   1, 124,  27,  41, 130,  18, 172, 135, 109,  64, 179, 155, 220,
+      8, 183,  48,  98, 168,  59,  30, 254, 189,  47, 100, 172, 148, 113,   1, 201,
+    134,  31, 168, 123, 239, 221,  24,  62, 125, 200, 106, 150, 131, 195,  72, 217,
+    108,  80, 205, 152,  70, 214,  21, 145,  62, 224, 138, 103,  33,  91,   5,  59,
+     28, 219, 169, 252,  82, 157,  64, 219, 249,  73,  36, 191, 215,  87,  23,  74,
+    105, 205,  32, 146, 197,   3, 131, 156,  66, 123,  79, 247,  30, 185,  48, 221,
+    174,  57, 107,  16, 149,  76, 111, 191,  91,  42, 233,  58, 173, 255,  48, 124,
+    243,  26, 137, 100, 227,  55, 194, 170,   6, 200,  83, 217, 166, 193, 128, 242,
+    150, 207,  37, 138, 227, 103, 196, 116, 182,  54,  96, 230,   5,  48, 236, 173,
+    129, 250,  86, 120, 233, 180,  91, 222,  37, 234, 194,  16, 211,  73, 158, 121,
+     22, 235, 212,  89,  48, 207,   1, 252, 137,  27, 213,  83,  35, 102, 159,  13,
+    182,  63, 234,   1, 160,  31, 120,  96, 239, 127, 157,  50,  20, 210,  76, 108,
+     14,  64, 119, 199,  53,  17, 167,  86,   8, 211, 157, 125, 166, 113, 199, 149,
+     55,  16,  65, 218,  20,  76, 113, 207,  12, 106, 152,  57, 129,  97, 253,  87,
+    143,  69, 155, 195, 132, 229, 173, 153,  73, 163, 115, 183,   5, 226, 135, 211,
+     39, 117, 193,  85, 175, 252,  78,  43, 185,  29,  70, 254, 115, 142,  39, 179,
+    248, 189,  94,   9, 177, 240,  34, 137, 234, 147,  23,  79, 247, 140,  29,  94,
+    225, 188, 159, 135,  41, 248,  52, 166, 136, 182,  85, 226, 169,  37, 204,   7,
+    190,  40, 247,   9, 115,  32,  97,  51,  12, 197, 246,  66, 144, 199,  90,  74,
+    168, 147, 216,  48, 111, 133, 210, 147, 229, 108, 176,   0, 221,  57, 233,  87,
+     49, 144, 229,  75, 111, 150, 206,  70,  45, 105, 198,  59, 184,  40,  70, 240,
+      0, 111, 208, 176, 102, 152, 189,  69,  28, 244,  46,   3, 141, 236,  62, 115,
+    224, 102, 178,  82, 164,  61, 185, 240, 127, 222,  98,  21, 120, 241,  52,  17,
+    249,  94,  28, 238,  14,  66, 196,   9,  60,  88, 205, 152,  97, 187, 168, 123,
+    209, 162,  26, 132, 250,  60,  97, 221, 124, 255, 170,  12, 217, 102, 203, 164,
+    126,  46,  79,  25, 237,   6, 123, 230,  98, 213, 119, 197, 108,  26, 181, 159,
+    131,  54,  20, 218, 142, 233, 206,  78, 147,  38,  56, 172, 158,  32, 187, 109,
+    203,  58, 138, 186, 158, 104, 246,  23, 167, 138, 241,  35,  74, 133,  25,   7,
+     69, 103,  39, 213, 185,  20, 162,   1, 187,  30,  90, 119, 235, 133,  20, 180,
+     88, 254, 148,  63, 213,  89, 198, 143,  16,  61, 174, 154,  72, 217,  84,  12,
+    242,  76, 203, 125,  42, 107,   4,  27, 113, 181,  87, 209, 232,  78, 128, 153,
+    229,   6, 122,  76, 222,  37, 179, 124, 224,  47, 117,  15, 197, 245, 111, 224,
+    200, 175, 237,  84, 121,  48, 201,  80, 135, 228,  66, 158,  49,  78, 150,  58,
+    221,  33, 191, 130, 165,  49,  33,  81, 161, 255,  36,  91, 239,  50, 201, 139,
+    173,  31, 151, 255,  69, 193,  94, 169, 217, 251,  17, 135, 104,   0, 216,  42,
+    176,  99, 164, 206,  51,  90, 151,  77, 100, 190,  66, 216, 161,  83,  55, 151,
+     91, 135,  58,   6, 143, 173, 236, 109, 153,  41, 209, 176,   5, 248, 211, 118,
+      8, 101, 234,  13, 114, 248, 223, 183, 112, 205, 131,   8, 186, 123, 100,  39,
+    231, 110,  90, 183,  14, 157, 243, 129,  59, 154, 195,  45,  68, 183, 247,  62,
+     83,  31, 254,  19, 235, 137, 215,  29, 238,   7, 174, 143,  42, 231, 182,  32,
+    118,  18, 195, 247, 102, 218,  35,  62, 245,  17,  99, 139, 195, 110,  38, 186,
+    168, 138, 203,  69, 178,  95, 134,   4,  71,  47, 230, 145,  24, 164, 251,  67,
+    191,   1,  58, 227, 118,  51, 211,  36,  74,  10, 121, 239, 168,  23, 117, 139,
+    199, 149, 189,  67, 117,   1, 198,  54, 157, 130, 251,  92, 106, 128,   4, 255,
+    214, 148,  43, 159,  71,  23,  93, 192, 125, 181, 222,  82,  26, 233,  95,  72,
+    226,  52,  85,  41, 157,  23,  58, 149, 216, 100, 190,  79,  62, 220,  14, 154,
+    128, 206, 165, 140,  30,  84, 177, 143, 235, 100,  85, 221, 147, 205,  95,  15,
+    219, 107, 128,  43, 171,  97, 183,  73, 111, 205,  20,  60,  28, 209, 169,  75,
+    233,  64, 180, 226, 117, 208, 169, 141,   4,  72,  45, 120, 170,  61, 157, 128,
+     17, 147, 243, 214, 123, 231, 200, 242, 169,  29, 120, 246, 173,  94, 115, 213,
+     80,  44,  97, 218, 240, 194, 109,  21, 204, 163, 189,  54,  29,  80, 161, 237,
+     52,   9, 243,  81, 226, 143, 250,  36, 232,  84, 187, 225, 155, 192,  50,  96,
+    164, 109,  28,  87, 133,  10, 253,  55, 234, 157, 206, 247, 145,  13, 201, 252,
+     30, 191, 104,   1, 184,  78, 108,  44,  87,  12, 157, 202,  38, 136,  54,  29,
+    177, 248,  18,  72, 125,   6,  61, 229, 132,  43,   3, 112, 253, 126,  39, 174,
+     71, 184, 154, 210,  24,  56, 126,  15, 163,  45, 140, 120,  71, 243,  13, 132,
+     38,   0, 243, 202,  49, 153,  80, 111, 196,  90,  32, 103, 187,  51, 216,  89,
+    175, 119,  63, 164,  35, 142,  15, 193, 131, 221,  59, 107,   4, 240, 192, 230,
+    142, 108, 158, 188,  40, 168,  91, 155,  70, 245, 178, 142, 215,  61, 194, 230,
+    134,  91,  33, 105, 165, 199,  88, 178, 217, 103,   3, 176,  34, 111, 146, 204,
+    186, 220, 125,  67, 187, 230,  39, 178,  22, 129, 228,   8,  68, 135, 113,  40,
+     75, 233, 203,  90, 249, 222,  67, 177, 252, 144,  75, 180, 210, 152,  85,  68,
+      9, 222,  57, 134, 214, 253, 198, 116,  31, 212,  97,  75,  17, 155, 102,   2,
+    115, 203, 224,  64,   5, 244, 114, 150,  66, 201, 248,  81, 210, 231,  60,  88,
+     76, 154, 100, 171, 140,  19,  97, 217,  63, 147, 174,  83, 240, 164, 226,   5,
+    155, 139,  20,  47, 128, 158, 114,  52,  96,  33, 235, 122,  48,  24, 103, 167,
+    123, 202,  32,  79, 101, 145,  51,  13, 172, 127,  47, 227, 185,  88, 240,  28,
+    146,  48, 178, 124, 141,  77,  34, 229,  11, 129,  54, 160,  99,  16, 171, 251,
+    116,  53,  12,  33, 246, 115, 202, 161, 248,  46, 210, 119, 198,  21,  98, 184,
+    245,  56, 218, 174, 100,  25, 208,   6, 198, 164,  18,  92, 224, 133, 254,  41,
+    185,  90, 244,   2, 181,  25, 224,  85, 241, 201,   9, 165, 134,  37, 206, 170,
+     77, 254,  17, 232, 190, 211,  50, 186,  94, 237,  29, 145, 187,  45, 135,  25,
+    163, 239, 213, 192,  85,  56,   5, 122,  76,  14, 107,  34, 150,  50,  80, 207,
+    123, 107,  10, 193, 231,  76, 241, 149, 126, 215,  66, 186, 158, 199,  61,  12,
+    231, 154, 113, 164, 235, 121,  72, 189, 104, 149,  67, 114, 250,  57, 124, 219,
+     62, 155,  87,  37,  99, 159,  20, 136, 171, 109, 196,  74, 217, 121, 227, 199,
+     40, 145,  73, 131, 227, 152, 182, 238, 137, 191, 223,  61, 253, 177, 138,  30,
+     65, 167,  86, 144,  34,  58, 185,  85,  41, 109, 247,   0,  78, 112, 172, 209,
+     73, 135,  46,  64, 207,  41, 138, 160,  56,  33, 232,  84,  22, 192, 105,  10,
+    136, 199, 111, 171,  59, 121, 250,  83, 223,  41,  14, 254,  91,   2,  65, 103,
+     10,  93, 175,  22, 106,  41,  68,  95,  29, 169,  84, 157, 128,   0, 221, 238,
+    190,  43, 248, 214, 118, 162, 135,  22, 225, 175,  54, 141,  36, 242,  21, 144,
+    102,  27, 217, 176,  13,  92, 250, 218,   3, 181, 207, 139, 175, 223,  44,  92,
+    182, 234,  14, 215, 239,   2, 199,  65, 153, 117,  59, 159, 177, 141, 242, 184,
+    127, 224,  61, 195, 254, 164, 218, 205,  52, 230,  10,  99, 208,  72, 110,  92,
+    158,  14, 132,  68,   2, 200, 252, 103,  70, 156, 194,  96, 214, 120,  87,  53,
+    194, 251,  84, 126, 148, 197,  22, 112, 130, 245,  98,  15,  72, 148, 160, 246,
+     31,  71,  47, 131,  76, 144, 104,  31, 183, 213, 130, 203,  27,  50,  83, 209,
+    168, 238,  48, 119,   2, 139,  16, 127, 111, 145, 179, 242,  41, 195,  19, 146,
+     52, 204, 225, 110, 176,  91,  48, 210,   9, 235, 129,  18, 150, 233, 177, 225,
+    161,   4, 184, 227, 105,  49, 171,  81,  63,  42, 163, 122,  51, 239,   0, 205,
+    115, 146, 163, 192,  26, 175, 228,  46, 245,   7,  79, 101, 223, 114, 152,  19,
+    109,  30, 158, 204,  98,  81, 189,  35, 250,  74,  24, 122,  58, 165, 236, 119,
+     80, 171,  98,  37, 233,  19, 146, 122, 167,  34,  82, 205,  46,  66,  11, 128,
+     40, 111,  61,  32,  73, 239, 212, 151, 196, 228,  89, 216, 199, 103, 129,  82,
+     56, 226,  99, 252,  88, 208, 125, 161,  94, 139, 232, 166,  37, 247, 198,  74,
+    214,  89, 144,  70, 244, 174, 231,  62, 162, 198, 216,  90, 136, 183,  34, 216,
+    254,  27, 186, 152,  57, 195,  76, 241, 183,  60, 108, 253, 161, 186, 101,  74,
+    210, 154, 243, 167, 141,  11, 122,  30, 184,   7, 142,  27, 179,  65,  24, 189,
+    172, 212,   6,  38, 113,  56,  10,  71, 194,  22,  51,  68, 188,   5, 136,  56,
+    252, 190,   9, 220,  42,  26, 151,  92, 105,   9,  46, 153, 228,   6, 103,  61,
+    127,  11,  72, 245, 131, 113, 218,  25,  94, 139, 222,   6, 117,  31, 245, 196,
+    137,  93,  16, 202, 189,  98,  58, 234, 105,  73, 255, 112,  39, 232, 139, 249,
+     16, 122,  67, 140, 186, 234, 148, 216, 106, 179, 241, 147, 123,  97, 176,  41,
+    120,  22, 132, 180, 108, 124,  52, 211, 132, 185, 247, 114,  70, 206,  87, 158,
+    198, 141, 212,  88, 167,   4,  43, 158, 202,  50, 191, 173,  91, 145, 219,  20,
+     51, 231,  79, 128,  44, 251,  86, 163, 134,  49, 172, 155,  85, 219, 164,  46,
+     94, 153, 239, 203, 169,  18,  84, 248,  34, 116, 209,  88,  17, 217, 230, 154,
+    169, 101, 236,  62, 163, 240, 195,  24, 227,  80,  33, 169,  17, 244, 177,  40,
+    231, 107,  48,  31, 229, 181, 101, 249, 119,  71,  20, 239,  77,  58, 123, 165,
+    180,  35, 115, 223,   1, 174, 216,  18, 201, 225,  15, 208, 121,   5,  74, 110,
+    198,  32,  79,  51, 102, 127,  43, 173, 133,  12,  60, 160, 196,  32,  81,  66,
+    208,  47,  83, 212,  13,  74, 146,   2, 175,  61, 140, 220,  54, 130, 146,  75,
+      1, 189, 162, 123, 206,  63,  81, 148,  10, 232, 129, 154,  38, 202,   3, 107,
+     68, 242, 143, 160,  62, 107, 148,  40, 125,  65,  99, 192,  53, 148, 186, 241,
+    133, 176, 215,  21, 157, 224,  66, 205, 152,  77, 225,  44, 135, 243, 113,   1,
+    232, 197,  33, 138, 187,  96, 116, 255,  88, 159, 108, 199,  95, 190,  26, 118,
+    250,  96,  67, 240,  12, 139, 193, 221,  37, 165, 210, 105, 183, 225, 247, 152,
+    214,  97,  22, 185, 209,  74,  28, 241, 183,  82, 235,  31, 250,  92,  19,  60,
+    225,   8, 117, 254,  91, 195,   1, 238,  97, 189, 253, 174, 105,  57, 184, 141,
+     90, 121, 153, 246,  55, 220,  40, 201,  29, 234, 122,   6,  43, 237, 222,  57,
+    172, 214,  20, 151, 110,  53,  26, 172, 114,  86,  54,  27,  94, 132,  45,  82,
+     11, 200,  53,  87, 247, 135, 195, 113, 156,   5, 142, 166, 132, 211, 172,  40,
+    104,  70, 146, 185,  35, 138, 112,  52,  29, 122,   7,  92,  23, 212, 163,  16,
+     71, 178,   8, 110,  23, 171, 125, 152,  50, 187,  71, 213, 162,  78, 105, 155,
+     36, 132,  79, 223, 177, 254,  96, 132, 241,  66, 196, 251,  13, 174,  63, 191,
+    136, 170, 235, 126,   7,  47, 222,  90,  55, 206, 104,  44,  67, 112, 233, 155,
+    204,  86, 168,  55, 234,  76, 179, 163, 217, 144,  69, 156, 236, 126,  41, 251,
+    193,  59, 226, 162,  80, 237,  65, 214, 100,  14, 244, 142,  21, 181, 128,  11,
+    201, 185,  46,  91, 199,  38,  74, 205,   1, 181, 141, 110, 230, 149, 119, 222,
+     31, 112, 155,  37, 102, 179, 165,  16, 253, 176, 225,  23, 188,  81,   3, 122,
+    246,  25, 223,  10, 125, 210,  17, 246,  84, 202,  36, 222, 187,  78, 149, 102,
+    217,  37, 130,  94, 205,   4, 140, 181,  83, 131, 170,  58,  91, 253, 208,  66,
+     98, 246, 143,   8, 126, 163, 230, 153,  21, 219,  44, 161,  73,  35,  89,  18,
+    255,  76,  61, 227, 203, 147,  69, 119,  36,  75, 126, 242, 150, 218,  35, 196,
+     50, 135, 191, 109, 159,  64, 100,  45, 131, 175,  58, 116,  14,  53, 204,  25,
+    167, 142, 249,  46, 192, 107,  35, 251,  24, 225, 200, 107,  35, 150,  49, 228,
+    116,  28, 167, 236,  65,  25, 117,  51, 102,  82, 125,   9, 209, 239, 199, 159,
+    177, 209,  14, 187,  82,  26, 238, 213, 140, 192,  92,  13, 170,  57, 100, 145,
+    179,  68,  95,  42, 249, 198, 141, 228,   4, 106, 241, 163,  96, 137, 242, 111,
+     85,  10, 183,  73, 151, 229,  56, 164, 115,  68,   0, 233, 120, 193,   7,  85,
+    157, 219,  53, 106, 190, 216, 142, 246, 191, 227, 171,  96, 184,  56, 106, 130,
+     43,  95, 140, 110, 249, 129,  57,  99,   1, 156,  49, 115, 203, 130, 249,  84,
+     21, 236, 166, 215,  30,  85,  21, 157, 192,  75,  28, 211, 226,   5, 175,  64,
+    236,  24, 117, 215,  19, 125,  86, 209, 147,  42, 182, 158,  75, 241, 136, 175,
+     19,  73, 204, 135,  80,   5,  89, 165,  63,  26, 134, 249,  20, 144,  68,   0,
+    237, 219,  51, 171,   7, 160,  41, 200, 233, 172, 220,  31,  71, 227,   9, 160,
+    207, 118,   2, 129, 149, 180, 114,  56, 255, 126, 184, 145,  83,  47, 197, 127,
+    222,  96, 163,  60, 245, 177,  11, 190,  97, 220, 133,  52, 212,  29, 103, 188,
+    243, 125,  36, 173, 252,  45, 182, 114,  36, 199,  77,  52, 118, 221, 193,  84,
+    152, 120,  23, 196,  89, 224, 182,  79, 108,  63, 252,  86, 138, 180,  44, 109,
+     59, 225,  80,  52, 239,  71, 220, 205,  94,  15,  40,  63, 119, 251,  31, 151,
+     44, 208, 187,  33, 103, 138,  47, 231,  28,  77, 247,  13,  92, 168,  62,  44,
+    215,  91, 151,  14, 223,  98, 209,  17, 148, 235, 214, 156,  39, 167, 243,  33,
+    206, 165,  75, 245,  62, 116, 150,  30, 133,  19, 147, 197,  99,  26, 238, 193,
+    152,  33, 184, 201,  99,   8, 162,  46, 137, 172, 236, 207, 158, 182, 106,  72,
+      7, 129, 146,  80, 235, 159,  67, 201, 127, 172, 106, 149, 202, 121, 226, 142,
+      4, 110, 200,  59, 120, 157,  71, 242, 126, 104,   3, 181,  93, 108,  10, 134,
+     58, 102, 228,  36, 137, 209,  11, 240, 216, 188,  47,   5, 212, 167, 125,  72,
+     93, 253, 139, 170,  25, 123, 244,  30,  79, 196, 104,   0,  91,  22, 230, 170,
+     86, 246,  53, 199,   2, 114,  92, 252,   9,  57, 188,  38, 234,  20,  81, 161,
+    248,  70, 181, 237,  26, 137, 196,  54, 170,  83,  64, 139, 252, 189,  72, 231,
+    177,  16, 147, 181,  95,  48, 167,  72,  89, 122, 159, 111, 247,  54, 146,  12,
+    216,  18, 106,  65, 228, 146, 186, 111, 226, 151,  69, 132, 218,  57, 140, 194,
+    102, 223,  27, 121, 216, 184,  37, 145, 164, 116, 240,  69, 136, 179,  54, 208,
+     30, 131,  47, 166,  83, 228,  37,   9, 188, 223,  32, 207,  17,  49, 153, 201,
+     86, 113, 212,   3, 124, 190, 249, 105,  34, 177, 235,  67,  82,  35, 225, 115,
+    174,  49, 131, 211,  41,  87,  59, 208,  10,  51, 249, 165,  37, 243, 118,  18,
+     64, 178, 150,  73, 169,  18, 224,  81, 206,  25, 214,  88,   2, 196, 116,  95,
+    231, 191, 104,   7, 212, 112,  95, 248, 144, 116, 162, 233,  88, 129, 118,  27,
+     42, 254,  54, 235,  68,  24, 154, 201,  57, 220,  10, 192, 136, 204, 183,  86,
+    237, 200,  78, 156, 248,  13, 168,  97, 127, 180,  24, 112, 187,  78, 204, 160,
+    132,  39, 254,  94,  47, 242,  60, 133,  99,  49, 176, 156, 104, 255,  42, 154,
+     13,  75, 142, 252,  63, 152, 178,  73,  46,  21, 101,  60, 176, 193, 237, 218,
+    169, 133, 156, 195,  84, 139, 230,  15, 128, 144,  93,  26, 156, 102,   0,  62,
+    161,  32,   8, 179, 118, 194, 239, 141,  36, 234,  84, 215, 144,   8,  47, 238,
+    110,  15, 209, 196, 128, 104, 153, 194,   6, 229, 125,  32, 223,  64, 170, 127,
+    219, 175,  38, 201, 123,  16, 193, 130, 239, 201, 220, 135,  37,   7,  70,  98,
+     19,  76, 104,  32, 174, 217, 112,  43,  77, 169, 255, 118, 228,  45, 245, 126,
+    140, 107, 220,  95,  53,  21,  75, 218,  65, 156, 200, 100,  61, 174,  92, 216,
+    189,  82, 140,   4, 164,  26, 232, 179,  71, 249, 146,  78, 200,  11, 141,  85,
+     25, 243,  93, 162,  53, 221,  30, 166,  89,   4, 153,  80, 244, 110, 161,  53,
+    185, 204, 240, 121,  12,  60,  96, 185, 238, 207,  32,  64, 176,  78, 212,  20,
+    188, 252,  67, 148, 231, 132, 105, 164,   2, 117,  48,  18, 251, 125, 153,  28,
+    169, 236,  55, 115,  68, 212,  86,  36, 109,  15, 166,  55, 113, 182, 240,  50,
+    208,  65, 110,   0, 235,  81, 103, 207,  61, 122, 173,  51, 198, 213, 148, 248,
+    138,   0, 220,  47, 149, 251, 200, 160,   2,  52, 108, 194,  16, 146, 165,  55,
+     88,  39, 170, 207,  28, 184,  44, 205, 242, 189, 134, 222,  35, 194, 228,  69,
+    101, 149, 221, 177, 245,  45, 143, 123, 216, 191,  93, 210, 234,  28,  98, 194,
+    120, 155, 188, 133, 178, 145,  43, 226,  23, 251, 187,  28,  94,  16, 119,  34,
+     86,  65, 163,  93, 180,  74,  27, 124, 137,  88, 154, 223, 124,  95, 236, 197,
+    114, 229,   3, 123,  82, 249, 146,  19,  92,  77, 170, 148, 108,  81,   3,  45,
+    121,  11,  34,  77, 200,  16, 173, 241,  57, 137,  23,  42, 127, 151,  71,   6,
+    229,  43,  22, 213,  69, 245, 117, 159, 138,  68, 105, 144, 232,  74, 180, 223,
+    194, 109, 232, 131, 210,  38, 106, 226,  67, 213, 182,  41, 242,   5,  68,  29,
+    136, 155,  50, 192,  99,  63, 175, 114,  55, 229,  10,  64, 182, 245, 136, 204,
+    180,  90, 251, 131, 107, 154,  96,   8,  69, 159, 226, 175,  84, 248, 165, 134,
+    174, 102, 253,  89,  36,  14, 191,  93,  11, 235, 214,  42, 165, 132,  60,  12,
+    170,  43,  23, 145,   8, 244, 191, 171,  13, 250,  21,  80, 134, 206, 105, 177,
+    211,  76, 242,  17, 161, 226,  33, 212, 130, 255,  29, 206,  93,  52, 158, 238,
+     59, 213, 163,  24, 189,  53, 229, 203, 116, 254, 103,   2, 198,  60,  36, 221,
+     81,  55, 149, 197, 128, 170,  56, 204, 176,  82, 120,   2, 203, 244, 103, 151,
+    253, 121, 202,  81,  57, 117,  85,  45, 142, 100, 116, 173,  59, 161,  45, 227,
+     15,  93, 130, 218, 110, 140,   7, 194, 153, 102, 162, 120, 218,  15, 112,  25,
+    195,  42, 142,  65, 219,  84, 129,  35, 179,  79,  48, 143, 117, 214, 107,  13,
+    203, 234,  17, 112, 223,  76, 239, 109,  32,  49, 157, 191,  87,  29,  50, 215,
+     91,  64, 237, 186, 166, 219, 156, 234,  62, 202, 150,  27, 193, 246, 121, 143,
+    187,  60, 168,  40,  70, 245,  88,  46,  68, 186,  79,  43, 141, 175, 227,  74,
+    127, 101, 232, 116,   0, 166, 238,  20, 149, 211,  15, 188, 236,  27, 180, 145,
+    124,  67, 185, 162,  45,   3, 152, 136, 219, 255, 129,  63, 225, 114, 185,   6,
+    137,  33, 153,  15,  98,  29, 126,   4, 183,  35, 231, 219,  90,   7,  77,  36,
+    101, 254, 197,  25, 182, 204, 126, 236,  18, 221,   0, 240, 197,  33,  87, 149,
+    171, 244,  15, 182, 201,  46, 105, 192,  90,  58, 166, 131,  68,  93, 159,  49,
+    244,  95,  30, 139, 250,  99, 209,  22,  67, 181,  98,  17, 141, 172, 235,  70,
+    207, 178, 108, 227,  50, 207,  70, 246,  93, 130,  73,  50, 112, 156, 215, 234,
+     11, 151, 116,  83, 144,  55,  98, 173, 147, 113, 168, 127,  66, 104, 253,   5,
+    208,  35,  93,  79, 147, 252,  69, 136, 224, 243,  99, 219,  38, 248,  78, 195,
+     11, 168, 215,  84,  62, 188, 124,  87, 166,   7, 197, 241,  39,  79, 155, 124,
+     44, 241,  77, 132, 194, 142, 171, 110, 214, 162,  18, 253, 137, 184,  61, 173,
+    133,  49, 228, 214,   6, 163,  27, 210,  37, 250,  89,  52, 212, 158, 188,  54,
+     70, 156, 224,  56, 124,  28, 161,  40,  10, 120,  24, 154, 200,   4, 126, 223,
+    108,  41, 118, 200,  15, 173, 226,  43, 233, 113, 148,  55, 210, 105,  21, 197,
+     94, 167,  23,   1, 255,  86,  39,  12,  56, 197, 178,  97,  39, 203,  26,  86,
+    207,  73,  18, 106, 249, 121, 225,  78,  60, 190, 140,  25, 231,  13, 134, 115,
+     23, 192, 137, 171, 231, 208, 113, 177, 202,  76, 184,  54, 112, 171, 140,  60,
+    181, 230, 153, 241,  50, 106,  31, 156,  75, 206,  27,  89, 164, 220,   8, 250,
+     59, 148, 210, 118,  64, 182, 229, 152, 240,  79, 119,   6, 149, 238, 106, 122,
+    247, 159, 190, 174,  42,  67, 195, 134, 109,   9, 206, 100, 172,  44,  83, 221
+};
+
+#endif /* LIBSIXEL_ORDEREDDITHER_H */
+
+/* emacs Local Variables:      */
+/* emacs mode: c               */
+/* emacs tab-width: 4          */
+/* emacs indent-tabs-mode: nil */
+/* emacs c-basic-offset: 4     */
+/* emacs End:                  */
+/* vim: set expandtab ts=4 sts=4 sw=4 : */
+/* EOF */
@@ -25,12 +25,85 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#if HAVE_STRING_H
+# include <string.h>
+#endif  /* HAVE_STRING_H */
 #if HAVE_MEMORY_H
 # include <memory.h>
 #endif  /* HAVE_MEMORY_H */
+#if HAVE_TIME_H
+# include <time.h>
+#endif  /* HAVE_TIME_H */
+
+/* SSSE3 byte shuffles are selected at runtime */
+#if defined(__SSE2__) && defined(__GNUC__) && (__GNUC__ >= 5 || defined(__clang__))
+# include <immintrin.h>
+# define PIXELFORMAT_USE_SSSE3 1
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+# include <arm_neon.h>
+# define PIXELFORMAT_USE_NEON 1
+#endif
 
 #include <sixel.h>
+#include "pixelformat.h"
 
+/* position of the upper byte of 16bit pixels */
+#if SWAP_BYTES
+# define PIXELFORMAT_HIGH_BYTE 1
+#else
+# define PIXELFORMAT_HIGH_BYTE 0
+#endif
+
+#if HAVE_TESTS
+static int pixelformat_force_scalar = 0;
+#endif
+
+/* layout of a pixelformat which is converted to RGB888 */
+typedef struct pixelformat_layout {
+    int pixelformat;
+    int depth;
+    int order[3];   /* byte offsets of r, g and b in pixels of 8bit channels */
+    int shift[3];   /* bit offsets of r, g and b in packed 16bit pixels */
+    int bits[3];    /* bit widths of r, g and b in packed 16bit pixels, or 0 */
+} pixelformat_layout_t;
+
+static pixelformat_layout_t const pixelformat_layouts[] = {
+    /* 8bit channels */
+    { SIXEL_PIXELFORMAT_RGB888,   3, { 0, 1, 2 }, { 0, 0, 0 }, { 0, 0, 0 } },
+    { SIXEL_PIXELFORMAT_BGR888,   3, { 2, 1, 0 }, { 0, 0, 0 }, { 0, 0, 0 } },
+    { SIXEL_PIXELFORMAT_RGBA8888, 4, { 0, 1, 2 }, { 0, 0, 0 }, { 0, 0, 0 } },
+    { SIXEL_PIXELFORMAT_ARGB8888, 4, { 1, 2, 3 }, { 0, 0, 0 }, { 0, 0, 0 } },
+    { SIXEL_PIXELFORMAT_BGRA8888, 4, { 2, 1, 0 }, { 0, 0, 0 }, { 0, 0, 0 } },
+    { SIXEL_PIXELFORMAT_ABGR8888, 4, { 3, 2, 1 }, { 0, 0, 0 }, { 0, 0, 0 } },
+    { SIXEL_PIXELFORMAT_G8,       1, { 0, 0, 0 }, { 0, 0, 0 }, { 0, 0, 0 } },
+    { SIXEL_PIXELFORMAT_GA88,     2, { 0, 0, 0 }, { 0, 0, 0 }, { 0, 0, 0 } },
+    { SIXEL_PIXELFORMAT_AG88,     2, { 1, 1, 1 }, { 0, 0, 0 }, { 0, 0, 0 } },
+    /* packed 16bit pixels */
+    { SIXEL_PIXELFORMAT_RGB555,   2, { 0, 0, 0 }, { 10, 5, 0 }, { 5, 5, 5 } },
+    { SIXEL_PIXELFORMAT_RGB565,   2, { 0, 0, 0 }, { 11, 5, 0 }, { 5, 6, 5 } },
+    { SIXEL_PIXELFORMAT_BGR555,   2, { 0, 0, 0 }, { 0, 5, 10 }, { 5, 5, 5 } },
+    { SIXEL_PIXELFORMAT_BGR565,   2, { 0, 0, 0 }, { 0, 5, 11 }, { 5, 6, 5 } },
+};
+
+
+static pixelformat_layout_t const *
+pixelformat_find_layout(int pixelformat)
+{
+    size_t i;
+
+    for (i = 0; i < sizeof(pixelformat_layouts) / sizeof(pixelformat_layouts[0]); i++) {
+        if (pixelformat_layouts[i].pixelformat == pixelformat) {
+            return &pixelformat_layouts[i];
+        }
+    }
+
+    return NULL;
+}
+
+
+/* reference conversion of a pixel, the kernels below are tested against it */
+#if HAVE_TESTS
 static void
 get_rgb(unsigned char const *data,
         int const pixelformat,
@@ -123,6 +196,7 @@ get_rgb(unsigned char const *data,
         break;
     }
 }
+#endif  /* HAVE_TESTS */
 
 
 SIXELAPI int
@@ -167,28 +241,386 @@ sixel_helper_compute_depth(int pixelformat)
 }
 
 
+int
+sixel_pixelformat_get_channels(
+    int     /* in */  pixelformat,
+    int     /* out */ *stride,
+    int     /* out */ offsets[3])
+{
+    pixelformat_layout_t const *layout;
+
+    /* grayscale layouts alias one byte for all channels */
+    if (pixelformat & SIXEL_FORMATTYPE_GRAYSCALE) {
+        return 0;
+    }
+    layout = pixelformat_find_layout(pixelformat);
+    if (layout == NULL || layout->bits[0] != 0) {
+        return 0;
+    }
+    *stride = layout->depth;
+    offsets[0] = layout->order[0];
+    offsets[1] = layout->order[1];
+    offsets[2] = layout->order[2];
+
+    return 1;
+}
+
+
+int
+sixel_pixelformat_get_row_bytes(
+    int     /* in */  pixelformat,
+    int     /* in */  width)
+{
+    int bpp;
+    int depth;
+
+    switch (pixelformat) {
+    case SIXEL_PIXELFORMAT_PAL1:
+    case SIXEL_PIXELFORMAT_G1:
+        bpp = 1;
+        break;
+    case SIXEL_PIXELFORMAT_PAL2:
+    case SIXEL_PIXELFORMAT_G2:
+        bpp = 2;
+        break;
+    case SIXEL_PIXELFORMAT_PAL4:
+    case SIXEL_PIXELFORMAT_G4:
+        bpp = 4;
+        break;
+    default:
+        depth = sixel_helper_compute_depth(pixelformat);
+        if (depth <= 0) {
+            return 0;
+        }
+        return width * depth;
+    }
+
+    return (width * bpp + 7) / 8;
+}
+
+
+SIXELSTATUS
+sixel_pixelformat_normalize_rows(
+    unsigned char       /* out */ *dst,
+    int                 /* out */ *dst_pixelformat,
+    unsigned char const /* in */  *src,
+    int                 /* in */  src_pixelformat,
+    int                 /* in */  width,
+    int                 /* in */  height,
+    int                 /* in */  pitch)
+{
+    SIXELSTATUS status = SIXEL_FALSE;
+    int y;
+    int dst_row_bytes;
+
+    /* packed rows are converted at once */
+    if (pitch == sixel_pixelformat_get_row_bytes(src_pixelformat, width)) {
+        return sixel_helper_normalize_pixelformat(dst, dst_pixelformat,
+                                                  src, src_pixelformat,
+                                                  width, height);
+    }
+
+    for (y = 0; y < height; ++y) {
+        status = sixel_helper_normalize_pixelformat(dst, dst_pixelformat,
+                                                    src, src_pixelformat,
+                                                    width, 1);
+        if (SIXEL_FAILED(status)) {
+            goto end;
+        }
+        dst_row_bytes = sixel_pixelformat_get_row_bytes(*dst_pixelformat, width);
+        dst += dst_row_bytes;
+        src += pitch;
+    }
+
+    status = SIXEL_OK;
+
+end:
+    return status;
+}
+
+
+/* convert pixels of 8bit channels */
+static void
+expand_bytes(unsigned char *dst,
+             unsigned char const *src,
+             size_t count,
+             pixelformat_layout_t const *layout)
+{
+    int const depth = layout->depth;
+    int const r = layout->order[0];
+    int const g = layout->order[1];
+    int const b = layout->order[2];
+    size_t i;
+
+    for (i = 0; i < count; i++) {
+        dst[0] = src[r];
+        dst[1] = src[g];
+        dst[2] = src[b];
+        dst += 3;
+        src += depth;
+    }
+}
+
+
+/* convert packed 16bit pixels */
+static void
+expand_packed(unsigned char *dst,
+              unsigned char const *src,
+              size_t count,
+              pixelformat_layout_t const *layout)
+{
+    int const rshift = layout->shift[0];
+    int const gshift = layout->shift[1];
+    int const bshift = layout->shift[2];
+    unsigned int const rmask = (1u << layout->bits[0]) - 1;
+    unsigned int const gmask = (1u << layout->bits[1]) - 1;
+    unsigned int const bmask = (1u << layout->bits[2]) - 1;
+    int const rscale = 8 - layout->bits[0];
+    int const gscale = 8 - layout->bits[1];
+    int const bscale = 8 - layout->bits[2];
+    unsigned int pixel;
+    size_t i;
+
+    for (i = 0; i < count; i++) {
+        pixel = (unsigned int)src[PIXELFORMAT_HIGH_BYTE] << 8
+              | src[1 - PIXELFORMAT_HIGH_BYTE];
+        dst[0] = (unsigned char)(((pixel >> rshift) & rmask) << rscale);
+        dst[1] = (unsigned char)(((pixel >> gshift) & gmask) << gscale);
+        dst[2] = (unsigned char)(((pixel >> bshift) & bmask) << bscale);
+        dst += 3;
+        src += 2;
+    }
+}
+
+
+#if PIXELFORMAT_USE_SSSE3
+/*
+ * convert pixels of 8bit channels with byte shuffles, whose masks are
+ * built from the layout. a step converts the pixels of a 16 byte load,
+ * and its stores may spill over into the output of the next step.
+ * returns the number of converted pixels.
+ */
+__attribute__((target("ssse3")))
+static size_t
+expand_bytes_ssse3(unsigned char *dst,
+                   unsigned char const *src,
+                   size_t count,
+                   pixelformat_layout_t const *layout)
+{
+    int const depth = layout->depth;
+    int const step = depth == 3 ? 5: 16 / depth;
+    int const nchunks = (step * 3 + 15) / 16;
+    unsigned char mask[16];
+    __m128i shuffles[3];
+    __m128i pixels;
+    size_t i;
+    int j;
+    int k;
+    int n;
+
+    for (k = 0; k < nchunks; k++) {
+        for (j = 0; j < 16; j++) {
+            n = k * 16 + j;
+            mask[j] = (unsigned char)(n < step * 3
+                                      ? n / 3 * depth + layout->order[n % 3]
+                                      : 0x80);
+        }
+        shuffles[k] = _mm_loadu_si128((__m128i const *)mask);
+    }
+
+    for (i = 0; i + (size_t)step * 2 <= count; i += (size_t)step) {
+        pixels = _mm_loadu_si128((__m128i const *)(src + i * (size_t)depth));
+        for (k = 0; k < nchunks; k++) {
+            _mm_storeu_si128((__m128i *)(dst + i * 3 + (size_t)k * 16),
+                             _mm_shuffle_epi8(pixels, shuffles[k]));
+        }
+    }
+
+    return i;
+}
+
+
+/*
+ * convert packed 16bit pixels, 8 pixels at once. channels are extracted
+ * with 16bit shifts and interleaved into 24 bytes with shuffles.
+ * returns the number of converted pixels.
+ */
+__attribute__((target("ssse3")))
+static size_t
+expand_packed_ssse3(unsigned char *dst,
+                    unsigned char const *src,
+                    size_t count,
+                    pixelformat_layout_t const *layout)
+{
+    unsigned char mask[4][16];
+    __m128i shuffles[4];
+    __m128i shifts[3];
+    __m128i lshifts[3];
+    __m128i masks[3];
+    __m128i channels[3];
+    __m128i pixels;
+    __m128i rg;
+    __m128i b;
+    size_t i;
+    int j;
+    int c;
+    int n;
+
+    /* r and g are packed into one register, b into another */
+    for (j = 0; j < 32; j++) {
+        n = j < 24 ? j / 3: 0;
+        c = j < 24 ? j % 3: 3;
+        mask[j / 16 * 2 + 0][j % 16] = (unsigned char)(c == 0 ? n: c == 1 ? 8 + n: 0x80);
+        mask[j / 16 * 2 + 1][j % 16] = (unsigned char)(c == 2 ? n: 0x80);
+    }
+    for (j = 0; j < 4; j++) {
+        shuffles[j] = _mm_loadu_si128((__m128i const *)mask[j]);
+    }
+    for (c = 0; c < 3; c++) {
+        shifts[c] = _mm_cvtsi32_si128(layout->shift[c]);
+        lshifts[c] = _mm_cvtsi32_si128(8 - layout->bits[c]);
+        masks[c] = _mm_set1_epi16((short)((1 << layout->bits[c]) - 1));
+    }
+
+    for (i = 0; i + 8 <= count; i += 8) {
+        pixels = _mm_loadu_si128((__m128i const *)(src + i * 2));
+#if !SWAP_BYTES
+        /* pixels are stored with the upper byte first */
+        pixels = _mm_or_si128(_mm_slli_epi16(pixels, 8), _mm_srli_epi16(pixels, 8));
+#endif
+        for (c = 0; c < 3; c++) {
+            channels[c] = _mm_sll_epi16(_mm_and_si128(_mm_srl_epi16(pixels, shifts[c]),
+                                                      masks[c]),
+                                        lshifts[c]);
+        }
+        rg = _mm_packus_epi16(channels[0], channels[1]);
+        b = _mm_packus_epi16(channels[2], channels[2]);
+        _mm_storeu_si128((__m128i *)(dst + i * 3),
+                         _mm_or_si128(_mm_shuffle_epi8(rg, shuffles[0]),
+                                      _mm_shuffle_epi8(b, shuffles[1])));
+        _mm_storel_epi64((__m128i *)(dst + i * 3 + 16),
+                         _mm_or_si128(_mm_shuffle_epi8(rg, shuffles[2]),
+                                      _mm_shuffle_epi8(b, shuffles[3])));
+    }
+
+    return i;
+}
+#endif  /* PIXELFORMAT_USE_SSSE3 */
+
+
+#if PIXELFORMAT_USE_NEON
+/*
+ * convert pixels of 8bit channels, 16 pixels at once. structure loads
+ * split channels into registers, which are picked by the layout.
+ * returns the number of converted pixels.
+ */
+static size_t
+expand_bytes_neon(unsigned char *dst,
+                  unsigned char const *src,
+                  size_t count,
+                  pixelformat_layout_t const *layout)
+{
+    int const r = layout->order[0];
+    int const g = layout->order[1];
+    int const b = layout->order[2];
+    uint8x16x3_t out;
+    size_t i = 0;
+
+    switch (layout->depth) {
+    case 4:
+        for (; i + 16 <= count; i += 16) {
+            uint8x16x4_t in = vld4q_u8(src + i * 4);
+            out.val[0] = in.val[r];
+            out.val[1] = in.val[g];
+            out.val[2] = in.val[b];
+            vst3q_u8(dst + i * 3, out);
+        }
+        break;
+    case 3:
+        for (; i + 16 <= count; i += 16) {
+            uint8x16x3_t in = vld3q_u8(src + i * 3);
+            out.val[0] = in.val[r];
+            out.val[1] = in.val[g];
+            out.val[2] = in.val[b];
+            vst3q_u8(dst + i * 3, out);
+        }
+        break;
+    case 2:
+        for (; i + 16 <= count; i += 16) {
+            uint8x16x2_t in = vld2q_u8(src + i * 2);
+            out.val[0] = in.val[r];
+            out.val[1] = in.val[g];
+            out.val[2] = in.val[b];
+            vst3q_u8(dst + i * 3, out);
+        }
+        break;
+    case 1:
+        for (; i + 16 <= count; i += 16) {
+            out.val[0] = out.val[1] = out.val[2] = vld1q_u8(src + i);
+            vst3q_u8(dst + i * 3, out);
+        }
+        break;
+    default:
+        break;
+    }
+
+    return i;
+}
+#endif  /* PIXELFORMAT_USE_NEON */
+
+
+static int
+pixelformat_use_simd(void)
+{
+#if HAVE_TESTS
+    if (pixelformat_force_scalar) {
+        return 0;
+    }
+#endif
+#if PIXELFORMAT_USE_SSSE3
+    return __builtin_cpu_supports("ssse3");
+#elif PIXELFORMAT_USE_NEON
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+
+/*
+ * convert "count" pixels into RGB888. the kernel is chosen by the layout
+ * of the format once, instead of decoding each pixel by the format.
+ */
 static void
 expand_rgb(unsigned char *dst,
            unsigned char const *src,
-           int width, int height,
-           int pixelformat, int depth)
+           size_t count,
+           pixelformat_layout_t const *layout)
 {
-    int x;
-    int y;
-    int dst_offset;
-    int src_offset;
-    unsigned char r, g, b;
-
-    for (y = 0; y < height; y++) {
-        for (x = 0; x < width; x++) {
-            src_offset = depth * (y * width + x);
-            dst_offset = 3 * (y * width + x);
-            get_rgb(src + src_offset, pixelformat, depth, &r, &g, &b);
-
-            *(dst + dst_offset + 0) = r;
-            *(dst + dst_offset + 1) = g;
-            *(dst + dst_offset + 2) = b;
+    size_t n = 0;
+
+    if (layout->pixelformat == SIXEL_PIXELFORMAT_RGB888) {
+        memcpy(dst, src, count * 3);
+        return;
+    }
+
+    if (layout->bits[0] == 0) {
+        if (pixelformat_use_simd()) {
+#if PIXELFORMAT_USE_SSSE3
+            n = expand_bytes_ssse3(dst, src, count, layout);
+#elif PIXELFORMAT_USE_NEON
+            n = expand_bytes_neon(dst, src, count, layout);
+#endif
         }
+        expand_bytes(dst + n * 3, src + n * (size_t)layout->depth,
+                     count - n, layout);
+    } else {
+#if PIXELFORMAT_USE_SSSE3
+        if (pixelformat_use_simd()) {
+            n = expand_packed_ssse3(dst, src, count, layout);
+        }
+#endif
+        expand_packed(dst + n * 3, src + n * 2, count - n, layout);
     }
 }
 
@@ -270,28 +702,20 @@ sixel_helper_normalize_pixelformat(
 
     switch (src_pixelformat) {
     case SIXEL_PIXELFORMAT_G8:
-        expand_rgb(dst, src, width, height, src_pixelformat, 1);
-        *dst_pixelformat = SIXEL_PIXELFORMAT_RGB888;
-        break;
     case SIXEL_PIXELFORMAT_RGB565:
     case SIXEL_PIXELFORMAT_RGB555:
     case SIXEL_PIXELFORMAT_BGR565:
     case SIXEL_PIXELFORMAT_BGR555:
     case SIXEL_PIXELFORMAT_GA88:
     case SIXEL_PIXELFORMAT_AG88:
-        expand_rgb(dst, src, width, height, src_pixelformat, 2);
-        *dst_pixelformat = SIXEL_PIXELFORMAT_RGB888;
-        break;
     case SIXEL_PIXELFORMAT_RGB888:
     case SIXEL_PIXELFORMAT_BGR888:
-        expand_rgb(dst, src, width, height, src_pixelformat, 3);
-        *dst_pixelformat = SIXEL_PIXELFORMAT_RGB888;
-        break;
     case SIXEL_PIXELFORMAT_RGBA8888:
     case SIXEL_PIXELFORMAT_ARGB8888:
     case SIXEL_PIXELFORMAT_BGRA8888:
     case SIXEL_PIXELFORMAT_ABGR8888:
-        expand_rgb(dst, src, width, height, src_pixelformat, 4);
+        expand_rgb(dst, src, (size_t)width * (size_t)height,
+                   pixelformat_find_layout(src_pixelformat));
         *dst_pixelformat = SIXEL_PIXELFORMAT_RGB888;
         break;
     case SIXEL_PIXELFORMAT_PAL1:
@@ -681,6 +1105,139 @@ error:
 }
 
 
+/* kernels of all layouts must agree with get_rgb() on any length */
+static int
+test11(void)
+{
+    int nret = EXIT_FAILURE;
+    static int const counts[] = { 0, 1, 7, 8, 15, 16, 17, 31, 33, 40, 1001 };
+    unsigned char src[1001 * 4];
+    unsigned char dst[1001 * 3];
+    unsigned char r;
+    unsigned char g;
+    unsigned char b;
+    pixelformat_layout_t const *layout;
+    int dst_pixelformat;
+    size_t i;
+    size_t j;
+    int n;
+    int x;
+
+    for (n = 0; n < (int)sizeof(src); ++n) {
+        src[n] = (unsigned char)(n * 131 + n / 5);
+    }
+
+    for (n = 0; n < 2; ++n) {
+        pixelformat_force_scalar = n;
+        for (i = 0; i < sizeof(pixelformat_layouts) / sizeof(pixelformat_layouts[0]); ++i) {
+            layout = &pixelformat_layouts[i];
+            for (j = 0; j < sizeof(counts) / sizeof(counts[0]); ++j) {
+                memset(dst, 0, sizeof(dst));
+                if (SIXEL_FAILED(sixel_helper_normalize_pixelformat(dst,
+                                                                    &dst_pixelformat,
+                                                                    src,
+                                                                    layout->pixelformat,
+                                                                    counts[j], 1))) {
+                    goto error;
+                }
+                for (x = 0; x < counts[j]; ++x) {
+                    get_rgb(src + x * layout->depth, layout->pixelformat,
+                            layout->depth, &r, &g, &b);
+                    if (dst[x * 3 + 0] != r || dst[x * 3 + 1] != g || dst[x * 3 + 2] != b) {
+                        fprintf(stderr,
+                                "pixelformat: %#x differs at pixel %d of %d\n",
+                                layout->pixelformat, x, counts[j]);
+                        goto error;
+                    }
+                }
+                /* nothing after the last pixel must be written */
+                if (counts[j] < 1001 && dst[counts[j] * 3] != 0) {
+                    goto error;
+                }
+            }
+        }
+    }
+
+    nret = EXIT_SUCCESS;
+
+error:
+    pixelformat_force_scalar = 0;
+    return nret;
+}
+
+
+/*
+ * benchmark of normalizing a 1920x1080 frame, per pixel decoding with
+ * get_rgb() against the kernels.
+ * runs only if SIXEL_BENCHMARK environment variable is set.
+ */
+static int
+test12(void)
+{
+    int nret = EXIT_FAILURE;
+    static int const formats[] = {
+        SIXEL_PIXELFORMAT_BGRA8888,
+        SIXEL_PIXELFORMAT_RGBA8888,
+        SIXEL_PIXELFORMAT_BGR888,
+        SIXEL_PIXELFORMAT_RGB565,
+        SIXEL_PIXELFORMAT_GA88,
+        SIXEL_PIXELFORMAT_G8,
+    };
+    size_t const count = 1920 * 1080;
+    unsigned char *src = NULL;
+    unsigned char *dst = NULL;
+    pixelformat_layout_t const *layout;
+    int dst_pixelformat;
+    clock_t start;
+    double elapsed[3];
+    size_t i;
+    size_t x;
+    int n;
+
+    if (getenv("SIXEL_BENCHMARK") == NULL) {
+        return EXIT_SUCCESS;
+    }
+
+    src = (unsigned char *)malloc(count * 4);
+    dst = (unsigned char *)malloc(count * 3);
+    if (src == NULL || dst == NULL) {
+        goto error;
+    }
+    for (x = 0; x < count * 4; ++x) {
+        src[x] = (unsigned char)(x * 131);
+    }
+
+    fprintf(stderr, "pixelformat: %-10s %10s %10s %10s\n",
+            "format", "get_rgb", "scalar", "simd");
+    for (i = 0; i < sizeof(formats) / sizeof(formats[0]); ++i) {
+        layout = pixelformat_find_layout(formats[i]);
+        start = clock();
+        for (x = 0; x < count; ++x) {
+            get_rgb(src + x * (size_t)layout->depth, layout->pixelformat, layout->depth,
+                    dst + x * 3, dst + x * 3 + 1, dst + x * 3 + 2);
+        }
+        elapsed[0] = (double)(clock() - start) / CLOCKS_PER_SEC;
+        for (n = 0; n < 2; ++n) {
+            pixelformat_force_scalar = n == 0;
+            start = clock();
+            (void) sixel_helper_normalize_pixelformat(dst, &dst_pixelformat, src,
+                                                      formats[i], 1920, 1080);
+            elapsed[n + 1] = (double)(clock() - start) / CLOCKS_PER_SEC;
+        }
+        fprintf(stderr, "pixelformat: %#-10x %9.2fms %9.2fms %9.2fms\n",
+                formats[i], elapsed[0] * 1000, elapsed[1] * 1000, elapsed[2] * 1000);
+    }
+
+    nret = EXIT_SUCCESS;
+
+error:
+    pixelformat_force_scalar = 0;
+    free(src);
+    free(dst);
+    return nret;
+}
+
+
 SIXELAPI int
 sixel_pixelformat_tests_main(void)
 {
@@ -699,6 +1256,8 @@ sixel_pixelformat_tests_main(void)
         test8,
         test9,
         test10,
+        test11,
+        test12,
     };
 
     for (i = 0; i < sizeof(testcases) / sizeof(testcase); ++i) {
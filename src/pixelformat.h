@@ -22,10 +22,43 @@
 #ifndef LIBSIXEL_PIXELFORMAT_H
 #define LIBSIXEL_PIXELFORMAT_H
 
+#include <sixel.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/*
+ * get the pixel stride and the byte offsets of r, g and b for pixelformats
+ * whose color channels are separate bytes and can be read in place.
+ * returns 0 for other pixelformats, which must be normalized first.
+ */
+int
+sixel_pixelformat_get_channels(
+    int     /* in */  pixelformat,
+    int     /* out */ *stride,
+    int     /* out */ offsets[3]);
+
+/*
+ * get the number of bytes of a tightly packed row, rows of 1, 2 and 4bpp
+ * pixels are padded to a byte boundary. returns 0 for unknown formats.
+ */
+int
+sixel_pixelformat_get_row_bytes(
+    int     /* in */  pixelformat,
+    int     /* in */  width);
+
+/* normalize rows which are 'pitch' bytes apart into packed rows */
+SIXELSTATUS
+sixel_pixelformat_normalize_rows(
+    unsigned char       /* out */ *dst,
+    int                 /* out */ *dst_pixelformat,
+    unsigned char const /* in */  *src,
+    int                 /* in */  src_pixelformat,
+    int                 /* in */  width,
+    int                 /* in */  height,
+    int                 /* in */  pitch);
+
 #if HAVE_TESTS
 int
 sixel_pixelformat_tests_main(void);
@@ -62,8 +62,13 @@
 #if HAVE_INTTYPES_H
 # include <inttypes.h>
 #endif  /* HAVE_MATH_H */
+#if HAVE_TIME_H
+# include <time.h>
+#endif  /* HAVE_TIME_H */
 
 #include "quant.h"
+#include "pixelformat.h"
+#include "ordereddither.h"
 
 #if HAVE_DEBUG
 #define quant_trace fprintf
@@ -678,22 +683,13 @@ computeHash(unsigned char const *data, unsigned int const depth)
 }
 
 
-static SIXELSTATUS
-computeHistogram(unsigned char const    /* in */  *data,
-                 unsigned int           /* in */  length,
-                 unsigned long const    /* in */  depth,
-                 tupletable2 * const    /* out */ colorfreqtableP,
-                 int const              /* in */  qualityMode,
-                 sixel_allocator_t      /* in */  *allocator)
+/* bytes between sampled pixels, so that an image gives about as many
+   samples as the quality mode asks for */
+static unsigned int
+computeSamplingStep(unsigned int const  /* in */  length,
+                    unsigned int const  /* in */  stride,
+                    int const           /* in */  qualityMode)
 {
-    SIXELSTATUS status = SIXEL_FALSE;
-    typedef unsigned short unit_t;
-    unsigned int i, n;
-    unit_t *histogram = NULL;
-    unit_t *refmap = NULL;
-    unit_t *ref;
-    unit_t *it;
-    unsigned int bucket_index;
     unsigned int step;
     unsigned int max_sample;
 
@@ -710,11 +706,38 @@ computeHistogram(unsigned char const    /* in */  *data,
         break;
     }
 
-    step = length / depth / max_sample * depth;
+    step = length / stride / max_sample * stride;
     if (step <= 0) {
-        step = depth;
+        step = stride;
     }
 
+    return step;
+}
+
+
+static SIXELSTATUS
+computeHistogram(unsigned char const    /* in */  *data,
+                 unsigned int           /* in */  length,
+                 unsigned long const    /* in */  depth,
+                 unsigned int const     /* in */  stride,
+                 int const              /* in */  *offsets,
+                 tupletable2 * const    /* out */ colorfreqtableP,
+                 int const              /* in */  qualityMode,
+                 sixel_allocator_t      /* in */  *allocator)
+{
+    SIXELSTATUS status = SIXEL_FALSE;
+    typedef unsigned short unit_t;
+    unsigned int i, n;
+    unit_t *histogram = NULL;
+    unit_t *refmap = NULL;
+    unit_t *ref;
+    unit_t *it;
+    unsigned int bucket_index;
+    unsigned int step;
+    unsigned char pixel[3];
+
+    step = computeSamplingStep(length, stride, qualityMode);
+
     quant_trace(stderr, "making histogram...\n");
 
     histogram = (unit_t *)sixel_allocator_calloc(allocator,
@@ -737,7 +760,10 @@ computeHistogram(unsigned char const    /* in */  *data,
     }
 
     for (i = 0; i < length; i += step) {
-        bucket_index = computeHash(data + i, 3);
+        pixel[0] = data[i + offsets[0]];
+        pixel[1] = data[i + offsets[1]];
+        pixel[2] = data[i + offsets[2]];
+        bucket_index = computeHash(pixel, 3);
         if (histogram[bucket_index] == 0) {
             *ref++ = bucket_index;
         }
@@ -775,10 +801,59 @@ end:
 }
 
 
+/* choose at most 'reqColors' colors from a histogram, the table is sorted */
+static SIXELSTATUS
+computeColorMapFromTable(tupletable2 const colorfreqtable,
+                         unsigned int const depth,
+                         unsigned int const reqColors,
+                         int const methodForLargest,
+                         int const methodForRep,
+                         tupletable2 * const colormapP,
+                         sixel_allocator_t *allocator)
+{
+    SIXELSTATUS status = SIXEL_FALSE;
+    unsigned int i;
+    unsigned int n;
+
+    if (colorfreqtable.size <= reqColors) {
+        quant_trace(stderr,
+                    "Image already has few enough colors (<=%d).  "
+                    "Keeping same colors.\n", reqColors);
+        /* *colormapP = colorfreqtable; */
+        colormapP->size = colorfreqtable.size;
+        status = alloctupletable(&colormapP->table, depth, colorfreqtable.size, allocator);
+        if (SIXEL_FAILED(status)) {
+            goto end;
+        }
+        for (i = 0; i < colorfreqtable.size; ++i) {
+            colormapP->table[i]->value = colorfreqtable.table[i]->value;
+            for (n = 0; n < depth; ++n) {
+                colormapP->table[i]->tuple[n] = colorfreqtable.table[i]->tuple[n];
+            }
+        }
+    } else {
+        quant_trace(stderr, "choosing %d colors...\n", reqColors);
+        status = mediancut(colorfreqtable, depth, reqColors,
+                           methodForLargest, methodForRep, colormapP, allocator);
+        if (SIXEL_FAILED(status)) {
+            goto end;
+        }
+        quant_trace(stderr, "%d colors are choosed.\n", colorfreqtable.size);
+    }
+
+    status = SIXEL_OK;
+
+end:
+    return status;
+}
+
+
 static int
 computeColorMapFromInput(unsigned char const *data,
                          unsigned int const length,
                          unsigned int const depth,
+                         unsigned int const stride,
+                         int const *offsets,
                          unsigned int const reqColors,
                          int const methodForLargest,
                          int const methodForRep,
@@ -808,10 +883,8 @@ computeColorMapFromInput(unsigned char const *data,
 -----------------------------------------------------------------------------*/
     SIXELSTATUS status = SIXEL_FALSE;
     tupletable2 colorfreqtable = {0, NULL};
-    unsigned int i;
-    unsigned int n;
 
-    status = computeHistogram(data, length, depth,
+    status = computeHistogram(data, length, depth, stride, offsets,
                               &colorfreqtable, qualityMode, allocator);
     if (SIXEL_FAILED(status)) {
         goto end;
@@ -820,33 +893,9 @@ computeColorMapFromInput(unsigned char const *data,
         *origcolors = colorfreqtable.size;
     }
 
-    if (colorfreqtable.size <= reqColors) {
-        quant_trace(stderr,
-                    "Image already has few enough colors (<=%d).  "
-                    "Keeping same colors.\n", reqColors);
-        /* *colormapP = colorfreqtable; */
-        colormapP->size = colorfreqtable.size;
-        status = alloctupletable(&colormapP->table, depth, colorfreqtable.size, allocator);
-        if (SIXEL_FAILED(status)) {
-            goto end;
-        }
-        for (i = 0; i < colorfreqtable.size; ++i) {
-            colormapP->table[i]->value = colorfreqtable.table[i]->value;
-            for (n = 0; n < depth; ++n) {
-                colormapP->table[i]->tuple[n] = colorfreqtable.table[i]->tuple[n];
-            }
-        }
-    } else {
-        quant_trace(stderr, "choosing %d colors...\n", reqColors);
-        status = mediancut(colorfreqtable, depth, reqColors,
-                           methodForLargest, methodForRep, colormapP, allocator);
-        if (SIXEL_FAILED(status)) {
-            goto end;
-        }
-        quant_trace(stderr, "%d colors are choosed.\n", colorfreqtable.size);
-    }
-
-    status = SIXEL_OK;
+    status = computeColorMapFromTable(colorfreqtable, depth, reqColors,
+                                      methodForLargest, methodForRep,
+                                      colormapP, allocator);
 
 end:
     sixel_allocator_free(allocator, colorfreqtable.table);
@@ -854,18 +903,59 @@ end:
 }
 
 
+/* the diffusion kernels must be inlined for constant layouts to be folded */
+#if defined(__GNUC__)
+# define QUANT_ALWAYS_INLINE inline __attribute__((always_inline))
+#else
+# define QUANT_ALWAYS_INLINE inline
+#endif
+
+/*
+ * address of the pixel at (x, y) in rows of 'pitch' bytes.
+ * the diffusion kernels were written for a flat array of pixels, so a
+ * target beyond either end of a row wraps around to the neighbouring
+ * row, as it does when the rows are tightly packed. this keeps the
+ * result of padded rows identical and keeps writes inside the image.
+ */
+static QUANT_ALWAYS_INLINE unsigned char *
+diffuse_target(unsigned char /* in */ *data,    /* base address of pixel buffer */
+               int           /* in */ x,        /* column of the destination pixel */
+               int           /* in */ y,        /* row of the destination pixel */
+               int           /* in */ width,    /* pixels per row */
+               int           /* in */ stride,   /* bytes per pixel */
+               int           /* in */ pitch)    /* bytes per row */
+{
+    if (x >= 0 && x < width) {
+        return data + y * pitch + x * stride;
+    }
+    while (x < 0) {
+        x += width;
+        --y;
+    }
+    while (x >= width) {
+        x -= width;
+        ++y;
+    }
+
+    return data + y * pitch + x * stride;
+}
+
+
 /* diffuse error energy to surround pixels */
 static void
 error_diffuse(unsigned char /* in */    *data,      /* base address of pixel buffer */
-              int           /* in */    pos,        /* address of the destination pixel */
+              int           /* in */    x,          /* column of the destination pixel */
+              int           /* in */    y,          /* row of the destination pixel */
+              int           /* in */    width,      /* pixels per row */
               int           /* in */    depth,      /* color depth in bytes */
+              int           /* in */    pitch,      /* bytes per row */
               int           /* in */    error,      /* error energy */
               int           /* in */    numerator,  /* numerator of diffusion coefficient */
               int           /* in */    denominator /* denominator of diffusion coefficient */)
 {
     int c;
 
-    data += pos * depth;
+    data = diffuse_target(data, x, y, width, depth, pitch);
 
     c = *data + error * numerator / denominator;
     if (c < 0) {
@@ -880,7 +970,7 @@ error_diffuse(unsigned char /* in */    *data,      /* base address of pixel buf
 
 static void
 diffuse_none(unsigned char *data, int width, int height,
-             int x, int y, int depth, int error)
+             int x, int y, int depth, int pitch, int error)
 {
     /* unused */ (void) data;
     /* unused */ (void) width;
@@ -888,43 +978,36 @@ diffuse_none(unsigned char *data, int width, int height,
     /* unused */ (void) x;
     /* unused */ (void) y;
     /* unused */ (void) depth;
+    /* unused */ (void) pitch;
     /* unused */ (void) error;
 }
 
 
 static void
 diffuse_fs(unsigned char *data, int width, int height,
-           int x, int y, int depth, int error)
+           int x, int y, int depth, int pitch, int error)
 {
-    int pos;
-
-    pos = y * width + x;
-
     /* Floyd Steinberg Method
      *          curr    7/16
      *  3/16    5/48    1/16
      */
     if (x < width - 1 && y < height - 1) {
         /* add error to the right cell */
-        error_diffuse(data, pos + width * 0 + 1, depth, error, 7, 16);
+        error_diffuse(data, x + 1, y + 0, width, depth, pitch, error, 7, 16);
         /* add error to the left-bottom cell */
-        error_diffuse(data, pos + width * 1 - 1, depth, error, 3, 16);
+        error_diffuse(data, x - 1, y + 1, width, depth, pitch, error, 3, 16);
         /* add error to the bottom cell */
-        error_diffuse(data, pos + width * 1 + 0, depth, error, 5, 16);
+        error_diffuse(data, x + 0, y + 1, width, depth, pitch, error, 5, 16);
         /* add error to the right-bottom cell */
-        error_diffuse(data, pos + width * 1 + 1, depth, error, 1, 16);
+        error_diffuse(data, x + 1, y + 1, width, depth, pitch, error, 1, 16);
     }
 }
 
 
 static void
 diffuse_atkinson(unsigned char *data, int width, int height,
-                 int x, int y, int depth, int error)
+                 int x, int y, int depth, int pitch, int error)
 {
-    int pos;
-
-    pos = y * width + x;
-
     /* Atkinson's Method
      *          curr    1/8    1/8
      *   1/8     1/8    1/8
@@ -932,24 +1015,24 @@ diffuse_atkinson(unsigned char *data, int width, int height,
      */
     if (y < height - 2) {
         /* add error to the right cell */
-        error_diffuse(data, pos + width * 0 + 1, depth, error, 1, 8);
+        error_diffuse(data, x + 1, y + 0, width, depth, pitch, error, 1, 8);
         /* add error to the 2th right cell */
-        error_diffuse(data, pos + width * 0 + 2, depth, error, 1, 8);
+        error_diffuse(data, x + 2, y + 0, width, depth, pitch, error, 1, 8);
         /* add error to the left-bottom cell */
-        error_diffuse(data, pos + width * 1 - 1, depth, error, 1, 8);
+        error_diffuse(data, x - 1, y + 1, width, depth, pitch, error, 1, 8);
         /* add error to the bottom cell */
-        error_diffuse(data, pos + width * 1 + 0, depth, error, 1, 8);
+        error_diffuse(data, x + 0, y + 1, width, depth, pitch, error, 1, 8);
         /* add error to the right-bottom cell */
-        error_diffuse(data, pos + width * 1 + 1, depth, error, 1, 8);
+        error_diffuse(data, x + 1, y + 1, width, depth, pitch, error, 1, 8);
         /* add error to the 2th bottom cell */
-        error_diffuse(data, pos + width * 2 + 0, depth, error, 1, 8);
+        error_diffuse(data, x + 0, y + 2, width, depth, pitch, error, 1, 8);
     }
 }
 
 
 static void
 diffuse_jajuni(unsigned char *data, int width, int height,
-               int x, int y, int depth, int error)
+               int x, int y, int depth, int pitch, int error)
 {
     int pos;
 
@@ -961,25 +1044,25 @@ diffuse_jajuni(unsigned char *data, int width, int height,
      *  1/48    3/48    5/48    3/48    1/48
      */
     if (pos < (height - 2) * width - 2) {
-        error_diffuse(data, pos + width * 0 + 1, depth, error, 7, 48);
-        error_diffuse(data, pos + width * 0 + 2, depth, error, 5, 48);
-        error_diffuse(data, pos + width * 1 - 2, depth, error, 3, 48);
-        error_diffuse(data, pos + width * 1 - 1, depth, error, 5, 48);
-        error_diffuse(data, pos + width * 1 + 0, depth, error, 7, 48);
-        error_diffuse(data, pos + width * 1 + 1, depth, error, 5, 48);
-        error_diffuse(data, pos + width * 1 + 2, depth, error, 3, 48);
-        error_diffuse(data, pos + width * 2 - 2, depth, error, 1, 48);
-        error_diffuse(data, pos + width * 2 - 1, depth, error, 3, 48);
-        error_diffuse(data, pos + width * 2 + 0, depth, error, 5, 48);
-        error_diffuse(data, pos + width * 2 + 1, depth, error, 3, 48);
-        error_diffuse(data, pos + width * 2 + 2, depth, error, 1, 48);
+        error_diffuse(data, x + 1, y + 0, width, depth, pitch, error, 7, 48);
+        error_diffuse(data, x + 2, y + 0, width, depth, pitch, error, 5, 48);
+        error_diffuse(data, x - 2, y + 1, width, depth, pitch, error, 3, 48);
+        error_diffuse(data, x - 1, y + 1, width, depth, pitch, error, 5, 48);
+        error_diffuse(data, x + 0, y + 1, width, depth, pitch, error, 7, 48);
+        error_diffuse(data, x + 1, y + 1, width, depth, pitch, error, 5, 48);
+        error_diffuse(data, x + 2, y + 1, width, depth, pitch, error, 3, 48);
+        error_diffuse(data, x - 2, y + 2, width, depth, pitch, error, 1, 48);
+        error_diffuse(data, x - 1, y + 2, width, depth, pitch, error, 3, 48);
+        error_diffuse(data, x + 0, y + 2, width, depth, pitch, error, 5, 48);
+        error_diffuse(data, x + 1, y + 2, width, depth, pitch, error, 3, 48);
+        error_diffuse(data, x + 2, y + 2, width, depth, pitch, error, 1, 48);
     }
 }
 
 
 static void
 diffuse_stucki(unsigned char *data, int width, int height,
-               int x, int y, int depth, int error)
+               int x, int y, int depth, int pitch, int error)
 {
     int pos;
 
@@ -991,25 +1074,25 @@ diffuse_stucki(unsigned char *data, int width, int height,
      *  1/48    2/48    4/48    2/48    1/48
      */
     if (pos < (height - 2) * width - 2) {
-        error_diffuse(data, pos + width * 0 + 1, depth, error, 1, 6);
-        error_diffuse(data, pos + width * 0 + 2, depth, error, 1, 12);
-        error_diffuse(data, pos + width * 1 - 2, depth, error, 1, 24);
-        error_diffuse(data, pos + width * 1 - 1, depth, error, 1, 12);
-        error_diffuse(data, pos + width * 1 + 0, depth, error, 1, 6);
-        error_diffuse(data, pos + width * 1 + 1, depth, error, 1, 12);
-        error_diffuse(data, pos + width * 1 + 2, depth, error, 1, 24);
-        error_diffuse(data, pos + width * 2 - 2, depth, error, 1, 48);
-        error_diffuse(data, pos + width * 2 - 1, depth, error, 1, 24);
-        error_diffuse(data, pos + width * 2 + 0, depth, error, 1, 12);
-        error_diffuse(data, pos + width * 2 + 1, depth, error, 1, 24);
-        error_diffuse(data, pos + width * 2 + 2, depth, error, 1, 48);
+        error_diffuse(data, x + 1, y + 0, width, depth, pitch, error, 1, 6);
+        error_diffuse(data, x + 2, y + 0, width, depth, pitch, error, 1, 12);
+        error_diffuse(data, x - 2, y + 1, width, depth, pitch, error, 1, 24);
+        error_diffuse(data, x - 1, y + 1, width, depth, pitch, error, 1, 12);
+        error_diffuse(data, x + 0, y + 1, width, depth, pitch, error, 1, 6);
+        error_diffuse(data, x + 1, y + 1, width, depth, pitch, error, 1, 12);
+        error_diffuse(data, x + 2, y + 1, width, depth, pitch, error, 1, 24);
+        error_diffuse(data, x - 2, y + 2, width, depth, pitch, error, 1, 48);
+        error_diffuse(data, x - 1, y + 2, width, depth, pitch, error, 1, 24);
+        error_diffuse(data, x + 0, y + 2, width, depth, pitch, error, 1, 12);
+        error_diffuse(data, x + 1, y + 2, width, depth, pitch, error, 1, 24);
+        error_diffuse(data, x + 2, y + 2, width, depth, pitch, error, 1, 48);
     }
 }
 
 
 static void
 diffuse_burkes(unsigned char *data, int width, int height,
-               int x, int y, int depth, int error)
+               int x, int y, int depth, int pitch, int error)
 {
     int pos;
 
@@ -1020,26 +1103,46 @@ diffuse_burkes(unsigned char *data, int width, int height,
      *  1/16    2/16    4/16    2/16    1/16
      */
     if (pos < (height - 1) * width - 2) {
-        error_diffuse(data, pos + width * 0 + 1, depth, error, 1, 4);
-        error_diffuse(data, pos + width * 0 + 2, depth, error, 1, 8);
-        error_diffuse(data, pos + width * 1 - 2, depth, error, 1, 16);
-        error_diffuse(data, pos + width * 1 - 1, depth, error, 1, 8);
-        error_diffuse(data, pos + width * 1 + 0, depth, error, 1, 4);
-        error_diffuse(data, pos + width * 1 + 1, depth, error, 1, 8);
-        error_diffuse(data, pos + width * 1 + 2, depth, error, 1, 16);
+        error_diffuse(data, x + 1, y + 0, width, depth, pitch, error, 1, 4);
+        error_diffuse(data, x + 2, y + 0, width, depth, pitch, error, 1, 8);
+        error_diffuse(data, x - 2, y + 1, width, depth, pitch, error, 1, 16);
+        error_diffuse(data, x - 1, y + 1, width, depth, pitch, error, 1, 8);
+        error_diffuse(data, x + 0, y + 1, width, depth, pitch, error, 1, 4);
+        error_diffuse(data, x + 1, y + 1, width, depth, pitch, error, 1, 8);
+        error_diffuse(data, x + 2, y + 1, width, depth, pitch, error, 1, 16);
     }
 }
 
-static float
+/*
+ * position dependent masks return an offset in [-32, 31] which is added
+ * to each channel before the palette lookup.
+ */
+static int
 mask_a (int x, int y, int c)
 {
-    return ((((x + c * 67) + y * 236) * 119) & 255 ) / 128.0 - 1.0;
+    return (((((x + c * 67) + y * 236) * 119) & 255) >> 2) - 32;
 }
 
-static float
+static int
 mask_x (int x, int y, int c)
 {
-    return ((((x + c * 29) ^ y* 149) * 1234) & 511 ) / 256.0 - 1.0;
+    return (((((x + c * 29) ^ y * 149) * 1234) & 511) >> 3) - 32;
+}
+
+/* ordered dither with 8x8 Bayer matrix, same threshold for all channels */
+static int
+mask_bayer (int x, int y, int c)
+{
+    (void) c;
+    return bayer_matrix_8x8[((y & 7) << 3) + (x & 7)] - 32;
+}
+
+/* ordered dither with blue noise, texture is shifted for each channel */
+static int
+mask_bluenoise (int x, int y, int c)
+{
+    return (bluenoise_matrix_64x64[(((y + c * 23) & 63) << 6)
+                                   + ((x + c * 41) & 63)] >> 2) - 32;
 }
 
 /* lookup closest color from palette with "normal" strategy */
@@ -1180,109 +1283,825 @@ lookup_mono_lightbg(unsigned char const * const pixel,
 }
 
 
-/* choose colors using median-cut method */
-SIXELSTATUS
-sixel_quant_make_palette(
-    unsigned char          /* out */ **result,
-    unsigned char const    /* in */  *data,
-    unsigned int           /* in */  length,
-    int                    /* in */  pixelformat,
-    unsigned int           /* in */  reqcolors,
-    unsigned int           /* in */  *ncolors,
-    unsigned int           /* in */  *origcolors,
-    int                    /* in */  methodForLargest,
-    int                    /* in */  methodForRep,
-    int                    /* in */  qualityMode,
-    sixel_allocator_t      /* in */  *allocator)
+/*
+ * specialized apply loops for 3-channel pixels
+ *
+ * sixel_quant_apply_palette() selects f_lookup and f_diffuse at run time
+ * and calls them per pixel and per channel. For the common RGB case the
+ * whole loop is instantiated once per (lookup, diffuse) pair below, so
+ * that the compiler can inline the lookup and unroll the error kernels.
+ * The results are identical to the generic loop.
+ *
+ * Pixels are addressed through a stride and the byte offsets of r, g and
+ * b, so that 32bpp input such as RGBA or BGRA is quantized in place
+ * without being normalized to RGB888 first. Rows are 'pitch' bytes apart
+ * so that a rectangle of a larger buffer can be used as is. The RGB888 loops fix both at
+ * compile time; the strided loops take them at run time. Bytes which are
+ * not color channels, like alpha, are never read or written.
+ */
+
+/* diffuse error energy of all three channels to a pixel */
+static QUANT_ALWAYS_INLINE void
+error_diffuse_rgb(unsigned char /* in */ *data,        /* base address of pixel buffer */
+                  int           /* in */ x,            /* column of the destination pixel */
+                  int           /* in */ y,            /* row of the destination pixel */
+                  int           /* in */ width,        /* pixels per row */
+                  int           /* in */ stride,       /* bytes per pixel */
+                  int           /* in */ pitch,        /* bytes per row */
+                  int const     /* in */ *offsets,     /* byte offsets of r, g and b */
+                  int const     /* in */ *error,       /* error energy of each channel */
+                  int           /* in */ numerator,    /* numerator of diffusion coefficient */
+                  int           /* in */ denominator)  /* denominator of diffusion coefficient */
 {
-    SIXELSTATUS status = SIXEL_FALSE;
-    unsigned int i;
-    unsigned int n;
-    int ret;
-    tupletable2 colormap;
-    unsigned int depth;
-    int result_depth;
+    int c;
+    int n;
 
-    result_depth = sixel_helper_compute_depth(pixelformat);
-    if (result_depth <= 0) {
-        *result = NULL;
-        goto end;
+    data = diffuse_target(data, x, y, width, stride, pitch);
+
+    for (n = 0; n < 3; ++n) {
+        c = data[offsets[n]] + error[n] * numerator / denominator;
+        if (c < 0) {
+            c = 0;
+        }
+        if (c >= 1 << 8) {
+            c = (1 << 8) - 1;
+        }
+        data[offsets[n]] = (unsigned char)c;
     }
+}
 
-    depth = (unsigned int)result_depth;
 
-    ret = computeColorMapFromInput(data, length, depth,
-                                   reqcolors, methodForLargest,
-                                   methodForRep, qualityMode,
-                                   &colormap, origcolors, allocator);
-    if (ret != 0) {
-        *result = NULL;
-        goto end;
+static QUANT_ALWAYS_INLINE void
+diffuse_none_rgb(unsigned char *data, int width, int height,
+                 int x, int y, int stride, int pitch, int const *offsets,
+                 int const *error)
+{
+    /* unused */ (void) data;
+    /* unused */ (void) width;
+    /* unused */ (void) height;
+    /* unused */ (void) x;
+    /* unused */ (void) y;
+    /* unused */ (void) stride;
+    /* unused */ (void) pitch;
+    /* unused */ (void) offsets;
+    /* unused */ (void) error;
+}
+
+
+static QUANT_ALWAYS_INLINE void
+diffuse_fs_rgb(unsigned char *data, int width, int height,
+               int x, int y, int stride, int pitch, int const *offsets,
+               int const *error)
+{
+    if (x < width - 1 && y < height - 1) {
+        error_diffuse_rgb(data, x + 1, y + 0, width, stride, pitch, offsets, error, 7, 16);
+        error_diffuse_rgb(data, x - 1, y + 1, width, stride, pitch, offsets, error, 3, 16);
+        error_diffuse_rgb(data, x + 0, y + 1, width, stride, pitch, offsets, error, 5, 16);
+        error_diffuse_rgb(data, x + 1, y + 1, width, stride, pitch, offsets, error, 1, 16);
     }
-    *ncolors = colormap.size;
-    quant_trace(stderr, "tupletable size: %d\n", *ncolors);
-    *result = (unsigned char *)sixel_allocator_malloc(allocator, *ncolors * depth);
-    for (i = 0; i < *ncolors; i++) {
-        for (n = 0; n < depth; ++n) {
-            (*result)[i * depth + n] = colormap.table[i]->tuple[n];
-        }
+}
+
+
+static QUANT_ALWAYS_INLINE void
+diffuse_atkinson_rgb(unsigned char *data, int width, int height,
+                     int x, int y, int stride, int pitch, int const *offsets,
+                     int const *error)
+{
+    if (y < height - 2) {
+        error_diffuse_rgb(data, x + 1, y + 0, width, stride, pitch, offsets, error, 1, 8);
+        error_diffuse_rgb(data, x + 2, y + 0, width, stride, pitch, offsets, error, 1, 8);
+        error_diffuse_rgb(data, x - 1, y + 1, width, stride, pitch, offsets, error, 1, 8);
+        error_diffuse_rgb(data, x + 0, y + 1, width, stride, pitch, offsets, error, 1, 8);
+        error_diffuse_rgb(data, x + 1, y + 1, width, stride, pitch, offsets, error, 1, 8);
+        error_diffuse_rgb(data, x + 0, y + 2, width, stride, pitch, offsets, error, 1, 8);
     }
+}
 
-    sixel_allocator_free(allocator, colormap.table);
 
-    status = SIXEL_OK;
+static QUANT_ALWAYS_INLINE void
+diffuse_jajuni_rgb(unsigned char *data, int width, int height,
+                   int x, int y, int stride, int pitch, int const *offsets,
+                   int const *error)
+{
+    int pos;
 
-end:
-    return status;
+    pos = y * width + x;
+
+    if (pos < (height - 2) * width - 2) {
+        error_diffuse_rgb(data, x + 1, y + 0, width, stride, pitch, offsets, error, 7, 48);
+        error_diffuse_rgb(data, x + 2, y + 0, width, stride, pitch, offsets, error, 5, 48);
+        error_diffuse_rgb(data, x - 2, y + 1, width, stride, pitch, offsets, error, 3, 48);
+        error_diffuse_rgb(data, x - 1, y + 1, width, stride, pitch, offsets, error, 5, 48);
+        error_diffuse_rgb(data, x + 0, y + 1, width, stride, pitch, offsets, error, 7, 48);
+        error_diffuse_rgb(data, x + 1, y + 1, width, stride, pitch, offsets, error, 5, 48);
+        error_diffuse_rgb(data, x + 2, y + 1, width, stride, pitch, offsets, error, 3, 48);
+        error_diffuse_rgb(data, x - 2, y + 2, width, stride, pitch, offsets, error, 1, 48);
+        error_diffuse_rgb(data, x - 1, y + 2, width, stride, pitch, offsets, error, 3, 48);
+        error_diffuse_rgb(data, x + 0, y + 2, width, stride, pitch, offsets, error, 5, 48);
+        error_diffuse_rgb(data, x + 1, y + 2, width, stride, pitch, offsets, error, 3, 48);
+        error_diffuse_rgb(data, x + 2, y + 2, width, stride, pitch, offsets, error, 1, 48);
+    }
 }
 
 
-/* apply color palette into specified pixel buffers */
-SIXELSTATUS
-sixel_quant_apply_palette(
-    sixel_index_t     /* out */ *result,
-    unsigned char     /* in */  *data,
-    int               /* in */  width,
-    int               /* in */  height,
-    int               /* in */  depth,
-    unsigned char     /* in */  *palette,
-    int               /* in */  reqcolor,
-    int               /* in */  methodForDiffuse,
-    int               /* in */  foptimize,
-    int               /* in */  foptimize_palette,
-    int               /* in */  complexion,
-    unsigned short    /* in */  *cachetable,
-    int               /* in */  *ncolors,
-    sixel_allocator_t /* in */  *allocator)
+static QUANT_ALWAYS_INLINE void
+diffuse_stucki_rgb(unsigned char *data, int width, int height,
+                   int x, int y, int stride, int pitch, int const *offsets,
+                   int const *error)
 {
-    typedef int component_t;
-    enum { max_depth = 4 };
-    enum { max_channel_diff_sq = 255 * 255 };
-    SIXELSTATUS status = SIXEL_FALSE;
-    int pos, n, x, y, sum1, sum2;
-    int non_weighted_components;
-    component_t offset;
-    int color_index;
-    long long max_complexion;
-    unsigned short *indextable;
-    unsigned char new_palette[SIXEL_PALETTE_MAX * 4];
-    unsigned short migration_map[SIXEL_PALETTE_MAX];
-    float (*f_mask) (int x, int y, int c) = NULL;
-    void (*f_diffuse)(unsigned char *data, int width, int height,
-                      int x, int y, int depth, int offset);
-    int (*f_lookup)(unsigned char const * const pixel,
-                    int const depth,
-                    unsigned char const * const palette,
-                    int const reqcolor,
-                    unsigned short * const cachetable,
-                    int const complexion);
+    int pos;
 
-    /* check bad reqcolor */
-    if (reqcolor < 1) {
+    pos = y * width + x;
+
+    if (pos < (height - 2) * width - 2) {
+        error_diffuse_rgb(data, x + 1, y + 0, width, stride, pitch, offsets, error, 1, 6);
+        error_diffuse_rgb(data, x + 2, y + 0, width, stride, pitch, offsets, error, 1, 12);
+        error_diffuse_rgb(data, x - 2, y + 1, width, stride, pitch, offsets, error, 1, 24);
+        error_diffuse_rgb(data, x - 1, y + 1, width, stride, pitch, offsets, error, 1, 12);
+        error_diffuse_rgb(data, x + 0, y + 1, width, stride, pitch, offsets, error, 1, 6);
+        error_diffuse_rgb(data, x + 1, y + 1, width, stride, pitch, offsets, error, 1, 12);
+        error_diffuse_rgb(data, x + 2, y + 1, width, stride, pitch, offsets, error, 1, 24);
+        error_diffuse_rgb(data, x - 2, y + 2, width, stride, pitch, offsets, error, 1, 48);
+        error_diffuse_rgb(data, x - 1, y + 2, width, stride, pitch, offsets, error, 1, 24);
+        error_diffuse_rgb(data, x + 0, y + 2, width, stride, pitch, offsets, error, 1, 12);
+        error_diffuse_rgb(data, x + 1, y + 2, width, stride, pitch, offsets, error, 1, 24);
+        error_diffuse_rgb(data, x + 2, y + 2, width, stride, pitch, offsets, error, 1, 48);
+    }
+}
+
+
+static QUANT_ALWAYS_INLINE void
+diffuse_burkes_rgb(unsigned char *data, int width, int height,
+                   int x, int y, int stride, int pitch, int const *offsets,
+                   int const *error)
+{
+    int pos;
+
+    pos = y * width + x;
+
+    if (pos < (height - 1) * width - 2) {
+        error_diffuse_rgb(data, x + 1, y + 0, width, stride, pitch, offsets, error, 1, 4);
+        error_diffuse_rgb(data, x + 2, y + 0, width, stride, pitch, offsets, error, 1, 8);
+        error_diffuse_rgb(data, x - 2, y + 1, width, stride, pitch, offsets, error, 1, 16);
+        error_diffuse_rgb(data, x - 1, y + 1, width, stride, pitch, offsets, error, 1, 8);
+        error_diffuse_rgb(data, x + 0, y + 1, width, stride, pitch, offsets, error, 1, 4);
+        error_diffuse_rgb(data, x + 1, y + 1, width, stride, pitch, offsets, error, 1, 8);
+        error_diffuse_rgb(data, x + 2, y + 1, width, stride, pitch, offsets, error, 1, 16);
+    }
+}
+
+
+/* lookup_normal() with depth fixed to 3 */
+static inline int
+lookup_normal_rgb(unsigned char const * const pixel,
+                  int const depth,
+                  unsigned char const * const palette,
+                  int const reqcolor,
+                  unsigned short * const cachetable,
+                  int const complexion)
+{
+    int result;
+    int diff;
+    int i;
+    int r;
+    int g;
+    int b;
+    int distant;
+
+    /* unused */ (void) depth;
+    /* unused */ (void) cachetable;
+
+    result = (-1);
+    diff = INT_MAX;
+
+    for (i = 0; i < reqcolor; i++) {
+        r = pixel[0] - palette[i * 3 + 0];
+        g = pixel[1] - palette[i * 3 + 1];
+        b = pixel[2] - palette[i * 3 + 2];
+        distant = r * r * complexion + g * g + b * b;
+        if (distant < diff) {
+            diff = distant;
+            result = i;
+        }
+    }
+
+    return result;
+}
+
+
+/* lookup_fast() is already specialized for depth 3, just allow inlining */
+static inline int
+lookup_fast_rgb(unsigned char const * const pixel,
+                int const depth,
+                unsigned char const * const palette,
+                int const reqcolor,
+                unsigned short * const cachetable,
+                int const complexion)
+{
+    int result;
+    unsigned int hash;
+    int diff;
+    int cache;
+    int i;
+    int distant;
+
+    /* unused */ (void) depth;
+
+    hash = computeHash(pixel, 3);
+    cache = cachetable[hash];
+    if (cache) {  /* fast lookup */
+        return cache - 1;
+    }
+
+    result = (-1);
+    diff = INT_MAX;
+
+    /* collision */
+    for (i = 0; i < reqcolor; i++) {
+        distant = (pixel[0] - palette[i * 3 + 0]) * (pixel[0] - palette[i * 3 + 0]) * complexion
+                + (pixel[1] - palette[i * 3 + 1]) * (pixel[1] - palette[i * 3 + 1])
+                + (pixel[2] - palette[i * 3 + 2]) * (pixel[2] - palette[i * 3 + 2])
+                ;
+        if (distant < diff) {
+            diff = distant;
+            result = i;
+        }
+    }
+    cachetable[hash] = result + 1;
+
+    return result;
+}
+
+
+typedef void (*apply_palette_rgb_t)(
+    sixel_index_t       /* out */ *result,
+    unsigned char       /* in */  *data,
+    int                 /* in */  width,
+    int                 /* in */  height,
+    int                 /* in */  rows,
+    int                 /* in */  stride,
+    int                 /* in */  pitch,
+    int const           /* in */  *offsets,
+    unsigned char const /* in */  *palette,
+    int                 /* in */  reqcolor,
+    unsigned short      /* in */  *indextable,
+    int                 /* in */  complexion,
+    unsigned char       /* out */ *new_palette,    /* NULL unless optimize_palette */
+    unsigned short      /* out */ *migration_map,  /* NULL unless optimize_palette */
+    int                 /* out */ *ncolors);
+
+
+static int const quant_rgb_offsets[3] = { 0, 1, 2 };
+
+#define SIXEL_QUANT_DEFINE_APPLY_RGB(name, f_lookup, f_diffuse,                \
+                                     pixel_stride, pixel_offsets)             \
+static void                                                                   \
+name(sixel_index_t *result, unsigned char *data, int width, int height,       \
+     int rows, int stride, int pitch, int const *offsets,                     \
+     unsigned char const *palette, int reqcolor,                              \
+     unsigned short *indextable, int complexion,                              \
+     unsigned char *new_palette, unsigned short *migration_map,               \
+     int *ncolors)                                                            \
+{                                                                             \
+    int x;                                                                    \
+    int y;                                                                    \
+    int pos;                                                                  \
+    int color_index;                                                          \
+    int error[3];                                                             \
+    int const s = (pixel_stride);                                             \
+    int const *o = (pixel_offsets);                                           \
+    unsigned char pixel[3];                                                   \
+    unsigned char const *row;                                                 \
+    unsigned char const *color;                                               \
+                                                                              \
+    /* unused */ (void) stride;                                               \
+    /* unused */ (void) offsets;                                              \
+                                                                              \
+    for (y = 0, pos = 0; y < rows; ++y) {                                     \
+        row = data + y * pitch;                                               \
+        for (x = 0; x < width; ++x, ++pos) {                                  \
+            pixel[0] = row[x * s + o[0]];                                     \
+            pixel[1] = row[x * s + o[1]];                                     \
+            pixel[2] = row[x * s + o[2]];                                     \
+            color_index = f_lookup(pixel, 3, palette, reqcolor,               \
+                                   indextable, complexion);                   \
+            color = palette + color_index * 3;                                \
+            if (migration_map == NULL) {                                      \
+                result[pos] = color_index;                                    \
+            } else if (migration_map[color_index] == 0) {                     \
+                result[pos] = *ncolors;                                       \
+                new_palette[*ncolors * 3 + 0] = color[0];                     \
+                new_palette[*ncolors * 3 + 1] = color[1];                     \
+                new_palette[*ncolors * 3 + 2] = color[2];                     \
+                ++*ncolors;                                                   \
+                migration_map[color_index] = *ncolors;                        \
+            } else {                                                          \
+                result[pos] = migration_map[color_index] - 1;                 \
+            }                                                                 \
+            error[0] = pixel[0] - color[0];                                   \
+            error[1] = pixel[1] - color[1];                                   \
+            error[2] = pixel[2] - color[2];                                   \
+            f_diffuse(data, width, height, x, y, s, pitch, o, error);         \
+        }                                                                     \
+    }                                                                         \
+}
+
+SIXEL_QUANT_DEFINE_APPLY_RGB(apply_palette_normal_none, lookup_normal_rgb, diffuse_none_rgb,
+                             3, quant_rgb_offsets)
+SIXEL_QUANT_DEFINE_APPLY_RGB(apply_palette_normal_fs, lookup_normal_rgb, diffuse_fs_rgb,
+                             3, quant_rgb_offsets)
+SIXEL_QUANT_DEFINE_APPLY_RGB(apply_palette_normal_atkinson, lookup_normal_rgb, diffuse_atkinson_rgb,
+                             3, quant_rgb_offsets)
+SIXEL_QUANT_DEFINE_APPLY_RGB(apply_palette_normal_jajuni, lookup_normal_rgb, diffuse_jajuni_rgb,
+                             3, quant_rgb_offsets)
+SIXEL_QUANT_DEFINE_APPLY_RGB(apply_palette_normal_stucki, lookup_normal_rgb, diffuse_stucki_rgb,
+                             3, quant_rgb_offsets)
+SIXEL_QUANT_DEFINE_APPLY_RGB(apply_palette_normal_burkes, lookup_normal_rgb, diffuse_burkes_rgb,
+                             3, quant_rgb_offsets)
+SIXEL_QUANT_DEFINE_APPLY_RGB(apply_palette_fast_none, lookup_fast_rgb, diffuse_none_rgb,
+                             3, quant_rgb_offsets)
+SIXEL_QUANT_DEFINE_APPLY_RGB(apply_palette_fast_fs, lookup_fast_rgb, diffuse_fs_rgb,
+                             3, quant_rgb_offsets)
+SIXEL_QUANT_DEFINE_APPLY_RGB(apply_palette_fast_atkinson, lookup_fast_rgb, diffuse_atkinson_rgb,
+                             3, quant_rgb_offsets)
+SIXEL_QUANT_DEFINE_APPLY_RGB(apply_palette_fast_jajuni, lookup_fast_rgb, diffuse_jajuni_rgb,
+                             3, quant_rgb_offsets)
+SIXEL_QUANT_DEFINE_APPLY_RGB(apply_palette_fast_stucki, lookup_fast_rgb, diffuse_stucki_rgb,
+                             3, quant_rgb_offsets)
+SIXEL_QUANT_DEFINE_APPLY_RGB(apply_palette_fast_burkes, lookup_fast_rgb, diffuse_burkes_rgb,
+                             3, quant_rgb_offsets)
+
+SIXEL_QUANT_DEFINE_APPLY_RGB(apply_palette_normal_none_strided, lookup_normal_rgb, diffuse_none_rgb,
+                             stride, offsets)
+SIXEL_QUANT_DEFINE_APPLY_RGB(apply_palette_normal_fs_strided, lookup_normal_rgb, diffuse_fs_rgb,
+                             stride, offsets)
+SIXEL_QUANT_DEFINE_APPLY_RGB(apply_palette_normal_atkinson_strided, lookup_normal_rgb, diffuse_atkinson_rgb,
+                             stride, offsets)
+SIXEL_QUANT_DEFINE_APPLY_RGB(apply_palette_normal_jajuni_strided, lookup_normal_rgb, diffuse_jajuni_rgb,
+                             stride, offsets)
+SIXEL_QUANT_DEFINE_APPLY_RGB(apply_palette_normal_stucki_strided, lookup_normal_rgb, diffuse_stucki_rgb,
+                             stride, offsets)
+SIXEL_QUANT_DEFINE_APPLY_RGB(apply_palette_normal_burkes_strided, lookup_normal_rgb, diffuse_burkes_rgb,
+                             stride, offsets)
+SIXEL_QUANT_DEFINE_APPLY_RGB(apply_palette_fast_none_strided, lookup_fast_rgb, diffuse_none_rgb,
+                             stride, offsets)
+SIXEL_QUANT_DEFINE_APPLY_RGB(apply_palette_fast_fs_strided, lookup_fast_rgb, diffuse_fs_rgb,
+                             stride, offsets)
+SIXEL_QUANT_DEFINE_APPLY_RGB(apply_palette_fast_atkinson_strided, lookup_fast_rgb, diffuse_atkinson_rgb,
+                             stride, offsets)
+SIXEL_QUANT_DEFINE_APPLY_RGB(apply_palette_fast_jajuni_strided, lookup_fast_rgb, diffuse_jajuni_rgb,
+                             stride, offsets)
+SIXEL_QUANT_DEFINE_APPLY_RGB(apply_palette_fast_stucki_strided, lookup_fast_rgb, diffuse_stucki_rgb,
+                             stride, offsets)
+SIXEL_QUANT_DEFINE_APPLY_RGB(apply_palette_fast_burkes_strided, lookup_fast_rgb, diffuse_burkes_rgb,
+                             stride, offsets)
+
+#undef SIXEL_QUANT_DEFINE_APPLY_RGB
+
+
+#if HAVE_TESTS
+/* set by tests to compare the specialized loops with the generic one */
+static int quant_force_generic_loop = 0;
+#endif  /* HAVE_TESTS */
+
+
+/* select specialized loop, returns NULL if the generic loop is required */
+static apply_palette_rgb_t
+select_apply_palette_rgb(
+    int stride,
+    int const *offsets,
+    int (*f_lookup)(unsigned char const * const pixel,
+                    int const depth,
+                    unsigned char const * const palette,
+                    int const reqcolor,
+                    unsigned short * const cachetable,
+                    int const complexion),
+    void (*f_diffuse)(unsigned char *data, int width, int height,
+                      int x, int y, int depth, int pitch, int offset))
+{
+    static struct {
+        void (*f_diffuse)(unsigned char *data, int width, int height,
+                          int x, int y, int depth, int pitch, int offset);
+        apply_palette_rgb_t normal;
+        apply_palette_rgb_t fast;
+        apply_palette_rgb_t normal_strided;
+        apply_palette_rgb_t fast_strided;
+    } const table[] = {
+        { diffuse_none,
+          apply_palette_normal_none, apply_palette_fast_none,
+          apply_palette_normal_none_strided, apply_palette_fast_none_strided },
+        { diffuse_fs,
+          apply_palette_normal_fs, apply_palette_fast_fs,
+          apply_palette_normal_fs_strided, apply_palette_fast_fs_strided },
+        { diffuse_atkinson,
+          apply_palette_normal_atkinson, apply_palette_fast_atkinson,
+          apply_palette_normal_atkinson_strided, apply_palette_fast_atkinson_strided },
+        { diffuse_jajuni,
+          apply_palette_normal_jajuni, apply_palette_fast_jajuni,
+          apply_palette_normal_jajuni_strided, apply_palette_fast_jajuni_strided },
+        { diffuse_stucki,
+          apply_palette_normal_stucki, apply_palette_fast_stucki,
+          apply_palette_normal_stucki_strided, apply_palette_fast_stucki_strided },
+        { diffuse_burkes,
+          apply_palette_normal_burkes, apply_palette_fast_burkes,
+          apply_palette_normal_burkes_strided, apply_palette_fast_burkes_strided },
+    };
+    size_t i;
+    int packed_rgb;
+
+    packed_rgb = stride == 3
+              && offsets[0] == 0 && offsets[1] == 1 && offsets[2] == 2;
+
+    for (i = 0; i < sizeof(table) / sizeof(table[0]); ++i) {
+        if (table[i].f_diffuse == f_diffuse) {
+            if (f_lookup == lookup_normal) {
+                return packed_rgb ? table[i].normal: table[i].normal_strided;
+            }
+            if (f_lookup == lookup_fast) {
+                return packed_rgb ? table[i].fast: table[i].fast_strided;
+            }
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+/* choose colors using median-cut method */
+SIXELSTATUS
+sixel_quant_make_palette(
+    unsigned char          /* out */ **result,
+    unsigned char const    /* in */  *data,
+    unsigned int           /* in */  length,
+    int                    /* in */  pixelformat,
+    unsigned int           /* in */  reqcolors,
+    unsigned int           /* in */  *ncolors,
+    unsigned int           /* in */  *origcolors,
+    int                    /* in */  methodForLargest,
+    int                    /* in */  methodForRep,
+    int                    /* in */  qualityMode,
+    sixel_allocator_t      /* in */  *allocator)
+{
+    SIXELSTATUS status = SIXEL_FALSE;
+    unsigned int i;
+    unsigned int n;
+    int ret;
+    tupletable2 colormap;
+    unsigned int const depth = 3;
+    int stride;
+    int offsets[3];
+
+    /* the palette always has r, g and b, pixels are sampled in place */
+    if (!sixel_pixelformat_get_channels(pixelformat, &stride, offsets)) {
+        sixel_helper_set_additional_message(
+            "sixel_quant_make_palette: unsupported pixelformat.");
+        status = SIXEL_BAD_ARGUMENT;
+        *result = NULL;
+        goto end;
+    }
+
+    ret = computeColorMapFromInput(data, length, depth,
+                                   (unsigned int)stride, offsets,
+                                   reqcolors, methodForLargest,
+                                   methodForRep, qualityMode,
+                                   &colormap, origcolors, allocator);
+    if (ret != 0) {
+        *result = NULL;
+        goto end;
+    }
+    *ncolors = colormap.size;
+    quant_trace(stderr, "tupletable size: %d\n", *ncolors);
+    *result = (unsigned char *)sixel_allocator_malloc(allocator, *ncolors * depth);
+    for (i = 0; i < *ncolors; i++) {
+        for (n = 0; n < depth; ++n) {
+            (*result)[i * depth + n] = colormap.table[i]->tuple[n];
+        }
+    }
+
+    sixel_allocator_free(allocator, colormap.table);
+
+    status = SIXEL_OK;
+
+end:
+    return status;
+}
+
+
+/* add the colors of an image into a histogram of 15bpp buckets, the image
+   is sampled as sixel_quant_make_palette() samples it */
+SIXELSTATUS
+sixel_quant_add_histogram(
+    unsigned int           /* in */  *histogram,
+    unsigned char const    /* in */  *data,
+    unsigned int           /* in */  length,
+    int                    /* in */  pixelformat,
+    int                    /* in */  qualityMode)
+{
+    SIXELSTATUS status = SIXEL_FALSE;
+    unsigned int i;
+    unsigned int step;
+    unsigned int max_count = 0;
+    int stride;
+    int offsets[3];
+    unsigned char pixel[3];
+
+    if (!sixel_pixelformat_get_channels(pixelformat, &stride, offsets)) {
+        sixel_helper_set_additional_message(
+            "sixel_quant_add_histogram: unsupported pixelformat.");
+        status = SIXEL_BAD_ARGUMENT;
+        goto end;
+    }
+
+    /* an image adds less than UINT_MAX / 2 samples, so halving the counts
+       before they reach it keeps them from overflowing */
+    for (i = 0; i < SIXEL_QUANT_HISTOGRAM_SIZE; ++i) {
+        if (histogram[i] > max_count) {
+            max_count = histogram[i];
+        }
+    }
+    if (max_count > UINT_MAX / 2) {
+        for (i = 0; i < SIXEL_QUANT_HISTOGRAM_SIZE; ++i) {
+            histogram[i] = (histogram[i] + 1) / 2;
+        }
+    }
+
+    step = computeSamplingStep(length, (unsigned int)stride, qualityMode);
+    for (i = 0; i < length; i += step) {
+        pixel[0] = data[i + (unsigned int)offsets[0]];
+        pixel[1] = data[i + (unsigned int)offsets[1]];
+        pixel[2] = data[i + (unsigned int)offsets[2]];
+        histogram[computeHash(pixel, 3)]++;
+    }
+
+    status = SIXEL_OK;
+
+end:
+    return status;
+}
+
+
+/* choose colors from a histogram filled by sixel_quant_add_histogram() */
+SIXELSTATUS
+sixel_quant_make_palette_from_histogram(
+    unsigned char          /* out */ **result,
+    unsigned int const     /* in */  *histogram,
+    unsigned int           /* in */  reqcolors,
+    unsigned int           /* in */  *ncolors,
+    unsigned int           /* in */  *origcolors,
+    int                    /* in */  methodForLargest,
+    int                    /* in */  methodForRep,
+    sixel_allocator_t      /* in */  *allocator)
+{
+    SIXELSTATUS status = SIXEL_FALSE;
+    tupletable2 colorfreqtable = {0, NULL};
+    tupletable2 colormap = {0, NULL};
+    unsigned int const depth = 3;
+    unsigned int size = 0;
+    unsigned int max_count = 0;
+    unsigned int scale;
+    unsigned int bucket;
+    unsigned int i;
+    unsigned int n;
+
+    *result = NULL;
+
+    for (bucket = 0; bucket < SIXEL_QUANT_HISTOGRAM_SIZE; ++bucket) {
+        if (histogram[bucket] > 0) {
+            ++size;
+            if (histogram[bucket] > max_count) {
+                max_count = histogram[bucket];
+            }
+        }
+    }
+    if (size == 0) {
+        sixel_helper_set_additional_message(
+            "sixel_quant_make_palette_from_histogram: histogram is empty.");
+        status = SIXEL_BAD_INPUT;
+        goto end;
+    }
+
+    status = alloctupletable(&colorfreqtable.table, depth, size, allocator);
+    if (SIXEL_FAILED(status)) {
+        goto end;
+    }
+    colorfreqtable.size = size;
+
+    /* counts are scaled into the range of computeHistogram(), so that the
+       sums of boxes stay within int as they do for a single image */
+    scale = max_count / 0xffff + 1;
+    for (bucket = 0, i = 0; bucket < SIXEL_QUANT_HISTOGRAM_SIZE; ++bucket) {
+        if (histogram[bucket] > 0) {
+            colorfreqtable.table[i]->value = histogram[bucket] / scale;
+            if (colorfreqtable.table[i]->value == 0) {
+                colorfreqtable.table[i]->value = 1;
+            }
+            for (n = 0; n < depth; n++) {
+                colorfreqtable.table[i]->tuple[depth - 1 - n]
+                    = (sample)((bucket >> n * 5 & 0x1f) << 3);
+            }
+            ++i;
+        }
+    }
+    if (origcolors) {
+        *origcolors = size;
+    }
+
+    status = computeColorMapFromTable(colorfreqtable, depth, reqcolors,
+                                      methodForLargest, methodForRep,
+                                      &colormap, allocator);
+    if (SIXEL_FAILED(status)) {
+        goto end;
+    }
+
+    *ncolors = colormap.size;
+    *result = (unsigned char *)sixel_allocator_malloc(allocator,
+                                                      *ncolors * depth);
+    if (*result == NULL) {
+        sixel_helper_set_additional_message(
+            "sixel_quant_make_palette_from_histogram: "
+            "sixel_allocator_malloc() failed.");
+        status = SIXEL_BAD_ALLOCATION;
+        goto end;
+    }
+    for (i = 0; i < *ncolors; i++) {
+        for (n = 0; n < depth; ++n) {
+            (*result)[i * depth + n] = (unsigned char)colormap.table[i]->tuple[n];
+        }
+    }
+
+    status = SIXEL_OK;
+
+end:
+    sixel_allocator_free(allocator, colormap.table);
+    sixel_allocator_free(allocator, colorfreqtable.table);
+
+    return status;
+}
+
+
+/*
+ * fill all entries of the lookup cache used by lookup_fast().
+ * each 15bpp bucket is represented by its center color, and the nearest
+ * palette color is searched by brute force. distances of the red and
+ * green channels are accumulated outside of the inner loop, which is a
+ * plain array scan so that compilers can vectorize it.
+ */
+SIXELSTATUS
+sixel_quant_precompute_cache(
+    unsigned short      /* out */ *cachetable,
+    unsigned char const /* in */  *palette,
+    int                 /* in */  reqcolor,
+    int                 /* in */  complexion,
+    sixel_allocator_t   /* in */  *allocator)
+{
+    SIXELSTATUS status = SIXEL_FALSE;
+    int *rdist = NULL;
+    int *rgdist = NULL;
+    int *pb = NULL;
+    int r;
+    int g;
+    int b;
+    int i;
+    int d;
+    int diff;
+    int result;
+    int value;
+
+    if (reqcolor < 1 || reqcolor > SIXEL_PALETTE_MAX) {
+        status = SIXEL_BAD_ARGUMENT;
+        sixel_helper_set_additional_message(
+            "sixel_quant_precompute_cache: "
+            "a bad argument is detected, reqcolor is out of range.");
+        goto end;
+    }
+
+    rdist = (int *)sixel_allocator_malloc(allocator,
+                                          sizeof(int) * (size_t)reqcolor * 3);
+    if (rdist == NULL) {
+        status = SIXEL_BAD_ALLOCATION;
+        sixel_helper_set_additional_message(
+            "sixel_quant_precompute_cache: sixel_allocator_malloc() failed.");
+        goto end;
+    }
+    rgdist = rdist + reqcolor;
+    pb = rgdist + reqcolor;
+
+    for (i = 0; i < reqcolor; ++i) {
+        pb[i] = palette[i * 3 + 2];
+    }
+
+    for (r = 0; r < 32; ++r) {
+        value = r << 3 | 4;
+        for (i = 0; i < reqcolor; ++i) {
+            d = value - palette[i * 3 + 0];
+            rdist[i] = d * d * complexion;
+        }
+        for (g = 0; g < 32; ++g) {
+            value = g << 3 | 4;
+            for (i = 0; i < reqcolor; ++i) {
+                d = value - palette[i * 3 + 1];
+                rgdist[i] = rdist[i] + d * d;
+            }
+            for (b = 0; b < 32; ++b) {
+                value = b << 3 | 4;
+                result = 0;
+                diff = INT_MAX;
+                for (i = 0; i < reqcolor; ++i) {
+                    d = rgdist[i] + (value - pb[i]) * (value - pb[i]);
+                    if (d < diff) {
+                        diff = d;
+                        result = i;
+                    }
+                }
+                cachetable[r << 10 | g << 5 | b] = (unsigned short)(result + 1);
+            }
+        }
+    }
+
+    status = SIXEL_OK;
+
+end:
+    sixel_allocator_free(allocator, rdist);
+    return status;
+}
+
+
+/* apply color palette into the first rows of specified pixel buffers */
+SIXELSTATUS
+sixel_quant_apply_palette_rows(
+    sixel_index_t     /* out */ *result,
+    unsigned char     /* in */  *data,
+    int               /* in */  width,
+    int               /* in */  height,
+    int               /* in */  pitch,
+    int               /* in */  rows,
+    int               /* in */  origin,
+    int               /* in */  pixelformat,
+    unsigned char     /* in */  *palette,
+    int               /* in */  reqcolor,
+    int               /* in */  methodForDiffuse,
+    int               /* in */  foptimize,
+    int               /* in */  foptimize_palette,
+    int               /* in */  complexion,
+    unsigned short    /* in */  *cachetable,
+    int               /* in */  *ncolors,
+    sixel_allocator_t /* in */  *allocator)
+{
+    typedef int component_t;
+    enum { depth = 3 };
+    enum { max_channel_diff_sq = 255 * 255 };
+    SIXELSTATUS status = SIXEL_FALSE;
+    int pos, n, x, y, sum1, sum2;
+    int stride;
+    int offsets[3];
+    unsigned char copy[depth];
+    int non_weighted_components;
+    component_t offset;
+    int color_index;
+    long long max_complexion;
+    unsigned short *indextable;
+    unsigned char new_palette[SIXEL_PALETTE_MAX * 4];
+    unsigned short migration_map[SIXEL_PALETTE_MAX];
+    int (*f_mask) (int x, int y, int c) = NULL;
+    void (*f_diffuse)(unsigned char *data, int width, int height,
+                      int x, int y, int depth, int pitch, int offset);
+    int (*f_lookup)(unsigned char const * const pixel,
+                    int const depth,
+                    unsigned char const * const palette,
+                    int const reqcolor,
+                    unsigned short * const cachetable,
+                    int const complexion);
+    apply_palette_rgb_t f_apply;
+
+    /* check bad reqcolor */
+    if (reqcolor < 1) {
+        status = SIXEL_BAD_ARGUMENT;
+        sixel_helper_set_additional_message(
+            "sixel_quant_apply_palette: "
+            "a bad argument is detected, reqcolor < 0.");
+        goto end;
+    }
+
+    /* r, g and b are read from their offsets in each pixel of 'stride' bytes */
+    if (!sixel_pixelformat_get_channels(pixelformat, &stride, offsets)) {
         status = SIXEL_BAD_ARGUMENT;
         sixel_helper_set_additional_message(
             "sixel_quant_apply_palette: "
-            "a bad argument is detected, reqcolor < 0.");
+            "a bad argument is detected, unsupported pixelformat.");
+        goto end;
+    }
+    if (pitch < width * stride) {
+        status = SIXEL_BAD_ARGUMENT;
+        sixel_helper_set_additional_message(
+            "sixel_quant_apply_palette: "
+            "a bad argument is detected, pitch < width * stride.");
+        goto end;
+    }
+    if (rows < 0 || rows > height) {
+        status = SIXEL_BAD_ARGUMENT;
+        sixel_helper_set_additional_message(
+            "sixel_quant_apply_palette: "
+            "a bad argument is detected, rows > height.");
         goto end;
     }
 
@@ -1293,46 +2112,50 @@ sixel_quant_apply_palette(
      * reference pos + width * 1 - 1, but since these functions are only called
      * when width >= 1, they do not cause underflow.
      */
-    if (depth != 3) {
+    switch (methodForDiffuse) {
+    case SIXEL_DIFFUSE_NONE:
         f_diffuse = diffuse_none;
-    } else {
-        switch (methodForDiffuse) {
-        case SIXEL_DIFFUSE_NONE:
-            f_diffuse = diffuse_none;
-            break;
-        case SIXEL_DIFFUSE_ATKINSON:
-            f_diffuse = diffuse_atkinson;
-            break;
-        case SIXEL_DIFFUSE_FS:
-            f_diffuse = diffuse_fs;
-            break;
-        case SIXEL_DIFFUSE_JAJUNI:
-            /* fallback to diffuse_none if width < 2 */
-            f_diffuse = width >= 2 ? diffuse_jajuni: diffuse_none;
-            break;
-        case SIXEL_DIFFUSE_STUCKI:
-            /* fallback to diffuse_none if width < 2 */
-            f_diffuse = width >= 2 ? diffuse_stucki: diffuse_none;
-            break;
-        case SIXEL_DIFFUSE_BURKES:
-            /* fallback to diffuse_none if width < 2 */
-            f_diffuse = width >= 2 ? diffuse_burkes: diffuse_none;
-            break;
-        case SIXEL_DIFFUSE_A_DITHER:
-            f_diffuse = diffuse_none;
-            f_mask = mask_a;
-            break;
-        case SIXEL_DIFFUSE_X_DITHER:
-            f_diffuse = diffuse_none;
-            f_mask = mask_x;
-            break;
-        default:
-            quant_trace(stderr, "Internal error: invalid value of"
-                                " methodForDiffuse: %d\n",
-                        methodForDiffuse);
-            f_diffuse = diffuse_none;
-            break;
-        }
+        break;
+    case SIXEL_DIFFUSE_ATKINSON:
+        f_diffuse = diffuse_atkinson;
+        break;
+    case SIXEL_DIFFUSE_FS:
+        f_diffuse = diffuse_fs;
+        break;
+    case SIXEL_DIFFUSE_JAJUNI:
+        /* fallback to diffuse_none if width < 2 */
+        f_diffuse = width >= 2 ? diffuse_jajuni: diffuse_none;
+        break;
+    case SIXEL_DIFFUSE_STUCKI:
+        /* fallback to diffuse_none if width < 2 */
+        f_diffuse = width >= 2 ? diffuse_stucki: diffuse_none;
+        break;
+    case SIXEL_DIFFUSE_BURKES:
+        /* fallback to diffuse_none if width < 2 */
+        f_diffuse = width >= 2 ? diffuse_burkes: diffuse_none;
+        break;
+    case SIXEL_DIFFUSE_A_DITHER:
+        f_diffuse = diffuse_none;
+        f_mask = mask_a;
+        break;
+    case SIXEL_DIFFUSE_X_DITHER:
+        f_diffuse = diffuse_none;
+        f_mask = mask_x;
+        break;
+    case SIXEL_DIFFUSE_BAYER:
+        f_diffuse = diffuse_none;
+        f_mask = mask_bayer;
+        break;
+    case SIXEL_DIFFUSE_BLUENOISE:
+        f_diffuse = diffuse_none;
+        f_mask = mask_bluenoise;
+        break;
+    default:
+        quant_trace(stderr, "Internal error: invalid value of"
+                            " methodForDiffuse: %d\n",
+                    methodForDiffuse);
+        f_diffuse = diffuse_none;
+        break;
     }
 
     f_lookup = NULL;
@@ -1352,7 +2175,7 @@ sixel_quant_apply_palette(
         }
     }
     if (f_lookup == NULL) {
-        if (foptimize && depth == 3) {
+        if (foptimize) {
             f_lookup = lookup_fast;
         } else {
             f_lookup = lookup_normal;
@@ -1360,7 +2183,7 @@ sixel_quant_apply_palette(
     }
 
     if ((f_lookup == lookup_fast || f_lookup == lookup_normal) && complexion > 1) {
-        non_weighted_components = depth > 1 ? depth - 1 : 0;
+        non_weighted_components = depth - 1;
         max_complexion = (INT_MAX - (long long)max_channel_diff_sq
                           * (long long)non_weighted_components)
                          / (long long)max_channel_diff_sq;
@@ -1383,22 +2206,46 @@ sixel_quant_apply_palette(
         }
     }
 
-    if (foptimize_palette) {
+    /* dispatch once per image to a specialized loop if available */
+    f_apply = NULL;
+    if (f_mask == NULL) {
+        f_apply = select_apply_palette_rgb(stride, offsets, f_lookup, f_diffuse);
+    }
+#if HAVE_TESTS
+    if (quant_force_generic_loop) {
+        f_apply = NULL;
+    }
+#endif  /* HAVE_TESTS */
+
+    if (f_apply) {
+        if (foptimize_palette) {
+            *ncolors = 0;
+            memset(migration_map, 0x00, sizeof(migration_map));
+            f_apply(result, data, width, height, rows, stride, pitch, offsets,
+                    palette, reqcolor, indextable, complexion,
+                    new_palette, migration_map, ncolors);
+            memcpy(palette, new_palette, (size_t)(*ncolors * depth));
+        } else {
+            f_apply(result, data, width, height, rows, stride, pitch, offsets,
+                    palette, reqcolor, indextable, complexion,
+                    NULL, NULL, NULL);
+            *ncolors = reqcolor;
+        }
+    } else if (foptimize_palette) {
         *ncolors = 0;
 
         memset(new_palette, 0x00, sizeof(SIXEL_PALETTE_MAX * depth));
         memset(migration_map, 0x00, sizeof(migration_map));
 
         if (f_mask) {
-            for (y = 0; y < height; ++y) {
+            for (y = 0; y < rows; ++y) {
                 for (x = 0; x < width; ++x) {
-                    unsigned char copy[max_depth];
                     int d;
                     int val;
 
                     pos = y * width + x;
                     for (d = 0; d < depth; d ++) {
-                        val = data[pos * depth + d] + f_mask(x, y, d) * 32;
+                        val = data[y * pitch + x * stride + offsets[d]] + f_mask(x, origin + y, d);
                         copy[d] = val < 0 ? 0 : val > 255 ? 255 : val;
                     }
                     color_index = f_lookup(copy, depth,
@@ -1417,10 +2264,13 @@ sixel_quant_apply_palette(
             }
             memcpy(palette, new_palette, (size_t)(*ncolors * depth));
         } else {
-            for (y = 0; y < height; ++y) {
+            for (y = 0; y < rows; ++y) {
                 for (x = 0; x < width; ++x) {
                     pos = y * width + x;
-                    color_index = f_lookup(data + (pos * depth), depth,
+                    for (n = 0; n < depth; ++n) {
+                        copy[n] = data[y * pitch + x * stride + offsets[n]];
+                    }
+                    color_index = f_lookup(copy, depth,
                                            palette, reqcolor, indextable, complexion);
                     if (migration_map[color_index] == 0) {
                         result[pos] = *ncolors;
@@ -1433,8 +2283,8 @@ sixel_quant_apply_palette(
                         result[pos] = migration_map[color_index] - 1;
                     }
                     for (n = 0; n < depth; ++n) {
-                        offset = data[pos * depth + n] - palette[color_index * depth + n];
-                        f_diffuse(data + n, width, height, x, y, depth, offset);
+                        offset = copy[n] - palette[color_index * depth + n];
+                        f_diffuse(data + offsets[n], width, height, x, y, stride, pitch, offset);
                     }
                 }
             }
@@ -1442,15 +2292,14 @@ sixel_quant_apply_palette(
         }
     } else {
         if (f_mask) {
-            for (y = 0; y < height; ++y) {
+            for (y = 0; y < rows; ++y) {
                 for (x = 0; x < width; ++x) {
-                    unsigned char copy[max_depth];
                     int d;
                     int val;
 
                     pos = y * width + x;
                     for (d = 0; d < depth; d ++) {
-                        val = data[pos * depth + d] + f_mask(x, y, d) * 32;
+                        val = data[y * pitch + x * stride + offsets[d]] + f_mask(x, origin + y, d);
                         copy[d] = val < 0 ? 0 : val > 255 ? 255 : val;
                     }
                     result[pos] = f_lookup(copy, depth,
@@ -1458,15 +2307,18 @@ sixel_quant_apply_palette(
                 }
             }
         } else {
-            for (y = 0; y < height; ++y) {
+            for (y = 0; y < rows; ++y) {
                 for (x = 0; x < width; ++x) {
                     pos = y * width + x;
-                    color_index = f_lookup(data + (pos * depth), depth,
+                    for (n = 0; n < depth; ++n) {
+                        copy[n] = data[y * pitch + x * stride + offsets[n]];
+                    }
+                    color_index = f_lookup(copy, depth,
                                            palette, reqcolor, indextable, complexion);
                     result[pos] = color_index;
                     for (n = 0; n < depth; ++n) {
-                        offset = data[pos * depth + n] - palette[color_index * depth + n];
-                        f_diffuse(data + n, width, height, x, y, depth, offset);
+                        offset = copy[n] - palette[color_index * depth + n];
+                        f_diffuse(data + offsets[n], width, height, x, y, stride, pitch, offset);
                     }
                 }
             }
@@ -1485,6 +2337,34 @@ end:
 }
 
 
+/* apply color palette into specified pixel buffers */
+SIXELSTATUS
+sixel_quant_apply_palette(
+    sixel_index_t     /* out */ *result,
+    unsigned char     /* in */  *data,
+    int               /* in */  width,
+    int               /* in */  height,
+    int               /* in */  pitch,
+    int               /* in */  pixelformat,
+    unsigned char     /* in */  *palette,
+    int               /* in */  reqcolor,
+    int               /* in */  methodForDiffuse,
+    int               /* in */  foptimize,
+    int               /* in */  foptimize_palette,
+    int               /* in */  complexion,
+    unsigned short    /* in */  *cachetable,
+    int               /* in */  *ncolors,
+    sixel_allocator_t /* in */  *allocator)
+{
+    return sixel_quant_apply_palette_rows(result, data, width, height, pitch,
+                                          height, 0, pixelformat,
+                                          palette, reqcolor, methodForDiffuse,
+                                          foptimize, foptimize_palette,
+                                          complexion, cachetable, ncolors,
+                                          allocator);
+}
+
+
 void
 sixel_quant_free_palette(
     unsigned char       /* in */ *data,
@@ -1514,6 +2394,514 @@ error:
 }
 
 
+static int
+test2(void)
+{
+    int nret = EXIT_FAILURE;
+    int hist[256];
+    int x;
+    int y;
+    int c;
+    int v;
+
+    /* every level of the threshold matrices must appear evenly */
+    memset(hist, 0, sizeof(hist));
+    for (y = 0; y < 8; ++y) {
+        for (x = 0; x < 8; ++x) {
+            hist[mask_bayer(x, y, 0) + 32]++;
+        }
+    }
+    for (v = 0; v < 64; ++v) {
+        if (hist[v] != 1) {
+            goto error;
+        }
+    }
+
+    memset(hist, 0, sizeof(hist));
+    for (y = 0; y < 64; ++y) {
+        for (x = 0; x < 64; ++x) {
+            hist[bluenoise_matrix_64x64[y * 64 + x]]++;
+        }
+    }
+    for (v = 0; v < 256; ++v) {
+        if (hist[v] != 16) {
+            goto error;
+        }
+    }
+
+    /* all masks must stay in [-32, 31] */
+    for (y = 0; y < 128; ++y) {
+        for (x = 0; x < 128; ++x) {
+            for (c = 0; c < 3; ++c) {
+                v = mask_a(x, y, c);
+                if (v < -32 || v > 31) {
+                    goto error;
+                }
+                v = mask_x(x, y, c);
+                if (v < -32 || v > 31) {
+                    goto error;
+                }
+                v = mask_bluenoise(x, y, c);
+                if (v < -32 || v > 31) {
+                    goto error;
+                }
+            }
+        }
+    }
+    nret = EXIT_SUCCESS;
+
+error:
+    return nret;
+}
+
+
+/* fill the test image with a smooth gradient and some noise */
+static void
+make_test_image(unsigned char *pixels, int width, int height)
+{
+    int x;
+    int y;
+    unsigned int seed = 12345;
+
+    for (y = 0; y < height; ++y) {
+        for (x = 0; x < width; ++x) {
+            seed = seed * 1103515245 + 12345;
+            pixels[(y * width + x) * 3 + 0] = (unsigned char)(x * 255 / width);
+            pixels[(y * width + x) * 3 + 1] = (unsigned char)(y * 255 / height);
+            pixels[(y * width + x) * 3 + 2] = (unsigned char)(seed >> 16);
+        }
+    }
+}
+
+
+/* run sixel_quant_apply_palette() with the generic or the specialized loop */
+static SIXELSTATUS
+run_apply_palette(sixel_index_t *result, unsigned char *pixels,
+                  unsigned char const *source, unsigned char *palette,
+                  unsigned char const *source_palette,
+                  int width, int height, int reqcolor, int method,
+                  int foptimize, int foptimize_palette, int generic,
+                  int *ncolors, sixel_allocator_t *allocator)
+{
+    SIXELSTATUS status;
+
+    memcpy(pixels, source, (size_t)(width * height * 3));
+    memcpy(palette, source_palette, (size_t)(reqcolor * 3));
+    quant_force_generic_loop = generic;
+    status = sixel_quant_apply_palette(result, pixels, width, height,
+                                       width * 3, SIXEL_PIXELFORMAT_RGB888,
+                                       palette, reqcolor, method,
+                                       foptimize, foptimize_palette, 1,
+                                       NULL, ncolors, allocator);
+    quant_force_generic_loop = 0;
+
+    return status;
+}
+
+
+/* specialized loops must produce the same result as the generic loop */
+static int
+test3(void)
+{
+    int nret = EXIT_FAILURE;
+    SIXELSTATUS status;
+    sixel_allocator_t *allocator = NULL;
+    enum { width = 67, height = 41, reqcolor = 37 };
+    static int const methods[] = {
+        SIXEL_DIFFUSE_NONE,
+        SIXEL_DIFFUSE_ATKINSON,
+        SIXEL_DIFFUSE_FS,
+        SIXEL_DIFFUSE_JAJUNI,
+        SIXEL_DIFFUSE_STUCKI,
+        SIXEL_DIFFUSE_BURKES,
+    };
+    unsigned char source[width * height * 3];
+    unsigned char pixels1[width * height * 3];
+    unsigned char pixels2[width * height * 3];
+    unsigned char source_palette[reqcolor * 3];
+    unsigned char palette1[reqcolor * 3];
+    unsigned char palette2[reqcolor * 3];
+    sixel_index_t result1[width * height];
+    sixel_index_t result2[width * height];
+    int ncolors1;
+    int ncolors2;
+    size_t i;
+    int foptimize;
+    int foptimize_palette;
+
+    status = sixel_allocator_new(&allocator, NULL, NULL, NULL, NULL);
+    if (SIXEL_FAILED(status)) {
+        goto error;
+    }
+
+    make_test_image(source, width, height);
+    for (i = 0; i < sizeof(source_palette); ++i) {
+        source_palette[i] = (unsigned char)(i * 97 % 256);
+    }
+
+    for (i = 0; i < sizeof(methods) / sizeof(methods[0]); ++i) {
+        for (foptimize = 0; foptimize < 2; ++foptimize) {
+            for (foptimize_palette = 0; foptimize_palette < 2; ++foptimize_palette) {
+                status = run_apply_palette(result1, pixels1, source,
+                                           palette1, source_palette,
+                                           width, height, reqcolor, methods[i],
+                                           foptimize, foptimize_palette, 1,
+                                           &ncolors1, allocator);
+                if (SIXEL_FAILED(status)) {
+                    goto error;
+                }
+                status = run_apply_palette(result2, pixels2, source,
+                                           palette2, source_palette,
+                                           width, height, reqcolor, methods[i],
+                                           foptimize, foptimize_palette, 0,
+                                           &ncolors2, allocator);
+                if (SIXEL_FAILED(status)) {
+                    goto error;
+                }
+                if (ncolors1 != ncolors2) {
+                    goto error;
+                }
+                if (memcmp(result1, result2, sizeof(result1)) != 0) {
+                    goto error;
+                }
+                if (memcmp(pixels1, pixels2, sizeof(pixels1)) != 0) {
+                    goto error;
+                }
+                if (memcmp(palette1, palette2, (size_t)(ncolors1 * 3)) != 0) {
+                    goto error;
+                }
+            }
+        }
+    }
+    nret = EXIT_SUCCESS;
+
+error:
+    sixel_allocator_unref(allocator);
+    return nret;
+}
+
+
+/* precomputed cache must match brute force lookup of bucket centers */
+static int
+test5(void)
+{
+    int nret = EXIT_FAILURE;
+    SIXELSTATUS status;
+    sixel_allocator_t *allocator = NULL;
+    unsigned short *cachetable = NULL;
+    unsigned char palette[61 * 3];
+    unsigned char pixel[3];
+    int hash;
+    int index;
+    size_t i;
+
+    status = sixel_allocator_new(&allocator, NULL, NULL, NULL, NULL);
+    if (SIXEL_FAILED(status)) {
+        goto error;
+    }
+    cachetable = (unsigned short *)sixel_allocator_calloc(allocator,
+                                                          1 << 3 * 5,
+                                                          sizeof(unsigned short));
+    if (cachetable == NULL) {
+        goto error;
+    }
+    for (i = 0; i < sizeof(palette); ++i) {
+        palette[i] = (unsigned char)(i * 89 % 256);
+    }
+
+    status = sixel_quant_precompute_cache(cachetable, palette, 61, 3, allocator);
+    if (SIXEL_FAILED(status)) {
+        goto error;
+    }
+    for (hash = 0; hash < 1 << 3 * 5; ++hash) {
+        pixel[0] = (unsigned char)((hash >> 10 & 0x1f) << 3 | 4);
+        pixel[1] = (unsigned char)((hash >> 5 & 0x1f) << 3 | 4);
+        pixel[2] = (unsigned char)((hash & 0x1f) << 3 | 4);
+        if ((int)computeHash(pixel, 3) != hash) {
+            goto error;
+        }
+        index = lookup_normal(pixel, 3, palette, 61, NULL, 3);
+        if (cachetable[hash] != index + 1) {
+            goto error;
+        }
+    }
+    nret = EXIT_SUCCESS;
+
+error:
+    sixel_allocator_free(allocator, cachetable);
+    sixel_allocator_unref(allocator);
+    return nret;
+}
+
+
+/*
+ * benchmark of the generic and the specialized loops,
+ * runs only if SIXEL_BENCHMARK environment variable is set.
+ */
+static int
+test4(void)
+{
+    int nret = EXIT_FAILURE;
+    SIXELSTATUS status;
+    sixel_allocator_t *allocator = NULL;
+    enum { width = 640, height = 480, reqcolor = 256, rounds = 4 };
+    static struct {
+        int method;
+        char const *name;
+    } const methods[] = {
+        { SIXEL_DIFFUSE_NONE,     "none"     },
+        { SIXEL_DIFFUSE_ATKINSON, "atkinson" },
+        { SIXEL_DIFFUSE_FS,       "fs"       },
+        { SIXEL_DIFFUSE_JAJUNI,   "jajuni"   },
+        { SIXEL_DIFFUSE_STUCKI,   "stucki"   },
+        { SIXEL_DIFFUSE_BURKES,   "burkes"   },
+    };
+    unsigned char *source = NULL;
+    unsigned char *pixels = NULL;
+    sixel_index_t *result = NULL;
+    unsigned char source_palette[reqcolor * 3];
+    unsigned char palette[reqcolor * 3];
+    int ncolors;
+    size_t i;
+    int foptimize;
+    int generic;
+    int n;
+    clock_t start;
+    double elapsed[2];
+
+    if (getenv("SIXEL_BENCHMARK") == NULL) {
+        return EXIT_SUCCESS;
+    }
+
+    status = sixel_allocator_new(&allocator, NULL, NULL, NULL, NULL);
+    if (SIXEL_FAILED(status)) {
+        goto error;
+    }
+    source = (unsigned char *)sixel_allocator_malloc(allocator, width * height * 3);
+    pixels = (unsigned char *)sixel_allocator_malloc(allocator, width * height * 3);
+    result = (sixel_index_t *)sixel_allocator_malloc(allocator, width * height);
+    if (source == NULL || pixels == NULL || result == NULL) {
+        goto error;
+    }
+
+    make_test_image(source, width, height);
+    for (i = 0; i < sizeof(source_palette); ++i) {
+        source_palette[i] = (unsigned char)(i * 97 % 256);
+    }
+
+    for (foptimize = 0; foptimize < 2; ++foptimize) {
+        for (i = 0; i < sizeof(methods) / sizeof(methods[0]); ++i) {
+            for (generic = 0; generic < 2; ++generic) {
+                start = clock();
+                for (n = 0; n < rounds; ++n) {
+                    status = run_apply_palette(result, pixels, source,
+                                               palette, source_palette,
+                                               width, height, reqcolor,
+                                               methods[i].method,
+                                               foptimize, 1, generic,
+                                               &ncolors, allocator);
+                    if (SIXEL_FAILED(status)) {
+                        goto error;
+                    }
+                }
+                elapsed[generic] = (double)(clock() - start) / CLOCKS_PER_SEC;
+            }
+            fprintf(stderr,
+                    "apply_palette %-6s %-8s generic: %.3fs specialized: %.3fs\n",
+                    foptimize ? "fast" : "normal", methods[i].name,
+                    elapsed[1], elapsed[0]);
+        }
+    }
+    nret = EXIT_SUCCESS;
+
+error:
+    sixel_allocator_free(allocator, source);
+    sixel_allocator_free(allocator, pixels);
+    sixel_allocator_free(allocator, result);
+    sixel_allocator_unref(allocator);
+    return nret;
+}
+
+
+/* 32bpp and BGR pixels must be quantized like the same pixels in RGB888 */
+static int
+test6(void)
+{
+    int nret = EXIT_FAILURE;
+    SIXELSTATUS status;
+    sixel_allocator_t *allocator = NULL;
+    enum { width = 53, height = 29, reqcolor = 23 };
+    static struct {
+        int pixelformat;
+        int stride;
+        int offsets[3];
+    } const formats[] = {
+        { SIXEL_PIXELFORMAT_BGR888,   3, { 2, 1, 0 } },
+        { SIXEL_PIXELFORMAT_RGBA8888, 4, { 0, 1, 2 } },
+        { SIXEL_PIXELFORMAT_ARGB8888, 4, { 1, 2, 3 } },
+        { SIXEL_PIXELFORMAT_BGRA8888, 4, { 2, 1, 0 } },
+        { SIXEL_PIXELFORMAT_ABGR8888, 4, { 3, 2, 1 } },
+    };
+    static int const methods[] = {
+        SIXEL_DIFFUSE_NONE,
+        SIXEL_DIFFUSE_FS,
+        SIXEL_DIFFUSE_JAJUNI,
+        SIXEL_DIFFUSE_BURKES,
+        SIXEL_DIFFUSE_A_DITHER,
+        SIXEL_DIFFUSE_BAYER,
+    };
+    unsigned char source[width * height * 3];
+    unsigned char rgb[width * height * 3];
+    unsigned char wide[width * height * 4];
+    unsigned char alpha[width * height];
+    unsigned char source_palette[reqcolor * 3];
+    unsigned char palette1[reqcolor * 3];
+    unsigned char palette2[reqcolor * 3];
+    unsigned char *made1 = NULL;
+    unsigned char *made2 = NULL;
+    unsigned int made_colors1;
+    unsigned int made_colors2;
+    sixel_index_t result1[width * height];
+    sixel_index_t result2[width * height];
+    int ncolors1;
+    int ncolors2;
+    int pos;
+    int n;
+    int alpha_offset;
+    size_t f;
+    size_t i;
+    int foptimize;
+    int foptimize_palette;
+    int generic;
+
+    status = sixel_allocator_new(&allocator, NULL, NULL, NULL, NULL);
+    if (SIXEL_FAILED(status)) {
+        goto error;
+    }
+
+    make_test_image(source, width, height);
+    for (i = 0; i < sizeof(source_palette); ++i) {
+        source_palette[i] = (unsigned char)(i * 89 % 256);
+    }
+
+    for (f = 0; f < sizeof(formats) / sizeof(formats[0]); ++f) {
+        alpha_offset = 6 - formats[f].offsets[0]
+                         - formats[f].offsets[1]
+                         - formats[f].offsets[2];
+
+        for (i = 0; i < sizeof(methods) / sizeof(methods[0]); ++i) {
+            for (foptimize = 0; foptimize < 2; ++foptimize) {
+                for (foptimize_palette = 0; foptimize_palette < 2; ++foptimize_palette) {
+                    for (generic = 0; generic < 2; ++generic) {
+                        status = run_apply_palette(result1, rgb, source,
+                                                   palette1, source_palette,
+                                                   width, height, reqcolor, methods[i],
+                                                   foptimize, foptimize_palette, generic,
+                                                   &ncolors1, allocator);
+                        if (SIXEL_FAILED(status)) {
+                            goto error;
+                        }
+
+                        for (pos = 0; pos < width * height; ++pos) {
+                            alpha[pos] = (unsigned char)(pos * 7);
+                            for (n = 0; n < 3; ++n) {
+                                wide[pos * formats[f].stride + formats[f].offsets[n]]
+                                    = source[pos * 3 + n];
+                            }
+                            if (formats[f].stride == 4) {
+                                wide[pos * 4 + alpha_offset] = alpha[pos];
+                            }
+                        }
+                        memcpy(palette2, source_palette, sizeof(source_palette));
+                        quant_force_generic_loop = generic;
+                        status = sixel_quant_apply_palette(result2, wide, width, height,
+                                                           width * formats[f].stride,
+                                                           formats[f].pixelformat,
+                                                           palette2, reqcolor, methods[i],
+                                                           foptimize, foptimize_palette, 1,
+                                                           NULL, &ncolors2, allocator);
+                        quant_force_generic_loop = 0;
+                        if (SIXEL_FAILED(status)) {
+                            goto error;
+                        }
+
+                        if (ncolors1 != ncolors2) {
+                            goto error;
+                        }
+                        if (memcmp(result1, result2, sizeof(result1)) != 0) {
+                            goto error;
+                        }
+                        if (memcmp(palette1, palette2, (size_t)(ncolors1 * 3)) != 0) {
+                            goto error;
+                        }
+                        /* diffused channels must match and alpha must be left alone */
+                        for (pos = 0; pos < width * height; ++pos) {
+                            for (n = 0; n < 3; ++n) {
+                                if (wide[pos * formats[f].stride + formats[f].offsets[n]]
+                                    != rgb[pos * 3 + n]) {
+                                    goto error;
+                                }
+                            }
+                            if (formats[f].stride == 4 &&
+                                wide[pos * 4 + alpha_offset] != alpha[pos]) {
+                                goto error;
+                            }
+                        }
+                    }
+                }
+            }
+        }
+
+        /* the histogram samples the same colors */
+        status = sixel_quant_make_palette(&made1, source,
+                                          (unsigned int)sizeof(source),
+                                          SIXEL_PIXELFORMAT_RGB888,
+                                          reqcolor, &made_colors1, NULL,
+                                          SIXEL_LARGE_NORM, SIXEL_REP_CENTER_BOX,
+                                          SIXEL_QUALITY_HIGH, allocator);
+        if (SIXEL_FAILED(status)) {
+            goto error;
+        }
+        status = sixel_quant_make_palette(&made2, wide,
+                                          (unsigned int)(width * height
+                                                         * formats[f].stride),
+                                          formats[f].pixelformat,
+                                          reqcolor, &made_colors2, NULL,
+                                          SIXEL_LARGE_NORM, SIXEL_REP_CENTER_BOX,
+                                          SIXEL_QUALITY_HIGH, allocator);
+        if (SIXEL_FAILED(status)) {
+            goto error;
+        }
+        if (made_colors1 != made_colors2) {
+            goto error;
+        }
+        if (memcmp(made1, made2, (size_t)(made_colors1 * 3)) != 0) {
+            goto error;
+        }
+        sixel_quant_free_palette(made1, allocator);
+        sixel_quant_free_palette(made2, allocator);
+        made1 = made2 = NULL;
+    }
+
+    /* grayscale and packed pixels have to be normalized by the caller */
+    status = sixel_quant_apply_palette(result2, wide, width, height,
+                                       width * 2, SIXEL_PIXELFORMAT_RGB565,
+                                       palette2, reqcolor, SIXEL_DIFFUSE_NONE,
+                                       0, 0, 1, NULL, &ncolors2, allocator);
+    if (status != SIXEL_BAD_ARGUMENT) {
+        goto error;
+    }
+
+    nret = EXIT_SUCCESS;
+
+error:
+    sixel_quant_free_palette(made1, allocator);
+    sixel_quant_free_palette(made2, allocator);
+    sixel_allocator_unref(allocator);
+    return nret;
+}
+
+
 SIXELAPI int
 sixel_quant_tests_main(void)
 {
@@ -1523,6 +2911,11 @@ sixel_quant_tests_main(void)
 
     static testcase const testcases[] = {
         test1,
+        test2,
+        test3,
+        test4,
+        test5,
+        test6,
     };
 
     for (i = 0; i < sizeof(testcases) / sizeof(testcase); ++i) {
@@ -44,6 +44,32 @@ sixel_quant_make_palette(
     sixel_allocator_t       /* in */  *allocator);
 
 
+/* number of 15bpp buckets of histograms for sixel_quant_add_histogram() */
+#define SIXEL_QUANT_HISTOGRAM_SIZE (1 << 15)
+
+/* add colors of 24bpp or 32bpp pixels into a histogram */
+SIXELSTATUS
+sixel_quant_add_histogram(
+    unsigned int            /* in */  *histogram,        /* histogram to fill */
+    unsigned char const     /* in */  *data,             /* data for sampling */
+    unsigned int            /* in */  length,            /* data size */
+    int                     /* in */  pixelformat,
+    int                     /* in */  qualityMode);
+
+
+/* choose colors from a histogram using median-cut method */
+SIXELSTATUS
+sixel_quant_make_palette_from_histogram(
+    unsigned char           /* out */ **result,
+    unsigned int const      /* in */  *histogram,
+    unsigned int            /* in */  reqcolors,
+    unsigned int            /* in */  *ncolors,
+    unsigned int            /* in */  *origcolors,
+    int                     /* in */  methodForLargest,
+    int                     /* in */  methodForRep,
+    sixel_allocator_t       /* in */  *allocator);
+
+
 /* apply color palette into specified pixel buffers */
 SIXELSTATUS
 sixel_quant_apply_palette(
@@ -51,6 +77,30 @@ sixel_quant_apply_palette(
     unsigned char       /* in */  *data,
     int                 /* in */  width,
     int                 /* in */  height,
+    int                 /* in */  pitch,            /* bytes per row */
+    int                 /* in */  pixelformat,
+    unsigned char       /* in */  *palette,
+    int                 /* in */  reqcolor,
+    int const           /* in */  methodForDiffuse,
+    int                 /* in */  foptimize,
+    int                 /* in */  foptimize_palette,
+    int                 /* in */  complexion,
+    unsigned short      /* in */  *cachetable,
+    int                 /* in */  *ncolor,
+    sixel_allocator_t   /* in */  *allocator);
+
+
+/* apply color palette into the first 'rows' rows of specified pixel buffers,
+   errors are still diffused into the rows below them */
+SIXELSTATUS
+sixel_quant_apply_palette_rows(
+    sixel_index_t       /* out */ *result,
+    unsigned char       /* in */  *data,
+    int                 /* in */  width,
+    int                 /* in */  height,           /* rows in the buffer */
+    int                 /* in */  pitch,            /* bytes per row */
+    int                 /* in */  rows,             /* rows to be quantized */
+    int                 /* in */  origin,           /* image row of the buffer */
     int                 /* in */  pixelformat,
     unsigned char       /* in */  *palette,
     int                 /* in */  reqcolor,
@@ -63,6 +113,16 @@ sixel_quant_apply_palette(
     sixel_allocator_t   /* in */  *allocator);
 
 
+/* fill all entries of 15bpp lookup cache */
+SIXELSTATUS
+sixel_quant_precompute_cache(
+    unsigned short      /* out */ *cachetable,
+    unsigned char const /* in */  *palette,
+    int                 /* in */  reqcolor,
+    int                 /* in */  complexion,
+    sixel_allocator_t   /* in */  *allocator);
+
+
 /* deallocate specified palette */
 void
 sixel_quant_free_palette(
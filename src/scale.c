@@ -22,8 +22,19 @@
 #include "config.h"
 
 /* STDC_HEADERS */
+#include <stdio.h>
 #include <stdlib.h>
 
+#if HAVE_STRING_H
+# include <string.h>
+#endif  /* HAVE_STRING_H */
+#if HAVE_TIME_H
+# include <time.h>
+#endif  /* HAVE_TIME_H */
+#if HAVE_LIMITS_H
+# include <limits.h>
+#endif  /* HAVE_LIMITS_H */
+
 #if HAVE_MATH_H
 # define _USE_MATH_DEFINES  /* for MSVC */
 # include <math.h>
@@ -31,8 +42,26 @@
 #ifndef M_PI
 # define M_PI 3.14159265358979323846
 #endif
+#if HAVE_UNISTD_H
+# include <unistd.h>
+#endif  /* HAVE_UNISTD_H */
+#if HAVE_PTHREAD_H && HAVE_PTHREAD
+# include <pthread.h>
+# define SCALE_USE_THREADS 1
+#endif  /* HAVE_PTHREAD_H && HAVE_PTHREAD */
+
+/* SSE2 is a part of x86_64, AVX2 is selected at runtime */
+#if defined(__SSE2__)
+# include <emmintrin.h>
+# define SCALE_USE_SSE2 1
+# if defined(__GNUC__) && (__GNUC__ >= 5 || defined(__clang__))
+#  include <immintrin.h>
+#  define SCALE_USE_AVX2 1
+# endif
+#endif  /* __SSE2__ */
 
 #include <sixel.h>
+#include "scale.h"
 
 #if !defined(MAX)
 # define MAX(l, r) ((l) > (r) ? (l) : (r))
@@ -172,223 +201,2020 @@ hamming(const double d)
 }
 
 
-static unsigned char
-normalize(double x, double total)
+/* source image, which is read one row at a time as RGB888 */
+typedef struct scale_source {
+    unsigned char const *pixels;
+    unsigned char const *palette;   /* palette of PAL formats, may be NULL */
+    int width;
+    int height;
+    int pixelformat;
+    size_t stride;                  /* bytes per row */
+} scale_source_t;
+
+/* size of a buffer for scale_source_row(), with slack for SIMD loads */
+#define SCALE_ROW_BUFFER_SIZE(width) ((size_t)(width) * 4 + 8)
+
+
+static int
+scale_source_init(
+    scale_source_t *source,
+    unsigned char const *pixels,
+    int const width,
+    int const height,
+    int const pixelformat,
+    unsigned char const *palette)
 {
-    int result;
+    source->pixels = pixels;
+    source->palette = palette;
+    source->width = width;
+    source->height = height;
+    source->pixelformat = pixelformat;
 
-    result = floor(x / total);
-    if (result > 255) {
-        return 0xff;
+    switch (pixelformat) {
+    case SIXEL_PIXELFORMAT_PAL1:
+    case SIXEL_PIXELFORMAT_G1:
+        source->stride = ((size_t)width + 7) / 8;
+        break;
+    case SIXEL_PIXELFORMAT_PAL2:
+    case SIXEL_PIXELFORMAT_G2:
+        source->stride = ((size_t)width * 2 + 7) / 8;
+        break;
+    case SIXEL_PIXELFORMAT_PAL4:
+    case SIXEL_PIXELFORMAT_G4:
+        source->stride = ((size_t)width * 4 + 7) / 8;
+        break;
+    default:
+        if (sixel_helper_compute_depth(pixelformat) <= 0) {
+            return (-1);
+        }
+        source->stride = (size_t)width * (size_t)sixel_helper_compute_depth(pixelformat);
+        break;
     }
-    if (result < 0) {
-        return 0x00;
+
+    return 0;
+}
+
+
+/*
+ * get row "y" of the source as RGB888. rows of other formats are
+ * converted into "buffer", which has SCALE_ROW_BUFFER_SIZE(width) bytes.
+ * indices of PAL formats without a palette are taken as gray levels.
+ */
+static unsigned char const *
+scale_source_row(
+    scale_source_t const *source,
+    int const y,
+    unsigned char *buffer)
+{
+    unsigned char const *p = source->pixels + (size_t)y * source->stride;
+    unsigned char const *indices;
+    unsigned char const *color;
+    int pixelformat;
+    int max = 255;
+    int x;
+
+    switch (source->pixelformat) {
+    case SIXEL_PIXELFORMAT_RGB888:
+        return p;
+    case SIXEL_PIXELFORMAT_PAL1:
+    case SIXEL_PIXELFORMAT_PAL2:
+    case SIXEL_PIXELFORMAT_PAL4:
+    case SIXEL_PIXELFORMAT_PAL8:
+    case SIXEL_PIXELFORMAT_G1:
+    case SIXEL_PIXELFORMAT_G2:
+    case SIXEL_PIXELFORMAT_G4:
+    case SIXEL_PIXELFORMAT_G8:
+        indices = p;
+        if (source->pixelformat == SIXEL_PIXELFORMAT_G1) {
+            max = 1;
+        } else if (source->pixelformat == SIXEL_PIXELFORMAT_G2) {
+            max = 3;
+        } else if (source->pixelformat == SIXEL_PIXELFORMAT_G4) {
+            max = 15;
+        }
+        if (source->pixelformat != SIXEL_PIXELFORMAT_PAL8 &&
+            source->pixelformat != SIXEL_PIXELFORMAT_G8) {
+            /* unpack into the last quarter of the buffer */
+            (void) sixel_helper_normalize_pixelformat(buffer + source->width * 3,
+                                                      &pixelformat, p,
+                                                      source->pixelformat,
+                                                      source->width, 1);
+            indices = buffer + source->width * 3;
+        }
+        if (source->palette != NULL &&
+            (source->pixelformat == SIXEL_PIXELFORMAT_PAL1 ||
+             source->pixelformat == SIXEL_PIXELFORMAT_PAL2 ||
+             source->pixelformat == SIXEL_PIXELFORMAT_PAL4 ||
+             source->pixelformat == SIXEL_PIXELFORMAT_PAL8)) {
+            for (x = 0; x < source->width; x++) {
+                color = source->palette + indices[x] * 3;
+                buffer[x * 3 + 0] = color[0];
+                buffer[x * 3 + 1] = color[1];
+                buffer[x * 3 + 2] = color[2];
+            }
+        } else {
+            for (x = 0; x < source->width; x++) {
+                buffer[x * 3 + 0] = buffer[x * 3 + 1] = buffer[x * 3 + 2]
+                    = (unsigned char)(indices[x] * 255 / max);
+            }
+        }
+        return buffer;
+    default:
+        (void) sixel_helper_normalize_pixelformat(buffer, &pixelformat, p,
+                                                  source->pixelformat,
+                                                  source->width, 1);
+        return buffer;
     }
-    return (unsigned char)result;
 }
 
 
-static void
+/*
+ * nearest neighbor scaling.
+ * source offsets of columns are computed once, and destination rows
+ * which map to the same source row as the previous one are copied.
+ */
+static int
 scale_without_resampling(
     unsigned char *dst,
-    unsigned char const *src,
-    int const srcw,
-    int const srch,
+    scale_source_t const *source,
     int const dstw,
     int const dsth,
-    int const depth)
+    sixel_allocator_t *allocator)
 {
+    int const srcw = source->width;
+    int const srch = source->height;
+    size_t const rowsize = (size_t)dstw * 3;
+    size_t *offsets;
+    unsigned char *buffer;
+    unsigned char const *row;
+    unsigned char *out;
     int w;
     int h;
-    int x;
     int y;
-    int i;
-    int pos;
+    int prev = (-1);
+    int nwords;
+
+    offsets = (size_t *)sixel_allocator_malloc(allocator,
+                                               sizeof(size_t) * (size_t)dstw);
+    buffer = (unsigned char *)sixel_allocator_malloc(allocator,
+                                                     SCALE_ROW_BUFFER_SIZE(srcw));
+    if (offsets == NULL || buffer == NULL) {
+        sixel_allocator_free(allocator, offsets);
+        sixel_allocator_free(allocator, buffer);
+        return (-1);
+    }
+    for (w = 0; w < dstw; w++) {
+        offsets[w] = (size_t)((long)w * srcw / dstw) * 3;
+    }
+
+    /*
+     * 3 byte pixels are moved as 4 byte words. the extra byte is
+     * overwritten by the next pixel, so the last column and columns
+     * reading the last source pixel are copied bytewise.
+     */
+    nwords = 0;
+    while (nwords < dstw - 1 && offsets[nwords] + 4 <= (size_t)srcw * 3) {
+        nwords++;
+    }
 
     for (h = 0; h < dsth; h++) {
-        for (w = 0; w < dstw; w++) {
-            x = (long)w * srcw / dstw;
-            y = (long)h * srch / dsth;
-            for (i = 0; i < depth; i++) {
-                pos = (y * srcw + x) * depth + i;
-                dst[(h * dstw + w) * depth + i] = src[pos];
-            }
+        y = (int)((long)h * srch / dsth);
+        out = dst + (size_t)h * rowsize;
+        if (y == prev) {
+            memcpy(out, out - rowsize, rowsize);
+            continue;
+        }
+        prev = y;
+        row = scale_source_row(source, y, buffer);
+        for (w = 0; w < nwords; w++) {
+            memcpy(out, row + offsets[w], 4);
+            out += 3;
+        }
+        for (; w < dstw; w++) {
+            out[0] = row[offsets[w] + 0];
+            out[1] = row[offsets[w] + 1];
+            out[2] = row[offsets[w] + 2];
+            out += 3;
         }
     }
+
+    sixel_allocator_free(allocator, offsets);
+    sixel_allocator_free(allocator, buffer);
+
+    return 0;
 }
 
 
 typedef double (*resample_fn_t)(double const d);
 
+/* fixed point precision of filter weights */
+#define SCALE_WEIGHT_BITS   12
+#define SCALE_WEIGHT_ONE    (1 << SCALE_WEIGHT_BITS)
+
+/*
+ * precision of the intermediate image between two passes.
+ * it is stored as 16bit integers so that both passes can be computed
+ * with 16bit multiplications, 255 << 6 leaves room for the overshoot
+ * of the sharpening filters.
+ */
+#define SCALE_INTERMEDIATE_BITS 6
+#define SCALE_INTERMEDIATE_MAX  32767
+#define SCALE_INTERMEDIATE_MIN  (-32768)
+
+/*
+ * linear light samples have SCALE_LINEAR_BITS more bits than 8bit sRGB
+ * ones, so that dark levels stay distinct. they are scaled to fit the
+ * same intermediate range as sRGB samples.
+ */
+#define SCALE_LINEAR_BITS       4
+#define SCALE_LINEAR_MAX        (255 << SCALE_LINEAR_BITS)
+
+/* shifts which bring sums of weighted samples to the next precision */
+#define SCALE_HORIZONTAL_SHIFT  (SCALE_WEIGHT_BITS - SCALE_INTERMEDIATE_BITS)
+#define SCALE_VERTICAL_SHIFT    (SCALE_WEIGHT_BITS + SCALE_INTERMEDIATE_BITS)
+#define SCALE_LINEAR_HORIZONTAL_SHIFT (SCALE_HORIZONTAL_SHIFT + SCALE_LINEAR_BITS)
+#define SCALE_LINEAR_VERTICAL_SHIFT   (SCALE_VERTICAL_SHIFT - SCALE_LINEAR_BITS)
+
+/* implementations of the convolution kernels */
+enum {
+    SCALE_KERNEL_SCALAR = 0,
+    SCALE_KERNEL_SSE2   = 1,
+    SCALE_KERNEL_AVX2   = 2
+};
+
+/*
+ * reductions which need filter windows wider than SCALE_PREREDUCE_TAPS
+ * are first shrunk by an integer factor with a box filter, leaving at
+ * least the ratio SCALE_REDUCING_GAP to the chosen filter
+ */
+#define SCALE_PREREDUCE_TAPS    16
+#define SCALE_REDUCING_GAP      2
+
+/* limits of the row-tiled worker threads */
+#define SCALE_MAX_THREADS       16
+#define SCALE_MIN_ROWS_PER_TASK 16
+
+#if HAVE_TESTS
+static int scale_force_kernel = (-1);
+static int scale_force_threads = 0;
+static int scale_disable_prereduce = 0;
+#endif
+
+/* contributions of source pixels for each destination pixel of one axis */
+typedef struct scale_weights {
+    int *first;     /* the first source pixel */
+    int *count;     /* number of source pixels */
+    int *weights;   /* fixed point weights, "taps" entries for each pixel */
+    int taps;       /* maximum number of source pixels */
+} scale_weights_t;
+
+/* conversion tables between sRGB and linear light samples */
+typedef struct scale_gamma {
+    short to_linear[256];
+    unsigned char to_srgb[SCALE_LINEAR_MAX + 1];
+} scale_gamma_t;
+
+/* shared state of the resampling passes, read only while they run */
+typedef struct scale_context {
+    unsigned char *dst;
+    scale_source_t const *source;
+    int srcw;
+    int srch;
+    int dstw;
+    int dsth;
+    int kernel;
+    scale_weights_t xtable;
+    scale_weights_t ytable;
+    short *xpacked;         /* horizontal weights in the layout of SIMD kernels */
+    int xpairs;             /* number of tap pairs of each pixel in xpacked */
+    short *intermediate;    /* result of the horizontal pass */
+    scale_gamma_t const *gamma; /* resample in linear light, or NULL */
+    unsigned char *buffers; /* row buffers for each task */
+    size_t buffersize;      /* size of a row buffer */
+} scale_context_t;
+
+typedef void (*scale_pass_fn_t)(scale_context_t const *context,
+                                int const begin,
+                                int const end,
+                                unsigned char *buffer);
+
+
+/* build tables of the sRGB transfer function and its inverse */
 static void
-scale_with_resampling(
-    unsigned char *dst,
-    unsigned char const *src,
-    int const srcw,
-    int const srch,
-    int const dstw,
-    int const dsth,
-    int const depth,
-    resample_fn_t const f_resample,
-    double n)
+scale_gamma_init(scale_gamma_t *gamma)
 {
-    int w;
-    int h;
-    int x;
-    int y;
+    double v;
     int i;
+
+    for (i = 0; i < 256; i++) {
+        v = i / 255.0;
+        v = v <= 0.04045 ? v / 12.92: pow((v + 0.055) / 1.055, 2.4);
+        gamma->to_linear[i] = (short)floor(v * SCALE_LINEAR_MAX + 0.5);
+    }
+    for (i = 0; i <= SCALE_LINEAR_MAX; i++) {
+        v = (double)i / SCALE_LINEAR_MAX;
+        v = v <= 0.0031308 ? v * 12.92: 1.055 * pow(v, 1.0 / 2.4) - 0.055;
+        gamma->to_srgb[i] = (unsigned char)floor(v * 255.0 + 0.5);
+    }
+}
+
+
+/* compute range of source pixels affected by a destination pixel */
+static void
+scale_compute_range(
+    int const srclen,
+    int const dstlen,
+    int const pos,
+    double const n,
+    double *center,
+    int *first,
+    int *last)
+{
+    if (dstlen >= srclen) {
+        *center = (pos + 0.5) * srclen / dstlen;
+        *first = MAX(*center - n, 0);
+        *last = MIN(*center + n, srclen - 1);
+    } else {
+        *center = pos + 0.5;
+        *first = MAX(floor((*center - n) * srclen / dstlen), 0);
+        *last = MIN(floor((*center + n) * srclen / dstlen), srclen - 1);
+    }
+}
+
+
+/*
+ * build the contribution table of one axis.
+ * weights are normalized so that the sum of each pixel is
+ * SCALE_WEIGHT_ONE, filter functions are evaluated only here.
+ */
+static int
+scale_weights_init(
+    scale_weights_t *table,
+    int const srclen,
+    int const dstlen,
+    resample_fn_t const f_resample,
+    double const n,
+    sixel_allocator_t *allocator)
+{
+    int nret = (-1);
     int pos;
-    int x_first, x_last, y_first, y_last;
-    double center_x, center_y;
-    double diff_x, diff_y;
-    double weight;
+    int i;
+    int first;
+    int last;
+    int sum;
+    int largest;
+    double center;
+    double diff;
     double total;
-    double offsets[8];
+    double *values = NULL;
+    int *weights;
 
-    for (h = 0; h < dsth; h++) {
-        for (w = 0; w < dstw; w++) {
-            total = 0.0;
-            for (i = 0; i < depth; i++) {
-                offsets[i] = 0;
-            }
+    table->first = NULL;
+    table->weights = NULL;
+    table->taps = 1;
+
+    for (pos = 0; pos < dstlen; pos++) {
+        scale_compute_range(srclen, dstlen, pos, n, &center, &first, &last);
+        table->taps = MAX(table->taps, last - first + 1);
+    }
+
+    table->first = (int *)sixel_allocator_malloc(allocator,
+                                                 sizeof(int) * (size_t)dstlen * 2);
+    table->weights = (int *)sixel_allocator_malloc(allocator,
+                                                   sizeof(int) * (size_t)dstlen
+                                                   * (size_t)table->taps);
+    values = (double *)sixel_allocator_malloc(allocator,
+                                              sizeof(double) * (size_t)table->taps);
+    if (table->first == NULL || table->weights == NULL || values == NULL) {
+        goto end;
+    }
+    table->count = table->first + dstlen;
+
+    for (pos = 0; pos < dstlen; pos++) {
+        scale_compute_range(srclen, dstlen, pos, n, &center, &first, &last);
+        weights = table->weights + pos * table->taps;
 
-            /* retrieve range of affected pixels */
-            if (dstw >= srcw) {
-                center_x = (w + 0.5) * srcw / dstw;
-                x_first = MAX(center_x - n, 0);
-                x_last = MIN(center_x + n, srcw - 1);
+        total = 0.0;
+        for (i = 0; i <= last - first; i++) {
+            if (dstlen >= srclen) {
+                diff = (first + i + 0.5) - center;
             } else {
-                center_x = w + 0.5;
-                x_first = MAX(floor((center_x - n) * srcw / dstw), 0);
-                x_last = MIN(floor((center_x + n) * srcw / dstw), srcw - 1);
+                diff = (first + i + 0.5) * dstlen / srclen - center;
             }
-            if (dsth >= srch) {
-                center_y = (h + 0.5) * srch / dsth;
-                y_first = MAX(center_y - n, 0);
-                y_last = MIN(center_y + n, srch - 1);
-            } else {
-                center_y = h + 0.5;
-                y_first = MAX(floor((center_y - n) * srch / dsth), 0);
-                y_last = MIN(floor((center_y + n) * srch / dsth), srch - 1);
+            values[i] = f_resample(fabs(diff));
+            total += values[i];
+        }
+
+        if (last < first || total <= 0.0) {
+            /* degenerated window: take the nearest source pixel */
+            first = MIN((int)((long)pos * srclen / dstlen), srclen - 1);
+            table->first[pos] = first;
+            table->count[pos] = 1;
+            weights[0] = SCALE_WEIGHT_ONE;
+            continue;
+        }
+
+        /* quantize, and put the rounding error on the largest weight */
+        sum = 0;
+        largest = 0;
+        for (i = 0; i <= last - first; i++) {
+            weights[i] = (int)floor(values[i] / total * SCALE_WEIGHT_ONE + 0.5);
+            sum += weights[i];
+            if (values[i] > values[largest]) {
+                largest = i;
             }
+        }
+        weights[largest] += SCALE_WEIGHT_ONE - sum;
 
-            /* accumerate weights of affected pixels */
-            for (y = y_first; y <= y_last; y++) {
-                for (x = x_first; x <= x_last; x++) {
-                    if (dstw >= srcw) {
-                        diff_x = (x + 0.5) - center_x;
-                    } else {
-                        diff_x = (x + 0.5) * dstw / srcw - center_x;
-                    }
-                    if (dsth >= srch) {
-                        diff_y = (y + 0.5) - center_y;
-                    } else {
-                        diff_y = (y + 0.5) * dsth / srch - center_y;
-                    }
-                    weight = f_resample(fabs(diff_x)) * f_resample(fabs(diff_y));
-                    for (i = 0; i < depth; i++) {
-                        pos = (y * srcw + x) * depth + i;
-                        offsets[i] += src[pos] * weight;
-                    }
-                    total += weight;
-                }
+        table->first[pos] = first;
+        table->count[pos] = last - first + 1;
+    }
+
+    nret = 0;
+
+end:
+    sixel_allocator_free(allocator, values);
+    return nret;
+}
+
+
+static void
+scale_weights_fini(
+    scale_weights_t *table,
+    sixel_allocator_t *allocator)
+{
+    sixel_allocator_free(allocator, table->first);
+    sixel_allocator_free(allocator, table->weights);
+}
+
+
+/*
+ * arrange horizontal weights for the SIMD kernels of 3 channel pixels.
+ * each pair of taps is stored as { w0, w0, w0, w1, w1, w1, 0, 0 }, which
+ * matches two pixels loaded as 8 bytes.
+ */
+static int
+scale_pack_weights(
+    scale_context_t *context,
+    sixel_allocator_t *allocator)
+{
+    scale_weights_t const *table = &context->xtable;
+    short *packed;
+    int pos;
+    int k;
+    int i;
+    int weight;
+
+    context->xpairs = (table->taps + 1) / 2;
+    context->xpacked = (short *)sixel_allocator_calloc(allocator,
+                                                       (size_t)context->dstw
+                                                       * (size_t)context->xpairs * 8,
+                                                       sizeof(short));
+    if (context->xpacked == NULL) {
+        return (-1);
+    }
+
+    for (pos = 0; pos < context->dstw; pos++) {
+        packed = context->xpacked + (size_t)pos * context->xpairs * 8;
+        for (k = 0; k < table->count[pos]; k++) {
+            weight = table->weights[pos * table->taps + k];
+            for (i = 0; i < 3; i++) {
+                packed[(k / 2) * 8 + (k % 2) * 3 + i] = (short)weight;
             }
+        }
+    }
 
-            /* normalize */
-            if (total > 0.0) {
-                for (i = 0; i < depth; i++) {
-                    pos = (h * dstw + w) * depth + i;
-                    dst[pos] = normalize(offsets[i], total);
-                }
+    return 0;
+}
+
+
+/* round a horizontal sum to the intermediate precision, keeping the sign */
+static short
+scale_round_intermediate(int value, int const shift)
+{
+    if (value >= 0) {
+        value = (value + (1 << (shift - 1))) >> shift;
+    } else {
+        value = -((-value + (1 << (shift - 1))) >> shift);
+    }
+    if (value > SCALE_INTERMEDIATE_MAX) {
+        value = SCALE_INTERMEDIATE_MAX;
+    } else if (value < SCALE_INTERMEDIATE_MIN) {
+        value = SCALE_INTERMEDIATE_MIN;
+    }
+
+    return (short)value;
+}
+
+
+/* round a vertical sum to an 8bit sample */
+static unsigned char
+scale_round_sample(int value)
+{
+    int const shift = SCALE_VERTICAL_SHIFT;
+
+    if (value <= 0) {
+        return 0;
+    }
+    value = (value + (1 << (shift - 1))) >> shift;
+    if (value > 255) {
+        return 255;
+    }
+
+    return (unsigned char)value;
+}
+
+
+/* round a vertical sum to a linear light sample */
+static short
+scale_round_linear(int value)
+{
+    int const shift = SCALE_LINEAR_VERTICAL_SHIFT;
+
+    if (value <= 0) {
+        return 0;
+    }
+    value = (value + (1 << (shift - 1))) >> shift;
+    if (value > SCALE_LINEAR_MAX) {
+        return SCALE_LINEAR_MAX;
+    }
+
+    return (short)value;
+}
+
+
+static void
+scale_horizontal_row_scalar(
+    scale_context_t const *context,
+    short *out,
+    unsigned char const *row)
+{
+    scale_weights_t const *table = &context->xtable;
+    int w;
+    int i;
+    int k;
+    int value;
+    int const *weights;
+    unsigned char const *p;
+
+    for (w = 0; w < context->dstw; w++) {
+        weights = table->weights + w * table->taps;
+        p = row + table->first[w] * 3;
+        for (i = 0; i < 3; i++) {
+            value = 0;
+            for (k = 0; k < table->count[w]; k++) {
+                value += p[k * 3 + i] * weights[k];
             }
+            out[w * 3 + i] = scale_round_intermediate(value,
+                                                      SCALE_HORIZONTAL_SHIFT);
         }
     }
 }
 
 
-SIXELAPI int
-sixel_helper_scale_image(
-    unsigned char       /* out */ *dst,
-    unsigned char const /* in */  *src,                   /* source image data */
-    int                 /* in */  srcw,                   /* source image width */
-    int                 /* in */  srch,                   /* source image height */
-    int                 /* in */  pixelformat,            /* one of enum pixelFormat */
-    int                 /* in */  dstw,                   /* destination image width */
-    int                 /* in */  dsth,                   /* destination image height */
-    int                 /* in */  method_for_resampling,  /* one of methodForResampling */
-    sixel_allocator_t   /* in */  *allocator)             /* allocator object */
+/* scalar horizontal kernel for a row of linear light samples */
+static void
+scale_horizontal_row_linear_scalar(
+    scale_context_t const *context,
+    short *out,
+    short const *row)
 {
-    int const depth = sixel_helper_compute_depth(pixelformat);
-    unsigned char *new_src = NULL;
-    int nret;
-    int new_pixelformat;
+    scale_weights_t const *table = &context->xtable;
+    int w;
+    int i;
+    int k;
+    int value;
+    int const *weights;
+    short const *p;
 
-    if (depth != 3) {
-        new_src = (unsigned char *)sixel_allocator_malloc(allocator, (size_t)(srcw * srch * 3));
-        if (new_src == NULL) {
-            return (-1);
+    for (w = 0; w < context->dstw; w++) {
+        weights = table->weights + w * table->taps;
+        p = row + table->first[w] * 3;
+        for (i = 0; i < 3; i++) {
+            value = 0;
+            for (k = 0; k < table->count[w]; k++) {
+                value += p[k * 3 + i] * weights[k];
+            }
+            out[w * 3 + i] = scale_round_intermediate(value,
+                                                      SCALE_LINEAR_HORIZONTAL_SHIFT);
         }
-        nret = sixel_helper_normalize_pixelformat(new_src,
-                                                  &new_pixelformat,
-                                                  src, pixelformat,
-                                                  srcw, srch);
-        if (nret != 0) {
-            sixel_allocator_free(allocator, new_src);
-            return (-1);
+    }
+}
+
+
+/*
+ * compute destination columns from "x" with scalar code.
+ * if "wide" is not NULL, linear light samples are stored there instead.
+ */
+static void
+scale_vertical_columns(
+    unsigned char *out,
+    short *wide,
+    short const *intermediate,
+    int const rowsize,
+    int x,
+    int const first,
+    int const count,
+    int const *weights)
+{
+    int k;
+    int value;
+    short const *column;
+
+    for (; x < rowsize; x++) {
+        column = intermediate + (size_t)first * rowsize + x;
+        value = 0;
+        for (k = 0; k < count; k++) {
+            value += column[(size_t)k * rowsize] * weights[k];
         }
+        if (wide != NULL) {
+            wide[x] = scale_round_linear(value);
+        } else {
+            out[x] = scale_round_sample(value);
+        }
+    }
+}
 
-        src = new_src;
-    } else {
-        new_pixelformat = pixelformat;
+
+#if SCALE_USE_SSE2
+/*
+ * horizontal kernel for 3 channel pixels, two taps at once.
+ * two pixels are loaded as 8 bytes, so the caller must ensure that 5 bytes
+ * following the row are readable.
+ */
+static void
+scale_horizontal_row_sse2(
+    scale_context_t const *context,
+    short *out,
+    unsigned char const *row)
+{
+    scale_weights_t const *table = &context->xtable;
+    __m128i const zero = _mm_setzero_si128();
+    __m128i pixels;
+    __m128i weights;
+    __m128i lo;
+    __m128i hi;
+    __m128i sum_lo;
+    __m128i sum_hi;
+    int sums[4];
+    int w;
+    int j;
+    int pairs;
+    short const *packed;
+    unsigned char const *p;
+
+    for (w = 0; w < context->dstw; w++) {
+        p = row + table->first[w] * 3;
+        packed = context->xpacked + (size_t)w * context->xpairs * 8;
+        pairs = (table->count[w] + 1) / 2;
+        sum_lo = sum_hi = zero;
+        for (j = 0; j < pairs; j++) {
+            pixels = _mm_loadl_epi64((__m128i const *)(p + j * 6));
+            pixels = _mm_unpacklo_epi8(pixels, zero);
+            weights = _mm_loadu_si128((__m128i const *)(packed + j * 8));
+            lo = _mm_mullo_epi16(pixels, weights);
+            hi = _mm_mulhi_epi16(pixels, weights);
+            sum_lo = _mm_add_epi32(sum_lo, _mm_unpacklo_epi16(lo, hi));
+            sum_hi = _mm_add_epi32(sum_hi, _mm_unpackhi_epi16(lo, hi));
+        }
+        /* { r0, g0, b0, r1 } + { g1, b1, 0, 0 } -> { r, g, b } */
+        sum_lo = _mm_add_epi32(sum_lo, _mm_srli_si128(sum_lo, 12));
+        sum_lo = _mm_add_epi32(sum_lo, _mm_slli_si128(sum_hi, 4));
+        _mm_storeu_si128((__m128i *)sums, sum_lo);
+        out[w * 3 + 0] = scale_round_intermediate(sums[0], SCALE_HORIZONTAL_SHIFT);
+        out[w * 3 + 1] = scale_round_intermediate(sums[1], SCALE_HORIZONTAL_SHIFT);
+        out[w * 3 + 2] = scale_round_intermediate(sums[2], SCALE_HORIZONTAL_SHIFT);
     }
+}
 
-    /* choose re-sampling strategy */
-    switch (method_for_resampling) {
-    case SIXEL_RES_NEAREST:
-        scale_without_resampling(dst, src, srcw, srch, dstw, dsth, depth);
-        break;
-    case SIXEL_RES_GAUSSIAN:
-        scale_with_resampling(dst, src, srcw, srch, dstw, dsth, depth,
-                              gaussian, 1.0);
-        break;
-    case SIXEL_RES_HANNING:
-        scale_with_resampling(dst, src, srcw, srch, dstw, dsth, depth,
-                              hanning, 1.0);
-        break;
-    case SIXEL_RES_HAMMING:
-        scale_with_resampling(dst, src, srcw, srch, dstw, dsth, depth,
-                              hamming, 1.0);
-        break;
-    case SIXEL_RES_WELSH:
-        scale_with_resampling(dst, src, srcw, srch, dstw, dsth, depth,
-                              welsh, 1.0);
-        break;
-    case SIXEL_RES_BICUBIC:
-        scale_with_resampling(dst, src, srcw, srch, dstw, dsth, depth,
-                              bicubic, 2.0);
-        break;
-    case SIXEL_RES_LANCZOS2:
-        scale_with_resampling(dst, src, srcw, srch, dstw, dsth, depth,
-                              lanczos2, 3.0);
-        break;
-    case SIXEL_RES_LANCZOS3:
-        scale_with_resampling(dst, src, srcw, srch, dstw, dsth, depth,
-                              lanczos3, 3.0);
-        break;
-    case SIXEL_RES_LANCZOS4:
-        scale_with_resampling(dst, src, srcw, srch, dstw, dsth, depth,
-                              lanczos4, 4.0);
-        break;
-    case SIXEL_RES_BILINEAR:
-    default:
-        scale_with_resampling(dst, src, srcw, srch, dstw, dsth, depth,
-                              bilinear, 1.0);
-        break;
+
+/*
+ * horizontal kernel for linear light samples, same as above but two
+ * pixels are loaded as 8 samples, so 5 samples following the row must
+ * be readable.
+ */
+static void
+scale_horizontal_row_linear_sse2(
+    scale_context_t const *context,
+    short *out,
+    short const *row)
+{
+    scale_weights_t const *table = &context->xtable;
+    __m128i const zero = _mm_setzero_si128();
+    __m128i pixels;
+    __m128i weights;
+    __m128i lo;
+    __m128i hi;
+    __m128i sum_lo;
+    __m128i sum_hi;
+    int sums[4];
+    int w;
+    int j;
+    int pairs;
+    short const *packed;
+    short const *p;
+
+    for (w = 0; w < context->dstw; w++) {
+        p = row + table->first[w] * 3;
+        packed = context->xpacked + (size_t)w * context->xpairs * 8;
+        pairs = (table->count[w] + 1) / 2;
+        sum_lo = sum_hi = zero;
+        for (j = 0; j < pairs; j++) {
+            pixels = _mm_loadu_si128((__m128i const *)(p + j * 6));
+            weights = _mm_loadu_si128((__m128i const *)(packed + j * 8));
+            lo = _mm_mullo_epi16(pixels, weights);
+            hi = _mm_mulhi_epi16(pixels, weights);
+            sum_lo = _mm_add_epi32(sum_lo, _mm_unpacklo_epi16(lo, hi));
+            sum_hi = _mm_add_epi32(sum_hi, _mm_unpackhi_epi16(lo, hi));
+        }
+        sum_lo = _mm_add_epi32(sum_lo, _mm_srli_si128(sum_lo, 12));
+        sum_lo = _mm_add_epi32(sum_lo, _mm_slli_si128(sum_hi, 4));
+        _mm_storeu_si128((__m128i *)sums, sum_lo);
+        out[w * 3 + 0] = scale_round_intermediate(sums[0], SCALE_LINEAR_HORIZONTAL_SHIFT);
+        out[w * 3 + 1] = scale_round_intermediate(sums[1], SCALE_LINEAR_HORIZONTAL_SHIFT);
+        out[w * 3 + 2] = scale_round_intermediate(sums[2], SCALE_LINEAR_HORIZONTAL_SHIFT);
     }
+}
 
-    free(new_src);
-    return 0;
+
+/* vertical kernel, 8 columns and two taps at once */
+static void
+scale_vertical_row_sse2(
+    unsigned char *out,
+    short *wide,
+    short const *intermediate,
+    int const rowsize,
+    int const first,
+    int const count,
+    int const *weights)
+{
+    __m128i const bias = _mm_set1_epi32(1 << (SCALE_VERTICAL_SHIFT - 1));
+    __m128i const linear_bias = _mm_set1_epi32(1 << (SCALE_LINEAR_VERTICAL_SHIFT - 1));
+    __m128i const linear_max = _mm_set1_epi16(SCALE_LINEAR_MAX);
+    __m128i sum_lo;
+    __m128i sum_hi;
+    __m128i a;
+    __m128i b;
+    __m128i pair;
+    short const *row0;
+    short const *row1;
+    int x;
+    int k;
+    int w1;
+
+    for (x = 0; x + 8 <= rowsize; x += 8) {
+        sum_lo = sum_hi = _mm_setzero_si128();
+        for (k = 0; k < count; k += 2) {
+            row0 = intermediate + (size_t)(first + k) * rowsize + x;
+            row1 = k + 1 < count ? row0 + rowsize: row0;
+            w1 = k + 1 < count ? weights[k + 1]: 0;
+            pair = _mm_set1_epi32((int)(((unsigned int)w1 << 16)
+                                        | ((unsigned int)weights[k] & 0xffff)));
+            a = _mm_loadu_si128((__m128i const *)row0);
+            b = _mm_loadu_si128((__m128i const *)row1);
+            sum_lo = _mm_add_epi32(sum_lo,
+                                   _mm_madd_epi16(_mm_unpacklo_epi16(a, b), pair));
+            sum_hi = _mm_add_epi32(sum_hi,
+                                   _mm_madd_epi16(_mm_unpackhi_epi16(a, b), pair));
+        }
+        if (wide != NULL) {
+            /* same as scale_round_linear() */
+            sum_lo = _mm_srai_epi32(_mm_add_epi32(sum_lo, linear_bias),
+                                    SCALE_LINEAR_VERTICAL_SHIFT);
+            sum_hi = _mm_srai_epi32(_mm_add_epi32(sum_hi, linear_bias),
+                                    SCALE_LINEAR_VERTICAL_SHIFT);
+            a = _mm_packs_epi32(sum_lo, sum_hi);
+            a = _mm_min_epi16(_mm_max_epi16(a, _mm_setzero_si128()), linear_max);
+            _mm_storeu_si128((__m128i *)(wide + x), a);
+            continue;
+        }
+        /* same as scale_round_sample(), negative sums saturate to 0 */
+        sum_lo = _mm_srai_epi32(_mm_add_epi32(sum_lo, bias), SCALE_VERTICAL_SHIFT);
+        sum_hi = _mm_srai_epi32(_mm_add_epi32(sum_hi, bias), SCALE_VERTICAL_SHIFT);
+        a = _mm_packs_epi32(sum_lo, sum_hi);
+        _mm_storel_epi64((__m128i *)(out + x), _mm_packus_epi16(a, a));
+    }
+
+    scale_vertical_columns(out, wide, intermediate, rowsize, x, first, count, weights);
 }
+#endif  /* SCALE_USE_SSE2 */
+
+
+#if SCALE_USE_AVX2
+/* vertical kernel, 16 columns and two taps at once */
+__attribute__((target("avx2")))
+static void
+scale_vertical_row_avx2(
+    unsigned char *out,
+    short *wide,
+    short const *intermediate,
+    int const rowsize,
+    int const first,
+    int const count,
+    int const *weights)
+{
+    __m256i const bias = _mm256_set1_epi32(1 << (SCALE_VERTICAL_SHIFT - 1));
+    __m256i const linear_bias = _mm256_set1_epi32(1 << (SCALE_LINEAR_VERTICAL_SHIFT - 1));
+    __m256i const linear_max = _mm256_set1_epi16(SCALE_LINEAR_MAX);
+    __m256i sum_lo;
+    __m256i sum_hi;
+    __m256i a;
+    __m256i b;
+    __m256i pair;
+    short const *row0;
+    short const *row1;
+    int x;
+    int k;
+    int w1;
+
+    for (x = 0; x + 16 <= rowsize; x += 16) {
+        sum_lo = sum_hi = _mm256_setzero_si256();
+        for (k = 0; k < count; k += 2) {
+            row0 = intermediate + (size_t)(first + k) * rowsize + x;
+            row1 = k + 1 < count ? row0 + rowsize: row0;
+            w1 = k + 1 < count ? weights[k + 1]: 0;
+            pair = _mm256_set1_epi32((int)(((unsigned int)w1 << 16)
+                                           | ((unsigned int)weights[k] & 0xffff)));
+            a = _mm256_loadu_si256((__m256i const *)row0);
+            b = _mm256_loadu_si256((__m256i const *)row1);
+            /* unpack works in 128bit lanes, packs below restores the order */
+            sum_lo = _mm256_add_epi32(sum_lo,
+                                      _mm256_madd_epi16(_mm256_unpacklo_epi16(a, b), pair));
+            sum_hi = _mm256_add_epi32(sum_hi,
+                                      _mm256_madd_epi16(_mm256_unpackhi_epi16(a, b), pair));
+        }
+        if (wide != NULL) {
+            /* lanes hold columns 0-3, 4-7 and 8-11, 12-15 after packing */
+            sum_lo = _mm256_srai_epi32(_mm256_add_epi32(sum_lo, linear_bias),
+                                       SCALE_LINEAR_VERTICAL_SHIFT);
+            sum_hi = _mm256_srai_epi32(_mm256_add_epi32(sum_hi, linear_bias),
+                                       SCALE_LINEAR_VERTICAL_SHIFT);
+            a = _mm256_packs_epi32(sum_lo, sum_hi);
+            a = _mm256_min_epi16(_mm256_max_epi16(a, _mm256_setzero_si256()),
+                                 linear_max);
+            _mm256_storeu_si256((__m256i *)(wide + x), a);
+            continue;
+        }
+        sum_lo = _mm256_srai_epi32(_mm256_add_epi32(sum_lo, bias), SCALE_VERTICAL_SHIFT);
+        sum_hi = _mm256_srai_epi32(_mm256_add_epi32(sum_hi, bias), SCALE_VERTICAL_SHIFT);
+        a = _mm256_packs_epi32(sum_lo, sum_hi);
+        a = _mm256_packus_epi16(a, a);
+        a = _mm256_permute4x64_epi64(a, 0x08);
+        _mm_storeu_si128((__m128i *)(out + x), _mm256_castsi256_si128(a));
+    }
+
+    scale_vertical_columns(out, wide, intermediate, rowsize, x, first, count, weights);
+}
+#endif  /* SCALE_USE_AVX2 */
+
+
+/* pick the fastest kernel the running CPU supports */
+static int
+scale_detect_kernel(void)
+{
+#if SCALE_USE_AVX2
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return SCALE_KERNEL_AVX2;
+    }
+#endif
+#if SCALE_USE_SSE2
+    return SCALE_KERNEL_SSE2;
+#else
+    return SCALE_KERNEL_SCALAR;
+#endif
+}
+
+
+static int
+scale_select_kernel(void)
+{
+#if HAVE_TESTS
+    if (scale_force_kernel >= 0) {
+        return scale_force_kernel;
+    }
+#endif
+    return scale_detect_kernel();
+}
+
+
+/*
+ * horizontal pass over source rows [begin, end). rows which are not
+ * RGB888 are converted into "buffer" one at a time, so the source is
+ * never normalized as a whole. in linear light mode, samples are then
+ * looked up into the linear row after the RGB888 one.
+ */
+static void
+scale_horizontal_rows(
+    scale_context_t const *context,
+    int const begin,
+    int const end,
+    unsigned char *buffer)
+{
+#if SCALE_USE_SSE2
+    size_t const srcsize = (size_t)context->srcw * 3;
+#endif
+    size_t const rowsize = (size_t)context->dstw * 3;
+    unsigned char const *row;
+    short *linear = (short *)(buffer + SCALE_ROW_BUFFER_SIZE(context->srcw));
+    int const nsamples = context->srcw * 3;
+    int x;
+    int y;
+
+    for (y = begin; y < end; y++) {
+        row = scale_source_row(context->source, y, buffer);
+        if (context->gamma != NULL) {
+            for (x = 0; x < nsamples; x++) {
+                linear[x] = context->gamma->to_linear[row[x]];
+            }
+            for (x = nsamples; x < nsamples + 5; x++) {
+                linear[x] = 0;
+            }
+#if SCALE_USE_SSE2
+            if (context->kernel != SCALE_KERNEL_SCALAR) {
+                scale_horizontal_row_linear_sse2(context,
+                                                 context->intermediate + (size_t)y * rowsize,
+                                                 linear);
+                continue;
+            }
+#endif
+            scale_horizontal_row_linear_scalar(context,
+                                               context->intermediate + (size_t)y * rowsize,
+                                               linear);
+            continue;
+        }
+#if SCALE_USE_SSE2
+        /*
+         * SIMD kernels read up to 5 bytes past the end of the row, which
+         * is safe within the buffer and before the last source pixels.
+         */
+        if (context->kernel != SCALE_KERNEL_SCALAR
+            && (row == buffer
+                || ((size_t)y + 1) * srcsize + 5 <= (size_t)context->srch * srcsize)) {
+            scale_horizontal_row_sse2(context,
+                                      context->intermediate + (size_t)y * rowsize,
+                                      row);
+            continue;
+        }
+#endif
+        scale_horizontal_row_scalar(context,
+                                    context->intermediate + (size_t)y * rowsize,
+                                    row);
+    }
+}
+
+
+/*
+ * vertical pass over destination rows [begin, end). in linear light
+ * mode, the kernels write linear samples into "buffer", which are then
+ * looked up back to sRGB.
+ */
+static void
+scale_vertical_rows(
+    scale_context_t const *context,
+    int const begin,
+    int const end,
+    unsigned char *buffer)
+{
+    scale_weights_t const *table = &context->ytable;
+    int const rowsize = context->dstw * 3;
+    short *wide = context->gamma != NULL ? (short *)buffer: NULL;
+    unsigned char *out;
+    int const *weights;
+    int h;
+    int x;
+
+    for (h = begin; h < end; h++) {
+        out = context->dst + (size_t)h * rowsize;
+        weights = table->weights + h * table->taps;
+        switch (context->kernel) {
+#if SCALE_USE_AVX2
+        case SCALE_KERNEL_AVX2:
+            scale_vertical_row_avx2(out, wide, context->intermediate, rowsize,
+                                    table->first[h], table->count[h], weights);
+            break;
+#endif
+#if SCALE_USE_SSE2
+        case SCALE_KERNEL_SSE2:
+            scale_vertical_row_sse2(out, wide, context->intermediate, rowsize,
+                                    table->first[h], table->count[h], weights);
+            break;
+#endif
+        default:
+            scale_vertical_columns(out, wide, context->intermediate, rowsize, 0,
+                                   table->first[h], table->count[h], weights);
+            break;
+        }
+        if (wide != NULL) {
+            for (x = 0; x < rowsize; x++) {
+                out[x] = context->gamma->to_srgb[wide[x]];
+            }
+        }
+    }
+}
+
+
+/*
+ * number of worker threads, taken from ${SIXEL_THREADS} or the number of
+ * online processors.
+ */
+static int
+scale_get_thread_count(void)
+{
+    int nthreads = 1;
+    char const *env;
+
+#if HAVE_TESTS
+    if (scale_force_threads > 0) {
+        return MIN(scale_force_threads, SCALE_MAX_THREADS);
+    }
+#endif
+
+    env = getenv("SIXEL_THREADS");
+    if (env != NULL && atoi(env) > 0) {
+        nthreads = atoi(env);
+    }
+#if HAVE_UNISTD_H && defined(_SC_NPROCESSORS_ONLN)
+    else {
+        nthreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    }
+#endif
+
+    return MAX(MIN(nthreads, SCALE_MAX_THREADS), 1);
+}
+
+
+#if SCALE_USE_THREADS
+typedef struct scale_task {
+    scale_context_t const *context;
+    scale_pass_fn_t fn;
+    int begin;
+    int end;
+    unsigned char *buffer;
+} scale_task_t;
+
+
+static void *
+scale_task_main(void *arg)
+{
+    scale_task_t *task = (scale_task_t *)arg;
+
+    task->fn(task->context, task->begin, task->end, task->buffer);
+
+    return NULL;
+}
+#endif  /* SCALE_USE_THREADS */
+
+
+/*
+ * run a pass over "length" rows, split into bands of worker threads.
+ * the i-th band gets the i-th row buffer of the context.
+ */
+static void
+scale_run_pass(
+    scale_context_t const *context,
+    scale_pass_fn_t fn,
+    int const length,
+    int nthreads)
+{
+#if SCALE_USE_THREADS
+    pthread_t threads[SCALE_MAX_THREADS];
+    scale_task_t tasks[SCALE_MAX_THREADS];
+    int started[SCALE_MAX_THREADS];
+    int i;
+
+    nthreads = MIN(nthreads, length / SCALE_MIN_ROWS_PER_TASK);
+    if (nthreads > 1) {
+        for (i = 0; i < nthreads; i++) {
+            tasks[i].context = context;
+            tasks[i].fn = fn;
+            tasks[i].begin = (int)((long)length * i / nthreads);
+            tasks[i].end = (int)((long)length * (i + 1) / nthreads);
+            tasks[i].buffer = context->buffers + context->buffersize * (size_t)i;
+        }
+        for (i = 1; i < nthreads; i++) {
+            started[i] = pthread_create(&threads[i], NULL,
+                                        scale_task_main, &tasks[i]) == 0;
+        }
+        fn(context, tasks[0].begin, tasks[0].end, tasks[0].buffer);
+        for (i = 1; i < nthreads; i++) {
+            if (started[i]) {
+                pthread_join(threads[i], NULL);
+            } else {
+                /* could not start a thread, do its band here */
+                fn(context, tasks[i].begin, tasks[i].end, tasks[i].buffer);
+            }
+        }
+        return;
+    }
+#else
+    (void) nthreads;
+#endif  /* SCALE_USE_THREADS */
+
+    fn(context, 0, length, context->buffers);
+}
+
+
+/*
+ * separable resampling: a horizontal pass into an intermediate image of
+ * SCALE_INTERMEDIATE_BITS extra precision, followed by a vertical pass.
+ * the 2D filter used before was the product of the same 1D filter on
+ * both axes, so the result only differs in rounding.
+ * rows of each pass are independent, so they are split between threads,
+ * and every kernel gives exactly the same result as the scalar one.
+ */
+static int
+scale_with_resampling(
+    unsigned char *dst,
+    scale_source_t const *source,
+    int const dstw,
+    int const dsth,
+    resample_fn_t const f_resample,
+    double n,
+    scale_gamma_t const *gamma,
+    sixel_allocator_t *allocator)
+{
+    int const srcw = source->width;
+    int const srch = source->height;
+    int nret = (-1);
+    int nthreads;
+    scale_context_t context;
+
+    context.dst = dst;
+    context.source = source;
+    context.srcw = srcw;
+    context.srch = srch;
+    context.dstw = dstw;
+    context.dsth = dsth;
+    context.kernel = scale_select_kernel();
+    context.xtable.first = context.xtable.weights = NULL;
+    context.ytable.first = context.ytable.weights = NULL;
+    context.xpacked = NULL;
+    context.xpairs = 0;
+    context.intermediate = NULL;
+    context.gamma = gamma;
+    context.buffers = NULL;
+    context.buffersize = SCALE_ROW_BUFFER_SIZE(srcw);
+    if (gamma != NULL) {
+        /* a linear row with 5 samples of slack, or a row of the vertical pass */
+        context.buffersize += sizeof(short) * (size_t)(MAX(srcw, dstw) * 3 + 5);
+    }
+
+    if (scale_weights_init(&context.xtable, srcw, dstw,
+                           f_resample, n, allocator) != 0) {
+        goto end;
+    }
+    if (scale_weights_init(&context.ytable, srch, dsth,
+                           f_resample, n, allocator) != 0) {
+        goto end;
+    }
+    if (context.kernel != SCALE_KERNEL_SCALAR) {
+        if (scale_pack_weights(&context, allocator) != 0) {
+            goto end;
+        }
+    }
+
+    context.intermediate = (short *)sixel_allocator_malloc(allocator,
+                                                           sizeof(short)
+                                                           * (size_t)dstw * 3
+                                                           * (size_t)srch);
+    if (context.intermediate == NULL) {
+        goto end;
+    }
+
+    nthreads = scale_get_thread_count();
+    context.buffers = (unsigned char *)sixel_allocator_malloc(allocator,
+                                                              context.buffersize
+                                                              * (size_t)nthreads);
+    if (context.buffers == NULL) {
+        goto end;
+    }
+    scale_run_pass(&context, scale_horizontal_rows, srch, nthreads);
+    scale_run_pass(&context, scale_vertical_rows, dsth, nthreads);
+
+    nret = 0;
+
+end:
+    sixel_allocator_free(allocator, context.buffers);
+    sixel_allocator_free(allocator, context.intermediate);
+    sixel_allocator_free(allocator, context.xpacked);
+    scale_weights_fini(&context.xtable, allocator);
+    scale_weights_fini(&context.ytable, allocator);
+    return nret;
+}
+
+
+/*
+ * area-averaging reduction of RGB888 pixels by integer factors (fx, fy).
+ * every source pixel is read once, so the cost does not depend on the
+ * ratio. boxes at the right and bottom edges may be partial.
+ * if "gamma" is given, boxes are averaged in linear light.
+ */
+static int
+scale_box_reduce(
+    unsigned char *dst,
+    scale_source_t const *source,
+    int const fx,
+    int const fy,
+    scale_gamma_t const *gamma,
+    sixel_allocator_t *allocator)
+{
+    int const srcw = source->width;
+    int const srch = source->height;
+    int const dstw = (srcw + fx - 1) / fx;
+    int const dsth = (srch + fy - 1) / fy;
+    int const srcsize = srcw * 3;
+    unsigned int *columns;
+    unsigned int const *column;
+    unsigned char *buffer;
+    unsigned int r;
+    unsigned int g;
+    unsigned int b;
+    unsigned int n;
+    unsigned char const *p;
+    unsigned char *out;
+    int w;
+    int h;
+    int x;
+    int y;
+    int y1;
+    int width;
+
+    /* sums of source columns over the rows of a box */
+    columns = (unsigned int *)sixel_allocator_malloc(allocator,
+                                                     sizeof(unsigned int)
+                                                     * (size_t)srcsize);
+    buffer = (unsigned char *)sixel_allocator_malloc(allocator,
+                                                     SCALE_ROW_BUFFER_SIZE(srcw));
+    if (columns == NULL || buffer == NULL) {
+        sixel_allocator_free(allocator, columns);
+        sixel_allocator_free(allocator, buffer);
+        return (-1);
+    }
+
+    for (h = 0; h < dsth; h++) {
+        y1 = MIN((h + 1) * fy, srch);
+        for (x = 0; x < srcsize; x++) {
+            columns[x] = 0;
+        }
+        for (y = h * fy; y < y1; y++) {
+            p = scale_source_row(source, y, buffer);
+            if (gamma != NULL) {
+                for (x = 0; x < srcsize; x++) {
+                    columns[x] += (unsigned int)gamma->to_linear[p[x]];
+                }
+            } else {
+                for (x = 0; x < srcsize; x++) {
+                    columns[x] += p[x];
+                }
+            }
+        }
+        column = columns;
+        out = dst + (size_t)h * dstw * 3;
+        for (w = 0; w < dstw; w++) {
+            width = MIN(fx, srcw - w * fx);
+            r = g = b = 0;
+            for (x = 0; x < width; x++) {
+                r += column[0];
+                g += column[1];
+                b += column[2];
+                column += 3;
+            }
+            n = (unsigned int)(width * (y1 - h * fy));
+            r = (r + n / 2) / n;
+            g = (g + n / 2) / n;
+            b = (b + n / 2) / n;
+            if (gamma != NULL) {
+                r = gamma->to_srgb[r];
+                g = gamma->to_srgb[g];
+                b = gamma->to_srgb[b];
+            }
+            out[0] = (unsigned char)r;
+            out[1] = (unsigned char)g;
+            out[2] = (unsigned char)b;
+            out += 3;
+        }
+    }
+
+    sixel_allocator_free(allocator, columns);
+    sixel_allocator_free(allocator, buffer);
+
+    return 0;
+}
+
+
+/*
+ * scale an image of any pixelformat into RGB888 "dst". rows are
+ * normalized as they are read, through "palette" for PAL formats, so no
+ * RGB888 copy of the whole source is made.
+ * with SIXEL_RES_LINEAR_LIGHT, filters are applied to linear light
+ * samples looked up from tables, so that downscaled fine detail keeps
+ * its brightness.
+ */
+int
+sixel_scale_image(
+    unsigned char       /* out */ *dst,
+    unsigned char const /* in */  *src,                   /* source image data */
+    int                 /* in */  srcw,                   /* source image width */
+    int                 /* in */  srch,                   /* source image height */
+    int                 /* in */  pixelformat,            /* one of enum pixelFormat */
+    unsigned char const /* in */  *palette,               /* palette of PAL formats or NULL */
+    int                 /* in */  dstw,                   /* destination image width */
+    int                 /* in */  dsth,                   /* destination image height */
+    int                 /* in */  method_for_resampling,  /* one of methodForResampling */
+    sixel_allocator_t   /* in */  *allocator)             /* allocator object */
+{
+    unsigned char *reduced = NULL;
+    int nret = (-1);
+    int fx;
+    int fy;
+    int maxsample;
+    resample_fn_t f_resample;
+    double n;
+    scale_source_t source;
+    scale_gamma_t gamma;
+    scale_gamma_t const *pgamma = NULL;
+
+    if (scale_source_init(&source, src, srcw, srch, pixelformat, palette) != 0) {
+        return (-1);
+    }
+
+    /* work buffers of resampling filters need an allocator */
+    if (allocator == NULL) {
+        if (SIXEL_FAILED(sixel_allocator_new(&allocator, NULL, NULL, NULL, NULL))) {
+            return (-1);
+        }
+    } else {
+        sixel_allocator_ref(allocator);
+    }
+
+    /* nearest neighbor does not blend samples, so it ignores the modifier */
+    if (method_for_resampling & SIXEL_RES_LINEAR_LIGHT) {
+        method_for_resampling &= ~SIXEL_RES_LINEAR_LIGHT;
+        if (method_for_resampling != SIXEL_RES_NEAREST) {
+            scale_gamma_init(&gamma);
+            pgamma = &gamma;
+        }
+    }
+
+    /* choose re-sampling strategy */
+    switch (method_for_resampling) {
+    case SIXEL_RES_NEAREST:
+        nret = scale_without_resampling(dst, &source, dstw, dsth, allocator);
+        goto end;
+    case SIXEL_RES_GAUSSIAN:
+        f_resample = gaussian;
+        n = 1.0;
+        break;
+    case SIXEL_RES_HANNING:
+        f_resample = hanning;
+        n = 1.0;
+        break;
+    case SIXEL_RES_HAMMING:
+        f_resample = hamming;
+        n = 1.0;
+        break;
+    case SIXEL_RES_WELSH:
+        f_resample = welsh;
+        n = 1.0;
+        break;
+    case SIXEL_RES_BICUBIC:
+        f_resample = bicubic;
+        n = 2.0;
+        break;
+    case SIXEL_RES_LANCZOS2:
+        f_resample = lanczos2;
+        n = 3.0;
+        break;
+    case SIXEL_RES_LANCZOS3:
+        f_resample = lanczos3;
+        n = 3.0;
+        break;
+    case SIXEL_RES_LANCZOS4:
+        f_resample = lanczos4;
+        n = 4.0;
+        break;
+    case SIXEL_RES_BILINEAR:
+    default:
+        f_resample = bilinear;
+        n = 1.0;
+        break;
+    }
+
+    /*
+     * the windows of resampling filters grow with the reduction ratio.
+     * if they get wide, shrink by the integer part of the ratio with a
+     * box filter first, which reads each source pixel only once.
+     */
+    fx = fy = 1;
+    if (2.0 * n * srcw / dstw > SCALE_PREREDUCE_TAPS) {
+        fx = MAX(srcw / (dstw * SCALE_REDUCING_GAP), 1);
+    }
+    if (2.0 * n * srch / dsth > SCALE_PREREDUCE_TAPS) {
+        fy = MAX(srch / (dsth * SCALE_REDUCING_GAP), 1);
+    }
+#if HAVE_TESTS
+    if (scale_disable_prereduce) {
+        fx = fy = 1;
+    }
+#endif
+    /* sums over a box must fit in unsigned int, the resampler does the rest */
+    maxsample = pgamma != NULL ? SCALE_LINEAR_MAX : 255;
+    while ((double)fx * fy * maxsample > (double)UINT_MAX) {
+        if (fx >= fy) {
+            fx = (fx + 1) / 2;
+        } else {
+            fy = (fy + 1) / 2;
+        }
+    }
+    if (fx > 1 || fy > 1) {
+        reduced = (unsigned char *)sixel_allocator_malloc(allocator,
+                                                          (size_t)((srcw + fx - 1) / fx)
+                                                          * (size_t)((srch + fy - 1) / fy)
+                                                          * 3);
+        if (reduced == NULL) {
+            goto end;
+        }
+        if (scale_box_reduce(reduced, &source, fx, fy, pgamma, allocator) != 0) {
+            goto end;
+        }
+        (void) scale_source_init(&source, reduced,
+                                 (srcw + fx - 1) / fx, (srch + fy - 1) / fy,
+                                 SIXEL_PIXELFORMAT_RGB888, NULL);
+    }
+
+    nret = scale_with_resampling(dst, &source, dstw, dsth,
+                                 f_resample, n, pgamma, allocator);
+
+end:
+    sixel_allocator_free(allocator, reduced);
+    sixel_allocator_unref(allocator);
+    return nret;
+}
+
+
+SIXELAPI int
+sixel_helper_scale_image(
+    unsigned char       /* out */ *dst,
+    unsigned char const /* in */  *src,                   /* source image data */
+    int                 /* in */  srcw,                   /* source image width */
+    int                 /* in */  srch,                   /* source image height */
+    int                 /* in */  pixelformat,            /* one of enum pixelFormat */
+    int                 /* in */  dstw,                   /* destination image width */
+    int                 /* in */  dsth,                   /* destination image height */
+    int                 /* in */  method_for_resampling,  /* one of methodForResampling */
+    sixel_allocator_t   /* in */  *allocator)             /* allocator object */
+{
+    return sixel_scale_image(dst, src, srcw, srch, pixelformat, NULL,
+                             dstw, dsth, method_for_resampling, allocator);
+}
+
+
+#if HAVE_TESTS
+
+static void
+make_test_image(unsigned char *pixels, int width, int height)
+{
+    int x;
+    int y;
+
+    for (y = 0; y < height; y++) {
+        for (x = 0; x < width; x++) {
+            pixels[(y * width + x) * 3 + 0] = (unsigned char)(x * 255 / MAX(width - 1, 1));
+            pixels[(y * width + x) * 3 + 1] = (unsigned char)(y * 255 / MAX(height - 1, 1));
+            pixels[(y * width + x) * 3 + 2] = (unsigned char)((x * 7 + y * 13) % 256);
+        }
+    }
+}
+
+
+/* all kernels and thread counts must give the same result as scalar code */
+static int
+test1(void)
+{
+    int nret = EXIT_FAILURE;
+    sixel_allocator_t *allocator = NULL;
+    static int const sizes[][4] = {
+        { 37, 23, 80, 50 },
+        { 80, 50, 37, 23 },
+        { 1, 1, 5, 3 },
+        { 2, 3, 1, 1 },
+        { 64, 64, 17, 200 },
+        { 200, 120, 160, 96 },
+        { 300, 40, 33, 7 },
+    };
+    static int const kernels[] = {
+        SCALE_KERNEL_SSE2, SCALE_KERNEL_AVX2
+    };
+    unsigned char *src = NULL;
+    unsigned char *expected = NULL;
+    unsigned char *actual = NULL;
+    size_t i;
+    size_t j;
+    int n;
+    int method;
+    int nthreads;
+
+    if (SIXEL_FAILED(sixel_allocator_new(&allocator, NULL, NULL, NULL, NULL))) {
+        goto error;
+    }
+
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        src = (unsigned char *)sixel_allocator_malloc(allocator,
+                                                      (size_t)(sizes[i][0] * sizes[i][1] * 3));
+        expected = (unsigned char *)sixel_allocator_malloc(allocator,
+                                                           (size_t)(sizes[i][2] * sizes[i][3] * 3));
+        actual = (unsigned char *)sixel_allocator_malloc(allocator,
+                                                         (size_t)(sizes[i][2] * sizes[i][3] * 3));
+        if (src == NULL || expected == NULL || actual == NULL) {
+            goto error;
+        }
+        make_test_image(src, sizes[i][0], sizes[i][1]);
+
+        /* every method, then every method in linear light */
+        for (n = 0; n < (SIXEL_RES_LANCZOS4 + 1) * 2; n++) {
+            method = n % (SIXEL_RES_LANCZOS4 + 1);
+            if (n > SIXEL_RES_LANCZOS4) {
+                method |= SIXEL_RES_LINEAR_LIGHT;
+            }
+            scale_force_kernel = SCALE_KERNEL_SCALAR;
+            scale_force_threads = 1;
+            if (sixel_helper_scale_image(expected, src, sizes[i][0], sizes[i][1],
+                                         SIXEL_PIXELFORMAT_RGB888,
+                                         sizes[i][2], sizes[i][3],
+                                         method, allocator) != 0) {
+                goto error;
+            }
+            for (j = 0; j < sizeof(kernels) / sizeof(kernels[0]) + 1; j++) {
+                if (j < sizeof(kernels) / sizeof(kernels[0])) {
+                    /* skip kernels which are not available here */
+                    if (kernels[j] > scale_detect_kernel()) {
+                        continue;
+                    }
+                    scale_force_kernel = kernels[j];
+                } else {
+                    scale_force_kernel = SCALE_KERNEL_SCALAR;
+                }
+                for (nthreads = 1; nthreads <= 4; nthreads += 3) {
+                    scale_force_threads = nthreads;
+                    if (sixel_helper_scale_image(actual, src, sizes[i][0], sizes[i][1],
+                                                 SIXEL_PIXELFORMAT_RGB888,
+                                                 sizes[i][2], sizes[i][3],
+                                                 method, allocator) != 0) {
+                        goto error;
+                    }
+                    if (memcmp(expected, actual,
+                               (size_t)(sizes[i][2] * sizes[i][3] * 3)) != 0) {
+                        fprintf(stderr,
+                                "scale: %dx%d -> %dx%d method %#x kernel %d "
+                                "threads %d differs\n",
+                                sizes[i][0], sizes[i][1], sizes[i][2], sizes[i][3],
+                                method, scale_force_kernel, nthreads);
+                        goto error;
+                    }
+                }
+            }
+        }
+
+        sixel_allocator_free(allocator, src);
+        sixel_allocator_free(allocator, expected);
+        sixel_allocator_free(allocator, actual);
+        src = expected = actual = NULL;
+    }
+
+    nret = EXIT_SUCCESS;
+
+error:
+    scale_force_kernel = (-1);
+    scale_force_threads = 0;
+    if (allocator) {
+        sixel_allocator_free(allocator, src);
+        sixel_allocator_free(allocator, expected);
+        sixel_allocator_free(allocator, actual);
+        sixel_allocator_unref(allocator);
+    }
+    return nret;
+}
+
+
+/*
+ * benchmark of all resampling methods with the scalar and the detected
+ * kernels, and without the box filter reduction of large ratios.
+ * runs only if SIXEL_BENCHMARK environment variable is set.
+ * timings are CPU time of a single thread.
+ */
+static int
+test2(void)
+{
+    int nret = EXIT_FAILURE;
+    sixel_allocator_t *allocator = NULL;
+    static int const sizes[][4] = {
+        { 1920, 1080, 640, 360 },
+        { 320, 180, 1280, 720 },
+        { 6000, 4000, 800, 533 },
+        { 6000, 4000, 200, 133 },
+    };
+    static char const *names[] = {
+        "nearest", "gaussian", "hanning", "hamming", "bilinear",
+        "welsh", "bicubic", "lanczos2", "lanczos3", "lanczos4"
+    };
+    enum { rounds = 4 };
+    unsigned char *src = NULL;
+    unsigned char *dst = NULL;
+    size_t i;
+    int method;
+    int mode;
+    int n;
+    clock_t start;
+    double elapsed[3];
+
+    if (getenv("SIXEL_BENCHMARK") == NULL) {
+        return EXIT_SUCCESS;
+    }
+
+    if (SIXEL_FAILED(sixel_allocator_new(&allocator, NULL, NULL, NULL, NULL))) {
+        goto error;
+    }
+    src = (unsigned char *)sixel_allocator_malloc(allocator, 6000 * 4000 * 3);
+    dst = (unsigned char *)sixel_allocator_malloc(allocator, 1280 * 720 * 3);
+    if (src == NULL || dst == NULL) {
+        goto error;
+    }
+
+    scale_force_threads = 1;
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        make_test_image(src, sizes[i][0], sizes[i][1]);
+        for (method = SIXEL_RES_NEAREST; method <= SIXEL_RES_LANCZOS4; method++) {
+            for (mode = 0; mode < 3; mode++) {
+                scale_force_kernel = mode ? scale_detect_kernel(): SCALE_KERNEL_SCALAR;
+                scale_disable_prereduce = mode == 2;
+                start = clock();
+                for (n = 0; n < rounds; n++) {
+                    if (sixel_helper_scale_image(dst, src, sizes[i][0], sizes[i][1],
+                                                 SIXEL_PIXELFORMAT_RGB888,
+                                                 sizes[i][2], sizes[i][3],
+                                                 method, allocator) != 0) {
+                        goto error;
+                    }
+                }
+                elapsed[mode] = (double)(clock() - start) / CLOCKS_PER_SEC / rounds;
+            }
+            fprintf(stderr,
+                    "scale %4dx%-4d -> %4dx%-4d %-8s scalar: %.4fs kernel %d: %.4fs "
+                    "direct: %.4fs\n",
+                    sizes[i][0], sizes[i][1], sizes[i][2], sizes[i][3],
+                    names[method], elapsed[0], scale_detect_kernel(), elapsed[1],
+                    elapsed[2]);
+        }
+    }
+
+    nret = EXIT_SUCCESS;
+
+error:
+    scale_force_kernel = (-1);
+    scale_force_threads = 0;
+    scale_disable_prereduce = 0;
+    if (allocator) {
+        sixel_allocator_free(allocator, src);
+        sixel_allocator_free(allocator, dst);
+        sixel_allocator_unref(allocator);
+    }
+    return nret;
+}
+
+
+/* large reductions keep flat colors and stay close to the direct path */
+static int
+test3(void)
+{
+    int nret = EXIT_FAILURE;
+    sixel_allocator_t *allocator = NULL;
+    static int const sizes[][4] = {
+        { 1200, 900, 50, 40 },
+        { 1001, 703, 37, 23 },
+        { 640, 20, 13, 20 },
+    };
+    unsigned char *src = NULL;
+    unsigned char *expected = NULL;
+    unsigned char *actual = NULL;
+    size_t i;
+    size_t j;
+    size_t npixels;
+    int method;
+    int diff;
+    enum { tolerance = 3 };
+
+    if (SIXEL_FAILED(sixel_allocator_new(&allocator, NULL, NULL, NULL, NULL))) {
+        goto error;
+    }
+
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        npixels = (size_t)(sizes[i][2] * sizes[i][3]);
+        src = (unsigned char *)sixel_allocator_malloc(allocator,
+                                                      (size_t)(sizes[i][0] * sizes[i][1] * 3));
+        expected = (unsigned char *)sixel_allocator_malloc(allocator, npixels * 3);
+        actual = (unsigned char *)sixel_allocator_malloc(allocator, npixels * 3);
+        if (src == NULL || expected == NULL || actual == NULL) {
+            goto error;
+        }
+
+        for (method = SIXEL_RES_GAUSSIAN; method <= SIXEL_RES_LANCZOS4; method++) {
+            /* flat color */
+            for (j = 0; j < (size_t)(sizes[i][0] * sizes[i][1]); j++) {
+                src[j * 3 + 0] = 17;
+                src[j * 3 + 1] = 130;
+                src[j * 3 + 2] = 251;
+            }
+            if (sixel_helper_scale_image(actual, src, sizes[i][0], sizes[i][1],
+                                         SIXEL_PIXELFORMAT_RGB888,
+                                         sizes[i][2], sizes[i][3],
+                                         method, allocator) != 0) {
+                goto error;
+            }
+            for (j = 0; j < npixels; j++) {
+                if (actual[j * 3 + 0] != 17 || actual[j * 3 + 1] != 130
+                    || actual[j * 3 + 2] != 251) {
+                    goto error;
+                }
+            }
+
+            /* gradient, compared with the direct path */
+            make_test_image(src, sizes[i][0], sizes[i][1]);
+            scale_disable_prereduce = 1;
+            if (sixel_helper_scale_image(expected, src, sizes[i][0], sizes[i][1],
+                                         SIXEL_PIXELFORMAT_RGB888,
+                                         sizes[i][2], sizes[i][3],
+                                         method, allocator) != 0) {
+                goto error;
+            }
+            scale_disable_prereduce = 0;
+            if (sixel_helper_scale_image(actual, src, sizes[i][0], sizes[i][1],
+                                         SIXEL_PIXELFORMAT_RGB888,
+                                         sizes[i][2], sizes[i][3],
+                                         method, allocator) != 0) {
+                goto error;
+            }
+            for (j = 0; j < npixels * 3; j++) {
+                /* blue of the test image is a sawtooth, compare only ramps */
+                if (j % 3 == 2) {
+                    continue;
+                }
+                diff = abs(expected[j] - actual[j]);
+                if (diff > tolerance) {
+                    fprintf(stderr,
+                            "scale: %dx%d -> %dx%d method %d differs by %d\n",
+                            sizes[i][0], sizes[i][1], sizes[i][2], sizes[i][3],
+                            method, diff);
+                    goto error;
+                }
+            }
+        }
+
+        sixel_allocator_free(allocator, src);
+        sixel_allocator_free(allocator, expected);
+        sixel_allocator_free(allocator, actual);
+        src = expected = actual = NULL;
+    }
+
+    nret = EXIT_SUCCESS;
+
+error:
+    scale_disable_prereduce = 0;
+    if (allocator) {
+        sixel_allocator_free(allocator, src);
+        sixel_allocator_free(allocator, expected);
+        sixel_allocator_free(allocator, actual);
+        sixel_allocator_unref(allocator);
+    }
+    return nret;
+}
+
+
+/* nearest neighbor scaling picks the same pixels as the naive loop */
+static int
+test4(void)
+{
+    int nret = EXIT_FAILURE;
+    sixel_allocator_t *allocator = NULL;
+    static int const sizes[][4] = {
+        { 1, 1, 7, 5 },
+        { 5, 3, 1, 1 },
+        { 3, 1, 2, 1 },
+        { 2, 2, 9, 4 },
+        { 37, 23, 80, 50 },
+        { 80, 50, 37, 23 },
+    };
+    unsigned char *src = NULL;
+    unsigned char *dst = NULL;
+    size_t i;
+    int x;
+    int y;
+    int w;
+    int h;
+    int c;
+
+    if (SIXEL_FAILED(sixel_allocator_new(&allocator, NULL, NULL, NULL, NULL))) {
+        goto error;
+    }
+
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        src = (unsigned char *)sixel_allocator_malloc(allocator,
+                                                      (size_t)(sizes[i][0] * sizes[i][1] * 3));
+        dst = (unsigned char *)sixel_allocator_malloc(allocator,
+                                                      (size_t)(sizes[i][2] * sizes[i][3] * 3));
+        if (src == NULL || dst == NULL) {
+            goto error;
+        }
+        make_test_image(src, sizes[i][0], sizes[i][1]);
+        if (sixel_helper_scale_image(dst, src, sizes[i][0], sizes[i][1],
+                                     SIXEL_PIXELFORMAT_RGB888,
+                                     sizes[i][2], sizes[i][3],
+                                     SIXEL_RES_NEAREST, allocator) != 0) {
+            goto error;
+        }
+        for (h = 0; h < sizes[i][3]; h++) {
+            for (w = 0; w < sizes[i][2]; w++) {
+                x = w * sizes[i][0] / sizes[i][2];
+                y = h * sizes[i][1] / sizes[i][3];
+                for (c = 0; c < 3; c++) {
+                    if (dst[(h * sizes[i][2] + w) * 3 + c]
+                        != src[(y * sizes[i][0] + x) * 3 + c]) {
+                        goto error;
+                    }
+                }
+            }
+        }
+        sixel_allocator_free(allocator, src);
+        sixel_allocator_free(allocator, dst);
+        src = dst = NULL;
+    }
+
+    nret = EXIT_SUCCESS;
+
+error:
+    if (allocator) {
+        sixel_allocator_free(allocator, src);
+        sixel_allocator_free(allocator, dst);
+        sixel_allocator_unref(allocator);
+    }
+    return nret;
+}
+
+
+/*
+ * in linear light, a fine black and white checkerboard must shrink to
+ * the gray of half the light, and flat colors must be kept exactly.
+ */
+static int
+test5(void)
+{
+    int nret = EXIT_FAILURE;
+    sixel_allocator_t *allocator = NULL;
+    static int const methods[] = {
+        SIXEL_RES_GAUSSIAN, SIXEL_RES_HANNING, SIXEL_RES_HAMMING,
+        SIXEL_RES_BILINEAR, SIXEL_RES_WELSH, SIXEL_RES_BICUBIC,
+        SIXEL_RES_LANCZOS2, SIXEL_RES_LANCZOS3, SIXEL_RES_LANCZOS4,
+    };
+    unsigned char src[64 * 64 * 3];
+    unsigned char flat[64 * 64 * 3];
+    unsigned char dst[8 * 8 * 3];
+    unsigned char gamma_dst[8 * 8 * 3];
+    size_t i;
+    int n;
+
+    if (SIXEL_FAILED(sixel_allocator_new(&allocator, NULL, NULL, NULL, NULL))) {
+        goto error;
+    }
+
+    for (n = 0; n < 64 * 64; n++) {
+        src[n * 3 + 0] = src[n * 3 + 1] = src[n * 3 + 2]
+            = (unsigned char)(((n % 64 + n / 64) % 2) * 255);
+        flat[n * 3 + 0] = 0x01;
+        flat[n * 3 + 1] = 0x80;
+        flat[n * 3 + 2] = 0xfe;
+    }
+
+    for (i = 0; i < sizeof(methods) / sizeof(methods[0]); i++) {
+        if (sixel_helper_scale_image(dst, src, 64, 64, SIXEL_PIXELFORMAT_RGB888,
+                                     8, 8, methods[i] | SIXEL_RES_LINEAR_LIGHT,
+                                     allocator) != 0) {
+            goto error;
+        }
+        if (sixel_helper_scale_image(gamma_dst, src, 64, 64, SIXEL_PIXELFORMAT_RGB888,
+                                     8, 8, methods[i], allocator) != 0) {
+            goto error;
+        }
+        /* sRGB of 50% light is 188, naive blending gives 128 */
+        for (n = 0; n < 8 * 8 * 3; n++) {
+            if (dst[n] < 184 || dst[n] > 192 || gamma_dst[n] > 132) {
+                fprintf(stderr, "scale: method %d gives %d in linear light, %d in sRGB\n",
+                        methods[i], dst[n], gamma_dst[n]);
+                goto error;
+            }
+        }
+
+        if (sixel_helper_scale_image(dst, flat, 64, 64, SIXEL_PIXELFORMAT_RGB888,
+                                     8, 8, methods[i] | SIXEL_RES_LINEAR_LIGHT,
+                                     allocator) != 0) {
+            goto error;
+        }
+        for (n = 0; n < 8 * 8 * 3; n++) {
+            if (dst[n] != flat[n]) {
+                goto error;
+            }
+        }
+    }
+
+    nret = EXIT_SUCCESS;
+
+error:
+    sixel_allocator_unref(allocator);
+    return nret;
+}
+
+
+/*
+ * box sums of a large reduction must not wrap, in linear light the
+ * samples are 16 times larger than sRGB ones.
+ */
+static int
+test6(void)
+{
+    int nret = EXIT_FAILURE;
+    sixel_allocator_t *allocator = NULL;
+    static int const methods[] = {
+        SIXEL_RES_BILINEAR, SIXEL_RES_LANCZOS3,
+        SIXEL_RES_BILINEAR | SIXEL_RES_LINEAR_LIGHT,
+        SIXEL_RES_LANCZOS3 | SIXEL_RES_LINEAR_LIGHT,
+    };
+    static unsigned char const palette[] = { 0x01, 0x80, 0xfe };
+    int const size = 2400;
+    unsigned char *src = NULL;
+    unsigned char dst[3];
+    size_t i;
+
+    if (SIXEL_FAILED(sixel_allocator_new(&allocator, NULL, NULL, NULL, NULL))) {
+        goto error;
+    }
+    src = (unsigned char *)sixel_allocator_calloc(allocator,
+                                                  (size_t)size * (size_t)size, 1);
+    if (src == NULL) {
+        goto error;
+    }
+
+    for (i = 0; i < sizeof(methods) / sizeof(methods[0]); i++) {
+        if (sixel_scale_image(dst, src, size, size, SIXEL_PIXELFORMAT_PAL8,
+                              palette, 1, 1, methods[i], allocator) != 0) {
+            goto error;
+        }
+        if (memcmp(dst, palette, 3) != 0) {
+            fprintf(stderr, "scale: method %d gives %d,%d,%d\n",
+                    methods[i], dst[0], dst[1], dst[2]);
+            goto error;
+        }
+    }
+
+    nret = EXIT_SUCCESS;
+
+error:
+    if (allocator) {
+        sixel_allocator_free(allocator, src);
+        sixel_allocator_unref(allocator);
+    }
+    return nret;
+}
+
+
+SIXELAPI int
+sixel_scale_tests_main(void)
+{
+    int nret = EXIT_FAILURE;
+    size_t i;
+    typedef int (* testcase)(void);
+
+    static testcase const testcases[] = {
+        test1,
+        test2,
+        test3,
+        test4,
+        test5,
+        test6,
+    };
+
+    for (i = 0; i < sizeof(testcases) / sizeof(testcase); ++i) {
+        nret = testcases[i]();
+        if (nret != EXIT_SUCCESS) {
+            goto error;
+        }
+    }
+
+    nret = EXIT_SUCCESS;
+
+error:
+    return nret;
+}
+#endif  /* HAVE_TESTS */
+
 
 /* emacs Local Variables:      */
 /* emacs mode: c               */
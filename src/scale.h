@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2014-2016 Hayaki Saito
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef LIBSIXEL_SCALE_H
+#define LIBSIXEL_SCALE_H
+
+#include <sixel.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* scale an image of any pixelformat into RGB888 */
+int
+sixel_scale_image(
+    unsigned char       /* out */ *dst,
+    unsigned char const /* in */  *src,                   /* source image data */
+    int                 /* in */  srcw,                   /* source image width */
+    int                 /* in */  srch,                   /* source image height */
+    int                 /* in */  pixelformat,            /* one of enum pixelFormat */
+    unsigned char const /* in */  *palette,               /* palette of PAL formats or NULL */
+    int                 /* in */  dstw,                   /* destination image width */
+    int                 /* in */  dsth,                   /* destination image height */
+    int                 /* in */  method_for_resampling,  /* one of methodForResampling */
+    sixel_allocator_t   /* in */  *allocator);            /* allocator object */
+
+#if HAVE_TESTS
+int
+sixel_scale_tests_main(void);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LIBSIXEL_SCALE_H */
+
+/* emacs Local Variables:      */
+/* emacs mode: c               */
+/* emacs tab-width: 4          */
+/* emacs indent-tabs-mode: nil */
+/* emacs c-basic-offset: 4     */
+/* emacs End:                  */
+/* vim: set expandtab ts=4 sts=4 sw=4 : */
+/* EOF */
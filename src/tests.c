@@ -42,6 +42,7 @@
 #include "dither.h"
 #include "quant.h"
 #include "frame.h"
+#include "scale.h"
 #include "pixelformat.h"
 #include "writer.h"
 #include "encoder.h"
@@ -49,6 +50,7 @@
 #include "status.h"
 #include "loader.h"
 #include "fromgif.h"
+#include "fromsixel.h"
 #include "chunk.h"
 #include "allocator.h"
 
@@ -102,6 +104,14 @@ main(int argc, char *argv[])
     puts("frame ok.");
     fflush(stdout);
 
+    nret = sixel_scale_tests_main();
+    if (nret != EXIT_SUCCESS) {
+        goto error;
+    }
+
+    puts("scale ok.");
+    fflush(stdout);
+
     nret = sixel_writer_tests_main();
     if (nret != EXIT_SUCCESS) {
         goto error;
@@ -134,6 +144,14 @@ main(int argc, char *argv[])
     puts("decoder ok.");
     fflush(stdout);
 
+    nret = sixel_fromsixel_tests_main();
+    if (nret != EXIT_SUCCESS) {
+        goto error;
+    }
+
+    puts("fromsixel ok.");
+    fflush(stdout);
+
     nret = sixel_status_tests_main();
     if (nret != EXIT_SUCCESS) {
         goto error;
@@ -36,6 +36,8 @@
 #include <sixel.h>
 #include "output.h"
 #include "dither.h"
+#include "ordereddither.h"
+#include "pixelformat.h"
 
 #define DCS_START_7BIT       "\033P"
 #define DCS_START_7BIT_SIZE  (sizeof(DCS_START_7BIT) - 1)
@@ -482,75 +484,94 @@ output_hls_palette_definition(
 }
 
 
+/* output definitions of the colors from 'first' up to 'last' - 1 */
 static SIXELSTATUS
-sixel_encode_body(
-    sixel_index_t       /* in */ *pixels,
-    int                 /* in */ width,
-    int                 /* in */ height,
+sixel_encode_palette_entries(
+    unsigned char       /* in */ *palette,
+    int                 /* in */ first,
+    int                 /* in */ last,
+    int                 /* in */ keycolor,
+    sixel_output_t      /* in */ *output)
+{
+    SIXELSTATUS status = SIXEL_OK;
+    int n;
+
+    if (output->palette_type == SIXEL_PALETTETYPE_HLS) {
+        for (n = first; n < last; n++) {
+            status = output_hls_palette_definition(output, palette, n, keycolor);
+            if (SIXEL_FAILED(status)) {
+                goto end;
+            }
+        }
+    } else {
+        for (n = first; n < last; n++) {
+            status = output_rgb_palette_definition(output, palette, n, keycolor);
+            if (SIXEL_FAILED(status)) {
+                goto end;
+            }
+        }
+    }
+
+end:
+    return status;
+}
+
+
+/* output palette definitions which precede the first band */
+static SIXELSTATUS
+sixel_encode_palette(
     unsigned char       /* in */ *palette,
     int                 /* in */ ncolors,
     int                 /* in */ keycolor,
     int                 /* in */ bodyonly,
+    sixel_output_t      /* in */ *output)
+{
+    SIXELSTATUS status = SIXEL_OK;
+
+    output->active_palette = (-1);
+
+    if (!bodyonly && (ncolors != 2 || keycolor == (-1))) {
+        status = sixel_encode_palette_entries(palette, 0, ncolors,
+                                              keycolor, output);
+    }
+
+    return status;
+}
+
+
+/* encode a band of up to six rows of color indexes */
+static SIXELSTATUS
+sixel_encode_band(
+    sixel_index_t       /* in */ *pixels,   /* first index of the band */
+    int                 /* in */ width,
+    int                 /* in */ y,         /* image row of the first row */
+    int                 /* in */ nrows,     /* rows in the band */
+    int                 /* in */ pitch,     /* indexes per row */
+    int                 /* in */ ncolors,
+    int                 /* in */ keycolor,
+    char                /* in */ *map,      /* ncolors * width bytes of zero */
     sixel_output_t      /* in */ *output,
     unsigned char       /* in */ *palstate,
     sixel_allocator_t   /* in */ *allocator)
 {
     SIXELSTATUS status = SIXEL_FALSE;
     int x;
-    int y;
     int i;
     int n;
     int c;
     int sx;
     int mx;
-    int len;
     int pix;
-    char *map = NULL;
     int check_integer_overflow;
     sixel_node_t *np, *tp, top;
-    int fillable;
-
-    if (ncolors < 1) {
-        status = SIXEL_BAD_ARGUMENT;
-        goto end;
-    }
-    len = ncolors * width;
-    output->active_palette = (-1);
-
-    map = (char *)sixel_allocator_calloc(allocator,
-                                         (size_t)len,
-                                         sizeof(char));
-    if (map == NULL) {
-        sixel_helper_set_additional_message(
-            "sixel_encode_body: sixel_allocator_calloc() failed.");
-        status = SIXEL_BAD_ALLOCATION;
-        goto end;
-    }
-
-    if (!bodyonly && (ncolors != 2 || keycolor == (-1))) {
-        if (output->palette_type == SIXEL_PALETTETYPE_HLS) {
-            for (n = 0; n < ncolors; n++) {
-                status = output_hls_palette_definition(output, palette, n, keycolor);
-                if (SIXEL_FAILED(status)) {
-                    goto end;
-                }
-            }
-        } else {
-            for (n = 0; n < ncolors; n++) {
-                status = output_rgb_palette_definition(output, palette, n, keycolor);
-                if (SIXEL_FAILED(status)) {
-                    goto end;
-                }
-            }
-        }
-    }
+    int fillable = 0;
 
-    for (y = i = 0; y < height; y++) {
+    for (i = 0; i < nrows; i++) {
         if (output->encode_policy != SIXEL_ENCODEPOLICY_SIZE) {
             fillable = 0;
         } else if (palstate) {
             /* high color sixel */
-            pix = pixels[(y - i) * width];
+            pix = pixels[0];
             if (pix >= ncolors) {
                 fillable = 0;
             } else {
@@ -561,24 +582,7 @@ sixel_encode_body(
             fillable = 1;
         }
         for (x = 0; x < width; x++) {
-            if (y > INT_MAX / width) {
-                /* integer overflow */
-                sixel_helper_set_additional_message(
-                    "sixel_encode_body: integer overflow detected."
-                    " (y > INT_MAX)");
-                status = SIXEL_BAD_INTEGER_OVERFLOW;
-                goto end;
-            }
-            check_integer_overflow = y * width;
-            if (check_integer_overflow > INT_MAX - x) {
-                /* integer overflow */
-                sixel_helper_set_additional_message(
-                    "sixel_encode_body: integer overflow detected."
-                    " (y * width > INT_MAX - x)");
-                status = SIXEL_BAD_INTEGER_OVERFLOW;
-                goto end;
-            }
-            pix = pixels[check_integer_overflow + x];  /* color index */
+            pix = pixels[i * pitch + x];  /* color index */
             if (pix >= 0 && pix < ncolors && pix != keycolor) {
                 if (pix > INT_MAX / width) {
                     /* integer overflow */
@@ -603,86 +607,100 @@ sixel_encode_body(
                 fillable = 0;
             }
         }
+    }
 
-        if (++i < 6 && (y + 1) < height) {
-            continue;
-        }
+    for (c = 0; c < ncolors; c++) {
+        for (sx = 0; sx < width; sx++) {
+            if (*(map + c * width + sx) == 0) {
+                continue;
+            }
 
-        for (c = 0; c < ncolors; c++) {
-            for (sx = 0; sx < width; sx++) {
-                if (*(map + c * width + sx) == 0) {
+            for (mx = sx + 1; mx < width; mx++) {
+                if (*(map + c * width + mx) != 0) {
                     continue;
                 }
 
-                for (mx = sx + 1; mx < width; mx++) {
-                    if (*(map + c * width + mx) != 0) {
-                        continue;
-                    }
-
-                    for (n = 1; (mx + n) < width; n++) {
-                        if (*(map + c * width + mx + n) != 0) {
-                            break;
-                        }
-                    }
-
-                    if (n >= 10 || (mx + n) >= width) {
+                for (n = 1; (mx + n) < width; n++) {
+                    if (*(map + c * width + mx + n) != 0) {
                         break;
                     }
-                    mx = mx + n - 1;
                 }
 
-                if ((np = output->node_free) != NULL) {
-                    output->node_free = np->next;
-                } else {
-                    status = sixel_node_new(&np, allocator);
-                    if (SIXEL_FAILED(status)) {
-                        goto end;
-                    }
+                if (n >= 10 || (mx + n) >= width) {
+                    break;
                 }
+                mx = mx + n - 1;
+            }
 
-                np->pal = c;
-                np->sx = sx;
-                np->mx = mx;
-                np->map = map + c * width;
-
-                top.next = output->node_top;
-                tp = &top;
-
-                while (tp->next != NULL) {
-                    if (np->sx < tp->next->sx) {
-                        break;
-                    } else if (np->sx == tp->next->sx && np->mx > tp->next->mx) {
-                        break;
-                    }
-                    tp = tp->next;
+            if ((np = output->node_free) != NULL) {
+                output->node_free = np->next;
+            } else {
+                status = sixel_node_new(&np, allocator);
+                if (SIXEL_FAILED(status)) {
+                    goto end;
                 }
+            }
+
+            np->pal = c;
+            np->sx = sx;
+            np->mx = mx;
+            np->map = map + c * width;
 
-                np->next = tp->next;
-                tp->next = np;
-                output->node_top = top.next;
+            top.next = output->node_top;
+            tp = &top;
 
-                sx = mx - 1;
+            while (tp->next != NULL) {
+                if (np->sx < tp->next->sx) {
+                    break;
+                } else if (np->sx == tp->next->sx && np->mx > tp->next->mx) {
+                    break;
+                }
+                tp = tp->next;
             }
 
+            np->next = tp->next;
+            tp->next = np;
+            output->node_top = top.next;
+
+            sx = mx - 1;
         }
 
-        if (y != 5) {
-            /* DECGNL Graphics Next Line */
-            output->buffer[output->pos] = '-';
+    }
+
+    if (y + nrows - 1 != 5) {
+        /* DECGNL Graphics Next Line */
+        output->buffer[output->pos] = '-';
+        sixel_advance(output, 1);
+    }
+
+    for (x = 0; (np = output->node_top) != NULL;) {
+        sixel_node_t *next;
+        if (x > np->sx) {
+            /* DECGCR Graphics Carriage Return */
+            output->buffer[output->pos] = '$';
             sixel_advance(output, 1);
+            x = 0;
         }
 
-        for (x = 0; (np = output->node_top) != NULL;) {
-            sixel_node_t *next;
-            if (x > np->sx) {
-                /* DECGCR Graphics Carriage Return */
-                output->buffer[output->pos] = '$';
-                sixel_advance(output, 1);
-                x = 0;
+        if (fillable) {
+            memset(np->map + np->sx, (1 << nrows) - 1, (size_t)(np->mx - np->sx));
+        }
+        status = sixel_put_node(output, &x, np, ncolors, keycolor);
+        if (SIXEL_FAILED(status)) {
+            goto end;
+        }
+        next = np->next;
+        sixel_node_del(output, np);
+        np = next;
+
+        while (np != NULL) {
+            if (np->sx < x) {
+                np = np->next;
+                continue;
             }
 
             if (fillable) {
-                memset(np->map + np->sx, (1 << i) - 1, (size_t)(np->mx - np->sx));
+                memset(np->map + np->sx, (1 << nrows) - 1, (size_t)(np->mx - np->sx));
             }
             status = sixel_put_node(output, &x, np, ncolors, keycolor);
             if (SIXEL_FAILED(status)) {
@@ -691,47 +709,102 @@ sixel_encode_body(
             next = np->next;
             sixel_node_del(output, np);
             np = next;
-
-            while (np != NULL) {
-                if (np->sx < x) {
-                    np = np->next;
-                    continue;
-                }
-
-                if (fillable) {
-                    memset(np->map + np->sx, (1 << i) - 1, (size_t)(np->mx - np->sx));
-                }
-                status = sixel_put_node(output, &x, np, ncolors, keycolor);
-                if (SIXEL_FAILED(status)) {
-                    goto end;
-                }
-                next = np->next;
-                sixel_node_del(output, np);
-                np = next;
-            }
-
-            fillable = 0;
         }
 
-        i = 0;
-        memset(map, 0, (size_t)len);
+        fillable = 0;
     }
 
-    if (palstate) {
-        output->buffer[output->pos] = '$';
-        sixel_advance(output, 1);
-    }
+    memset(map, 0, (size_t)ncolors * (size_t)width);
 
     status = SIXEL_OK;
 
 end:
-    /* free nodes */
+    return status;
+}
+
+
+/* release the nodes kept by sixel_encode_band() */
+static void
+sixel_encode_release_nodes(
+    sixel_output_t      /* in */ *output,
+    sixel_allocator_t   /* in */ *allocator)
+{
+    sixel_node_t *np;
+
     while ((np = output->node_free) != NULL) {
         output->node_free = np->next;
         sixel_allocator_free(allocator, np);
     }
     output->node_top = NULL;
+}
+
+
+static SIXELSTATUS
+sixel_encode_body(
+    sixel_index_t       /* in */ *pixels,
+    int                 /* in */ width,
+    int                 /* in */ height,
+    int                 /* in */ pitch,     /* indexes per row */
+    unsigned char       /* in */ *palette,
+    int                 /* in */ ncolors,
+    int                 /* in */ keycolor,
+    int                 /* in */ bodyonly,
+    sixel_output_t      /* in */ *output,
+    unsigned char       /* in */ *palstate,
+    sixel_allocator_t   /* in */ *allocator)
+{
+    SIXELSTATUS status = SIXEL_FALSE;
+    int y;
+    int nrows;
+    char *map = NULL;
+
+    if (ncolors < 1) {
+        status = SIXEL_BAD_ARGUMENT;
+        goto end;
+    }
+
+    map = (char *)sixel_allocator_calloc(allocator,
+                                         (size_t)ncolors * (size_t)width,
+                                         sizeof(char));
+    if (map == NULL) {
+        sixel_helper_set_additional_message(
+            "sixel_encode_body: sixel_allocator_calloc() failed.");
+        status = SIXEL_BAD_ALLOCATION;
+        goto end;
+    }
+
+    status = sixel_encode_palette(palette, ncolors, keycolor, bodyonly, output);
+    if (SIXEL_FAILED(status)) {
+        goto end;
+    }
+
+    for (y = 0; y < height; y += 6) {
+        nrows = height - y < 6 ? height - y: 6;
+        if (y + nrows - 1 > (INT_MAX - width) / pitch) {
+            /* integer overflow */
+            sixel_helper_set_additional_message(
+                "sixel_encode_body: integer overflow detected."
+                " (y * pitch > INT_MAX - x)");
+            status = SIXEL_BAD_INTEGER_OVERFLOW;
+            goto end;
+        }
+        status = sixel_encode_band(pixels + y * pitch, width, y, nrows, pitch,
+                                   ncolors, keycolor, map,
+                                   output, palstate, allocator);
+        if (SIXEL_FAILED(status)) {
+            goto end;
+        }
+    }
+
+    if (palstate) {
+        output->buffer[output->pos] = '$';
+        sixel_advance(output, 1);
+    }
+
+    status = SIXEL_OK;
 
+end:
+    sixel_encode_release_nodes(output, allocator);
     sixel_allocator_free(allocator, map);
 
     return status;
@@ -782,12 +855,14 @@ sixel_encode_dither(
     unsigned char   /* in */ *pixels,   /* pixel bytes to be encoded */
     int             /* in */ width,     /* width of source image */
     int             /* in */ height,    /* height of source image */
+    int             /* in */ pitch,     /* bytes per row of source image */
     sixel_dither_t  /* in */ *dither,   /* dither context */
     sixel_output_t  /* in */ *output)   /* output context */
 {
     SIXELSTATUS status = SIXEL_FALSE;
     sixel_index_t *paletted_pixels = NULL;
     sixel_index_t *input_pixels;
+    int input_pitch;
     size_t bufsize;
 
     switch (dither->pixelformat) {
@@ -805,31 +880,35 @@ sixel_encode_dither(
             status = SIXEL_BAD_ALLOCATION;
             goto end;
         }
-        status = sixel_helper_normalize_pixelformat(paletted_pixels,
-                                                    &dither->pixelformat,
-                                                    pixels,
-                                                    dither->pixelformat,
-                                                    width, height);
+        status = sixel_pixelformat_normalize_rows(paletted_pixels,
+                                                  &dither->pixelformat,
+                                                  pixels,
+                                                  dither->pixelformat,
+                                                  width, height, pitch);
         if (SIXEL_FAILED(status)) {
             goto end;
         }
         input_pixels = paletted_pixels;
+        input_pitch = width;
         break;
     case SIXEL_PIXELFORMAT_PAL8:
     case SIXEL_PIXELFORMAT_G8:
     case SIXEL_PIXELFORMAT_GA88:
     case SIXEL_PIXELFORMAT_AG88:
         input_pixels = pixels;
+        input_pitch = pitch;
         break;
     default:
         /* apply palette */
-        paletted_pixels = sixel_dither_apply_palette(dither, pixels,
-                                                     width, height);
+        paletted_pixels = sixel_dither_apply_palette_with_pitch(dither, pixels,
+                                                                width, height,
+                                                                pitch);
         if (paletted_pixels == NULL) {
             status = SIXEL_RUNTIME_ERROR;
             goto end;
         }
         input_pixels = paletted_pixels;
+        input_pitch = width;
         break;
     }
 
@@ -841,6 +920,7 @@ sixel_encode_dither(
     status = sixel_encode_body(input_pixels,
                                width,
                                height,
+                               input_pitch,
                                dither->palette,
                                dither->ncolors,
                                dither->keycolor,
@@ -1249,6 +1329,43 @@ dither_func_x_dither(unsigned char *data, int width, int x, int y)
 }
 
 
+/* ordered dither with 8x8 Bayer matrix, spreads [0, 7] before 5bit truncation */
+static void
+dither_func_bayer(unsigned char *data, int width, int x, int y)
+{
+    int c;
+    int value;
+    int offset;
+
+    (void) width;  /* unused */
+
+    offset = bayer_matrix_8x8[((y & 7) << 3) + (x & 7)] >> 3;
+    for (c = 0; c < 3; c ++) {
+        value = data[c] + offset;
+        data[c] = value > 255 ? 255 : value;
+    }
+}
+
+
+/* ordered dither with 64x64 blue noise, spreads [0, 7] before 5bit truncation */
+static void
+dither_func_bluenoise(unsigned char *data, int width, int x, int y)
+{
+    int c;
+    int value;
+    int offset;
+
+    (void) width;  /* unused */
+
+    for (c = 0; c < 3; c ++) {
+        offset = bluenoise_matrix_64x64[(((y + c * 23) & 63) << 6)
+                                        + ((x + c * 41) & 63)] >> 5;
+        value = data[c] + offset;
+        data[c] = value > 255 ? 255 : value;
+    }
+}
+
+
 static void
 sixel_apply_15bpp_dither(
     unsigned char *pixels,
@@ -1288,6 +1405,12 @@ sixel_apply_15bpp_dither(
     case SIXEL_DIFFUSE_X_DITHER:
         dither_func_x_dither(pixels, width, x, y);
         break;
+    case SIXEL_DIFFUSE_BAYER:
+        dither_func_bayer(pixels, width, x, y);
+        break;
+    case SIXEL_DIFFUSE_BLUENOISE:
+        dither_func_bluenoise(pixels, width, x, y);
+        break;
     case SIXEL_DIFFUSE_NONE:
     default:
         dither_func_none(pixels, width);
@@ -1298,7 +1421,7 @@ sixel_apply_15bpp_dither(
 
 static SIXELSTATUS
 sixel_encode_highcolor(
-        unsigned char *pixels, int width, int height,
+        unsigned char *pixels, int width, int height, int pitch,
         sixel_dither_t *dither, sixel_output_t *output
         )
 {
@@ -1374,23 +1497,22 @@ sixel_encode_highcolor(
                + maxcolors_size  /* for rgb2pal */
                + marks_size;     /* for marks */
 
-    if (dither->pixelformat != SIXEL_PIXELFORMAT_RGB888) {
-        /* normalize pixelfromat */
-        normalized_pixels = (unsigned char *)sixel_allocator_malloc(
-            dither->allocator, normalized_size);
-        if (normalized_pixels == NULL) {
-            goto error;
-        }
-        status = sixel_helper_normalize_pixelformat(normalized_pixels,
-                                                    &dither->pixelformat,
-                                                    pixels,
-                                                    dither->pixelformat,
-                                                    width, height);
-        if (SIXEL_FAILED(status)) {
-            goto error;
-        }
-        pixels = normalized_pixels;
+    /* the dither kernels below write errors into packed RGB888 rows, so
+       they work on a normalized copy and the caller's pixels are kept */
+    normalized_pixels = (unsigned char *)sixel_allocator_malloc(
+        dither->allocator, normalized_size);
+    if (normalized_pixels == NULL) {
+        goto error;
     }
+    status = sixel_pixelformat_normalize_rows(normalized_pixels,
+                                              &dither->pixelformat,
+                                              pixels,
+                                              dither->pixelformat,
+                                              width, height, pitch);
+    if (SIXEL_FAILED(status)) {
+        goto error;
+    }
+    pixels = normalized_pixels;
     paletted_pixels = (sixel_index_t *)sixel_allocator_malloc(dither->allocator,
                                                               whole_size);
     if (paletted_pixels == NULL) {
@@ -1398,6 +1520,7 @@ sixel_encode_highcolor(
     }
     rgbhit = paletted_pixels + image_size;
     memset(rgbhit, 0, maxcolors_size * 2UL + marks_size);
+    memset(palhitcount, 0, sizeof(palhitcount));
     rgb2pal = rgbhit + maxcolors;
     marks = rgb2pal + maxcolors;
     output_count = 0;
@@ -1493,6 +1616,7 @@ next:
             status = sixel_encode_body(paletted_pixels,
                                        width,
                                        height,
+                                       width,
                                        dither->palette,
                                        255,
                                        255,
@@ -1529,6 +1653,7 @@ end:
     status = sixel_encode_body(paletted_pixels,
                                width,
                                height,
+                               width,
                                dither->palette,
                                255,
                                255,
@@ -1553,19 +1678,18 @@ error:
 }
 
 
-SIXELAPI SIXELSTATUS
-sixel_encode(
+/* encode rows of pixels which are 'pitch' bytes apart */
+static SIXELSTATUS
+sixel_encode_rows(
     unsigned char  /* in */ *pixels,   /* pixel bytes */
     int            /* in */ width,     /* image width */
     int            /* in */ height,    /* image height */
-    int const      /* in */ depth,     /* color depth */
+    int            /* in */ pitch,     /* bytes per row */
     sixel_dither_t /* in */ *dither,   /* dither context */
     sixel_output_t /* in */ *output)   /* output context */
 {
     SIXELSTATUS status = SIXEL_FALSE;
 
-    (void) depth;
-
     /* TODO: reference counting should be thread-safe */
     sixel_dither_ref(dither);
     sixel_output_ref(output);
@@ -1602,11 +1726,16 @@ sixel_encode(
         goto end;
     }
 
+    /* zero pitch means tightly packed rows */
+    if (pitch == 0) {
+        pitch = sixel_pixelformat_get_row_bytes(dither->pixelformat, width);
+    }
+
     if (dither->quality_mode == SIXEL_QUALITY_HIGHCOLOR) {
-        status = sixel_encode_highcolor(pixels, width, height,
+        status = sixel_encode_highcolor(pixels, width, height, pitch,
                                         dither, output);
     } else {
-        status = sixel_encode_dither(pixels, width, height,
+        status = sixel_encode_dither(pixels, width, height, pitch,
                                      dither, output);
     }
 
@@ -1617,6 +1746,411 @@ end:
     return status;
 }
 
+
+SIXELAPI SIXELSTATUS
+sixel_encode(
+    unsigned char  /* in */ *pixels,   /* pixel bytes */
+    int            /* in */ width,     /* image width */
+    int            /* in */ height,    /* image height */
+    int const      /* in */ depth,     /* color depth */
+    sixel_dither_t /* in */ *dither,   /* dither context */
+    sixel_output_t /* in */ *output)   /* output context */
+{
+    (void) depth;
+
+    return sixel_encode_rows(pixels, width, height, 0, dither, output);
+}
+
+
+/* convert a rectangle of a larger pixel buffer into sixel format */
+SIXELAPI SIXELSTATUS
+sixel_encode_rect(
+    unsigned char  /* in */ *pixels,   /* first pixel of the whole buffer */
+    int            /* in */ stride,    /* bytes per row of the whole buffer */
+    int            /* in */ x,         /* left edge of the rectangle */
+    int            /* in */ y,         /* top edge of the rectangle */
+    int            /* in */ width,     /* width of the rectangle */
+    int            /* in */ height,    /* height of the rectangle */
+    sixel_dither_t /* in */ *dither,   /* dither context */
+    sixel_output_t /* in */ *output)   /* output context */
+{
+    SIXELSTATUS status = SIXEL_FALSE;
+    int bits;
+    int row_bytes;
+    size_t offset_bits;
+
+    if (pixels == NULL || dither == NULL || output == NULL) {
+        sixel_helper_set_additional_message(
+            "sixel_encode_rect: a null pointer is given.");
+        status = SIXEL_BAD_ARGUMENT;
+        goto end;
+    }
+
+    if (x < 0 || y < 0 || width < 1 || height < 1 ||
+        width > SIXEL_WIDTH_LIMIT || height > SIXEL_HEIGHT_LIMIT) {
+        sixel_helper_set_additional_message(
+            "sixel_encode_rect: bad rectangle.");
+        status = SIXEL_BAD_INPUT;
+        goto end;
+    }
+
+    /* bits per pixel, 1, 2 and 4bpp formats have 8 pixels in 'bits' bytes */
+    bits = sixel_pixelformat_get_row_bytes(dither->pixelformat, 8);
+    if (bits <= 0) {
+        sixel_helper_set_additional_message(
+            "sixel_encode_rect: unsupported pixelformat.");
+        status = SIXEL_BAD_ARGUMENT;
+        goto end;
+    }
+
+    offset_bits = (size_t)x * (size_t)bits;
+    if (offset_bits % 8 != 0) {
+        sixel_helper_set_additional_message(
+            "sixel_encode_rect: the left edge must be on a byte boundary.");
+        status = SIXEL_BAD_INPUT;
+        goto end;
+    }
+
+    row_bytes = sixel_pixelformat_get_row_bytes(dither->pixelformat, width);
+    if (stride < row_bytes || offset_bits / 8 > (size_t)(stride - row_bytes)) {
+        sixel_helper_set_additional_message(
+            "sixel_encode_rect: the rectangle exceeds the stride.");
+        status = SIXEL_BAD_INPUT;
+        goto end;
+    }
+
+    status = sixel_encode_rows(pixels + (size_t)y * (size_t)stride + offset_bits / 8,
+                               width, height, stride, dither, output);
+
+end:
+    return status;
+}
+
+
+/* pull all rows into one buffer, for the paths which need the whole image */
+static SIXELSTATUS
+sixel_encode_collect_scanlines(
+    unsigned char           /* out */ *pixels,
+    sixel_scanline_function /* in */  fn_scanline,
+    void                    /* in */  *priv,
+    int                     /* in */  row_bytes,
+    int                     /* in */  height)
+{
+    SIXELSTATUS status = SIXEL_FALSE;
+    unsigned char *row;
+    int y;
+
+    for (y = 0; y < height; ++y) {
+        status = fn_scanline(&row, y, priv);
+        if (SIXEL_FAILED(status)) {
+            goto end;
+        }
+        memcpy(pixels + (size_t)y * (size_t)row_bytes, row, (size_t)row_bytes);
+    }
+
+    status = SIXEL_OK;
+
+end:
+    return status;
+}
+
+
+/* convert pixels into sixel format pulling them row by row */
+SIXELAPI SIXELSTATUS
+sixel_encode_scanlines(
+    sixel_scanline_function /* in */ fn_scanline, /* callback for input rows */
+    void                    /* in */ *priv,       /* private data of fn_scanline */
+    int                     /* in */ width,       /* image width */
+    int                     /* in */ height,      /* image height */
+    sixel_dither_t          /* in */ *dither,     /* dither context */
+    sixel_output_t          /* in */ *output)     /* output context */
+{
+    /*
+     * a band is quantized when the rows which receive its errors are in
+     * the window, then these rows are moved to the top of the window.
+     */
+    enum {
+        band_rows = SIXEL_DITHER_BAND_ROWS,
+        lookahead_rows = SIXEL_DITHER_LOOKAHEAD_ROWS
+    };
+    SIXELSTATUS status = SIXEL_FALSE;
+    sixel_allocator_t *allocator;
+    unsigned char *buffer = NULL;
+    unsigned char *window = NULL;
+    sixel_index_t *indexes = NULL;
+    char *map = NULL;
+    unsigned char *row;
+    unsigned char used_palette[SIXEL_PALETTE_MAX * 3];
+    unsigned short migration_map[SIXEL_PALETTE_MAX];
+    int pixelformat;
+    int normalized_pixelformat;
+    int window_pixelformat;
+    int window_pitch = 0;
+    int row_bytes;
+    int stride;
+    int offsets[3];
+    int paletted;
+    int unpack;
+    int optimize;
+    int nused;
+    int fetched;
+    int limit;
+    int nrows;
+    int first;
+    int n;
+    int y;
+    int i;
+
+    if (fn_scanline == NULL || dither == NULL || output == NULL) {
+        sixel_helper_set_additional_message(
+            "sixel_encode_scanlines: a null pointer is given.");
+        return SIXEL_BAD_ARGUMENT;
+    }
+
+    /* TODO: reference counting should be thread-safe */
+    sixel_dither_ref(dither);
+    sixel_output_ref(output);
+
+    allocator = dither->allocator;
+    pixelformat = dither->pixelformat;
+
+    if (width < 1 || width > SIXEL_WIDTH_LIMIT) {
+        sixel_helper_set_additional_message(
+            "sixel_encode_scanlines: bad width parameter.");
+        status = SIXEL_BAD_INPUT;
+        goto end;
+    }
+
+    if (height < 1 || height > SIXEL_HEIGHT_LIMIT) {
+        sixel_helper_set_additional_message(
+            "sixel_encode_scanlines: bad height parameter.");
+        status = SIXEL_BAD_INPUT;
+        goto end;
+    }
+
+    row_bytes = sixel_pixelformat_get_row_bytes(pixelformat, width);
+    if (row_bytes <= 0) {
+        sixel_helper_set_additional_message(
+            "sixel_encode_scanlines: unsupported pixelformat.");
+        status = SIXEL_BAD_ARGUMENT;
+        goto end;
+    }
+
+    /* an optimized palette numbers colors in order of first use */
+    optimize = dither->optimize_palette
+            && !(pixelformat & (SIXEL_FORMATTYPE_PALETTE | SIXEL_FORMATTYPE_GRAYSCALE));
+
+    /* high color mode decides the palette of each band from the whole
+       image, and the register of the key color is known only after the
+       whole image is numbered */
+    if (dither->quality_mode == SIXEL_QUALITY_HIGHCOLOR ||
+        (optimize && dither->keycolor != (-1))) {
+        buffer = (unsigned char *)sixel_allocator_malloc(
+            allocator, (size_t)row_bytes * (size_t)height);
+        if (buffer == NULL) {
+            sixel_helper_set_additional_message(
+                "sixel_encode_scanlines: sixel_allocator_malloc() failed.");
+            status = SIXEL_BAD_ALLOCATION;
+            goto end;
+        }
+        status = sixel_encode_collect_scanlines(buffer, fn_scanline, priv,
+                                                row_bytes, height);
+        if (SIXEL_FAILED(status)) {
+            goto end;
+        }
+        if (dither->quality_mode == SIXEL_QUALITY_HIGHCOLOR) {
+            status = sixel_encode_highcolor(buffer, width, height, row_bytes,
+                                            dither, output);
+        } else {
+            status = sixel_encode_dither(buffer, width, height, row_bytes,
+                                         dither, output);
+        }
+        goto end;
+    }
+
+    if (dither->ncolors < 1) {
+        status = SIXEL_BAD_ARGUMENT;
+        goto end;
+    }
+
+    switch (pixelformat) {
+    case SIXEL_PIXELFORMAT_PAL1:
+    case SIXEL_PIXELFORMAT_PAL2:
+    case SIXEL_PIXELFORMAT_PAL4:
+    case SIXEL_PIXELFORMAT_G1:
+    case SIXEL_PIXELFORMAT_G2:
+    case SIXEL_PIXELFORMAT_G4:
+        /* rows are packed color indexes */
+        paletted = 1;
+        unpack = 1;
+        window_pixelformat = pixelformat;
+        break;
+    case SIXEL_PIXELFORMAT_PAL8:
+    case SIXEL_PIXELFORMAT_G8:
+    case SIXEL_PIXELFORMAT_GA88:
+    case SIXEL_PIXELFORMAT_AG88:
+        /* rows are color indexes already */
+        paletted = 1;
+        unpack = 0;
+        window_pixelformat = pixelformat;
+        break;
+    default:
+        paletted = 0;
+        unpack = 0;
+        if (sixel_pixelformat_get_channels(pixelformat, &stride, offsets)) {
+            /* 24bpp and 32bpp rows are quantized as they are */
+            window_pixelformat = pixelformat;
+            window_pitch = row_bytes;
+        } else {
+            window_pixelformat = SIXEL_PIXELFORMAT_RGB888;
+            window_pitch = width * 3;
+        }
+        window = (unsigned char *)sixel_allocator_malloc(
+            allocator,
+            (size_t)window_pitch * (size_t)(band_rows + lookahead_rows));
+        if (window == NULL) {
+            sixel_helper_set_additional_message(
+                "sixel_encode_scanlines: sixel_allocator_malloc() failed.");
+            status = SIXEL_BAD_ALLOCATION;
+            goto end;
+        }
+        break;
+    }
+
+    indexes = (sixel_index_t *)sixel_allocator_malloc(
+        allocator, sizeof(sixel_index_t) * (size_t)width * band_rows);
+    map = (char *)sixel_allocator_calloc(allocator,
+                                         (size_t)dither->ncolors * (size_t)width,
+                                         sizeof(char));
+    if (indexes == NULL || map == NULL) {
+        sixel_helper_set_additional_message(
+            "sixel_encode_scanlines: sixel_allocator_malloc() failed.");
+        status = SIXEL_BAD_ALLOCATION;
+        goto end;
+    }
+
+    status = sixel_encode_header(width, height, output);
+    if (SIXEL_FAILED(status)) {
+        goto end;
+    }
+
+    /* each color of an optimized palette is defined before the first
+       band which uses it */
+    nused = 0;
+    memset(migration_map, 0x00, sizeof(migration_map));
+    status = sixel_encode_palette(dither->palette, dither->ncolors,
+                                  dither->keycolor,
+                                  dither->bodyonly || optimize, output);
+    if (SIXEL_FAILED(status)) {
+        goto end;
+    }
+
+    for (y = fetched = 0; y < height; y += band_rows) {
+        nrows = height - y < band_rows ? height - y: band_rows;
+        if (paletted) {
+            for (i = 0; i < nrows; ++i) {
+                status = fn_scanline(&row, y + i, priv);
+                if (SIXEL_FAILED(status)) {
+                    goto end;
+                }
+                if (unpack) {
+                    status = sixel_pixelformat_normalize_rows(
+                        indexes + i * width, &normalized_pixelformat,
+                        row, pixelformat, width, 1, row_bytes);
+                    if (SIXEL_FAILED(status)) {
+                        goto end;
+                    }
+                } else {
+                    memcpy(indexes + i * width, row, (size_t)width);
+                }
+            }
+        } else {
+            limit = height - y < band_rows + lookahead_rows
+                  ? height: y + band_rows + lookahead_rows;
+            for (; fetched < limit; ++fetched) {
+                status = fn_scanline(&row, fetched, priv);
+                if (SIXEL_FAILED(status)) {
+                    goto end;
+                }
+                if (window_pixelformat == pixelformat) {
+                    memcpy(window + (fetched - y) * window_pitch, row,
+                           (size_t)row_bytes);
+                } else {
+                    status = sixel_pixelformat_normalize_rows(
+                        window + (fetched - y) * window_pitch,
+                        &normalized_pixelformat,
+                        row, pixelformat, width, 1, row_bytes);
+                    if (SIXEL_FAILED(status)) {
+                        goto end;
+                    }
+                }
+            }
+            status = sixel_dither_apply_palette_rows(dither, indexes, window,
+                                                     window_pixelformat,
+                                                     width, limit - y,
+                                                     window_pitch, nrows, y);
+            if (SIXEL_FAILED(status)) {
+                goto end;
+            }
+            memmove(window, window + nrows * window_pitch,
+                    (size_t)((limit - y - nrows) * window_pitch));
+        }
+
+        if (optimize) {
+            /* renumber in order of first use as sixel_dither_apply_palette()
+               does for the whole image, so registers match sixel_encode() */
+            first = nused;
+            for (n = 0; n < nrows * width; ++n) {
+                if (migration_map[indexes[n]] == 0) {
+                    memcpy(used_palette + nused * 3,
+                           dither->palette + indexes[n] * 3, 3);
+                    migration_map[indexes[n]] = (unsigned short)++nused;
+                }
+                indexes[n] = (sixel_index_t)(migration_map[indexes[n]] - 1);
+            }
+            if (nused > first && !dither->bodyonly) {
+                status = sixel_encode_palette_entries(used_palette, first, nused,
+                                                      (-1), output);
+                if (SIXEL_FAILED(status)) {
+                    goto end;
+                }
+                /* a definition selects its register */
+                output->active_palette = (-1);
+            }
+        }
+
+        status = sixel_encode_band(indexes, width, y, nrows, width,
+                                   optimize ? nused: dither->ncolors,
+                                   dither->keycolor, map,
+                                   output, NULL, allocator);
+        if (SIXEL_FAILED(status)) {
+            goto end;
+        }
+    }
+
+    status = sixel_encode_footer(output);
+    if (SIXEL_FAILED(status)) {
+        goto end;
+    }
+
+    if (optimize) {
+        /* leave the palette as sixel_encode() does */
+        memcpy(dither->palette, used_palette, (size_t)(nused * 3));
+        dither->ncolors = nused;
+    }
+
+end:
+    sixel_encode_release_nodes(output, allocator);
+    sixel_allocator_free(allocator, buffer);
+    sixel_allocator_free(allocator, window);
+    sixel_allocator_free(allocator, indexes);
+    sixel_allocator_free(allocator, map);
+    sixel_output_unref(output);
+    sixel_dither_unref(dither);
+
+    return status;
+}
+
 /* emacs Local Variables:      */
 /* emacs mode: c               */
 /* emacs tab-width: 4          */